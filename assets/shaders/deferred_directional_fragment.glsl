@@ -0,0 +1,160 @@
+#version 330 core
+
+#define SHADOW_BIAS_MAX 0.001
+#define SHADOW_BIAS_MIN 0.0005
+// See max_directional_lights and max_shadow_tiles
+#define MAX_DIRECTIONAL_LIGHTS 4
+#define MAX_SHADOW_TILES 32
+
+struct directional_light
+{
+    vec4 direction; // w first shadow tile, one per cascade from there on, -1 without shadows
+    vec4 ambient; // w shadow cascade count
+    vec4 diffuse;
+    vec4 specular;
+    vec4 cascade_splits; // View depth each cascade ends at
+};
+
+// Filled once by renderer::render (see light_uniforms)
+layout (std140) uniform light_data
+{
+    directional_light u_directional_lights[MAX_DIRECTIONAL_LIGHTS];
+    uvec4 u_cluster_dimensions;
+    vec4 u_cluster_params; // slice scale, slice bias, tile size in pixels
+    ivec4 u_light_counts; // directional, local
+};
+
+// Per-frame camera data, filled once by renderer::render (see frame_uniforms)
+layout (std140) uniform frame_data
+{
+    mat4 u_view;
+    mat4 u_projection;
+    mat4 u_view_projection;
+    mat4 u_inverse_view_projection;
+    vec4 u_camera_position;
+};
+
+// See gbuffer_attachment
+uniform sampler2D u_gbuffer_albedo_specular;
+uniform sampler2D u_gbuffer_normal_shininess;
+uniform sampler2D u_gbuffer_depth;
+
+// One matrix and atlas rect per shadow tile, filled once by renderer::render (see shadow_uniforms)
+layout (std140) uniform shadow_data
+{
+    mat4 u_shadow_matrices[MAX_SHADOW_TILES];
+    vec4 u_shadow_rects[MAX_SHADOW_TILES]; // uv offset, uv size
+};
+
+// Every shadowed light renders into its own tiles of this (see shadow_atlas)
+uniform sampler2D u_shadow_atlas;
+
+in vec2 uv;
+
+out vec4 fragment_colour;
+
+// 3x3 PCF inside one atlas tile, 1 fully shadowed. Samples are clamped to the tile so its neighbours never bleed
+// in, anything outside the tile's frustum counts as lit
+float calculate_shadow(int tile, vec3 fragment_position, vec3 normal, vec3 to_light)
+{
+    vec4 position_light_space = u_shadow_matrices[tile] * vec4(fragment_position, 1.0);
+    if(position_light_space.w <= 0.0)
+    {
+        return 0.0;
+    }
+
+    vec3 projected_coords = position_light_space.xyz / position_light_space.w;
+    projected_coords = projected_coords * 0.5 + 0.5;
+    if(projected_coords.z > 1.0 || any(lessThan(projected_coords.xy, vec2(0.0))) || any(greaterThan(projected_coords.xy, vec2(1.0))))
+    {
+        return 0.0;
+    }
+
+    vec4 rect = u_shadow_rects[tile];
+    vec2 texel_size = 1.0/vec2(textureSize(u_shadow_atlas, 0));
+    vec2 tile_min = rect.xy + texel_size * 0.5;
+    vec2 tile_max = rect.xy + rect.zw - texel_size * 0.5;
+    vec2 atlas_coords = rect.xy + projected_coords.xy * rect.zw;
+
+    float bias = max(SHADOW_BIAS_MAX * (1.0 - dot(normal, to_light)), SHADOW_BIAS_MIN);
+    float shadow = 0.0;
+
+    for (int x = -1; x <= 1; ++x)
+    {
+        for (int y = -1; y <= 1; ++y)
+        {
+            float closest_depth = texture(u_shadow_atlas, clamp(atlas_coords + vec2(x,y) * texel_size, tile_min, tile_max)).r;
+            shadow += projected_coords.z - bias > closest_depth ? 1.0 : 0.0;
+        }
+    }
+
+    return shadow / 9.0;
+}
+
+// First cascade that reaches past the fragment's view depth, -1 when it's beyond the shadowed cascades
+int get_shadow_cascade(directional_light light, vec3 fragment_position)
+{
+    float view_depth = -(u_view * vec4(fragment_position, 1.0)).z;
+    for(int i = 0; i < int(light.ambient.w); i++)
+    {
+        if(view_depth < light.cascade_splits[i])
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+float calculate_directional_shadow(directional_light light, vec3 fragment_position, vec3 normal, vec3 to_light)
+{
+    int cascade = get_shadow_cascade(light, fragment_position);
+    if(light.direction.w < 0.0 || cascade < 0)
+    {
+        return 0.0;
+    }
+
+    return calculate_shadow(int(light.direction.w) + cascade, fragment_position, normal, to_light);
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(u_gbuffer_depth, texel, 0).r;
+
+    // Nothing was drawn here, leave it for the skybox
+    if(depth == 1.0)
+    {
+        discard;
+    }
+
+    vec4 albedo_specular = texelFetch(u_gbuffer_albedo_specular, texel, 0);
+    vec4 normal_shininess = texelFetch(u_gbuffer_normal_shininess, texel, 0);
+    vec3 albedo = albedo_specular.rgb;
+    vec3 normal = normal_shininess.xyz;
+
+    vec4 world_position = u_inverse_view_projection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    vec3 fragment_position = world_position.xyz / world_position.w;
+
+    vec3 view_direction = normalize(u_camera_position.xyz - fragment_position);
+    vec3 colour = vec3(0.0);
+
+    for(int i = 0; i < u_light_counts.x; i++)
+    {
+        directional_light light = u_directional_lights[i];
+        vec3 to_light = normalize(-light.direction.xyz);
+        float shadow = calculate_directional_shadow(light, fragment_position, normal, to_light);
+
+        float diffuse_factor = max(dot(normal, to_light), 0.0);
+        vec3 diffuse = light.diffuse.rgb * diffuse_factor * albedo;
+
+        vec3 halfway_direction = normalize(to_light + view_direction);
+        float specular_factor = pow(max(dot(normal, halfway_direction), 0.0), normal_shininess.w);
+        vec3 specular = light.specular.rgb * specular_factor * albedo_specular.a;
+
+        vec3 ambient = light.ambient.rgb * albedo;
+
+        colour += ambient + (1 - shadow) * (diffuse + specular);
+    }
+
+    fragment_colour = vec4(colour, 1.0);
+}
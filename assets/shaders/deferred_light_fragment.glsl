@@ -0,0 +1,200 @@
+#version 330 core
+
+// Texels per light in u_local_lights, see local_light_data
+#define LOCAL_LIGHT_TEXELS 6
+#define SPOT_LIGHT 1.0
+
+#define SHADOW_BIAS_MAX 0.001
+#define SHADOW_BIAS_MIN 0.0005
+// See max_shadow_tiles
+#define MAX_SHADOW_TILES 32
+
+// Per-frame camera data, filled once by renderer::render (see frame_uniforms)
+layout (std140) uniform frame_data
+{
+    mat4 u_view;
+    mat4 u_projection;
+    mat4 u_view_projection;
+    mat4 u_inverse_view_projection;
+    vec4 u_camera_position;
+};
+
+// See gbuffer_attachment
+uniform sampler2D u_gbuffer_albedo_specular;
+uniform sampler2D u_gbuffer_normal_shininess;
+uniform sampler2D u_gbuffer_depth;
+
+// One matrix and atlas rect per shadow tile, filled once by renderer::render (see shadow_uniforms)
+layout (std140) uniform shadow_data
+{
+    mat4 u_shadow_matrices[MAX_SHADOW_TILES];
+    vec4 u_shadow_rects[MAX_SHADOW_TILES]; // uv offset, uv size
+};
+
+// Every shadowed light renders into its own tiles of this (see shadow_atlas)
+uniform sampler2D u_shadow_atlas;
+
+// Six layers per point light, +x -x +y -y +z -z laid out like cube map faces (see point_shadows)
+uniform sampler2DArray u_point_shadows;
+
+// Every point/spot light, shared with clustered forward shading (see light_clusters)
+uniform samplerBuffer u_local_lights;
+// The light whose volume is being drawn
+uniform int u_light_index;
+
+out vec4 fragment_colour;
+
+// 3x3 PCF inside one atlas tile, 1 fully shadowed. Samples are clamped to the tile so its neighbours never bleed
+// in, anything outside the tile's frustum counts as lit
+float calculate_shadow(int tile, vec3 fragment_position, vec3 normal, vec3 to_light)
+{
+    vec4 position_light_space = u_shadow_matrices[tile] * vec4(fragment_position, 1.0);
+    if(position_light_space.w <= 0.0)
+    {
+        return 0.0;
+    }
+
+    vec3 projected_coords = position_light_space.xyz / position_light_space.w;
+    projected_coords = projected_coords * 0.5 + 0.5;
+    if(projected_coords.z > 1.0 || any(lessThan(projected_coords.xy, vec2(0.0))) || any(greaterThan(projected_coords.xy, vec2(1.0))))
+    {
+        return 0.0;
+    }
+
+    vec4 rect = u_shadow_rects[tile];
+    vec2 texel_size = 1.0/vec2(textureSize(u_shadow_atlas, 0));
+    vec2 tile_min = rect.xy + texel_size * 0.5;
+    vec2 tile_max = rect.xy + rect.zw - texel_size * 0.5;
+    vec2 atlas_coords = rect.xy + projected_coords.xy * rect.zw;
+
+    float bias = max(SHADOW_BIAS_MAX * (1.0 - dot(normal, to_light)), SHADOW_BIAS_MIN);
+    float shadow = 0.0;
+
+    for (int x = -1; x <= 1; ++x)
+    {
+        for (int y = -1; y <= 1; ++y)
+        {
+            float closest_depth = texture(u_shadow_atlas, clamp(atlas_coords + vec2(x,y) * texel_size, tile_min, tile_max)).r;
+            shadow += projected_coords.z - bias > closest_depth ? 1.0 : 0.0;
+        }
+    }
+
+    return shadow / 9.0;
+}
+
+// 3x3 PCF in the cube face the fragment lands in, 1 fully shadowed. Taps are clamped to the face rather than
+// crossing the seam
+float calculate_point_shadow(int slot, vec4 light_position, float near_plane, vec3 fragment_position, vec3 normal, vec3 to_light)
+{
+    vec3 direction = fragment_position - light_position.xyz;
+    vec3 magnitude = abs(direction);
+
+    // Face and uv by the cube map rules
+    float major;
+    int face;
+    vec2 st;
+    if(magnitude.x >= magnitude.y && magnitude.x >= magnitude.z)
+    {
+        major = magnitude.x;
+        face = direction.x > 0.0 ? 0 : 1;
+        st = vec2(direction.x > 0.0 ? -direction.z : direction.z, -direction.y);
+    }
+    else if(magnitude.y >= magnitude.z)
+    {
+        major = magnitude.y;
+        face = direction.y > 0.0 ? 2 : 3;
+        st = vec2(direction.x, direction.y > 0.0 ? direction.z : -direction.z);
+    }
+    else
+    {
+        major = magnitude.z;
+        face = direction.z > 0.0 ? 4 : 5;
+        st = vec2(direction.z > 0.0 ? direction.x : -direction.x, -direction.y);
+    }
+    vec2 uv = st / major * 0.5 + 0.5;
+
+    // Depth the face's 90 degree perspective gives the fragment, far plane at the light's range
+    float far_plane = light_position.w;
+    float depth = ((far_plane + near_plane) / (far_plane - near_plane) - 2.0 * far_plane * near_plane / ((far_plane - near_plane) * major)) * 0.5 + 0.5;
+    if(depth > 1.0)
+    {
+        return 0.0;
+    }
+
+    float bias = max(SHADOW_BIAS_MAX * (1.0 - dot(normal, to_light)), SHADOW_BIAS_MIN);
+    vec2 texel_size = 1.0/vec2(textureSize(u_point_shadows, 0).xy);
+    float layer = float(slot * 6 + face);
+    float shadow = 0.0;
+
+    for (int x = -1; x <= 1; ++x)
+    {
+        for (int y = -1; y <= 1; ++y)
+        {
+            vec2 sample_uv = clamp(uv + vec2(x,y) * texel_size, texel_size * 0.5, 1.0 - texel_size * 0.5);
+            float closest_depth = texture(u_point_shadows, vec3(sample_uv, layer)).r;
+            shadow += depth - bias > closest_depth ? 1.0 : 0.0;
+        }
+    }
+
+    return shadow / 9.0;
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(u_gbuffer_depth, texel, 0).r;
+    vec4 albedo_specular = texelFetch(u_gbuffer_albedo_specular, texel, 0);
+    vec4 normal_shininess = texelFetch(u_gbuffer_normal_shininess, texel, 0);
+    vec3 albedo = albedo_specular.rgb;
+    vec3 normal = normal_shininess.xyz;
+
+    vec2 uv = gl_FragCoord.xy / vec2(textureSize(u_gbuffer_depth, 0));
+    vec4 world_position = u_inverse_view_projection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    vec3 fragment_position = world_position.xyz / world_position.w;
+
+    int base = u_light_index * LOCAL_LIGHT_TEXELS;
+    vec4 light_position = texelFetch(u_local_lights, base);
+    vec4 light_ambient = texelFetch(u_local_lights, base + 1);
+    vec4 light_diffuse = texelFetch(u_local_lights, base + 2);
+    vec4 light_specular = texelFetch(u_local_lights, base + 3);
+    vec4 light_attenuation = texelFetch(u_local_lights, base + 4);
+    vec4 light_direction = texelFetch(u_local_lights, base + 5);
+
+    // The stencil only rejects what's outside the volume's bounding mesh, the sphere can still be a bit bigger
+    float distance = length(light_position.xyz - fragment_position);
+    if(distance > light_position.w)
+    {
+        discard;
+    }
+
+    vec3 to_light = normalize(light_position.xyz - fragment_position);
+    vec3 view_direction = normalize(u_camera_position.xyz - fragment_position);
+
+    float diffuse_factor = max(dot(normal, to_light), 0.0);
+    vec3 diffuse = light_diffuse.rgb * diffuse_factor * albedo;
+
+    vec3 halfway_direction = normalize(to_light + view_direction);
+    float specular_factor = pow(max(dot(normal, halfway_direction), 0.0), normal_shininess.w);
+    vec3 specular = light_specular.rgb * specular_factor * albedo_specular.a;
+
+    vec3 ambient = light_ambient.rgb * albedo;
+
+    float attenuation = clamp(1.0 / (light_attenuation.x + light_attenuation.y * distance + light_attenuation.z * (distance * distance)), 0., 1.);
+    if(light_ambient.w == SPOT_LIGHT)
+    {
+        float theta = dot(to_light, normalize(-light_direction.xyz));
+        float epsilon = light_attenuation.w - light_direction.w;
+        attenuation *= clamp((theta - light_direction.w) / epsilon, 0.0, 1.0);
+    }
+
+    // Atlas tile or cube slot in diffuse.w, -1 without one
+    float shadow = 0.0;
+    if(light_diffuse.w >= 0.0)
+    {
+        shadow = light_ambient.w == SPOT_LIGHT
+            ? calculate_shadow(int(light_diffuse.w), fragment_position, normal, to_light)
+            : calculate_point_shadow(int(light_diffuse.w), light_position, light_direction.w, fragment_position, normal, to_light);
+    }
+
+    fragment_colour = vec4((ambient + (1.0 - shadow) * (diffuse + specular)) * attenuation, 1.0);
+}
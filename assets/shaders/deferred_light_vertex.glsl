@@ -0,0 +1,19 @@
+#version 330 core
+layout (location = 0) in vec3 a_position;
+// Per instance, occupies locations 3-6. Light volume sphere scaled to the light's range
+layout (location = 3) in mat4 a_transform;
+
+// Per-frame camera data, filled once by renderer::render (see frame_uniforms)
+layout (std140) uniform frame_data
+{
+    mat4 u_view;
+    mat4 u_projection;
+    mat4 u_view_projection;
+    mat4 u_inverse_view_projection;
+    vec4 u_camera_position;
+};
+
+void main()
+{
+    gl_Position = u_view_projection * a_transform * vec4(decode_position(a_position, get_vertex_page()), 1.0);
+}
@@ -0,0 +1,23 @@
+#version 330 core
+layout (location = 0) in vec3 a_position;
+// Per instance, occupies locations 3-6
+layout (location = 3) in mat4 a_transform;
+
+// Per-frame camera data, filled once by renderer::render (see frame_uniforms)
+layout (std140) uniform frame_data
+{
+    mat4 u_view;
+    mat4 u_projection;
+    mat4 u_view_projection;
+    mat4 u_inverse_view_projection;
+    vec4 u_camera_position;
+};
+
+// Same expression as vertex.glsl, both are invariant so the colour pass depth test sees exactly this depth
+invariant gl_Position;
+
+void main()
+{
+    vec3 position = decode_position(a_position, get_vertex_page());
+    gl_Position = u_view_projection * a_transform * vec4(position, 1.0);
+}
@@ -0,0 +1,53 @@
+#version 330 core
+
+// Same inputs as lit_fragment.glsl, lighting happens later in the deferred lighting passes
+struct material
+{
+    vec3 albedo;
+    sampler2D albedo_texture;
+    vec3 specular;
+    sampler2D specular_map;
+    float shininess;
+
+    bool sample_albedo;
+    bool sample_specular;
+};
+
+uniform material u_material;
+
+in vec3 fragment_position;
+in vec3 normal;
+in vec2 uv;
+
+// See gbuffer_attachment
+layout (location = 0) out vec4 gbuffer_albedo_specular;
+layout (location = 1) out vec4 gbuffer_normal_shininess;
+
+vec3 get_albedo()
+{
+    vec3 albedo = u_material.albedo;
+    if(u_material.sample_albedo)
+    {
+        albedo *= vec3(texture(u_material.albedo_texture, uv));
+    }
+
+    return albedo;
+}
+
+vec3 get_specular()
+{
+    vec3 specular = u_material.specular;
+    if(u_material.sample_specular)
+    {
+        specular *= vec3(texture(u_material.specular_map, uv));
+    }
+
+    return specular;
+}
+
+void main()
+{
+    // Specular colour is collapsed to an intensity to fit the albedo target
+    gbuffer_albedo_specular = vec4(get_albedo(), dot(get_specular(), vec3(1.0 / 3.0)));
+    gbuffer_normal_shininess = vec4(normalize(normal), u_material.shininess);
+}
@@ -1,9 +1,14 @@
 #version 330 core
 
-#define MAX_NUM_POINT_LIGHTS 4
+// Texels per light in u_local_lights, see local_light_data
+#define LOCAL_LIGHT_TEXELS 6
+#define SPOT_LIGHT 1.0
 
 #define SHADOW_BIAS_MAX 0.001
 #define SHADOW_BIAS_MIN 0.0005
+// See max_directional_lights and max_shadow_tiles
+#define MAX_DIRECTIONAL_LIGHTS 4
+#define MAX_SHADOW_TILES 32
 
 struct material
 {
@@ -19,51 +24,67 @@ struct material
 
 uniform material u_material;
 
-struct base_light
+struct directional_light
 {
-    vec3 position;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-//
-//    float angle_cos;
-//    float outer_angle_cos;
-//direction
+    vec4 direction; // w first shadow tile, one per cascade from there on, -1 without shadows
+    vec4 ambient; // w shadow cascade count
+    vec4 diffuse;
+    vec4 specular;
+    vec4 cascade_splits; // View depth each cascade ends at
 };
 
-struct directional_light
+// Point or spot light
+struct local_light
 {
-    base_light light;
-    vec3 direction;
+    vec4 position; // w range
+    vec4 ambient; // w type
+    vec4 diffuse; // w shadow atlas tile (spot) or cube slot (point), -1 without one
+    vec4 specular;
+    vec4 attenuation; // constant, linear, quadratic, spot inner angle cos
+    vec4 direction; // w spot outer angle cos, point shadow near plane
 };
 
-struct point_light
+// Filled once by renderer::render (see light_uniforms)
+layout (std140) uniform light_data
 {
-    base_light light;
-    float constant;
-    float linear;
-    float quadratic;
+    directional_light u_directional_lights[MAX_DIRECTIONAL_LIGHTS];
+    uvec4 u_cluster_dimensions;
+    vec4 u_cluster_params; // slice scale, slice bias, tile size in pixels
+    ivec4 u_light_counts; // directional, local
 };
 
-struct spot_light
+// Clustered lights (see light_clusters), every point/spot light, offset and count into u_light_indices per cluster
+// and the light indices themselves
+uniform samplerBuffer u_local_lights;
+uniform usamplerBuffer u_cluster_lights;
+uniform usamplerBuffer u_light_indices;
+
+// One matrix and atlas rect per shadow tile, filled once by renderer::render (see shadow_uniforms)
+layout (std140) uniform shadow_data
 {
-    base_light light;
-    float angle_cos;
-    float outer_angle_cos;
-    vec3 direction;
+    mat4 u_shadow_matrices[MAX_SHADOW_TILES];
+    vec4 u_shadow_rects[MAX_SHADOW_TILES]; // uv offset, uv size
 };
 
-uniform directional_light u_directional_light;
-uniform point_light u_point_lights[MAX_NUM_POINT_LIGHTS];
-uniform spot_light u_spot_light;
-uniform sampler2D u_shadow_map;
+// Every shadowed light renders into its own tiles of this (see shadow_atlas)
+uniform sampler2D u_shadow_atlas;
+
+// Six layers per point light, +x -x +y -y +z -z laid out like cube map faces (see point_shadows)
+uniform sampler2DArray u_point_shadows;
 
-uniform vec3 u_camera_position;
+// Per-frame camera data, filled once by renderer::render (see frame_uniforms)
+layout (std140) uniform frame_data
+{
+    mat4 u_view;
+    mat4 u_projection;
+    mat4 u_view_projection;
+    mat4 u_inverse_view_projection;
+    vec4 u_camera_position;
+};
 
 in vec3 fragment_position;
 in vec3 normal;
 in vec2 uv;
-in vec4 fragment_position_light_space;
 
 out vec4 fragment_colour;
 
@@ -89,24 +110,37 @@ vec3 get_specular()
     return specular;
 }
 
-float calculate_shadow(vec4 position_light_space, vec3 normal, vec3 to_light)
+// 3x3 PCF inside one atlas tile, 1 fully shadowed. Samples are clamped to the tile so its neighbours never bleed
+// in, anything outside the tile's frustum counts as lit
+float calculate_shadow(int tile, vec3 fragment_position, vec3 normal, vec3 to_light)
 {
+    vec4 position_light_space = u_shadow_matrices[tile] * vec4(fragment_position, 1.0);
+    if(position_light_space.w <= 0.0)
+    {
+        return 0.0;
+    }
+
     vec3 projected_coords = position_light_space.xyz / position_light_space.w;
     projected_coords = projected_coords * 0.5 + 0.5;
-    if(projected_coords.z > 1.0)
+    if(projected_coords.z > 1.0 || any(lessThan(projected_coords.xy, vec2(0.0))) || any(greaterThan(projected_coords.xy, vec2(1.0))))
     {
-        return 0.0;    
+        return 0.0;
     }
 
+    vec4 rect = u_shadow_rects[tile];
+    vec2 texel_size = 1.0/vec2(textureSize(u_shadow_atlas, 0));
+    vec2 tile_min = rect.xy + texel_size * 0.5;
+    vec2 tile_max = rect.xy + rect.zw - texel_size * 0.5;
+    vec2 atlas_coords = rect.xy + projected_coords.xy * rect.zw;
+
     float bias = max(SHADOW_BIAS_MAX * (1.0 - dot(normal, to_light)), SHADOW_BIAS_MIN);
-    vec2 texel_size = 1.0/textureSize(u_shadow_map, 0);
     float shadow = 0.0;
 
     for (int x = -1; x <= 1; ++x)
     {
         for (int y = -1; y <= 1; ++y)
         {
-            float closest_depth = texture(u_shadow_map, projected_coords.xy + vec2(x,y) * texel_size).r;
+            float closest_depth = texture(u_shadow_atlas, clamp(atlas_coords + vec2(x,y) * texel_size, tile_min, tile_max)).r;
             shadow += projected_coords.z - bias > closest_depth ? 1.0 : 0.0;
         }
     }
@@ -114,92 +148,200 @@ float calculate_shadow(vec4 position_light_space, vec3 normal, vec3 to_light)
     return shadow / 9.0;
 }
 
+// 3x3 PCF in the cube face the fragment lands in, 1 fully shadowed. Taps are clamped to the face rather than
+// crossing the seam
+float calculate_point_shadow(int slot, vec4 light_position, float near_plane, vec3 fragment_position, vec3 normal, vec3 to_light)
+{
+    vec3 direction = fragment_position - light_position.xyz;
+    vec3 magnitude = abs(direction);
+
+    // Face and uv by the cube map rules
+    float major;
+    int face;
+    vec2 st;
+    if(magnitude.x >= magnitude.y && magnitude.x >= magnitude.z)
+    {
+        major = magnitude.x;
+        face = direction.x > 0.0 ? 0 : 1;
+        st = vec2(direction.x > 0.0 ? -direction.z : direction.z, -direction.y);
+    }
+    else if(magnitude.y >= magnitude.z)
+    {
+        major = magnitude.y;
+        face = direction.y > 0.0 ? 2 : 3;
+        st = vec2(direction.x, direction.y > 0.0 ? direction.z : -direction.z);
+    }
+    else
+    {
+        major = magnitude.z;
+        face = direction.z > 0.0 ? 4 : 5;
+        st = vec2(direction.z > 0.0 ? direction.x : -direction.x, -direction.y);
+    }
+    vec2 uv = st / major * 0.5 + 0.5;
+
+    // Depth the face's 90 degree perspective gives the fragment, far plane at the light's range
+    float far_plane = light_position.w;
+    float depth = ((far_plane + near_plane) / (far_plane - near_plane) - 2.0 * far_plane * near_plane / ((far_plane - near_plane) * major)) * 0.5 + 0.5;
+    if(depth > 1.0)
+    {
+        return 0.0;
+    }
+
+    float bias = max(SHADOW_BIAS_MAX * (1.0 - dot(normal, to_light)), SHADOW_BIAS_MIN);
+    vec2 texel_size = 1.0/vec2(textureSize(u_point_shadows, 0).xy);
+    float layer = float(slot * 6 + face);
+    float shadow = 0.0;
+
+    for (int x = -1; x <= 1; ++x)
+    {
+        for (int y = -1; y <= 1; ++y)
+        {
+            vec2 sample_uv = clamp(uv + vec2(x,y) * texel_size, texel_size * 0.5, 1.0 - texel_size * 0.5);
+            float closest_depth = texture(u_point_shadows, vec3(sample_uv, layer)).r;
+            shadow += depth - bias > closest_depth ? 1.0 : 0.0;
+        }
+    }
+
+    return shadow / 9.0;
+}
+
+// First cascade that reaches past the fragment's view depth, -1 when it's beyond the shadowed cascades
+int get_shadow_cascade(directional_light light, vec3 fragment_position)
+{
+    float view_depth = -(u_view * vec4(fragment_position, 1.0)).z;
+    for(int i = 0; i < int(light.ambient.w); i++)
+    {
+        if(view_depth < light.cascade_splits[i])
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+float calculate_directional_shadow(directional_light light, vec3 fragment_position, vec3 normal, vec3 to_light)
+{
+    int cascade = get_shadow_cascade(light, fragment_position);
+    if(light.direction.w < 0.0 || cascade < 0)
+    {
+        return 0.0;
+    }
+
+    return calculate_shadow(int(light.direction.w) + cascade, fragment_position, normal, to_light);
+}
+
 vec3 calculate_directional_light(directional_light light, vec3 normal, vec3 view_direction)
 {
-    vec3 to_light = normalize(-light.direction);
+    vec3 to_light = normalize(-light.direction.xyz);
     
-    float shadow = calculate_shadow(fragment_position_light_space, normal, to_light);
+    float shadow = calculate_directional_shadow(light, fragment_position, normal, to_light);
 
     // Diffuse
     float diffuse_factor = max(dot(normal, to_light), 0.0);
-    vec3 diffuse = light.light.diffuse * diffuse_factor * get_albedo();
+    vec3 diffuse = light.diffuse.rgb * diffuse_factor * get_albedo();
 
     // Specular
     vec3 halfway_direction = normalize(to_light + view_direction);
     float specular_factor = pow(max(dot(normal, halfway_direction), 0.0), u_material.shininess);
-    vec3 specular = light.light.specular * specular_factor * get_specular();
+    vec3 specular = light.specular.rgb * specular_factor * get_specular();
 
     // Ambient
-    vec3 ambient = light.light.ambient * get_albedo();
+    vec3 ambient = light.ambient.rgb * get_albedo();
 
     return (ambient + (1 - shadow) * (diffuse + specular));
 
 }
 
-vec3 calculate_point_light(point_light light, vec3 normal, vec3 fragment_position, vec3 view_direction)
+local_light fetch_local_light(int index)
 {
-    vec3 to_light = normalize(light.light.position - fragment_position);
+    int base = index * LOCAL_LIGHT_TEXELS;
+
+    local_light light;
+    light.position = texelFetch(u_local_lights, base);
+    light.ambient = texelFetch(u_local_lights, base + 1);
+    light.diffuse = texelFetch(u_local_lights, base + 2);
+    light.specular = texelFetch(u_local_lights, base + 3);
+    light.attenuation = texelFetch(u_local_lights, base + 4);
+    light.direction = texelFetch(u_local_lights, base + 5);
+    return light;
+}
+
+vec3 calculate_local_light(local_light light, vec3 normal, vec3 fragment_position, vec3 view_direction)
+{
+    float distance = length(light.position.xyz - fragment_position);
+    if(distance > light.position.w)
+    {
+        return vec3(0.0);
+    }
+
+    vec3 to_light = normalize(light.position.xyz - fragment_position);
 
     // Diffuse
     float diffuse_factor = max(dot(normal, to_light), 0.0);
-    vec3 diffuse = light.light.diffuse * diffuse_factor * get_albedo();
+    vec3 diffuse = light.diffuse.rgb * diffuse_factor * get_albedo();
 
     // Specular
     vec3 halfway_direction = normalize(to_light + view_direction);
     float specular_factor = pow(max(dot(normal, halfway_direction), 0.0), u_material.shininess);
-    vec3 specular = light.light.specular * specular_factor * get_specular();
-    
+    vec3 specular = light.specular.rgb * specular_factor * get_specular();
+
     // Ambient
-    vec3 ambient = light.light.ambient * get_albedo();
+    vec3 ambient = light.ambient.rgb * get_albedo();
 
     // Attenuation
-    float distance = length(light.light.position - fragment_position);
-    float attenuation = clamp(1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance)), 0., 1.);
+    float attenuation = clamp(1.0 / (light.attenuation.x + light.attenuation.y * distance + light.attenuation.z * (distance * distance)), 0., 1.);
+
+    // Spot cone intensity
+    if(light.ambient.w == SPOT_LIGHT)
+    {
+        float theta = dot(to_light, normalize(-light.direction.xyz));
+        float epsilon = light.attenuation.w - light.direction.w;
+        attenuation *= clamp((theta - light.direction.w) / epsilon, 0.0, 1.0);
+    }
+
+    // Atlas tile or cube slot in diffuse.w, -1 without one
+    float shadow = 0.0;
+    if(light.diffuse.w >= 0.0)
+    {
+        shadow = light.ambient.w == SPOT_LIGHT
+            ? calculate_shadow(int(light.diffuse.w), fragment_position, normal, to_light)
+            : calculate_point_shadow(int(light.diffuse.w), light.position, light.direction.w, fragment_position, normal, to_light);
+    }
 
     ambient *= attenuation;
-    diffuse *= attenuation;
-    specular *= attenuation;
+    diffuse *= attenuation * (1.0 - shadow);
+    specular *= attenuation * (1.0 - shadow);
 
     return (ambient + diffuse + specular);
 }
 
-vec3 calculate_spot_light(spot_light light, vec3 normal, vec3 fragment_position, vec3 view_direction)
+// Index of the cluster this fragment falls in, must match light_clusters::build_cluster_bounds
+int get_cluster_index()
 {
-    vec3 to_light = normalize(light.light.position - fragment_position);
-
-    // Diffuse
-    float diffuse_factor = max(dot(normal, to_light), 0.0);
-    vec3 diffuse = light.light.diffuse * diffuse_factor * get_albedo();
+    float view_depth = -(u_view * vec4(fragment_position, 1.0)).z;
+    uint slice = uint(max(log(view_depth) * u_cluster_params.x + u_cluster_params.y, 0.0));
+    uvec3 cluster = min(uvec3(uvec2(gl_FragCoord.xy / u_cluster_params.zw), slice), u_cluster_dimensions.xyz - 1u);
 
-    // Specular
-    vec3 halfway_direction = normalize(to_light + view_direction);
-    float specular_factor = pow(max(dot(normal, halfway_direction), 0.0), u_material.shininess);
-    vec3 specular = light.light.specular * specular_factor * get_specular();
-
-    // Intensity
-    float theta = dot(to_light, normalize(-light.direction));
-    float epsilon = light.angle_cos - light.outer_angle_cos;
-    float intensity = clamp((theta - light.outer_angle_cos) / epsilon, 0.0, 1.0);
-
-    diffuse *= intensity;
-    specular *= intensity;
-
-    return (diffuse + specular);
+    return int(cluster.x + u_cluster_dimensions.x * (cluster.y + u_cluster_dimensions.y * cluster.z));
 }
 
 void main()
 {
     vec3 output = vec3(0.0);
-    vec3 view_direction = normalize(u_camera_position - fragment_position);
-
-    output += calculate_directional_light(u_directional_light, normal, view_direction);
+    vec3 view_direction = normalize(u_camera_position.xyz - fragment_position);
 
-    for(int i = 0; i < MAX_NUM_POINT_LIGHTS; i++)
+    for(int i = 0; i < u_light_counts.x; i++)
     {
-        output += calculate_point_light(u_point_lights[i], normal, fragment_position, view_direction);
+        output += calculate_directional_light(u_directional_lights[i], normal, view_direction);
     }
 
-    output += calculate_spot_light(u_spot_light, normal, fragment_position, view_direction);
+    // Only the lights whose range reaches this fragment's cluster
+    uvec2 cluster_lights = texelFetch(u_cluster_lights, get_cluster_index()).xy;
+    for(uint i = 0u; i < cluster_lights.y; i++)
+    {
+        int light_index = int(texelFetch(u_light_indices, int(cluster_lights.x + i)).r);
+        output += calculate_local_light(fetch_local_light(light_index), normal, fragment_position, view_direction);
+    }
 
     fragment_colour = vec4(output, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,65 @@
+#version 330 core
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 18) out;
+
+// Must match point_shadows::get_face_view_projection, +x -x +y -y +z -z laid out like cube map faces
+const vec3 face_directions[6] = vec3[](vec3(1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0), vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0));
+const vec3 face_ups[6] = vec3[](vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0), vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0));
+
+uniform vec3 u_light_position;
+uniform float u_near_plane;
+uniform float u_far_plane;
+// Face 0 of the light being rendered, the other five follow
+uniform int u_first_layer;
+
+flat in int face_mask[];
+
+// 90 degree square perspective from the light down the face's axis, same as glm::perspective * glm::lookAt
+vec4 project_to_face(int face, vec3 position)
+{
+    vec3 forward = face_directions[face];
+    vec3 side = normalize(cross(forward, face_ups[face]));
+    vec3 up = cross(side, forward);
+
+    vec3 relative = position - u_light_position;
+    float depth = dot(forward, relative);
+    float z = (u_far_plane + u_near_plane) / (u_far_plane - u_near_plane) * depth - 2.0 * u_far_plane * u_near_plane / (u_far_plane - u_near_plane);
+    return vec4(dot(side, relative), dot(up, relative), z, depth);
+}
+
+void main()
+{
+    for(int face = 0; face < 6; face++)
+    {
+        // Faces the whole instance was culled from on the CPU
+        if((face_mask[0] & (1 << face)) == 0)
+        {
+            continue;
+        }
+
+        vec4 clip[3];
+        for(int i = 0; i < 3; i++)
+        {
+            clip[i] = project_to_face(face, gl_in[i].gl_Position.xyz);
+        }
+
+        // Per triangle, skip the face when every vertex is outside the same one of its side planes
+        vec4 outside = vec4(1.0);
+        for(int i = 0; i < 3; i++)
+        {
+            outside *= vec4(step(clip[i].w, clip[i].x), step(clip[i].w, -clip[i].x), step(clip[i].w, clip[i].y), step(clip[i].w, -clip[i].y));
+        }
+        if(any(greaterThan(outside, vec4(0.0))))
+        {
+            continue;
+        }
+
+        for(int i = 0; i < 3; i++)
+        {
+            gl_Layer = u_first_layer + face;
+            gl_Position = clip[i];
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
@@ -0,0 +1,17 @@
+#version 330 core
+layout (location = 0) in vec3 a_position;
+// Per instance, occupies locations 3-6. [0][3] is 0 in any affine transform, the point shadow pass stores the
+// cube faces the instance is visible from there instead (see renderer::draw_point_shadow_casters)
+layout (location = 3) in mat4 a_transform;
+
+flat out int face_mask;
+
+void main()
+{
+    mat4 transform = a_transform;
+    face_mask = int(transform[0][3]);
+    transform[0][3] = 0.0;
+
+    // World space, projected per face in the geometry shader
+    gl_Position = transform * vec4(decode_position(a_position, get_vertex_page()), 1.0);
+}
@@ -1,13 +1,23 @@
 #version 330 core
 layout (location = 0) in vec3 a_position;
 
-uniform mat4 projection;
-uniform mat4 view;
+// Per-frame camera data, filled once by renderer::render (see frame_uniforms)
+layout (std140) uniform frame_data
+{
+    mat4 u_view;
+    mat4 u_projection;
+    mat4 u_view_projection;
+    mat4 u_inverse_view_projection;
+    vec4 u_camera_position;
+};
 
 out vec3 uv;
 
 void main()
 {
-    uv = a_position;
-    gl_Position = (projection * view * vec4(a_position, 1.0)).xyww;
+    vec3 position = decode_position(a_position, get_vertex_page());
+    uv = position;
+    // Drop the translation so the skybox stays centred on the camera
+    mat4 view = mat4(mat3(u_view));
+    gl_Position = (u_projection * view * vec4(position, 1.0)).xyww;
 }  
\ No newline at end of file
@@ -1,12 +1,14 @@
 #version 330 core
 layout (location = 0) in vec3 a_position;
+// Per instance, occupies locations 3-6
+layout (location = 3) in mat4 a_transform;
 
 //out vec3 vertex_colour;
 
-uniform mat4 transform;
 uniform mat4 light_space_matrix;
 
 void main()
 {
-    gl_Position = light_space_matrix * transform * vec4(a_position, 1.0);
+    vec3 position = decode_position(a_position, get_vertex_page());
+    gl_Position = light_space_matrix * a_transform * vec4(position, 1.0);
 }
\ No newline at end of file
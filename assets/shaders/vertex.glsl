@@ -1,28 +1,40 @@
 #version 330 core
+// Quantized, see vertex_decode.glsl
 layout (location = 0) in vec3 a_position;
-layout (location = 1) in vec3 a_normal;
+// Octahedral
+layout (location = 1) in vec2 a_normal;
 //layout (location = 1) in vec3 a_colour;
 layout (location = 2) in vec2 a_uv;
+// Per instance, occupies locations 3-6
+layout (location = 3) in mat4 a_transform;
 
 //out vec3 vertex_colour;
 
-uniform mat4 transform;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 light_space_matrix;
+// Per-frame camera data, filled once by renderer::render (see frame_uniforms)
+layout (std140) uniform frame_data
+{
+    mat4 u_view;
+    mat4 u_projection;
+    mat4 u_view_projection;
+    mat4 u_inverse_view_projection;
+    vec4 u_camera_position;
+};
 
 out vec3 fragment_position;
 out vec3 normal;
 out vec2 uv;
-out vec4 fragment_position_light_space;
+
+// Has to match the depth written by depth_prepass_vertex.glsl
+invariant gl_Position;
 
 void main()
 {
-    gl_Position = projection * view * transform * vec4(a_position, 1.0);
-    fragment_position = vec3(transform * vec4(a_position, 1.0));
-    normal = normalize(mat3(transpose(inverse(transform))) * a_normal);
-    uv = a_uv;
+    int page = get_vertex_page();
+    vec3 position = decode_position(a_position, page);
 
-    fragment_position_light_space = light_space_matrix * vec4(fragment_position, 1.0);
+    gl_Position = u_view_projection * a_transform * vec4(position, 1.0);
+    fragment_position = vec3(a_transform * vec4(position, 1.0));
+    normal = normalize(mat3(transpose(inverse(a_transform))) * decode_normal(a_normal));
+    uv = decode_uv(a_uv, page);
     //vertex_colour = a_colour;
 }
\ No newline at end of file
@@ -0,0 +1,32 @@
+// Prepended to every vertex shader by shader.cpp, right after #version and a #define of VERTEX_PAGE_SHIFT taken
+// from vertex_format.h so the page size only lives there
+
+// geometry_arena page decode table (see vertex_format.h), 3 texels for every page of vertices
+uniform samplerBuffer u_vertex_decode;
+
+// First of the vertex's page texels
+int get_vertex_page()
+{
+    return (gl_VertexID >> VERTEX_PAGE_SHIFT) * 3;
+}
+
+vec3 decode_position(vec3 position, int page)
+{
+    return texelFetch(u_vertex_decode, page).xyz + position * texelFetch(u_vertex_decode, page + 1).xyz;
+}
+
+vec2 decode_uv(vec2 uv, int page)
+{
+    vec4 uv_decode = texelFetch(u_vertex_decode, page + 2);
+    return uv_decode.xy + uv * uv_decode.zw;
+}
+
+// Octahedral, same maths as decode_octahedral in vertex_format.cpp
+vec3 decode_normal(vec2 encoded)
+{
+    vec3 decoded = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float fold = max(-decoded.z, 0.0);
+    decoded.x += decoded.x >= 0.0 ? -fold : fold;
+    decoded.y += decoded.y >= 0.0 ? -fold : fold;
+    return normalize(decoded);
+}
@@ -1,11 +1,15 @@
 #include <slam_renderer/renderer.h>
 
 #define SCREEN_TEXTURE 1
+// Scatters this many small point lights over the floor to stress clustered lighting, 0 for none
+#define STRESS_POINT_LIGHTS 0
 
 unsigned int window_width = 1280;
 unsigned int window_height = 720;
 
 bool cursor_enabled = false;
+// Toggled with I, renderer stats are printed once a second while on
+bool print_stats = false;
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
@@ -25,11 +29,31 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
         slam_renderer::renderer::get_instance()->toggle_wireframe();
     }
 
+    if (key == GLFW_KEY_G && action == GLFW_PRESS)
+    {
+        slam_renderer::renderer::get_instance()->toggle_deferred_shading();
+    }
+
+    if (key == GLFW_KEY_P && action == GLFW_PRESS)
+    {
+        slam_renderer::renderer::get_instance()->cycle_depth_prepass_mode();
+    }
+
     if (key == GLFW_KEY_O && action == GLFW_PRESS)
     {
         slam_renderer::renderer::get_instance()->toggle_persepctive();
     }
 
+    if (key == GLFW_KEY_K && action == GLFW_PRESS)
+    {
+        slam_renderer::renderer::get_instance()->toggle_occlusion_culling();
+    }
+
+    if (key == GLFW_KEY_I && action == GLFW_PRESS)
+    {
+        print_stats = !print_stats;
+    }
+
     if (key == GLFW_KEY_C && action == GLFW_PRESS)
     {
         cursor_enabled = !cursor_enabled;
@@ -43,6 +67,23 @@ void process_input(GLFWwindow* window)
 
 }
 
+void print_renderer_stats(slam_renderer::renderer* renderer, float frame_time)
+{
+    const slam_renderer::cull_stats& shadow_stats = renderer->get_cull_stats(slam_renderer::render_pass::shadow);
+    const slam_renderer::cull_stats& main_stats = renderer->get_cull_stats(slam_renderer::render_pass::opaque);
+    const slam_renderer::shadow_stats& shadows = renderer->get_shadow_stats();
+
+    std::cout << "FRAMETIME: " << frame_time * 1000 << "ms FPS: " << 1 / frame_time << std::endl;
+    std::cout << "CULLING: shadow " << shadow_stats.m_visible << "/" << shadow_stats.m_culled << " main " << main_stats.m_visible << "/" << main_stats.m_culled << " (visible/culled)" << std::endl;
+    std::cout << "OCCLUSION: " << main_stats.m_occluded << " occluded by " << renderer->get_software_occlusion().get_occluder_count() << " occluders, " << renderer->get_software_occlusion().get_triangle_count() << " triangles" << std::endl;
+    std::cout << "SHADOWS: " << shadows.m_cached_tiles << " cached " << shadows.m_static_redraws << " static " << shadows.m_dynamic_redraws << " dynamic tiles, " << renderer->get_shadow_atlas().get_dropped_tiles() << " dropped, " << shadows.m_cube_redraws << " cubes redrawn with " << shadows.m_culled_cube_faces << " caster faces culled" << std::endl;
+    std::cout << "LIGHT CLUSTERS: " << renderer->get_light_clusters().get_light_reference_count() << " references, max " << renderer->get_light_clusters().get_max_cluster_lights() << " per cluster" << std::endl;
+    std::cout << "DEPTH PREPASS: " << renderer->get_depth_prepass().is_active() << " overdraw " << renderer->get_depth_prepass().get_overdraw() << std::endl;
+    std::cout << "DEFERRED: " << renderer->get_deferred_lighting().get_drawn_volumes() << " light volumes" << std::endl;
+    std::cout << "GL STATE: " << renderer->get_gl_state().get_issued_calls() << " issued " << renderer->get_gl_state().get_skipped_calls() << " skipped" << std::endl;
+}
+
+
 int entry_point(int argc, char* argv[])
 {
     glfwInit();
@@ -72,19 +113,18 @@ int entry_point(int argc, char* argv[])
     // Setup renderer, shaders and textures ===================
     slam_renderer::renderer* renderer = new slam_renderer::renderer(window);
 
-    std::shared_ptr<slam_renderer::shader> lit_shader = renderer->register_shader("assets/shaders/vertex.glsl", "assets/shaders/lit_fragment.glsl", slam_renderer::shader_type::lit);
-    std::shared_ptr<slam_renderer::shader> unlit_shader = renderer->register_shader("assets/shaders/vertex.glsl", "assets/shaders/unlit_fragment.glsl");
-    std::shared_ptr<slam_renderer::shader> skybox_shader = renderer->register_shader("assets/shaders/skybox_vertex.glsl", "assets/shaders/skybox_fragment.glsl", slam_renderer::shader_type::unlit_cube);
+    slam_renderer::shader_handle lit_shader = renderer->register_shader("assets/shaders/vertex.glsl", "assets/shaders/lit_fragment.glsl", slam_renderer::shader_type::lit);
+    slam_renderer::shader_handle unlit_shader = renderer->register_shader("assets/shaders/vertex.glsl", "assets/shaders/unlit_fragment.glsl");
+    slam_renderer::shader_handle skybox_shader = renderer->register_shader("assets/shaders/skybox_vertex.glsl", "assets/shaders/skybox_fragment.glsl", slam_renderer::shader_type::unlit_cube);
 
-    std::shared_ptr<slam_renderer::texture> skybox_texture = renderer->get_register_texture("assets/textures/skybox/miramar.tga", true, slam_renderer::texture_type::cubemap);
-    std::shared_ptr<slam_renderer::material> skybox_material = std::make_shared<slam_renderer::material>(skybox_shader, skybox_texture, 0.f);
-    renderer->register_material(skybox_material);
+    slam_renderer::texture_handle skybox_texture = renderer->get_register_texture("assets/textures/skybox/miramar.tga", true, slam_renderer::texture_type::cubemap);
+    slam_renderer::material_handle skybox_material = renderer->register_material(slam_renderer::material(skybox_shader, skybox_texture, 0.f));
     // ========================================================
 
     // Models =================================================
     renderer->register_model("assets/models/backpack/backpack.obj", glm::mat4(1.f), 0);
-    slam_renderer::model* skybox_model = renderer->register_model("assets/models/primitives/cube.obj", glm::mat4(1.f), 2);
-    skybox_model->override_material(skybox_material);
+    slam_renderer::model_handle skybox_model = renderer->register_model("assets/models/primitives/cube.obj", glm::mat4(1.f), 2);
+    renderer->get_model(skybox_model)->override_material(skybox_material);
 
     // Crate
     if (true)
@@ -92,38 +132,38 @@ int entry_point(int argc, char* argv[])
         glm::mat4 cube_transform(1.0f);
         cube_transform = glm::translate(cube_transform, glm::vec3(0.0f, -2.5f, 0.f));
         cube_transform = glm::scale(cube_transform, glm::vec3(150.0f, 1.0f, 150.0f));
-        slam_renderer::model* crate_model = renderer->register_model("assets/models/primitives/cube.obj", cube_transform, 0);
-        std::shared_ptr<slam_renderer::texture> crate_texture = renderer->get_register_texture("assets/textures/crate.png");
-        std::shared_ptr<slam_renderer::texture> crate_specular = renderer->get_register_texture("assets/textures/crate_specular.png");
-        std::shared_ptr<slam_renderer::material> crate_material = std::make_shared<slam_renderer::material>(lit_shader, crate_texture, 32.f, glm::vec3(1.f, 1.f, 1.f), 1.f, 1.f);
-        crate_material->set_specular_map(crate_specular);
-        renderer->register_material(crate_material);
-        crate_model->override_material(crate_material);
+        slam_renderer::model_handle crate_model = renderer->register_model("assets/models/primitives/cube.obj", cube_transform, 0);
+        slam_renderer::texture_handle crate_texture = renderer->get_register_texture("assets/textures/crate.png");
+        slam_renderer::texture_handle crate_specular = renderer->get_register_texture("assets/textures/crate_specular.png");
+        slam_renderer::material crate_material(lit_shader, crate_texture, 32.f, glm::vec3(1.f, 1.f, 1.f), 1.f, 1.f);
+        crate_material.set_specular_map(crate_specular);
+        renderer->get_model(crate_model)->override_material(renderer->register_material(crate_material));
+        // The floor never moves, its shadows are cached
+        renderer->set_model_shadow_flags(crate_model, true, true);
     }
 
     // Framebuffers =======================================
 #if SCREEN_TEXTURE
 
     // Standard shader
-    //std::shared_ptr<slam_renderer::shader> scene_texture_shader = renderer->register_shader("assets/shaders/vertex_screenspace.glsl", "assets/shaders/textured_fragment.glsl", slam_renderer::shader_type::unlit);
+    //slam_renderer::shader_handle scene_texture_shader = renderer->register_shader("assets/shaders/vertex_screenspace.glsl", "assets/shaders/textured_fragment.glsl", slam_renderer::shader_type::unlit);
     
     // Inversion
-    //std::shared_ptr<slam_renderer::shader> scene_texture_shader = renderer->register_shader("assets/shaders/vertex_screenspace.glsl", "assets/shaders/post_processing/inversion.glsl", slam_renderer::shader_type::unlit);
+    //slam_renderer::shader_handle scene_texture_shader = renderer->register_shader("assets/shaders/vertex_screenspace.glsl", "assets/shaders/post_processing/inversion.glsl", slam_renderer::shader_type::unlit);
     // Greyscale
-    //std::shared_ptr<slam_renderer::shader> scene_texture_shader = renderer->register_shader("assets/shaders/vertex_screenspace.glsl", "assets/shaders/post_processing/greyscale.glsl", slam_renderer::shader_type::unlit);
+    //slam_renderer::shader_handle scene_texture_shader = renderer->register_shader("assets/shaders/vertex_screenspace.glsl", "assets/shaders/post_processing/greyscale.glsl", slam_renderer::shader_type::unlit);
     // Sharpen
-    //std::shared_ptr<slam_renderer::shader> scene_texture_shader = renderer->register_shader("assets/shaders/vertex_screenspace.glsl", "assets/shaders/post_processing/sharpen.glsl", slam_renderer::shader_type::unlit);
+    //slam_renderer::shader_handle scene_texture_shader = renderer->register_shader("assets/shaders/vertex_screenspace.glsl", "assets/shaders/post_processing/sharpen.glsl", slam_renderer::shader_type::unlit);
     // Blur
-    //std::shared_ptr<slam_renderer::shader> scene_texture_shader = renderer->register_shader("assets/shaders/vertex_screenspace.glsl", "assets/shaders/post_processing/blur.glsl", slam_renderer::shader_type::unlit);
+    //slam_renderer::shader_handle scene_texture_shader = renderer->register_shader("assets/shaders/vertex_screenspace.glsl", "assets/shaders/post_processing/blur.glsl", slam_renderer::shader_type::unlit);
     // Gamma Correction
-    std::shared_ptr<slam_renderer::shader> scene_texture_shader = renderer->register_shader("assets/shaders/vertex_screenspace.glsl", "assets/shaders/post_processing/gamma_correction.glsl", slam_renderer::shader_type::unlit);
+    slam_renderer::shader_handle scene_texture_shader = renderer->register_shader("assets/shaders/vertex_screenspace.glsl", "assets/shaders/post_processing/gamma_correction.glsl", slam_renderer::shader_type::unlit);
 
     std::shared_ptr<slam_renderer::framebuffer> framebuffer = renderer->register_framebuffer(slam_renderer::framebuffer_type::colour_depth_stencil, scene_texture_shader);
 
-    //slam_renderer::model* plane_model = slam_renderer::renderer::get_instance()->register_model("assets/models/primitives/screen_plane.obj", glm::mat4(1.f), 3);
-    //std::shared_ptr<slam_renderer::material> screen_texture_material = std::make_shared<slam_renderer::material>(scene_texture_shader, framebuffer->get_texture(), 32.f);
-    //renderer->register_material(screen_texture_material);
-   //plane_model->override_material(screen_texture_material);
+    //slam_renderer::model_handle plane_model = slam_renderer::renderer::get_instance()->register_model("assets/models/primitives/screen_plane.obj", glm::mat4(1.f), 3);
+    //slam_renderer::material_handle screen_texture_material = renderer->register_material(slam_renderer::material(scene_texture_shader, framebuffer->get_texture(), 32.f));
+   //renderer->get_model(plane_model)->override_material(screen_texture_material);
 #endif
     // ====================================================
 
@@ -135,11 +175,24 @@ int entry_point(int argc, char* argv[])
     renderer->register_directional_light(sun_direction, sun_position, sun_colour, 1.f, 0.1f, 1.f);
     //slam_renderer::renderer::get_instance()->register_point_light(1.0f, 0.09f, 0.032f, sun_position, glm::vec3(1,1,1), 0.5f, 0.1f, 1.f);
     //slam_renderer::renderer::get_instance()->register_spot_light(10.f, 20.f, sun_direction, sun_position, glm::vec3(0,1,0), 1.f, 0.1f, 1.f);
+
+#if STRESS_POINT_LIGHTS
+    for (unsigned int i = 0; i < STRESS_POINT_LIGHTS; ++i)
+    {
+        // Deterministic scatter over a 60x60 patch of the floor with a colour cycle
+        float x = float((i * 7919) % 600) / 10.f - 30.f;
+        float z = float((i * 104729) % 600) / 10.f - 30.f;
+        glm::vec3 colour(float(i % 3 == 0), float(i % 3 == 1), float(i % 3 == 2));
+        renderer->register_point_light(1.0f, 0.7f, 1.8f, glm::vec3(x, -1.5f, z), colour, 1.f, 0.f, 0.5f);
+    }
+#endif
     // ====================================================
 
 
     double previous_time = glfwGetTime();
     float delta = 0.f;
+    unsigned int stats_frames = 0;
+    float stats_time = 0.f;
 
     while (!glfwWindowShouldClose(window))
     {
@@ -154,7 +207,18 @@ int entry_point(int argc, char* argv[])
         delta = static_cast<float>(glfwGetTime() - previous_time);
         previous_time = glfwGetTime();
 
-        //std::cout << "FRAMETIME: " << delta * 1000 << "ms FPS: " << 1 / delta << std::endl;
+        // Averaged over the second so the frame time isn't just the last frame's
+        ++stats_frames;
+        stats_time += delta;
+        if (stats_time >= 1.f)
+        {
+            if (print_stats)
+            {
+                print_renderer_stats(renderer, stats_time / stats_frames);
+            }
+            stats_frames = 0;
+            stats_time = 0.f;
+        }
     }
 
     renderer->free();
@@ -0,0 +1,356 @@
+#include "baked_model.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+    // "SLBM" read as a little endian uint32
+    static const uint32_t baked_model_magic = 0x4D424C53;
+    // Bump whenever the layout below or anything in vertex_format.h changes
+    static const uint32_t baked_model_version = 2;
+    // Every section and geometry stream starts on this, more than any of them need
+    static const uint64_t baked_model_alignment = 16;
+
+    // Offsets are from the start of the file, strings are offsets into the NUL terminated string table
+    struct file_header
+    {
+        uint32_t m_magic;
+        uint32_t m_version;
+        uint64_t m_file_size;
+        uint32_t m_node_count;
+        uint32_t m_material_count;
+        uint32_t m_mesh_count;
+        uint32_t m_string_size;
+        uint32_t m_source_count;
+        uint32_t m_padding;
+        uint64_t m_sources_offset;
+        uint64_t m_nodes_offset;
+        uint64_t m_materials_offset;
+        uint64_t m_meshes_offset;
+        uint64_t m_strings_offset;
+    };
+    static_assert(sizeof(file_header) == 80, "baked file layout changed, bump baked_model_version");
+
+    struct file_source
+    {
+        uint32_t m_path;
+        uint32_t m_padding;
+        uint64_t m_size;
+        int64_t m_write_time;
+        uint64_t m_content_hash;
+    };
+    static_assert(sizeof(file_source) == 32, "baked file layout changed, bump baked_model_version");
+
+    struct file_node
+    {
+        glm::mat4 m_transform;
+        uint32_t m_parent;
+        uint32_t m_padding[3];
+    };
+    static_assert(sizeof(file_node) == 80, "baked file layout changed, bump baked_model_version");
+
+    struct file_material
+    {
+        uint32_t m_name;
+        uint32_t m_albedo_path;
+        uint32_t m_specular_path;
+        uint32_t m_padding;
+    };
+    static_assert(sizeof(file_material) == 16, "baked file layout changed, bump baked_model_version");
+
+    struct file_mesh
+    {
+        slam_renderer::vertex_decode m_decode;
+        glm::vec3 m_bounds_min;
+        glm::vec3 m_bounds_max;
+        glm::vec3 m_sphere_centre;
+        float m_sphere_radius;
+        uint32_t m_node;
+        uint32_t m_material;
+        uint32_t m_vertex_count;
+        uint32_t m_index_type;
+        uint32_t m_lod_count;
+        uint32_t m_index_counts[slam_renderer::max_lod_count];
+        float m_lod_errors[slam_renderer::max_lod_count];
+        uint32_t m_padding;
+        uint64_t m_positions_offset;
+        uint64_t m_attributes_offset;
+        uint64_t m_index_offsets[slam_renderer::max_lod_count];
+    };
+    static_assert(sizeof(file_mesh) == 208, "baked file layout changed, bump baked_model_version");
+
+    uint64_t align_offset(uint64_t offset)
+    {
+        return (offset + baked_model_alignment - 1) & ~(baked_model_alignment - 1);
+    }
+
+    bool in_file(uint64_t offset, uint64_t size, uint64_t file_size)
+    {
+        return offset <= file_size && size <= file_size - offset;
+    }
+
+    uint32_t add_string(std::string& strings, const std::string& string)
+    {
+        uint32_t offset = static_cast<uint32_t>(strings.size());
+        strings.append(string);
+        strings.push_back('\0');
+        return offset;
+    }
+}
+
+namespace slam_renderer
+{
+bool read_baked_model(const mapped_file& file, baked_model& model)
+{
+    const uint8_t* data = file.get_data();
+    uint64_t file_size = file.get_size();
+    if (data == nullptr || file_size < sizeof(file_header))
+    {
+        return false;
+    }
+
+    const file_header& header = *reinterpret_cast<const file_header*>(data);
+    if (header.m_magic != baked_model_magic || header.m_version != baked_model_version || header.m_file_size != file_size)
+    {
+        return false;
+    }
+
+    if (!in_file(header.m_sources_offset, uint64_t(header.m_source_count) * sizeof(file_source), file_size)
+        || !in_file(header.m_nodes_offset, uint64_t(header.m_node_count) * sizeof(file_node), file_size)
+        || !in_file(header.m_materials_offset, uint64_t(header.m_material_count) * sizeof(file_material), file_size)
+        || !in_file(header.m_meshes_offset, uint64_t(header.m_mesh_count) * sizeof(file_mesh), file_size)
+        || !in_file(header.m_strings_offset, header.m_string_size, file_size))
+    {
+        std::cout << "ERROR::BAKED_MODEL::TABLES OUT OF RANGE" << std::endl;
+        return false;
+    }
+
+    const char* strings = reinterpret_cast<const char*>(data + header.m_strings_offset);
+    if (header.m_string_size > 0 && strings[header.m_string_size - 1] != '\0')
+    {
+        std::cout << "ERROR::BAKED_MODEL::STRING TABLE NOT TERMINATED" << std::endl;
+        return false;
+    }
+    auto get_string = [&](uint32_t offset)
+        {
+            return offset < header.m_string_size ? std::string(strings + offset) : std::string();
+        };
+
+    model = {};
+
+    const file_source* sources = reinterpret_cast<const file_source*>(data + header.m_sources_offset);
+    model.m_sources.resize(header.m_source_count);
+    for (uint32_t i = 0; i < header.m_source_count; ++i)
+    {
+        model.m_sources[i] = { get_string(sources[i].m_path), sources[i].m_size, sources[i].m_write_time, sources[i].m_content_hash };
+    }
+
+    const file_node* nodes = reinterpret_cast<const file_node*>(data + header.m_nodes_offset);
+    model.m_nodes.resize(header.m_node_count);
+    for (uint32_t i = 0; i < header.m_node_count; ++i)
+    {
+        model.m_nodes[i].m_parent = nodes[i].m_parent;
+        model.m_nodes[i].m_transform = nodes[i].m_transform;
+    }
+
+    const file_material* materials = reinterpret_cast<const file_material*>(data + header.m_materials_offset);
+    model.m_materials.resize(header.m_material_count);
+    for (uint32_t i = 0; i < header.m_material_count; ++i)
+    {
+        model.m_materials[i] = { get_string(materials[i].m_name), get_string(materials[i].m_albedo_path), get_string(materials[i].m_specular_path) };
+    }
+
+    const file_mesh* meshes = reinterpret_cast<const file_mesh*>(data + header.m_meshes_offset);
+    model.m_meshes.resize(header.m_mesh_count);
+    for (uint32_t i = 0; i < header.m_mesh_count; ++i)
+    {
+        const file_mesh& source = meshes[i];
+        if (source.m_node >= header.m_node_count || (source.m_material != baked_mesh::no_material && source.m_material >= header.m_material_count)
+            || source.m_lod_count == 0 || source.m_lod_count > max_lod_count || source.m_index_type > uint32_t(index_type::uint32))
+        {
+            std::cout << "ERROR::BAKED_MODEL::BAD MESH: " << i << std::endl;
+            return false;
+        }
+
+        baked_mesh& mesh = model.m_meshes[i];
+        mesh.m_node = source.m_node;
+        mesh.m_material = source.m_material;
+
+        packed_geometry& geometry = mesh.m_geometry;
+        geometry.m_vertex_count = source.m_vertex_count;
+        geometry.m_decode = source.m_decode;
+        geometry.m_index_type = static_cast<index_type>(source.m_index_type);
+        geometry.m_lod_count = source.m_lod_count;
+        geometry.m_bounds = { source.m_bounds_min, source.m_bounds_max };
+        geometry.m_bounding_sphere = { source.m_sphere_centre, source.m_sphere_radius };
+
+        if (geometry.m_index_type == index_type::uint16 && geometry.m_vertex_count > 0x10000)
+        {
+            std::cout << "ERROR::BAKED_MODEL::BAD MESH: " << i << std::endl;
+            return false;
+        }
+
+        if (!in_file(source.m_positions_offset, uint64_t(source.m_vertex_count) * sizeof(packed_position), file_size)
+            || !in_file(source.m_attributes_offset, uint64_t(source.m_vertex_count) * sizeof(packed_attributes), file_size))
+        {
+            std::cout << "ERROR::BAKED_MODEL::VERTICES OUT OF RANGE: " << i << std::endl;
+            return false;
+        }
+        geometry.m_positions = reinterpret_cast<const packed_position*>(data + source.m_positions_offset);
+        geometry.m_attributes = reinterpret_cast<const packed_attributes*>(data + source.m_attributes_offset);
+
+        for (uint32_t lod = 0; lod < source.m_lod_count; ++lod)
+        {
+            if (!in_file(source.m_index_offsets[lod], uint64_t(source.m_index_counts[lod]) * get_index_size(geometry.m_index_type), file_size))
+            {
+                std::cout << "ERROR::BAKED_MODEL::INDICES OUT OF RANGE: " << i << std::endl;
+                return false;
+            }
+            geometry.m_indices[lod] = data + source.m_index_offsets[lod];
+            geometry.m_index_counts[lod] = source.m_index_counts[lod];
+            geometry.m_lod_errors[lod] = source.m_lod_errors[lod];
+        }
+    }
+
+    return true;
+}
+
+bool write_baked_model(const std::string& path, const baked_model& model)
+{
+    std::string strings;
+    std::vector<file_source> sources;
+    for (const baked_source& source : model.m_sources)
+    {
+        sources.push_back({ add_string(strings, source.m_path), 0, source.m_size, source.m_write_time, source.m_content_hash });
+    }
+
+    std::vector<file_material> materials;
+    for (const baked_material& material : model.m_materials)
+    {
+        materials.push_back({ add_string(strings, material.m_name), add_string(strings, material.m_albedo_path), add_string(strings, material.m_specular_path), 0 });
+    }
+
+    std::vector<file_node> nodes;
+    for (const mesh_node& node : model.m_nodes)
+    {
+        nodes.push_back({ node.m_transform, node.m_parent, {} });
+    }
+
+    file_header header = {};
+    header.m_magic = baked_model_magic;
+    header.m_version = baked_model_version;
+    header.m_source_count = static_cast<uint32_t>(sources.size());
+    header.m_node_count = static_cast<uint32_t>(nodes.size());
+    header.m_material_count = static_cast<uint32_t>(materials.size());
+    header.m_mesh_count = static_cast<uint32_t>(model.m_meshes.size());
+    header.m_string_size = static_cast<uint32_t>(strings.size());
+
+    // Lay everything out first so the tables can be written with their final offsets
+    uint64_t offset = align_offset(sizeof(file_header));
+    header.m_sources_offset = offset;
+    offset = align_offset(offset + sources.size() * sizeof(file_source));
+    header.m_nodes_offset = offset;
+    offset = align_offset(offset + nodes.size() * sizeof(file_node));
+    header.m_materials_offset = offset;
+    offset = align_offset(offset + materials.size() * sizeof(file_material));
+    header.m_meshes_offset = offset;
+    offset = align_offset(offset + model.m_meshes.size() * sizeof(file_mesh));
+    header.m_strings_offset = offset;
+    offset = align_offset(offset + strings.size());
+
+    // Geometry streams in the order they're listed here
+    std::vector<std::pair<const void*, uint64_t>> blobs;
+    auto add_blob = [&](const void* blob, uint64_t size)
+        {
+            uint64_t blob_offset = offset;
+            blobs.push_back({ blob, size });
+            offset = align_offset(offset + size);
+            return blob_offset;
+        };
+
+    std::vector<file_mesh> meshes;
+    for (const baked_mesh& mesh : model.m_meshes)
+    {
+        const packed_geometry& geometry = mesh.m_geometry;
+
+        file_mesh out = {};
+        out.m_decode = geometry.m_decode;
+        out.m_bounds_min = geometry.m_bounds.m_min;
+        out.m_bounds_max = geometry.m_bounds.m_max;
+        out.m_sphere_centre = geometry.m_bounding_sphere.m_centre;
+        out.m_sphere_radius = geometry.m_bounding_sphere.m_radius;
+        out.m_node = mesh.m_node;
+        out.m_material = mesh.m_material;
+        out.m_vertex_count = geometry.m_vertex_count;
+        out.m_index_type = static_cast<uint32_t>(geometry.m_index_type);
+        out.m_lod_count = geometry.m_lod_count;
+
+        out.m_positions_offset = add_blob(geometry.m_positions, uint64_t(geometry.m_vertex_count) * sizeof(packed_position));
+        out.m_attributes_offset = add_blob(geometry.m_attributes, uint64_t(geometry.m_vertex_count) * sizeof(packed_attributes));
+        for (unsigned int lod = 0; lod < geometry.m_lod_count; ++lod)
+        {
+            out.m_index_counts[lod] = geometry.m_index_counts[lod];
+            out.m_lod_errors[lod] = geometry.m_lod_errors[lod];
+            out.m_index_offsets[lod] = add_blob(geometry.m_indices[lod], uint64_t(geometry.m_index_counts[lod]) * get_index_size(geometry.m_index_type));
+        }
+        meshes.push_back(out);
+    }
+    header.m_file_size = offset;
+
+    std::string temporary_path = path + ".tmp";
+    {
+        std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            std::cout << "ERROR::BAKED_MODEL::COULD NOT WRITE: " << temporary_path << std::endl;
+            return false;
+        }
+
+        uint64_t written = 0;
+        auto write = [&](uint64_t at, const void* bytes, uint64_t size)
+            {
+                static const char padding[baked_model_alignment] = {};
+                file.write(padding, std::streamsize(at - written));
+                if (size > 0)
+                {
+                    file.write(static_cast<const char*>(bytes), std::streamsize(size));
+                }
+                written = at + size;
+            };
+
+        write(0, &header, sizeof(header));
+        write(header.m_sources_offset, sources.data(), sources.size() * sizeof(file_source));
+        write(header.m_nodes_offset, nodes.data(), nodes.size() * sizeof(file_node));
+        write(header.m_materials_offset, materials.data(), materials.size() * sizeof(file_material));
+        write(header.m_meshes_offset, meshes.data(), meshes.size() * sizeof(file_mesh));
+        write(header.m_strings_offset, strings.data(), strings.size());
+
+        uint64_t blob_offset = align_offset(header.m_strings_offset + strings.size());
+        for (const auto& [blob, size] : blobs)
+        {
+            write(blob_offset, blob, size);
+            blob_offset = align_offset(blob_offset + size);
+        }
+        write(header.m_file_size, nullptr, 0);
+
+        if (!file)
+        {
+            std::cout << "ERROR::BAKED_MODEL::COULD NOT WRITE: " << temporary_path << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary_path, path, error);
+    if (error)
+    {
+        std::cout << "ERROR::BAKED_MODEL::COULD NOT REPLACE: " << path << std::endl;
+        std::filesystem::remove(temporary_path, error);
+        return false;
+    }
+    return true;
+}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <slam_utils/memory/mapped_file.h>
+
+#include "mesh.h"
+#include "vertex_format.h"
+
+namespace slam_renderer
+{
+// Baked files sit next to their source model, e.g. backpack.obj.baked
+static const char* const baked_model_extension = ".baked";
+
+// Texture paths are relative to the model like assimp gives them, empty when there's no such texture
+struct baked_material
+{
+    std::string m_name;
+    std::string m_albedo_path;
+    std::string m_specular_path;
+};
+
+// A file the bake was made from, the model itself first then whatever else the importer read (e.g. an obj's .mtl).
+// The bake is current while every source has the same size and write time, or failing that the same contents
+struct baked_source
+{
+    // Relative to the model's directory unless absolute
+    std::string m_path;
+    uint64_t m_size = 0;
+    // file_time_type ticks
+    int64_t m_write_time = 0;
+    uint64_t m_content_hash = 0;
+};
+
+struct baked_mesh
+{
+    static const uint32_t no_material = ~0u;
+
+    uint32_t m_node = 0;
+    // Index into baked_model::m_materials
+    uint32_t m_material = no_material;
+    packed_geometry m_geometry;
+};
+
+// A model after import, optimization and simplification with its vertices and indices already in the arena's
+// layout. When read back the geometry views point straight into the mapped file, so it's uploaded from there
+struct baked_model
+{
+    std::vector<baked_source> m_sources;
+    std::vector<mesh_node> m_nodes;
+    std::vector<baked_material> m_materials;
+    std::vector<baked_mesh> m_meshes;
+};
+
+// False for anything but a complete file of this format version, whether it's still current is for the caller to
+// check against m_sources. The geometry views are only valid while file stays open
+bool read_baked_model(const mapped_file& file, baked_model& model);
+
+// Written to a temporary file that replaces path once complete, so a failed write never leaves a partial file
+bool write_baked_model(const std::string& path, const baked_model& model);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace slam_renderer
+{
+struct aabb
+{
+    glm::vec3 m_min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 m_max = glm::vec3(-std::numeric_limits<float>::max());
+
+    bool is_valid() const
+    {
+        return m_min.x <= m_max.x && m_min.y <= m_max.y && m_min.z <= m_max.z;
+    }
+
+    glm::vec3 get_centre() const
+    {
+        return (m_min + m_max) * 0.5f;
+    }
+
+    glm::vec3 get_extents() const
+    {
+        return (m_max - m_min) * 0.5f;
+    }
+
+    void expand(const glm::vec3& point)
+    {
+        m_min = glm::min(m_min, point);
+        m_max = glm::max(m_max, point);
+    }
+
+    void expand(const aabb& other)
+    {
+        m_min = glm::min(m_min, other.m_min);
+        m_max = glm::max(m_max, other.m_max);
+    }
+
+    // Arvo's method, transforms the extents by the absolute matrix rather than all 8 corners
+    aabb transformed(const glm::mat4& transform) const
+    {
+        glm::vec3 centre = glm::vec3(transform * glm::vec4(get_centre(), 1.f));
+        glm::mat3 absolute = glm::mat3(transform);
+        for (int column = 0; column < 3; ++column)
+        {
+            absolute[column] = glm::abs(absolute[column]);
+        }
+        glm::vec3 extents = absolute * get_extents();
+
+        return { centre - extents, centre + extents };
+    }
+};
+
+struct bounding_sphere
+{
+    glm::vec3 m_centre = glm::vec3(0.f);
+    float m_radius = 0.f;
+
+    // Centred on the box, radius from the furthest point in the mesh rather than the box corner so it stays tight
+    static bounding_sphere from_points(const aabb& box, const glm::vec3* points, size_t count, size_t stride)
+    {
+        bounding_sphere sphere;
+        sphere.m_centre = box.get_centre();
+
+        float radius_squared = 0.f;
+        const char* data = reinterpret_cast<const char*>(points);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const glm::vec3& point = *reinterpret_cast<const glm::vec3*>(data + i * stride);
+            glm::vec3 offset = point - sphere.m_centre;
+            radius_squared = std::max(radius_squared, glm::dot(offset, offset));
+        }
+        sphere.m_radius = glm::sqrt(radius_squared);
+
+        return sphere;
+    }
+
+    bounding_sphere transformed(const glm::mat4& transform) const
+    {
+        float scale = std::max({ glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])) });
+        return { glm::vec3(transform * glm::vec4(m_centre, 1.f)), m_radius * scale };
+    }
+};
+}
@@ -0,0 +1,358 @@
+#include "bvh.h"
+
+#include <algorithm>
+
+namespace
+{
+    static const uint32_t max_leaf_size = 4;
+    static const uint32_t max_stack_depth = 64;
+
+    enum class containment
+    {
+        outside,
+        intersecting,
+        inside
+    };
+
+    containment classify(const slam_renderer::frustum& frustum, const slam_renderer::aabb& box)
+    {
+        glm::vec3 centre = box.get_centre();
+        glm::vec3 extents = box.get_extents();
+
+        containment result = containment::inside;
+        for (const glm::vec4& plane : frustum.m_planes)
+        {
+            glm::vec3 normal = glm::vec3(plane);
+            float distance = glm::dot(normal, centre) + plane.w;
+            float radius = glm::dot(glm::abs(normal), extents);
+
+            if (distance + radius < 0.f)
+            {
+                return containment::outside;
+            }
+            if (distance - radius < 0.f)
+            {
+                result = containment::intersecting;
+            }
+        }
+        return result;
+    }
+
+    bool overlaps(const slam_renderer::aabb& a, const slam_renderer::aabb& b)
+    {
+        return glm::all(glm::lessThanEqual(a.m_min, b.m_max)) && glm::all(glm::lessThanEqual(b.m_min, a.m_max));
+    }
+
+    bool overlaps(const slam_renderer::bounding_sphere& sphere, const slam_renderer::aabb& box)
+    {
+        glm::vec3 closest = glm::clamp(sphere.m_centre, box.m_min, box.m_max);
+        glm::vec3 offset = closest - sphere.m_centre;
+        return glm::dot(offset, offset) <= sphere.m_radius * sphere.m_radius;
+    }
+
+    // Slab test, inverse_direction may contain infinities which the min/max handle
+    bool intersects_ray(const glm::vec3& origin, const glm::vec3& inverse_direction, float max_distance, const slam_renderer::aabb& box)
+    {
+        glm::vec3 t0 = (box.m_min - origin) * inverse_direction;
+        glm::vec3 t1 = (box.m_max - origin) * inverse_direction;
+        glm::vec3 t_near = glm::min(t0, t1);
+        glm::vec3 t_far = glm::max(t0, t1);
+
+        float enter = std::max({ t_near.x, t_near.y, t_near.z, 0.f });
+        float exit = std::min({ t_far.x, t_far.y, t_far.z, max_distance });
+        return enter <= exit;
+    }
+}
+
+namespace slam_renderer
+{
+void bvh::build(const std::vector<aabb>& object_bounds)
+{
+    m_object_bounds = object_bounds;
+    m_nodes.clear();
+    m_objects.resize(object_bounds.size());
+    m_object_leaf.assign(object_bounds.size(), invalid_index);
+    m_centroids.resize(object_bounds.size());
+
+    if (object_bounds.empty())
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < object_bounds.size(); ++i)
+    {
+        m_objects[i] = i;
+        m_centroids[i] = object_bounds[i].get_centre();
+    }
+
+    // A binary tree with leaves of at least one object never has more than 2n - 1 nodes
+    m_nodes.reserve(object_bounds.size() * 2);
+    m_nodes.emplace_back();
+    build_recursive(0, 0, static_cast<uint32_t>(object_bounds.size()));
+}
+
+void bvh::build_recursive(uint32_t node_index, uint32_t begin, uint32_t end)
+{
+    aabb bounds;
+    aabb centroid_bounds;
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        bounds.expand(m_object_bounds[m_objects[i]]);
+        centroid_bounds.expand(m_centroids[m_objects[i]]);
+    }
+    m_nodes[node_index].m_bounds = bounds;
+
+    uint32_t count = end - begin;
+    glm::vec3 centroid_extents = centroid_bounds.m_max - centroid_bounds.m_min;
+    bool degenerate = glm::all(glm::lessThanEqual(centroid_extents, glm::vec3(0.f)));
+
+    if (count <= max_leaf_size || degenerate)
+    {
+        m_nodes[node_index].m_first = begin;
+        m_nodes[node_index].m_count = count;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            m_object_leaf[m_objects[i]] = node_index;
+        }
+        return;
+    }
+
+    // Median split on the longest centroid axis, keeps the tree balanced so queries stay logarithmic
+    int axis = 0;
+    if (centroid_extents.y > centroid_extents[axis])
+    {
+        axis = 1;
+    }
+    if (centroid_extents.z > centroid_extents[axis])
+    {
+        axis = 2;
+    }
+
+    uint32_t middle = begin + count / 2;
+    std::nth_element(m_objects.begin() + begin, m_objects.begin() + middle, m_objects.begin() + end, [this, axis](uint32_t a, uint32_t b)
+        {
+            return m_centroids[a][axis] < m_centroids[b][axis];
+        });
+
+    uint32_t left = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.emplace_back();
+    m_nodes.emplace_back();
+    m_nodes[left].m_parent = node_index;
+    m_nodes[left + 1].m_parent = node_index;
+    m_nodes[node_index].m_first = left;
+    m_nodes[node_index].m_count = 0;
+
+    build_recursive(left, begin, middle);
+    build_recursive(left + 1, middle, end);
+}
+
+void bvh::refit(uint32_t object, const aabb& bounds)
+{
+    if (object >= m_object_bounds.size())
+    {
+        return;
+    }
+
+    m_object_bounds[object] = bounds;
+    uint32_t node_index = m_object_leaf[object];
+
+    while (node_index != invalid_index)
+    {
+        node& current = m_nodes[node_index];
+
+        aabb refitted;
+        if (current.is_leaf())
+        {
+            for (uint32_t i = current.m_first; i < current.m_first + current.m_count; ++i)
+            {
+                refitted.expand(m_object_bounds[m_objects[i]]);
+            }
+        }
+        else
+        {
+            refitted.expand(m_nodes[current.m_first].m_bounds);
+            refitted.expand(m_nodes[current.m_first + 1].m_bounds);
+        }
+
+        if (refitted.m_min == current.m_bounds.m_min && refitted.m_max == current.m_bounds.m_max)
+        {
+            break;
+        }
+
+        current.m_bounds = refitted;
+        node_index = current.m_parent;
+    }
+}
+
+void bvh::collect(uint32_t node_index, std::vector<uint32_t>& results) const
+{
+    uint32_t stack[max_stack_depth];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = node_index;
+
+    while (stack_size > 0)
+    {
+        const node& current = m_nodes[stack[--stack_size]];
+        if (current.is_leaf())
+        {
+            results.insert(results.end(), m_objects.begin() + current.m_first, m_objects.begin() + current.m_first + current.m_count);
+        }
+        else
+        {
+            stack[stack_size++] = current.m_first;
+            stack[stack_size++] = current.m_first + 1;
+        }
+    }
+}
+
+void bvh::query_frustum(const frustum& frustum, std::vector<uint32_t>& inside, std::vector<uint32_t>& intersecting) const
+{
+    if (m_nodes.empty())
+    {
+        return;
+    }
+
+    uint32_t stack[max_stack_depth];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0)
+    {
+        uint32_t node_index = stack[--stack_size];
+        const node& current = m_nodes[node_index];
+
+        containment result = classify(frustum, current.m_bounds);
+        if (result == containment::outside)
+        {
+            continue;
+        }
+
+        if (result == containment::inside)
+        {
+            collect(node_index, inside);
+        }
+        else if (current.is_leaf())
+        {
+            intersecting.insert(intersecting.end(), m_objects.begin() + current.m_first, m_objects.begin() + current.m_first + current.m_count);
+        }
+        else
+        {
+            stack[stack_size++] = current.m_first;
+            stack[stack_size++] = current.m_first + 1;
+        }
+    }
+}
+
+void bvh::query_sphere(const bounding_sphere& sphere, std::vector<uint32_t>& results) const
+{
+    if (m_nodes.empty())
+    {
+        return;
+    }
+
+    uint32_t stack[max_stack_depth];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0)
+    {
+        const node& current = m_nodes[stack[--stack_size]];
+        if (!overlaps(sphere, current.m_bounds))
+        {
+            continue;
+        }
+
+        if (current.is_leaf())
+        {
+            for (uint32_t i = current.m_first; i < current.m_first + current.m_count; ++i)
+            {
+                if (overlaps(sphere, m_object_bounds[m_objects[i]]))
+                {
+                    results.push_back(m_objects[i]);
+                }
+            }
+        }
+        else
+        {
+            stack[stack_size++] = current.m_first;
+            stack[stack_size++] = current.m_first + 1;
+        }
+    }
+}
+
+void bvh::query_aabb(const aabb& box, std::vector<uint32_t>& results) const
+{
+    if (m_nodes.empty())
+    {
+        return;
+    }
+
+    uint32_t stack[max_stack_depth];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0)
+    {
+        const node& current = m_nodes[stack[--stack_size]];
+        if (!overlaps(box, current.m_bounds))
+        {
+            continue;
+        }
+
+        if (current.is_leaf())
+        {
+            for (uint32_t i = current.m_first; i < current.m_first + current.m_count; ++i)
+            {
+                if (overlaps(box, m_object_bounds[m_objects[i]]))
+                {
+                    results.push_back(m_objects[i]);
+                }
+            }
+        }
+        else
+        {
+            stack[stack_size++] = current.m_first;
+            stack[stack_size++] = current.m_first + 1;
+        }
+    }
+}
+
+void bvh::query_ray(const glm::vec3& origin, const glm::vec3& direction, float max_distance, std::vector<uint32_t>& results) const
+{
+    if (m_nodes.empty())
+    {
+        return;
+    }
+
+    glm::vec3 inverse_direction = 1.f / direction;
+
+    uint32_t stack[max_stack_depth];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0)
+    {
+        const node& current = m_nodes[stack[--stack_size]];
+        if (!intersects_ray(origin, inverse_direction, max_distance, current.m_bounds))
+        {
+            continue;
+        }
+
+        if (current.is_leaf())
+        {
+            for (uint32_t i = current.m_first; i < current.m_first + current.m_count; ++i)
+            {
+                if (intersects_ray(origin, inverse_direction, max_distance, m_object_bounds[m_objects[i]]))
+                {
+                    results.push_back(m_objects[i]);
+                }
+            }
+        }
+        else
+        {
+            stack[stack_size++] = current.m_first;
+            stack[stack_size++] = current.m_first + 1;
+        }
+    }
+}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "bounds.h"
+#include "culling.h"
+
+namespace slam_renderer
+{
+// Bounding volume hierarchy over object world bounds. Objects are identified by the index they were passed
+// to build() with. Built once, then refit in place when an object moves so the tree topology is kept
+class bvh
+{
+public:
+    void build(const std::vector<aabb>& object_bounds);
+
+    // Updates a single object and walks up to the root growing/shrinking parents, stops early once a parent is unchanged
+    void refit(uint32_t object, const aabb& bounds);
+
+    // Objects in nodes entirely inside the frustum go to inside, objects in leaves that straddle a plane go
+    // to intersecting so the caller can test them individually
+    void query_frustum(const frustum& frustum, std::vector<uint32_t>& inside, std::vector<uint32_t>& intersecting) const;
+    void query_sphere(const bounding_sphere& sphere, std::vector<uint32_t>& results) const;
+    void query_aabb(const aabb& box, std::vector<uint32_t>& results) const;
+    // Objects whose bounds are hit by the ray within max_distance, in no particular order
+    void query_ray(const glm::vec3& origin, const glm::vec3& direction, float max_distance, std::vector<uint32_t>& results) const;
+
+    const aabb& get_object_bounds(uint32_t object) const
+    {
+        return m_object_bounds[object];
+    }
+
+    // Bounds of everything in the tree, invalid when empty
+    aabb get_bounds() const
+    {
+        return m_nodes.empty() ? aabb() : m_nodes[0].m_bounds;
+    }
+
+    size_t get_object_count() const
+    {
+        return m_object_bounds.size();
+    }
+
+    bool empty() const
+    {
+        return m_nodes.empty();
+    }
+
+private:
+    static const uint32_t invalid_index = ~0u;
+
+    struct node
+    {
+        aabb m_bounds;
+        uint32_t m_parent = invalid_index;
+        // Interior: index of the left child, right is always left + 1. Leaf: first entry in m_objects
+        uint32_t m_first = 0;
+        // 0 for interior nodes
+        uint32_t m_count = 0;
+
+        bool is_leaf() const
+        {
+            return m_count > 0;
+        }
+    };
+
+    void build_recursive(uint32_t node_index, uint32_t begin, uint32_t end);
+
+    // Every object below a node, used when the whole subtree is known to pass a query
+    void collect(uint32_t node_index, std::vector<uint32_t>& results) const;
+
+    std::vector<node> m_nodes;
+    std::vector<uint32_t> m_objects;
+    std::vector<uint32_t> m_object_leaf;
+    std::vector<aabb> m_object_bounds;
+    std::vector<glm::vec3> m_centroids;
+};
+}
@@ -0,0 +1,209 @@
+#include "culling.h"
+
+#include <slam_utils/threading/thread_pool.h>
+
+#if defined(__AVX__)
+#define CULLING_AVX 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define CULLING_SSE 1
+#endif
+
+#if CULLING_SSE || CULLING_AVX
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // Below this it costs more to hand the work out than to just do it
+    static const size_t min_cull_batch = 1024;
+}
+
+namespace slam_renderer
+{
+frustum frustum::from_matrix(const glm::mat4& view_projection)
+{
+    glm::vec4 row_x = glm::vec4(view_projection[0][0], view_projection[1][0], view_projection[2][0], view_projection[3][0]);
+    glm::vec4 row_y = glm::vec4(view_projection[0][1], view_projection[1][1], view_projection[2][1], view_projection[3][1]);
+    glm::vec4 row_z = glm::vec4(view_projection[0][2], view_projection[1][2], view_projection[2][2], view_projection[3][2]);
+    glm::vec4 row_w = glm::vec4(view_projection[0][3], view_projection[1][3], view_projection[2][3], view_projection[3][3]);
+
+    frustum result;
+    result.m_planes[0] = row_w + row_x; // Left
+    result.m_planes[1] = row_w - row_x; // Right
+    result.m_planes[2] = row_w + row_y; // Bottom
+    result.m_planes[3] = row_w - row_y; // Top
+    result.m_planes[4] = row_w + row_z; // Near
+    result.m_planes[5] = row_w - row_z; // Far
+
+    for (glm::vec4& plane : result.m_planes)
+    {
+        plane /= glm::length(glm::vec3(plane));
+    }
+
+    return result;
+}
+
+bool frustum::intersects(const aabb& box) const
+{
+    glm::vec3 centre = box.get_centre();
+    glm::vec3 extents = box.get_extents();
+
+    for (const glm::vec4& plane : m_planes)
+    {
+        glm::vec3 normal = glm::vec3(plane);
+        if (glm::dot(normal, centre) + glm::dot(glm::abs(normal), extents) + plane.w < 0.f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool frustum::intersects(const bounding_sphere& sphere) const
+{
+    for (const glm::vec4& plane : m_planes)
+    {
+        if (glm::dot(glm::vec3(plane), sphere.m_centre) + plane.w < -sphere.m_radius)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void cull_set::clear()
+{
+    m_centre_x.clear();
+    m_centre_y.clear();
+    m_centre_z.clear();
+    m_extent_x.clear();
+    m_extent_y.clear();
+    m_extent_z.clear();
+}
+
+void cull_set::add(const aabb& box)
+{
+    glm::vec3 centre = box.get_centre();
+    glm::vec3 extents = box.get_extents();
+
+    m_centre_x.push_back(centre.x);
+    m_centre_y.push_back(centre.y);
+    m_centre_z.push_back(centre.z);
+    m_extent_x.push_back(extents.x);
+    m_extent_y.push_back(extents.y);
+    m_extent_z.push_back(extents.z);
+}
+
+cull_stats cull_set::cull(const frustum& frustum, std::vector<uint8_t>& visibility, thread_pool* pool) const
+{
+    size_t count = size();
+    visibility.resize(count);
+
+    if (pool != nullptr)
+    {
+        pool->parallel_for(count, min_cull_batch, [&](size_t begin, size_t end)
+            {
+                cull_range(frustum, visibility.data(), begin, end);
+            });
+    }
+    else
+    {
+        cull_range(frustum, visibility.data(), 0, count);
+    }
+
+    cull_stats stats;
+    for (uint8_t visible : visibility)
+    {
+        stats.m_visible += visible;
+    }
+    stats.m_culled = static_cast<unsigned int>(count) - stats.m_visible;
+    return stats;
+}
+
+void cull_set::cull_range(const frustum& frustum, uint8_t* visibility, size_t begin, size_t end) const
+{
+    size_t i = begin;
+
+#if CULLING_AVX
+    // 8 boxes per iteration
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 centre_x = _mm256_loadu_ps(&m_centre_x[i]);
+        __m256 centre_y = _mm256_loadu_ps(&m_centre_y[i]);
+        __m256 centre_z = _mm256_loadu_ps(&m_centre_z[i]);
+        __m256 extent_x = _mm256_loadu_ps(&m_extent_x[i]);
+        __m256 extent_y = _mm256_loadu_ps(&m_extent_y[i]);
+        __m256 extent_z = _mm256_loadu_ps(&m_extent_z[i]);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (const glm::vec4& plane : frustum.m_planes)
+        {
+            __m256 distance = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(centre_x, _mm256_set1_ps(plane.x)), _mm256_mul_ps(centre_y, _mm256_set1_ps(plane.y))),
+                _mm256_add_ps(_mm256_mul_ps(centre_z, _mm256_set1_ps(plane.z)), _mm256_set1_ps(plane.w)));
+            __m256 radius = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(extent_x, _mm256_set1_ps(glm::abs(plane.x))), _mm256_mul_ps(extent_y, _mm256_set1_ps(glm::abs(plane.y)))),
+                _mm256_mul_ps(extent_z, _mm256_set1_ps(glm::abs(plane.z))));
+
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+
+        int mask = _mm256_movemask_ps(inside);
+        for (int lane = 0; lane < 8; ++lane)
+        {
+            visibility[i + lane] = (mask >> lane) & 1;
+        }
+    }
+#endif
+
+#if CULLING_SSE
+    // 4 boxes per iteration
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 centre_x = _mm_loadu_ps(&m_centre_x[i]);
+        __m128 centre_y = _mm_loadu_ps(&m_centre_y[i]);
+        __m128 centre_z = _mm_loadu_ps(&m_centre_z[i]);
+        __m128 extent_x = _mm_loadu_ps(&m_extent_x[i]);
+        __m128 extent_y = _mm_loadu_ps(&m_extent_y[i]);
+        __m128 extent_z = _mm_loadu_ps(&m_extent_z[i]);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (const glm::vec4& plane : frustum.m_planes)
+        {
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(centre_x, _mm_set1_ps(plane.x)), _mm_mul_ps(centre_y, _mm_set1_ps(plane.y))),
+                _mm_add_ps(_mm_mul_ps(centre_z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            __m128 radius = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(extent_x, _mm_set1_ps(glm::abs(plane.x))), _mm_mul_ps(extent_y, _mm_set1_ps(glm::abs(plane.y)))),
+                _mm_mul_ps(extent_z, _mm_set1_ps(glm::abs(plane.z))));
+
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            visibility[i + lane] = (mask >> lane) & 1;
+        }
+    }
+#endif
+
+    // Scalar tail
+    for (; i < end; ++i)
+    {
+        bool inside = true;
+        for (const glm::vec4& plane : frustum.m_planes)
+        {
+            float distance = m_centre_x[i] * plane.x + m_centre_y[i] * plane.y + m_centre_z[i] * plane.z + plane.w;
+            float radius = m_extent_x[i] * glm::abs(plane.x) + m_extent_y[i] * glm::abs(plane.y) + m_extent_z[i] * glm::abs(plane.z);
+            if (distance + radius < 0.f)
+            {
+                inside = false;
+                break;
+            }
+        }
+        visibility[i] = inside ? 1 : 0;
+    }
+}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "bounds.h"
+
+class thread_pool;
+
+namespace slam_renderer
+{
+// Planes are stored as (normal, distance) with normals pointing into the frustum
+struct frustum
+{
+    glm::vec4 m_planes[6];
+
+    // Gribb/Hartmann extraction, works for both perspective and orthographic matrices
+    static frustum from_matrix(const glm::mat4& view_projection);
+
+    bool intersects(const aabb& box) const;
+    bool intersects(const bounding_sphere& sphere) const;
+};
+
+struct cull_stats
+{
+    unsigned int m_visible = 0;
+    unsigned int m_culled = 0;
+    // Part of m_culled that passed the frustum test but was hidden in the software occlusion buffer
+    unsigned int m_occluded = 0;
+};
+
+// World space bounds in SoA form (centre/extents) so several boxes can be tested per SIMD instruction
+class cull_set
+{
+public:
+    void clear();
+    void add(const aabb& box);
+
+    size_t size() const
+    {
+        return m_centre_x.size();
+    }
+
+    // Writes 1 for every box that intersects the frustum, 0 otherwise. Split across the pool when large enough
+    cull_stats cull(const frustum& frustum, std::vector<uint8_t>& visibility, thread_pool* pool = nullptr) const;
+
+private:
+    void cull_range(const frustum& frustum, uint8_t* visibility, size_t begin, size_t end) const;
+
+    std::vector<float> m_centre_x;
+    std::vector<float> m_centre_y;
+    std::vector<float> m_centre_z;
+    std::vector<float> m_extent_x;
+    std::vector<float> m_extent_y;
+    std::vector<float> m_extent_z;
+};
+}
@@ -0,0 +1,218 @@
+#include "deferred_lighting.h"
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+
+#include "renderer.h"
+
+namespace
+{
+    static const unsigned int light_volume_rings = 8;
+    static const unsigned int light_volume_segments = 12;
+}
+
+namespace slam_renderer
+{
+void deferred_lighting::init(int width, int height)
+{
+    renderer* renderer = renderer::get_instance();
+    m_width = width;
+    m_height = height;
+
+    // Owned here rather than registered with the renderer, those are treated as post processing targets
+    m_gbuffer = std::make_shared<framebuffer>(width, height, shader_handle{}, framebuffer_type::gbuffer);
+
+    m_gbuffer_shader = renderer->register_shader("assets/shaders/vertex.glsl", "assets/shaders/gbuffer_fragment.glsl", shader_type::gbuffer);
+    m_directional_shader = renderer->register_shader("assets/shaders/deferred_fullscreen_vertex.glsl", "assets/shaders/deferred_directional_fragment.glsl");
+    m_volume_stencil_shader = renderer->register_shader("assets/shaders/deferred_light_vertex.glsl", "assets/shaders/empty_fragment.glsl");
+    m_volume_light_shader = renderer->register_shader("assets/shaders/deferred_light_vertex.glsl", "assets/shaders/deferred_light_fragment.glsl");
+
+    // Sampler units never change so they're only set once
+    for (shader_handle handle : { m_directional_shader, m_volume_light_shader })
+    {
+        shader* lighting_shader = renderer->get_shader(handle);
+        lighting_shader->use();
+        lighting_shader->set(lighting_shader->find_uniform<int>("u_gbuffer_albedo_specular"), int(gbuffer_albedo_specular_unit));
+        lighting_shader->set(lighting_shader->find_uniform<int>("u_gbuffer_normal_shininess"), int(gbuffer_normal_shininess_unit));
+        lighting_shader->set(lighting_shader->find_uniform<int>("u_gbuffer_depth"), int(gbuffer_depth_unit));
+        lighting_shader->set(lighting_shader->find_uniform<int>("u_shadow_atlas"), int(shadow_atlas_unit));
+        lighting_shader->set(lighting_shader->find_uniform<int>("u_point_shadows"), int(point_shadow_unit));
+        lighting_shader->set(lighting_shader->find_uniform<int>("u_local_lights"), int(local_light_buffer_unit));
+    }
+    for (shader_handle handle : { m_volume_stencil_shader, m_volume_light_shader })
+    {
+        shader* volume_shader = renderer->get_shader(handle);
+        volume_shader->use();
+        volume_shader->set(volume_shader->find_uniform<int>("u_vertex_decode"), int(vertex_decode_unit));
+    }
+    m_light_index_uniform = renderer->get_shader(m_volume_light_shader)->find_uniform<int>("u_light_index");
+
+    glGenVertexArrays(1, &m_empty_vertex_array);
+    create_light_volume();
+
+    // Volumes only need positions
+    unsigned int arena_vertex_array = renderer->get_geometry_arena().get_position_vertex_array();
+
+    m_directional_pipeline.m_program = renderer->get_shader(m_directional_shader)->m_id;
+    m_directional_pipeline.m_vertex_array = m_empty_vertex_array;
+    m_directional_pipeline.m_depth_test = false;
+    m_directional_pipeline.m_depth_write = false;
+
+    // Depth tested against the scene but never written, only the stencil counts
+    m_stencil_pipeline.m_program = renderer->get_shader(m_volume_stencil_shader)->m_id;
+    m_stencil_pipeline.m_vertex_array = arena_vertex_array;
+    m_stencil_pipeline.m_depth_write = false;
+    m_stencil_pipeline.m_stencil_mode = stencil_mode::mark_volume;
+    m_stencil_pipeline.m_colour_write = false;
+
+    // Back faces so the volume still covers the screen when the camera is inside it
+    m_light_pipeline.m_program = renderer->get_shader(m_volume_light_shader)->m_id;
+    m_light_pipeline.m_vertex_array = arena_vertex_array;
+    m_light_pipeline.m_depth_test = false;
+    m_light_pipeline.m_depth_write = false;
+    m_light_pipeline.m_cull_mode = cull_mode::front;
+    m_light_pipeline.m_blend_mode = blend_mode::additive;
+    m_light_pipeline.m_stencil_mode = stencil_mode::test_volume;
+}
+
+void deferred_lighting::create_light_volume()
+{
+    vertices sphere_vertices;
+    faces sphere_faces;
+    aabb bounds;
+
+    for (unsigned int ring = 0; ring <= light_volume_rings; ++ring)
+    {
+        float latitude = glm::pi<float>() * float(ring) / light_volume_rings;
+        for (unsigned int segment = 0; segment <= light_volume_segments; ++segment)
+        {
+            float longitude = glm::two_pi<float>() * float(segment) / light_volume_segments;
+            glm::vec3 position(std::sin(latitude) * std::cos(longitude), std::cos(latitude), std::sin(latitude) * std::sin(longitude));
+
+            sphere_vertices.push_back({ position, position, glm::vec2(float(segment) / light_volume_segments, float(ring) / light_volume_rings) });
+            bounds.m_min = glm::min(bounds.m_min, position);
+            bounds.m_max = glm::max(bounds.m_max, position);
+        }
+    }
+
+    // Outward facing, counter clockwise
+    for (unsigned int ring = 0; ring < light_volume_rings; ++ring)
+    {
+        for (unsigned int segment = 0; segment < light_volume_segments; ++segment)
+        {
+            unsigned int current = ring * (light_volume_segments + 1) + segment;
+            unsigned int below = current + light_volume_segments + 1;
+
+            sphere_faces.insert(sphere_faces.end(), { current, current + 1, below });
+            sphere_faces.insert(sphere_faces.end(), { current + 1, below + 1, below });
+        }
+    }
+
+    m_light_volume = renderer::get_instance()->register_geometry(sphere_vertices, sphere_faces, bounds);
+
+    // Closest any face gets to the centre
+    m_light_volume_scale = 1.f / (std::cos(glm::pi<float>() / light_volume_segments) * std::cos(glm::pi<float>() / (2.f * light_volume_rings)));
+}
+
+void deferred_lighting::begin_geometry_pass(gl_state& state)
+{
+    state.set_viewport(0, 0, m_width, m_height);
+    m_gbuffer->bind();
+
+    // Clears respect the write masks, stencil has to start at zero for the volume passes
+    state.set_colour_write(true);
+    state.set_depth_write(true);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+}
+
+void deferred_lighting::resolve(gl_state& state, geometry_arena& arena, unsigned int target, const std::vector<local_light_data>& lights, const glm::mat4& view_projection)
+{
+    renderer* renderer = renderer::get_instance();
+    m_drawn_volumes = 0;
+
+    // Forward drawn materials (skybox, unlit) are depth tested against the g-buffer geometry afterwards
+    state.blit(m_gbuffer->get_id(), target, 0, 0, m_width, m_height, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+    renderer->get_texture(m_gbuffer->get_texture(gbuffer_attachment::albedo_specular))->bind(gbuffer_albedo_specular_unit);
+    renderer->get_texture(m_gbuffer->get_texture(gbuffer_attachment::normal_shininess))->bind(gbuffer_normal_shininess_unit);
+    renderer->get_texture(m_gbuffer->get_texture(gbuffer_attachment::depth))->bind(gbuffer_depth_unit);
+
+    // Directional light and ambient, writes every covered pixel so nothing needs clearing first
+    state.apply(m_directional_pipeline);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    frustum view_frustum = frustum::from_matrix(view_projection);
+    m_visible_lights.clear();
+    m_volume_transforms.clear();
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        bounding_sphere sphere;
+        sphere.m_centre = glm::vec3(lights[i].m_position);
+        sphere.m_radius = lights[i].m_position.w;
+        if (!view_frustum.intersects(sphere))
+        {
+            continue;
+        }
+
+        m_visible_lights.push_back(static_cast<uint32_t>(i));
+        glm::mat4 transform = glm::translate(glm::mat4(1.f), sphere.m_centre);
+        m_volume_transforms.push_back(glm::scale(transform, glm::vec3(sphere.m_radius * m_light_volume_scale)));
+    }
+
+    if (m_visible_lights.empty())
+    {
+        return;
+    }
+
+    if (m_instance_buffer == 0)
+    {
+        glGenBuffers(1, &m_instance_buffer);
+    }
+    state.bind_array_buffer(m_instance_buffer);
+
+    size_t upload_size = m_volume_transforms.size() * sizeof(glm::mat4);
+    m_instance_buffer_capacity = std::max(upload_size, m_instance_buffer_capacity);
+    glBufferData(GL_ARRAY_BUFFER, m_instance_buffer_capacity, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, upload_size, m_volume_transforms.data());
+
+    const geometry_allocation& volume = renderer->get_geometry(m_light_volume)->get_allocation();
+    shader* light_shader = renderer->get_shader(m_volume_light_shader);
+
+    // Volumes crossing the near/far planes would otherwise lose faces and leave the stencil unbalanced
+    glEnable(GL_DEPTH_CLAMP);
+
+    arena.bind(m_instance_buffer, 0);
+    for (size_t i = 0; i < m_visible_lights.size(); ++i)
+    {
+        // After the pipeline so the offset lands in the VAO it binds
+        state.apply(m_stencil_pipeline);
+        arena.set_instance_offset(i * sizeof(glm::mat4));
+        arena.draw(volume, 1);
+
+        // The test pass zeroes every pixel it passes, so the stencil is clean again for the next light
+        state.apply(m_light_pipeline);
+        light_shader->set(m_light_index_uniform, static_cast<int>(m_visible_lights[i]));
+        arena.draw(volume, 1);
+    }
+
+    glDisable(GL_DEPTH_CLAMP);
+    m_drawn_volumes = static_cast<unsigned int>(m_visible_lights.size());
+}
+
+void deferred_lighting::free()
+{
+    if (m_gbuffer != nullptr)
+    {
+        m_gbuffer->free();
+    }
+
+    glDeleteVertexArrays(1, &m_empty_vertex_array);
+    if (m_instance_buffer != 0)
+    {
+        glDeleteBuffers(1, &m_instance_buffer);
+        m_instance_buffer = 0;
+    }
+}
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <memory>
+#include <vector>
+
+#include "framebuffer.h"
+#include "gl_state.h"
+#include "handles.h"
+#include "light_clusters.h"
+#include "point_shadows.h"
+#include "shadow_atlas.h"
+#include "shader.h"
+
+namespace slam_renderer
+{
+class geometry_arena;
+
+// Units the g-buffer is read from, the shadow atlas and local light buffer are shared with forward shading
+static const unsigned int gbuffer_albedo_specular_unit = 0;
+static const unsigned int gbuffer_normal_shininess_unit = 1;
+static const unsigned int gbuffer_depth_unit = 6;
+
+// Deferred shading. Lit materials write their inputs to a g-buffer and lighting is resolved once per covered pixel
+// afterwards: the directional light as a fullscreen pass, point and spot lights as a sphere volume each that is
+// stencil marked first so only pixels with geometry inside the volume get shaded
+class deferred_lighting
+{
+public:
+    // Registers the g-buffer and lighting shaders, has to happen before any lit material is registered
+    void init(int width, int height);
+
+    // Lit materials get a twin using this shader for the g-buffer pass (see renderer::register_material)
+    shader_handle get_gbuffer_shader() const
+    {
+        return m_gbuffer_shader;
+    }
+
+    // Binds and clears the g-buffer
+    void begin_geometry_pass(gl_state& state);
+
+    // Copies the g-buffer depth/stencil into target and adds every light to its colour, target is left bound.
+    // The shadow atlas and local light buffer have to be bound already
+    void resolve(gl_state& state, geometry_arena& arena, unsigned int target, const std::vector<local_light_data>& lights, const glm::mat4& view_projection);
+
+    void free();
+
+    // Light volumes drawn by the last resolve, lights outside the frustum are skipped
+    unsigned int get_drawn_volumes() const
+    {
+        return m_drawn_volumes;
+    }
+
+private:
+    void create_light_volume();
+
+    int m_width = 0;
+    int m_height = 0;
+    std::shared_ptr<framebuffer> m_gbuffer;
+
+    shader_handle m_gbuffer_shader;
+    shader_handle m_directional_shader;
+    shader_handle m_volume_stencil_shader;
+    shader_handle m_volume_light_shader;
+    uniform<int> m_light_index_uniform;
+
+    pipeline_state m_directional_pipeline;
+    pipeline_state m_stencil_pipeline;
+    pipeline_state m_light_pipeline;
+    // The fullscreen triangle comes from gl_VertexID but core profile still needs a VAO bound
+    unsigned int m_empty_vertex_array = 0;
+
+    // Unit sphere, scaled up so its flat faces still contain the real sphere
+    geometry_handle m_light_volume;
+    float m_light_volume_scale = 1.f;
+
+    std::vector<uint32_t> m_visible_lights;
+    std::vector<glm::mat4> m_volume_transforms;
+    unsigned int m_instance_buffer = 0;
+    size_t m_instance_buffer_capacity = 0;
+
+    unsigned int m_drawn_volumes = 0;
+};
+}
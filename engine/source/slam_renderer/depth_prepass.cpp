@@ -0,0 +1,146 @@
+#include "depth_prepass.h"
+
+#include <glad.h>
+
+#include "renderer.h"
+
+namespace
+{
+    // Hysteresis so a scene hovering around one threshold doesn't flip every measurement
+    static const float enable_overdraw = 1.5f;
+    static const float disable_overdraw = 1.25f;
+    // While off in automatic mode, frames between re-measuring with a pre-pass
+    static const unsigned int measure_interval = 120;
+}
+
+namespace slam_renderer
+{
+void depth_prepass::init()
+{
+    renderer* renderer = renderer::get_instance();
+
+    shader_handle depth_shader = renderer->register_shader("assets/shaders/depth_prepass_vertex.glsl", "assets/shaders/empty_fragment.glsl", shader_type::depth_prepass);
+    m_material = renderer->register_material(material(depth_shader, {}, 0.f));
+
+    for (frame_queries& queries : m_queries)
+    {
+        glGenQueries(1, &queries.m_prepass);
+        glGenQueries(1, &queries.m_colour);
+    }
+}
+
+void depth_prepass::read_results()
+{
+    // Oldest first so the latest available measurement wins
+    for (unsigned int i = 0; i < query_frames; ++i)
+    {
+        frame_queries& queries = m_queries[(m_frame + i) % query_frames];
+        if (!queries.m_pending)
+        {
+            continue;
+        }
+
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(queries.m_colour, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available == GL_FALSE)
+        {
+            continue;
+        }
+
+        GLuint prepass_samples = 0;
+        GLuint colour_samples = 0;
+        glGetQueryObjectuiv(queries.m_prepass, GL_QUERY_RESULT, &prepass_samples);
+        glGetQueryObjectuiv(queries.m_colour, GL_QUERY_RESULT, &colour_samples);
+        queries.m_pending = false;
+
+        m_overdraw = colour_samples > 0 ? float(prepass_samples) / float(colour_samples) : 1.f;
+        if (m_overdraw > enable_overdraw)
+        {
+            m_worthwhile = true;
+        }
+        else if (m_overdraw < disable_overdraw)
+        {
+            m_worthwhile = false;
+        }
+    }
+}
+
+void depth_prepass::begin_frame(bool allowed)
+{
+    read_results();
+
+    bool wanted = false;
+    switch (m_mode)
+    {
+    case depth_prepass_mode::automatic:
+        wanted = m_worthwhile || m_frames_since_measured >= measure_interval;
+        break;
+    case depth_prepass_mode::always:
+        wanted = true;
+        break;
+    case depth_prepass_mode::never:
+        wanted = false;
+        break;
+    }
+    m_active = allowed && wanted;
+}
+
+unsigned int depth_prepass::get_samples_query(render_pass pass) const
+{
+    if (!m_active)
+    {
+        return 0;
+    }
+
+    const frame_queries& queries = m_queries[m_frame % query_frames];
+    if (pass == render_pass::depth_prepass)
+    {
+        return queries.m_prepass;
+    }
+    return pass == render_pass::opaque ? queries.m_colour : 0;
+}
+
+void depth_prepass::end_frame()
+{
+    if (m_active)
+    {
+        // A slot still unread from three frames ago just loses that measurement
+        m_queries[m_frame % query_frames].m_pending = true;
+        m_frames_since_measured = 0;
+    }
+    else
+    {
+        ++m_frames_since_measured;
+    }
+    ++m_frame;
+}
+
+void depth_prepass::cycle_mode()
+{
+    switch (m_mode)
+    {
+    case depth_prepass_mode::automatic:
+        m_mode = depth_prepass_mode::always;
+        std::cout << "DEPTH PREPASS: always" << std::endl;
+        break;
+    case depth_prepass_mode::always:
+        m_mode = depth_prepass_mode::never;
+        std::cout << "DEPTH PREPASS: never" << std::endl;
+        break;
+    case depth_prepass_mode::never:
+        m_mode = depth_prepass_mode::automatic;
+        std::cout << "DEPTH PREPASS: automatic" << std::endl;
+        break;
+    }
+}
+
+void depth_prepass::free()
+{
+    for (frame_queries& queries : m_queries)
+    {
+        glDeleteQueries(1, &queries.m_prepass);
+        glDeleteQueries(1, &queries.m_colour);
+        queries = {};
+    }
+}
+}
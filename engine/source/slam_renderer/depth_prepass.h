@@ -0,0 +1,81 @@
+#pragma once
+
+#include "handles.h"
+#include "render_queue.h"
+
+namespace slam_renderer
+{
+enum class depth_prepass_mode
+{
+    automatic, // On while the measured overdraw makes it worth a second geometry pass
+    always,
+    never
+};
+
+// Depth only pass over the opaque geometry before the lit pass, so the lit pass depth tests with less_equal against
+// the final depth and shades every pixel once. Whether that pays off depends on the scene, so overdraw is measured
+// with sample queries on frames that have the pre-pass: fragments passing its depth test (what the lit pass would
+// shade without it) over fragments the lit pass actually shades. Results are read a few frames later so nothing stalls
+class depth_prepass
+{
+public:
+    // Registers the position only program and the override material the pass draws with
+    void init();
+
+    // Decides whether this frame gets a pre-pass from the results of earlier frames, allowed is false for frames
+    // where it never applies (deferred shading, wireframe)
+    void begin_frame(bool allowed);
+
+    // Sample query to wrap the pass in, 0 when this frame isn't measured
+    unsigned int get_samples_query(render_pass pass) const;
+
+    void end_frame();
+
+    bool is_active() const
+    {
+        return m_active;
+    }
+
+    material_handle get_material() const
+    {
+        return m_material;
+    }
+
+    void cycle_mode();
+
+    depth_prepass_mode get_mode() const
+    {
+        return m_mode;
+    }
+
+    // Lit pass fragments per visible fragment, from the latest measured frame
+    float get_overdraw() const
+    {
+        return m_overdraw;
+    }
+
+    void free();
+
+private:
+    void read_results();
+
+    static const unsigned int query_frames = 3;
+    struct frame_queries
+    {
+        unsigned int m_prepass = 0;
+        unsigned int m_colour = 0;
+        bool m_pending = false;
+    };
+    frame_queries m_queries[query_frames];
+    unsigned int m_frame = 0;
+
+    material_handle m_material;
+    depth_prepass_mode m_mode = depth_prepass_mode::automatic;
+    bool m_active = false;
+
+    // Automatic mode only, whether overdraw last measured high enough to keep the pre-pass on
+    bool m_worthwhile = false;
+    unsigned int m_frames_since_measured = 0;
+    float m_overdraw = 1.f;
+};
+}
@@ -17,19 +17,23 @@ namespace{
 
 namespace slam_renderer
 {
-framebuffer::framebuffer(unsigned int width, unsigned int height, std::shared_ptr<shader> shader, framebuffer_type type)
+framebuffer::framebuffer(unsigned int width, unsigned int height, shader_handle shader, framebuffer_type type, unsigned int layers)
     : m_type(type)
     , m_width(width)
     , m_height(height)
+    , m_layers(layers)
     , m_shader(shader)
 {
+    renderer* renderer = renderer::get_instance();
+    gl_state& state = renderer->get_gl_state();
+
     glGenFramebuffers(1, &m_id);
-    glBindFramebuffer(GL_FRAMEBUFFER, m_id);
+    state.bind_framebuffer(m_id);
 
     if (m_type < framebuffer_type::no_colour)
     {
-        m_texture = renderer::get_instance()->get_register_texture("", false, texture_type::texture_2d, width, height);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texture->get_id(), 0);
+        m_textures[0] = renderer->get_register_texture("", false, texture_type::texture_2d, width, height);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderer->get_texture(m_textures[0])->get_id(), 0);
     }
 
     if (m_type == framebuffer_type::colour_depth_stencil)
@@ -43,12 +47,35 @@ framebuffer::framebuffer(unsigned int width, unsigned int height, std::shared_pt
 
     if (m_type == framebuffer_type::depth)
     {
-        m_texture = renderer::get_instance()->get_register_texture("", false, texture_type::depth_2d, width, height);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_texture->get_id(), 0);
+        m_textures[0] = renderer->get_register_texture("", false, texture_type::depth_2d, width, height);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, renderer->get_texture(m_textures[0])->get_id(), 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+
+    if (m_type == framebuffer_type::depth_array)
+    {
+        m_textures[0] = renderer->get_register_texture("", false, texture_type::depth_2d_array, width, height, layers);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, renderer->get_texture(m_textures[0])->get_id(), 0);
         glDrawBuffer(GL_NONE);
         glReadBuffer(GL_NONE);
     }
 
+    if (m_type == framebuffer_type::gbuffer)
+    {
+        static const texture_type attachment_types[] = { texture_type::texture_2d, texture_type::colour_16f, texture_type::depth_stencil_2d };
+        static const GLenum attachment_points[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_DEPTH_STENCIL_ATTACHMENT };
+
+        for (unsigned int i = 0; i < static_cast<unsigned int>(gbuffer_attachment::count); ++i)
+        {
+            m_textures[i] = renderer->get_register_texture("", false, attachment_types[i], width, height);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, attachment_points[i], GL_TEXTURE_2D, renderer->get_texture(m_textures[i])->get_id(), 0);
+        }
+
+        unsigned int draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, draw_buffers);
+    }
+
 
     if (int res = glCheckFramebufferStatus(GL_FRAMEBUFFER); res != GL_FRAMEBUFFER_COMPLETE)
     {
@@ -61,16 +88,26 @@ framebuffer::framebuffer(unsigned int width, unsigned int height, std::shared_pt
 
     setup_quad();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // Fullscreen quad, no depth. Shadow maps etc. are never drawn so have no shader
+    if (slam_renderer::shader* quad_shader = renderer->get_shader(m_shader))
+    {
+        m_quad_pipeline.m_program = quad_shader->m_id;
+    }
+    m_quad_pipeline.m_vertex_array = m_vertex_array;
+    m_quad_pipeline.m_depth_test = false;
+
+    state.bind_framebuffer(0);
 }
 
 void framebuffer::setup_quad()
 {
+    gl_state& state = renderer::get_instance()->get_gl_state();
+
     glGenVertexArrays(1, &m_vertex_array);
-    glBindVertexArray(m_vertex_array);
+    state.bind_vertex_array(m_vertex_array);
 
     glGenBuffers(1, &m_vertex_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vertex_buffer);
+    state.bind_array_buffer(m_vertex_buffer);
     glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), &quad_vertices, GL_STATIC_DRAW);
 
     // Vertex positions
@@ -80,28 +117,35 @@ void framebuffer::setup_quad()
     // UVs
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
     glEnableVertexAttribArray(1);
-
-    // Unbind
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
 }
 
 void framebuffer::draw(float delta)
 {
-    glDisable(GL_DEPTH_TEST);
+    renderer* renderer = renderer::get_instance();
+    renderer->get_gl_state().apply(m_quad_pipeline);
+
     glClear(GL_COLOR_BUFFER_BIT);
-    m_shader->use();
-    glBindVertexArray(m_vertex_array);
-    glActiveTexture(GL_TEXTURE0);
-    m_texture->bind();
+    renderer->get_texture(m_textures[0])->bind(0);
     glDrawArrays(GL_TRIANGLES, 0, 6);
-
-    m_shader->post_draw();
-    glEnable(GL_DEPTH_TEST);
 }
 
 void framebuffer::bind()
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, m_id);
+    renderer::get_instance()->get_gl_state().bind_framebuffer(m_id);
+}
+
+void framebuffer::clear_layers(unsigned int first_layer, unsigned int layer_count)
+{
+    renderer* renderer = renderer::get_instance();
+    renderer->get_gl_state().bind_framebuffer(m_id);
+    unsigned int texture_id = renderer->get_texture(m_textures[0])->get_id();
+
+    // A clear with every layer attached would hit all of them, so each one is attached on its own first
+    for (unsigned int layer = first_layer; layer < first_layer + layer_count; ++layer)
+    {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture_id, 0, layer);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture_id, 0);
 }
 }
\ No newline at end of file
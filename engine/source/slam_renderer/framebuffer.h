@@ -6,6 +6,8 @@
 
 #include "texture.h"
 #include "shader.h"
+#include "handles.h"
+#include "gl_state.h"
 
 namespace slam_renderer
 {
@@ -17,13 +19,25 @@ enum class framebuffer_type
     colour_depth_stencil,
     // No Colour
     no_colour,
-    depth
+    depth,
+    // Layered depth texture, every layer is attached and a geometry shader picks one per primitive (gl_Layer)
+    depth_array,
+    // Multiple render targets for deferred shading, see gbuffer_attachment
+    gbuffer
+};
+
+enum class gbuffer_attachment : unsigned int
+{
+    albedo_specular, // RGBA8, albedo and specular intensity
+    normal_shininess, // RGBA16F, world normal and shininess
+    depth, // Depth24 stencil8, positions are reconstructed from it
+    count
 };
 
 class framebuffer
 {
 public:
-    framebuffer(unsigned int width, unsigned int height, std::shared_ptr<shader> shader, framebuffer_type type = framebuffer_type::colour);
+    framebuffer(unsigned int width, unsigned int height, shader_handle shader, framebuffer_type type = framebuffer_type::colour, unsigned int layers = 1);
 
     void setup_quad();
     
@@ -31,6 +45,9 @@ public:
 
     void bind();
 
+    // Clears the depth of a range of depth_array layers, leaves the framebuffer bound with every layer attached again
+    void clear_layers(unsigned int first_layer, unsigned int layer_count);
+
     void free()
     {
         if (m_render_buffer_object != 0)
@@ -41,9 +58,20 @@ public:
         glDeleteFramebuffers(1, &m_id);
     }
 
-    const std::shared_ptr<texture> get_texture() const
+    // Colour attachment, or the depth texture for depth only framebuffers
+    texture_handle get_texture() const
+    {
+        return m_textures[0];
+    }
+
+    texture_handle get_texture(gbuffer_attachment attachment) const
     {
-        return m_texture;
+        return m_textures[static_cast<unsigned int>(attachment)];
+    }
+
+    unsigned int get_id() const
+    {
+        return m_id;
     }
 
     const int get_width() const
@@ -56,20 +84,27 @@ public:
         return m_height;
     }
 
+    unsigned int get_layers() const
+    {
+        return m_layers;
+    }
+
 private:
     unsigned int m_width = 0;
     unsigned int m_height = 0;
+    unsigned int m_layers = 1;
     unsigned int m_id = 0;
 
     //vbo
     // TODO create some kind of abstract VBO class so that we can do this in the same place as meshes
     unsigned int m_vertex_array, m_vertex_buffer = 0;
+    pipeline_state m_quad_pipeline;
 
-    std::shared_ptr<shader> m_shader = nullptr;
+    shader_handle m_shader;
 
     framebuffer_type m_type = framebuffer_type::colour;
 
-    std::shared_ptr<texture> m_texture = nullptr;
+    texture_handle m_textures[static_cast<unsigned int>(gbuffer_attachment::count)];
     unsigned int m_render_buffer_object = 0;
 };
 }
\ No newline at end of file
@@ -0,0 +1,319 @@
+#include "geometry_arena.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <glad.h>
+
+namespace
+{
+    uint32_t get_page_count(uint32_t vertex_count)
+    {
+        return (vertex_count + slam_renderer::vertex_page_size - 1) / slam_renderer::vertex_page_size;
+    }
+
+    uint32_t get_word_count(uint32_t index_count, slam_renderer::index_type type)
+    {
+        return (index_count * slam_renderer::get_index_size(type) + 3) / 4;
+    }
+
+    GLenum get_gl_index_type(slam_renderer::index_type type)
+    {
+        return type == slam_renderer::index_type::uint16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
+}
+
+namespace slam_renderer
+{
+void geometry_arena::init(gl_state& state, uint32_t vertex_capacity, uint32_t index_capacity)
+{
+    m_state = &state;
+
+    uint32_t page_capacity = get_page_count(vertex_capacity);
+
+    glGenVertexArrays(1, &m_vertex_array);
+    glGenVertexArrays(1, &m_position_vertex_array);
+
+    glGenBuffers(1, &m_position_buffer);
+    m_state->bind_array_buffer(m_position_buffer);
+    glBufferData(GL_ARRAY_BUFFER, size_t(page_capacity) * vertex_page_size * sizeof(packed_position), nullptr, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &m_attribute_buffer);
+    m_state->bind_array_buffer(m_attribute_buffer);
+    glBufferData(GL_ARRAY_BUFFER, size_t(page_capacity) * vertex_page_size * sizeof(packed_attributes), nullptr, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &m_element_buffer);
+    m_state->bind_vertex_array(m_vertex_array);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_element_buffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, size_t(index_capacity) * sizeof(uint32_t), nullptr, GL_STATIC_DRAW);
+
+    bind_element_buffer();
+    setup_vertex_attributes();
+
+    // Instance transforms, the buffer and offset are only known at submit time so just enable them here
+    for (unsigned int vertex_array : { m_vertex_array, m_position_vertex_array })
+    {
+        m_state->bind_vertex_array(vertex_array);
+        for (unsigned int i = 0; i < 4; ++i)
+        {
+            glEnableVertexAttribArray(instance_transform_location + i);
+            glVertexAttribDivisor(instance_transform_location + i, 1);
+        }
+    }
+
+    m_vertex_pages.reset(page_capacity);
+    m_index_words.reset(index_capacity);
+
+    m_page_decodes.assign(page_capacity, vertex_decode{});
+    m_decode_buffer.init(state, GL_RGBA32F);
+    m_decodes_dirty = true;
+}
+
+void geometry_arena::setup_vertex_attributes()
+{
+    // Vertex positions, 0-1 within the mesh bounds, in both VAOs
+    m_state->bind_array_buffer(m_position_buffer);
+    for (unsigned int vertex_array : { m_vertex_array, m_position_vertex_array })
+    {
+        m_state->bind_vertex_array(vertex_array);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(packed_position), (void*)offsetof(packed_position, m_position));
+        glEnableVertexAttribArray(0);
+    }
+
+    m_state->bind_vertex_array(m_vertex_array);
+    m_state->bind_array_buffer(m_attribute_buffer);
+
+    // Octahedral normals
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(packed_attributes), (void*)offsetof(packed_attributes, m_normal));
+    glEnableVertexAttribArray(1);
+
+    // UVs, 0-1 within the mesh's uv bounds
+    glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(packed_attributes), (void*)offsetof(packed_attributes, m_uv));
+    glEnableVertexAttribArray(2);
+}
+
+void geometry_arena::bind_element_buffer()
+{
+    // Element buffer binding is part of the VAO state
+    for (unsigned int vertex_array : { m_vertex_array, m_position_vertex_array })
+    {
+        m_state->bind_vertex_array(vertex_array);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_element_buffer);
+    }
+}
+
+geometry_allocation geometry_arena::allocate(const packed_position* positions, const packed_attributes* attributes, uint32_t vertex_count,
+    const vertex_decode& decode, const void* indices, uint32_t index_count, index_type type)
+{
+    geometry_allocation allocation;
+    if (vertex_count == 0 || index_count == 0)
+    {
+        std::cout << "ERROR::GEOMETRY_ARENA::EMPTY MESH" << std::endl;
+        return allocation;
+    }
+    if (type == index_type::uint16 && vertex_count > 0x10000)
+    {
+        std::cout << "ERROR::GEOMETRY_ARENA::TOO MANY VERTICES FOR 16 BIT INDICES: " << vertex_count << std::endl;
+        return allocation;
+    }
+
+    uint32_t page_count = get_page_count(vertex_count);
+    uint32_t first_page = m_vertex_pages.allocate(page_count);
+    if (first_page == free_list_allocator::invalid_offset)
+    {
+        grow_vertices(m_vertex_pages.get_capacity() + page_count - m_vertex_pages.get_free_tail());
+        first_page = m_vertex_pages.allocate(page_count);
+    }
+
+    allocation.m_base_vertex = first_page * vertex_page_size;
+    allocation.m_vertex_count = vertex_count;
+    allocation.m_index_type = type;
+    allocation.m_first_index = allocate_index_words(indices, index_count, type);
+    allocation.m_index_count = index_count;
+
+    m_state->bind_array_buffer(m_position_buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, size_t(allocation.m_base_vertex) * sizeof(packed_position), size_t(vertex_count) * sizeof(packed_position), positions);
+    m_state->bind_array_buffer(m_attribute_buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, size_t(allocation.m_base_vertex) * sizeof(packed_attributes), size_t(vertex_count) * sizeof(packed_attributes), attributes);
+
+    std::fill(m_page_decodes.begin() + first_page, m_page_decodes.begin() + first_page + page_count, decode);
+    m_decodes_dirty = true;
+
+    return allocation;
+}
+
+uint32_t geometry_arena::allocate_index_words(const void* indices, uint32_t index_count, index_type type)
+{
+    uint32_t word_count = get_word_count(index_count, type);
+    uint32_t first_word = m_index_words.allocate(word_count);
+    if (first_word == free_list_allocator::invalid_offset)
+    {
+        grow_indices(m_index_words.get_capacity() + word_count - m_index_words.get_free_tail());
+        first_word = m_index_words.allocate(word_count);
+    }
+
+    // Bound through the VAO so we don't clobber whatever element buffer another VAO has
+    m_state->bind_vertex_array(m_vertex_array);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, size_t(first_word) * sizeof(uint32_t), size_t(index_count) * get_index_size(type), indices);
+
+    return first_word * sizeof(uint32_t) / get_index_size(type);
+}
+
+geometry_allocation geometry_arena::allocate_lod(const geometry_allocation& base, const void* indices, uint32_t index_count)
+{
+    geometry_allocation allocation;
+    if (!base.is_valid() || index_count == 0)
+    {
+        std::cout << "ERROR::GEOMETRY_ARENA::EMPTY LOD" << std::endl;
+        return allocation;
+    }
+
+    allocation.m_base_vertex = base.m_base_vertex;
+    allocation.m_vertex_count = base.m_vertex_count;
+    allocation.m_index_type = base.m_index_type;
+    allocation.m_first_index = allocate_index_words(indices, index_count, base.m_index_type);
+    allocation.m_index_count = index_count;
+
+    return allocation;
+}
+
+void geometry_arena::release_lod(const geometry_allocation& allocation)
+{
+    uint32_t first_word = allocation.m_first_index * get_index_size(allocation.m_index_type) / sizeof(uint32_t);
+    m_index_words.release(first_word, get_word_count(allocation.m_index_count, allocation.m_index_type));
+}
+
+void geometry_arena::release(const geometry_allocation& allocation)
+{
+    m_vertex_pages.release(allocation.m_base_vertex / vertex_page_size, get_page_count(allocation.m_vertex_count));
+    release_lod(allocation);
+}
+
+void geometry_arena::grow_vertices(uint32_t min_pages)
+{
+    uint32_t old_capacity = m_vertex_pages.get_capacity();
+    uint32_t new_capacity = std::max(min_pages, old_capacity * 2);
+    std::cout << "GEOMETRY_ARENA::GROW VERTICES: " << old_capacity * vertex_page_size << " -> " << new_capacity * vertex_page_size << std::endl;
+
+    size_t old_vertices = size_t(old_capacity) * vertex_page_size;
+    size_t new_vertices = size_t(new_capacity) * vertex_page_size;
+
+    // The old ids may be reused by the next glGenBuffers, so forget they were bound
+    m_state->bind_array_buffer(0);
+    m_position_buffer = resize_buffer(m_position_buffer, old_vertices * sizeof(packed_position), new_vertices * sizeof(packed_position));
+    m_attribute_buffer = resize_buffer(m_attribute_buffer, old_vertices * sizeof(packed_attributes), new_vertices * sizeof(packed_attributes));
+
+    // Attribute pointers reference the buffer objects so they need pointing at the new ones
+    setup_vertex_attributes();
+
+    m_vertex_pages.grow(new_capacity);
+    m_page_decodes.resize(new_capacity);
+}
+
+void geometry_arena::grow_indices(uint32_t min_words)
+{
+    uint32_t old_capacity = m_index_words.get_capacity();
+    uint32_t new_capacity = std::max(min_words, old_capacity * 2);
+    std::cout << "GEOMETRY_ARENA::GROW INDICES: " << old_capacity << " -> " << new_capacity << std::endl;
+
+    m_element_buffer = resize_buffer(m_element_buffer, size_t(old_capacity) * sizeof(uint32_t), size_t(new_capacity) * sizeof(uint32_t));
+    bind_element_buffer();
+
+    m_index_words.grow(new_capacity);
+}
+
+unsigned int geometry_arena::resize_buffer(unsigned int buffer, size_t old_size, size_t new_size)
+{
+    unsigned int new_buffer;
+    glGenBuffers(1, &new_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, new_buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, new_size, nullptr, GL_STATIC_DRAW);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_size);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+    return new_buffer;
+}
+
+void geometry_arena::bind(unsigned int instance_buffer, size_t instance_offset)
+{
+    m_state->bind_vertex_array(m_vertex_array);
+    m_instance_buffer = instance_buffer;
+    set_instance_offset(instance_offset);
+
+    if (m_decodes_dirty)
+    {
+        m_decode_buffer.update(m_page_decodes.data(), m_page_decodes.size() * sizeof(vertex_decode));
+        m_decodes_dirty = false;
+    }
+    m_decode_buffer.bind(*m_state, vertex_decode_unit);
+}
+
+void geometry_arena::set_instance_offset(size_t instance_offset)
+{
+    // GL 3.3 has no base instance so the transform attributes are re-pointed per batch instead
+    m_state->bind_array_buffer(m_instance_buffer);
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        glVertexAttribPointer(instance_transform_location + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(instance_offset + i * sizeof(glm::vec4)));
+    }
+}
+
+void geometry_arena::draw(const geometry_allocation& allocation, unsigned int instance_count)
+{
+    unsigned int index_size = get_index_size(allocation.m_index_type);
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, GLsizei(allocation.m_index_count), get_gl_index_type(allocation.m_index_type),
+        (void*)(size_t(allocation.m_first_index) * index_size), instance_count, GLint(allocation.m_base_vertex));
+}
+
+void geometry_arena::queue_multi_draw(const geometry_allocation& allocation)
+{
+    // One index type per call
+    if (!m_draw_counts.empty() && allocation.m_index_type != m_draw_index_type)
+    {
+        submit_multi_draw();
+    }
+    m_draw_index_type = allocation.m_index_type;
+
+    m_draw_counts.push_back(GLsizei(allocation.m_index_count));
+    m_draw_offsets.push_back((void*)(size_t(allocation.m_first_index) * get_index_size(allocation.m_index_type)));
+    m_draw_base_vertices.push_back(GLint(allocation.m_base_vertex));
+}
+
+void geometry_arena::submit_multi_draw()
+{
+    if (m_draw_counts.empty())
+    {
+        return;
+    }
+
+    // Non-instanced draws read instance 0 of the divisor 1 attributes, so every draw shares the current transform
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, m_draw_counts.data(), get_gl_index_type(m_draw_index_type), m_draw_offsets.data(),
+        GLsizei(m_draw_counts.size()), m_draw_base_vertices.data());
+
+    m_draw_counts.clear();
+    m_draw_offsets.clear();
+    m_draw_base_vertices.clear();
+}
+
+void geometry_arena::free()
+{
+    m_state->bind_vertex_array(0);
+    m_state->bind_array_buffer(0);
+    glDeleteVertexArrays(1, &m_vertex_array);
+    glDeleteVertexArrays(1, &m_position_vertex_array);
+    glDeleteBuffers(1, &m_position_buffer);
+    glDeleteBuffers(1, &m_attribute_buffer);
+    glDeleteBuffers(1, &m_element_buffer);
+    m_vertex_array = m_position_vertex_array = m_position_buffer = m_attribute_buffer = m_element_buffer = 0;
+
+    m_decode_buffer.free();
+    m_page_decodes.clear();
+
+    m_vertex_pages.reset(0);
+    m_index_words.reset(0);
+}
+}
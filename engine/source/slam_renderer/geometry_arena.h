@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <slam_utils/memory/free_list_allocator.h>
+
+#include "mesh_geometry.h"
+#include "gl_state.h"
+#include "texel_buffer.h"
+#include "vertex_format.h"
+
+namespace slam_renderer
+{
+// One VAO with one large vertex buffer and index buffer shared by every mesh of the same vertex format.
+// Meshes are sub-allocated with base vertex/first index offsets so drawing never rebinds vertex state,
+// runs of meshes can go out in a single glMultiDrawElementsBaseVertex.
+// Vertices are a packed_position and a packed_attributes stream, handed out in pages of vertex_page_size so the
+// decode for each page can live in a table the vertex shaders index with gl_VertexID. A second VAO only reads the
+// position stream for depth only passes. 16 and 32 bit indices share the index buffer, which is allocated in
+// 32 bit words so either kind is aligned
+class geometry_arena
+{
+public:
+    // All VAO/buffer binds go through state so it stays in sync. Capacities are in vertices and 32 bit indices
+    void init(gl_state& state, uint32_t vertex_capacity, uint32_t index_capacity);
+
+    // Grows the buffers if needed, indices are of type and stay relative to the mesh's own vertices
+    geometry_allocation allocate(const packed_position* positions, const packed_attributes* attributes, uint32_t vertex_count,
+        const vertex_decode& decode, const void* indices, uint32_t index_count, index_type type);
+    void release(const geometry_allocation& allocation);
+
+    // Only allocates indices, of base's type, they draw base's vertices. Released before base
+    geometry_allocation allocate_lod(const geometry_allocation& base, const void* indices, uint32_t index_count);
+    void release_lod(const geometry_allocation& allocation);
+
+    // Binds the arena VAO and decode table and points the per-instance transform attributes at instance_offset
+    // bytes into instance_buffer
+    void bind(unsigned int instance_buffer, size_t instance_offset);
+    // Applies to whichever of the arena's VAOs is bound, so call it after switching pipeline
+    void set_instance_offset(size_t instance_offset);
+
+    // The vertex format part of a pipeline_state
+    unsigned int get_vertex_array() const
+    {
+        return m_vertex_array;
+    }
+
+    // Same geometry with only the position attribute, for shaders that read nothing else
+    unsigned int get_position_vertex_array() const
+    {
+        return m_position_vertex_array;
+    }
+
+    // Both expect bind() to have been called
+    void draw(const geometry_allocation& allocation, unsigned int instance_count);
+    // Draws every queued allocation in one call with the transform at the current instance offset. A change of
+    // index type submits whatever was queued first
+    void queue_multi_draw(const geometry_allocation& allocation);
+    void submit_multi_draw();
+
+    void free();
+
+    // GPU memory in use, in bytes
+    size_t get_vertex_memory() const
+    {
+        return size_t(m_vertex_pages.get_capacity() - m_vertex_pages.get_free_size()) * vertex_page_size * (sizeof(packed_position) + sizeof(packed_attributes));
+    }
+
+    size_t get_index_memory() const
+    {
+        return size_t(m_index_words.get_capacity() - m_index_words.get_free_size()) * sizeof(uint32_t);
+    }
+
+private:
+    uint32_t allocate_index_words(const void* indices, uint32_t index_count, index_type type);
+    void grow_vertices(uint32_t min_pages);
+    void grow_indices(uint32_t min_words);
+    // Copies the old buffer contents into a bigger buffer, the old buffer is deleted
+    static unsigned int resize_buffer(unsigned int buffer, size_t old_size, size_t new_size);
+    void setup_vertex_attributes();
+    void bind_element_buffer();
+
+    gl_state* m_state = nullptr;
+
+    unsigned int m_vertex_array = 0;
+    unsigned int m_position_vertex_array = 0;
+    unsigned int m_position_buffer = 0;
+    unsigned int m_attribute_buffer = 0;
+    unsigned int m_element_buffer = 0;
+    unsigned int m_instance_buffer = 0;
+
+    free_list_allocator m_vertex_pages;
+    free_list_allocator m_index_words;
+
+    // One vertex_decode per page, uploaded at the next bind after it changes
+    std::vector<vertex_decode> m_page_decodes;
+    texel_buffer m_decode_buffer;
+    bool m_decodes_dirty = false;
+
+    // Multi draw scratch
+    index_type m_draw_index_type = index_type::uint32;
+    std::vector<int> m_draw_counts;
+    std::vector<const void*> m_draw_offsets;
+    std::vector<int> m_draw_base_vertices;
+};
+}
@@ -0,0 +1,297 @@
+#include "gl_state.h"
+
+namespace
+{
+    static const uint8_t invalid_flag = 0xFF;
+    static const unsigned int invalid_id = ~0u;
+
+    GLenum to_gl(slam_renderer::compare_func func)
+    {
+        switch (func)
+        {
+        case slam_renderer::compare_func::less_equal:
+            return GL_LEQUAL;
+        case slam_renderer::compare_func::equal:
+            return GL_EQUAL;
+        case slam_renderer::compare_func::always:
+            return GL_ALWAYS;
+        default:
+            return GL_LESS;
+        }
+    }
+}
+
+namespace slam_renderer
+{
+void gl_state::apply(const pipeline_state& state)
+{
+    use_program(state.m_program);
+    bind_vertex_array(state.m_vertex_array);
+    set_depth_test(state.m_depth_test);
+    set_depth_write(state.m_depth_write);
+    set_depth_func(state.m_depth_func);
+    set_cull_mode(state.m_cull_mode);
+    set_blend_mode(state.m_blend_mode);
+    set_polygon_mode(state.m_polygon_mode);
+    set_stencil_mode(state.m_stencil_mode);
+    set_colour_write(state.m_colour_write);
+}
+
+void gl_state::use_program(unsigned int program)
+{
+    if (update(m_program, program))
+    {
+        glUseProgram(program);
+    }
+}
+
+void gl_state::bind_vertex_array(unsigned int vertex_array)
+{
+    if (update(m_vertex_array, vertex_array))
+    {
+        glBindVertexArray(vertex_array);
+    }
+}
+
+void gl_state::bind_array_buffer(unsigned int buffer)
+{
+    if (update(m_array_buffer, buffer))
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    }
+}
+
+void gl_state::bind_framebuffer(unsigned int framebuffer)
+{
+    if (update(m_framebuffer, framebuffer))
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    }
+}
+
+void gl_state::bind_texture(unsigned int unit, GLenum target, unsigned int texture)
+{
+    unsigned int& bound = target == GL_TEXTURE_CUBE_MAP ? m_textures_cube[unit]
+        : target == GL_TEXTURE_2D_ARRAY ? m_textures_2d_array[unit]
+        : target == GL_TEXTURE_BUFFER ? m_textures_buffer[unit]
+        : m_textures_2d[unit];
+    if (bound == texture)
+    {
+        ++m_skipped_calls;
+        return;
+    }
+
+    if (update(m_active_texture_unit, unit))
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+    bound = texture;
+    ++m_issued_calls;
+    glBindTexture(target, texture);
+}
+
+void gl_state::set_viewport(int x, int y, int width, int height)
+{
+    if (m_viewport[0] == x && m_viewport[1] == y && m_viewport[2] == width && m_viewport[3] == height)
+    {
+        ++m_skipped_calls;
+        return;
+    }
+
+    m_viewport[0] = x;
+    m_viewport[1] = y;
+    m_viewport[2] = width;
+    m_viewport[3] = height;
+    ++m_issued_calls;
+    glViewport(x, y, width, height);
+}
+
+void gl_state::set_scissor(int x, int y, int width, int height)
+{
+    if (m_scissor[0] == x && m_scissor[1] == y && m_scissor[2] == width && m_scissor[3] == height)
+    {
+        ++m_skipped_calls;
+        return;
+    }
+
+    m_scissor[0] = x;
+    m_scissor[1] = y;
+    m_scissor[2] = width;
+    m_scissor[3] = height;
+    ++m_issued_calls;
+    glScissor(x, y, width, height);
+}
+
+void gl_state::set_scissor_test(bool enabled)
+{
+    if (update(m_scissor_test, uint8_t(enabled)))
+    {
+        enabled ? glEnable(GL_SCISSOR_TEST) : glDisable(GL_SCISSOR_TEST);
+    }
+}
+
+void gl_state::set_depth_test(bool enabled)
+{
+    if (update(m_depth_test, uint8_t(enabled)))
+    {
+        enabled ? glEnable(GL_DEPTH_TEST) : glDisable(GL_DEPTH_TEST);
+    }
+}
+
+void gl_state::set_depth_write(bool enabled)
+{
+    if (update(m_depth_write, uint8_t(enabled)))
+    {
+        glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+    }
+}
+
+void gl_state::set_depth_func(compare_func func)
+{
+    if (update(m_depth_func, func))
+    {
+        glDepthFunc(to_gl(func));
+    }
+}
+
+void gl_state::set_cull_mode(cull_mode mode)
+{
+    cull_mode previous = m_cull_mode;
+    if (!update(m_cull_mode, mode))
+    {
+        return;
+    }
+
+    if (mode == cull_mode::none)
+    {
+        glDisable(GL_CULL_FACE);
+        return;
+    }
+
+    // Only enable when coming from none (or unknown), switching faces doesn't need it
+    if (previous != cull_mode::front && previous != cull_mode::back)
+    {
+        glEnable(GL_CULL_FACE);
+    }
+    glCullFace(mode == cull_mode::front ? GL_FRONT : GL_BACK);
+}
+
+void gl_state::set_blend_mode(blend_mode mode)
+{
+    blend_mode previous = m_blend_mode;
+    if (!update(m_blend_mode, mode))
+    {
+        return;
+    }
+
+    if (mode == blend_mode::opaque)
+    {
+        glDisable(GL_BLEND);
+        return;
+    }
+
+    // Switching between blending modes doesn't need another enable
+    if (previous != blend_mode::alpha && previous != blend_mode::additive)
+    {
+        glEnable(GL_BLEND);
+    }
+
+    if (mode == blend_mode::alpha)
+    {
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+    else
+    {
+        glBlendFunc(GL_ONE, GL_ONE);
+    }
+}
+
+void gl_state::set_polygon_mode(polygon_mode mode)
+{
+    if (update(m_polygon_mode, mode))
+    {
+        glPolygonMode(GL_FRONT_AND_BACK, mode == polygon_mode::line ? GL_LINE : GL_FILL);
+    }
+}
+
+void gl_state::set_stencil_mode(stencil_mode mode)
+{
+    stencil_mode previous = m_stencil_mode;
+    if (!update(m_stencil_mode, mode))
+    {
+        return;
+    }
+
+    if (mode == stencil_mode::disabled)
+    {
+        glDisable(GL_STENCIL_TEST);
+        return;
+    }
+
+    if (previous != stencil_mode::mark_volume && previous != stencil_mode::test_volume)
+    {
+        glEnable(GL_STENCIL_TEST);
+    }
+
+    if (mode == stencil_mode::mark_volume)
+    {
+        glStencilFunc(GL_ALWAYS, 0, 0);
+        glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+        glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+    }
+    else
+    {
+        glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+        glStencilOp(GL_KEEP, GL_ZERO, GL_ZERO);
+    }
+}
+
+void gl_state::set_colour_write(bool enabled)
+{
+    if (update(m_colour_write, uint8_t(enabled)))
+    {
+        GLboolean mask = enabled ? GL_TRUE : GL_FALSE;
+        glColorMask(mask, mask, mask, mask);
+    }
+}
+
+void gl_state::blit(unsigned int source, unsigned int target, int x, int y, int width, int height, GLbitfield mask)
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, source);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+    glBlitFramebuffer(x, y, x + width, y + height, x, y, x + width, y + height, mask, GL_NEAREST);
+    ++m_issued_calls;
+
+    // Put both binding points back on the target so the cached framebuffer is right again
+    m_framebuffer = invalid_id;
+    bind_framebuffer(target);
+}
+
+void gl_state::invalidate()
+{
+    m_program = invalid_id;
+    m_vertex_array = invalid_id;
+    m_array_buffer = invalid_id;
+    m_framebuffer = invalid_id;
+    m_active_texture_unit = invalid_id;
+    for (unsigned int i = 0; i < max_texture_units; ++i)
+    {
+        m_textures_2d[i] = invalid_id;
+        m_textures_2d_array[i] = invalid_id;
+        m_textures_cube[i] = invalid_id;
+        m_textures_buffer[i] = invalid_id;
+    }
+    m_viewport[0] = m_viewport[1] = m_viewport[2] = m_viewport[3] = -1;
+    m_scissor[0] = m_scissor[1] = m_scissor[2] = m_scissor[3] = -1;
+
+    m_scissor_test = invalid_flag;
+    m_depth_test = invalid_flag;
+    m_depth_write = invalid_flag;
+    m_depth_func = static_cast<compare_func>(invalid_flag);
+    m_cull_mode = static_cast<cull_mode>(invalid_flag);
+    m_blend_mode = static_cast<blend_mode>(invalid_flag);
+    m_polygon_mode = static_cast<polygon_mode>(invalid_flag);
+    m_stencil_mode = static_cast<stencil_mode>(invalid_flag);
+    m_colour_write = invalid_flag;
+}
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <glad.h>
+
+#include <cstdint>
+
+namespace slam_renderer
+{
+enum class compare_func : uint8_t
+{
+    less,
+    less_equal,
+    equal,
+    always
+};
+
+enum class cull_mode : uint8_t
+{
+    none,
+    front,
+    back
+};
+
+enum class blend_mode : uint8_t
+{
+    opaque,
+    alpha,
+    additive
+};
+
+// Two pass light volume stencilling (see deferred_lighting)
+enum class stencil_mode : uint8_t
+{
+    disabled,
+    mark_volume, // Back faces failing depth increment, front faces failing depth decrement
+    test_volume // Passes where the mark pass left a non zero value and zeroes it again
+};
+
+enum class polygon_mode : uint8_t
+{
+    fill,
+    line
+};
+
+// Everything fixed function a draw depends on plus the program and vertex format (VAO). Built once by whoever
+// owns the draw (materials, framebuffers) and applied as a whole through gl_state
+struct pipeline_state
+{
+    unsigned int m_program = 0;
+    unsigned int m_vertex_array = 0;
+
+    bool m_depth_test = true;
+    bool m_depth_write = true;
+    compare_func m_depth_func = compare_func::less;
+    cull_mode m_cull_mode = cull_mode::none;
+    blend_mode m_blend_mode = blend_mode::opaque;
+    polygon_mode m_polygon_mode = polygon_mode::fill;
+    stencil_mode m_stencil_mode = stencil_mode::disabled;
+    bool m_colour_write = true;
+};
+
+// Shadow of the GL context state so redundant binds/enables never reach the driver. Anything that changes
+// tracked state has to go through here, or call invalidate() afterwards
+class gl_state
+{
+public:
+    static const unsigned int max_texture_units = 16;
+
+    gl_state()
+    {
+        invalidate();
+    }
+
+    void apply(const pipeline_state& state);
+
+    void use_program(unsigned int program);
+    void bind_vertex_array(unsigned int vertex_array);
+    void bind_array_buffer(unsigned int buffer);
+    void bind_framebuffer(unsigned int framebuffer);
+    void bind_texture(unsigned int unit, GLenum target, unsigned int texture);
+    void set_viewport(int x, int y, int width, int height);
+    void set_scissor(int x, int y, int width, int height);
+    void set_scissor_test(bool enabled);
+
+    void set_depth_test(bool enabled);
+    void set_depth_write(bool enabled);
+    void set_depth_func(compare_func func);
+    void set_cull_mode(cull_mode mode);
+    void set_blend_mode(blend_mode mode);
+    void set_polygon_mode(polygon_mode mode);
+    void set_stencil_mode(stencil_mode mode);
+    void set_colour_write(bool enabled);
+
+    // Copies the masked buffers of a rect from one framebuffer to the same rect of another, leaves target bound
+    void blit(unsigned int source, unsigned int target, int x, int y, int width, int height, GLbitfield mask);
+
+    // Forget everything so the next call of each kind always goes through
+    void invalidate();
+
+    void reset_stats()
+    {
+        m_issued_calls = 0;
+        m_skipped_calls = 0;
+    }
+
+    // GL calls made / avoided since the last reset_stats
+    unsigned int get_issued_calls() const
+    {
+        return m_issued_calls;
+    }
+
+    unsigned int get_skipped_calls() const
+    {
+        return m_skipped_calls;
+    }
+
+private:
+    // True (and counted as issued) if value differs from cached, which is then updated
+    template <typename T>
+    bool update(T& cached, const T& value)
+    {
+        if (cached == value)
+        {
+            ++m_skipped_calls;
+            return false;
+        }
+        cached = value;
+        ++m_issued_calls;
+        return true;
+    }
+
+    // invalidate() fills these with values no real call can match
+    unsigned int m_program;
+    unsigned int m_vertex_array;
+    unsigned int m_array_buffer;
+    unsigned int m_framebuffer;
+    unsigned int m_active_texture_unit;
+    unsigned int m_textures_2d[max_texture_units];
+    unsigned int m_textures_2d_array[max_texture_units];
+    unsigned int m_textures_cube[max_texture_units];
+    unsigned int m_textures_buffer[max_texture_units];
+    int m_viewport[4];
+    int m_scissor[4];
+
+    uint8_t m_scissor_test;
+    uint8_t m_depth_test;
+    uint8_t m_depth_write;
+    compare_func m_depth_func;
+    cull_mode m_cull_mode;
+    blend_mode m_blend_mode;
+    polygon_mode m_polygon_mode;
+    stencil_mode m_stencil_mode;
+    uint8_t m_colour_write;
+
+    unsigned int m_issued_calls = 0;
+    unsigned int m_skipped_calls = 0;
+};
+}
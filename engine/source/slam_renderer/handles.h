@@ -0,0 +1,19 @@
+#pragma once
+
+#include <slam_utils/containers/slot_map.h>
+
+namespace slam_renderer
+{
+class texture;
+class shader;
+class material;
+class mesh_geometry;
+class model;
+
+// Resources are owned by slot maps in the renderer, everything else refers to them through these
+typedef handle<texture> texture_handle;
+typedef handle<shader> shader_handle;
+typedef handle<material> material_handle;
+typedef handle<mesh_geometry> geometry_handle;
+typedef handle<model> model_handle;
+}
@@ -2,6 +2,27 @@
 
 #include "renderer.h"
 
+#include <algorithm>
+
+namespace
+{
+    // Projected radius of a light's range as a share of the screen height, the whole screen once the camera is
+    // inside it. Negative when the range doesn't reach the view at all
+    float get_shadow_importance(const glm::vec3& position, float range, const glm::mat4& view, const glm::mat4& projection)
+    {
+        slam_renderer::bounding_sphere sphere;
+        sphere.m_centre = position;
+        sphere.m_radius = range;
+        if (!slam_renderer::frustum::from_matrix(projection * view).intersects(sphere))
+        {
+            return -1.f;
+        }
+
+        float depth = -(view * glm::vec4(position, 1.f)).z;
+        return depth > range ? std::min(range * projection[1][1] / depth, 1.f) : 1.f;
+    }
+}
+
 namespace slam_renderer
 {
 light::light(glm::vec3 position, glm::vec3 colour, float diffuse, float ambient, float specular)
@@ -13,30 +34,155 @@ light::light(glm::vec3 position, glm::vec3 colour, float diffuse, float ambient,
     m_type = light_type::none;
 }
 
-void light::load_to_shader(std::shared_ptr<shader> shader, std::string prefix) const
-{
-    shader->set_vec3(prefix + ".light.diffuse", m_diffuse);
-    shader->set_vec3(prefix + ".light.ambient", m_ambient);
-    shader->set_vec3(prefix + ".light.specular", m_specular);
-    // Position is handled by derived light as not all types need it (directional)
-}
-
 directional_light::directional_light(glm::vec3 direction, glm::vec3 position, glm::vec3 colour, float diffuse, float ambient, float specular)
     : light(position, colour, diffuse, ambient, specular)
     , m_direction(direction)
 {
     m_type = light_type::directional;
-    m_shadow_map = renderer::get_instance()->register_framebuffer(slam_renderer::framebuffer_type::depth, nullptr, 1024, 1024);
 }
 
-void directional_light::load_to_shader(std::shared_ptr<shader> shader, std::string prefix) const
+void directional_light::load_to_buffer(light_uniforms& uniforms, std::vector<local_light_data>& local_lights)
+{
+    if (uniforms.m_counts.x >= static_cast<int>(max_directional_lights))
+    {
+        std::cout << "ERROR::LIGHT::TOO MANY DIRECTIONAL LIGHTS, MAX: " << max_directional_lights << std::endl;
+        return;
+    }
+
+    directional_light_data& data = uniforms.m_directional_lights[uniforms.m_counts.x++];
+    data.m_direction = glm::vec4(m_direction, m_shadowed_cascades > 0 ? float(m_first_shadow_tile) : -1.f);
+    data.m_ambient = glm::vec4(m_ambient, float(m_shadowed_cascades));
+    data.m_diffuse = glm::vec4(m_diffuse, 0.f);
+    data.m_specular = glm::vec4(m_specular, 0.f);
+    data.m_cascade_splits = m_cascade_splits;
+}
+
+void directional_light::request_shadows(shadow_atlas& atlas, point_shadows& point_shadows, const glm::mat4& view, const glm::mat4& projection)
+{
+    m_first_shadow_tile = -1;
+    if (!m_casts_shadows)
+    {
+        return;
+    }
+
+    // Requests are numbered in order so the cascades end up next to each other in the table
+    for (unsigned int cascade = 0; cascade < m_cascade_count; ++cascade)
+    {
+        int tile = atlas.request(2.f - cascade * 0.25f, &m_shadow_caches[cascade]);
+        if (tile < 0)
+        {
+            break;
+        }
+        m_first_shadow_tile = cascade == 0 ? tile : m_first_shadow_tile;
+    }
+}
+
+void directional_light::update_shadow_tiles(shadow_atlas& atlas, const glm::mat4& view, const glm::mat4& projection, const aabb& scene_bounds)
 {
-    light::load_to_shader(shader, prefix);
+    // Only the leading cascades that got a tile are shadowed, the rest count as past the shadow distance
+    m_shadowed_cascades = 0;
+    if (m_first_shadow_tile < 0)
+    {
+        return;
+    }
+
+    while (m_shadowed_cascades < m_cascade_count
+        && m_first_shadow_tile + m_shadowed_cascades < atlas.get_tile_count()
+        && atlas.get_tile(m_first_shadow_tile + m_shadowed_cascades).m_size > 0)
+    {
+        ++m_shadowed_cascades;
+    }
+    update_cascades(atlas, view, projection, scene_bounds);
+}
+
+void directional_light::update_cascades(shadow_atlas& atlas, const glm::mat4& view, const glm::mat4& projection, const aabb& scene_bounds)
+{
+    glm::mat4 inverse_projection = glm::inverse(projection);
+    glm::mat4 inverse_view = glm::inverse(view);
+    auto unproject = [&inverse_projection](float x, float y, float z) -> glm::vec3
+        {
+            glm::vec4 position = inverse_projection * glm::vec4(x, y, z, 1.f);
+            return glm::vec3(position) / position.w;
+        };
+
+    // View space lines through the frustum corners, near to far
+    glm::vec3 corner_starts[4];
+    glm::vec3 corner_ends[4];
+    for (unsigned int corner = 0; corner < 4; ++corner)
+    {
+        float x = corner & 1 ? 1.f : -1.f;
+        float y = corner & 2 ? 1.f : -1.f;
+        corner_starts[corner] = unproject(x, y, -1.f);
+        corner_ends[corner] = unproject(x, y, 1.f);
+    }
+
+    float near_plane = std::max(-corner_starts[0].z, 0.001f);
+    float far_plane = std::max(std::min(-corner_ends[0].z, m_shadow_distance), near_plane * 2.f);
 
-    shader->set_vec3(prefix + ".direction", m_direction);
-    // TODO hardcoded slot value
-    glActiveTexture(GL_TEXTURE2);
-    m_shadow_map->get_texture()->bind();
+    glm::vec3 direction = glm::normalize(m_direction);
+    glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.f, 0.f, 1.f) : glm::vec3(0.f, 1.f, 0.f);
+
+    m_cascade_splits = glm::vec4(0.f);
+    float split_start = near_plane;
+    for (unsigned int cascade = 0; cascade < m_shadowed_cascades; ++cascade)
+    {
+        int tile = m_first_shadow_tile + static_cast<int>(cascade);
+        float resolution = static_cast<float>(atlas.get_tile(tile).m_size);
+
+        // Practical split scheme, a blend of logarithmic and uniform splits
+        float ratio = float(cascade + 1) / m_cascade_count;
+        float split_end = m_split_lambda * near_plane * std::pow(far_plane / near_plane, ratio)
+            + (1.f - m_split_lambda) * (near_plane + (far_plane - near_plane) * ratio);
+        m_cascade_splits[cascade] = split_end;
+
+        glm::vec3 corners[8];
+        glm::vec3 centre(0.f);
+        for (unsigned int corner = 0; corner < 8; ++corner)
+        {
+            const glm::vec3& start = corner_starts[corner & 3];
+            const glm::vec3& end = corner_ends[corner & 3];
+            float depth = corner < 4 ? split_start : split_end;
+
+            float t = (-depth - start.z) / (end.z - start.z);
+            corners[corner] = glm::vec3(inverse_view * glm::vec4(start + t * (end - start), 1.f));
+            centre += corners[corner] / 8.f;
+        }
+
+        // A bounding sphere keeps the cascade the same size however the camera rotates, rounded so float
+        // noise in the radius doesn't change it either
+        float radius = 0.f;
+        for (const glm::vec3& corner : corners)
+        {
+            radius = std::max(radius, glm::length(corner - centre));
+        }
+        radius = std::ceil(radius * 16.f) / 16.f;
+
+        // Depths along the light direction relative to the centre, pulled back to cover casters outside the cascade
+        float near_depth = -radius;
+        if (scene_bounds.is_valid())
+        {
+            for (unsigned int corner = 0; corner < 8; ++corner)
+            {
+                glm::vec3 point((corner & 1) ? scene_bounds.m_max.x : scene_bounds.m_min.x,
+                    (corner & 2) ? scene_bounds.m_max.y : scene_bounds.m_min.y,
+                    (corner & 4) ? scene_bounds.m_max.z : scene_bounds.m_min.z);
+                near_depth = std::min(near_depth, glm::dot(point - centre, direction));
+            }
+        }
+
+        // The eye sits one unit behind the centre
+        glm::mat4 light_view = glm::lookAt(centre - direction, centre, up);
+        glm::mat4 light_projection = glm::ortho(-radius, radius, -radius, radius, 1.f + near_depth, 1.f + radius);
+
+        // Snap the translation to whole tile texels so static shadows don't shimmer while the camera moves
+        glm::vec4 origin = light_projection * light_view * glm::vec4(0.f, 0.f, 0.f, 1.f) * (resolution * 0.5f);
+        glm::vec2 offset = (glm::round(glm::vec2(origin)) - glm::vec2(origin)) * (2.f / resolution);
+        light_projection[3][0] += offset.x;
+        light_projection[3][1] += offset.y;
+
+        atlas.set_tile_matrix(tile, light_projection * light_view, centre - direction);
+        split_start = split_end;
+    }
 }
 
 point_light::point_light(float constant, float linear, float quadratic, glm::vec3 position, glm::vec3 colour, float diffuse, float ambient, float specular)
@@ -46,16 +192,52 @@ point_light::point_light(float constant, float linear, float quadratic, glm::vec
     , m_quadratic(quadratic)
 {
     m_type = light_type::point;
+
+    // Solve constant + linear * d + quadratic * d^2 = 256 * brightest
+    glm::vec3 total = m_ambient + m_diffuse + m_specular;
+    float limit = 256.f * std::max({ total.r, total.g, total.b }) - m_constant;
+    if (m_quadratic > 0.f)
+    {
+        m_range = (-m_linear + std::sqrt(m_linear * m_linear + 4.f * m_quadratic * limit)) / (2.f * m_quadratic);
+    }
+    else if (m_linear > 0.f)
+    {
+        m_range = limit / m_linear;
+    }
+    else
+    {
+        std::cout << "ERROR::LIGHT::POINT LIGHT HAS NO ATTENUATION, CLAMPING RANGE" << std::endl;
+        m_range = 100.f;
+    }
+    m_range = std::max(m_range, 0.f);
+}
+
+void point_light::load_to_buffer(light_uniforms& uniforms, std::vector<local_light_data>& local_lights)
+{
+    local_light_data& data = local_lights.emplace_back();
+    data.m_position = glm::vec4(m_position, m_range);
+    data.m_ambient = glm::vec4(m_ambient, 0.f);
+    data.m_diffuse = glm::vec4(m_diffuse, float(m_shadow_state.m_slot));
+    data.m_specular = glm::vec4(m_specular, 0.f);
+    data.m_attenuation = glm::vec4(m_constant, m_linear, m_quadratic, 0.f);
+    data.m_direction = glm::vec4(0.f, 0.f, 0.f, point_shadows::get_near_plane(m_range));
+    ++uniforms.m_counts.y;
 }
 
-void point_light::load_to_shader(std::shared_ptr<shader> shader, std::string prefix) const
+void point_light::request_shadows(shadow_atlas& atlas, point_shadows& point_shadows, const glm::mat4& view, const glm::mat4& projection)
 {
-    light::load_to_shader(shader, prefix);
-    shader->set_vec3(prefix + ".light.position", m_position);
+    m_shadow_state.m_slot = -1;
+    if (!m_casts_shadows)
+    {
+        return;
+    }
 
-    shader->set_float(prefix + ".constant", m_constant);
-    shader->set_float(prefix + ".linear", m_linear);
-    shader->set_float(prefix + ".quadratic", m_quadratic);
+    float importance = get_shadow_importance(m_position, m_range, view, projection);
+    if (importance >= 0.f)
+    {
+        m_shadow_state.m_sphere = glm::vec4(m_position, m_range);
+        point_shadows.request(importance, &m_shadow_state);
+    }
 }
 
 spot_light::spot_light(float angle, float outer_angle, glm::vec3 direction, glm::vec3 position, glm::vec3 colour, float diffuse, float ambient, float specular)
@@ -67,13 +249,52 @@ spot_light::spot_light(float angle, float outer_angle, glm::vec3 direction, glm:
     m_type = light_type::spot;
 }
 
-void spot_light::load_to_shader(std::shared_ptr<shader> shader, std::string prefix) const
+void spot_light::load_to_buffer(light_uniforms& uniforms, std::vector<local_light_data>& local_lights)
+{
+    // No ambient or attenuation, same as before spot lights were clustered
+    local_light_data& data = local_lights.emplace_back();
+    data.m_position = glm::vec4(m_position, m_range);
+    data.m_ambient = glm::vec4(0.f, 0.f, 0.f, 1.f);
+    data.m_diffuse = glm::vec4(m_diffuse, float(m_shadow_tile));
+    data.m_specular = glm::vec4(m_specular, 0.f);
+    data.m_attenuation = glm::vec4(1.f, 0.f, 0.f, glm::cos(glm::radians(m_angle)));
+    data.m_direction = glm::vec4(m_direction, glm::cos(glm::radians(m_outer_angle)));
+    ++uniforms.m_counts.y;
+}
+
+void spot_light::request_shadows(shadow_atlas& atlas, point_shadows& point_shadows, const glm::mat4& view, const glm::mat4& projection)
 {
-    light::load_to_shader(shader, prefix);
-    shader->set_vec3(prefix + ".light.position", m_position);
+    m_shadow_tile = -1;
+    if (!m_casts_shadows)
+    {
+        return;
+    }
 
-    shader->set_float(prefix + ".angle_cos", glm::cos(glm::radians(m_angle)));
-    shader->set_float(prefix + ".outer_angle_cos", glm::cos(glm::radians(m_outer_angle)));
-    shader->set_vec3(prefix + ".direction", m_direction);
+    float importance = get_shadow_importance(m_position, m_range, view, projection);
+    if (importance >= 0.f)
+    {
+        m_shadow_tile = atlas.request(importance, &m_shadow_cache);
+    }
+}
+
+void spot_light::update_shadow_tiles(shadow_atlas& atlas, const glm::mat4& view, const glm::mat4& projection, const aabb& scene_bounds)
+{
+    if (m_shadow_tile < 0)
+    {
+        return;
+    }
+    if (atlas.get_tile(m_shadow_tile).m_size == 0)
+    {
+        m_shadow_tile = -1;
+        return;
+    }
+
+    glm::vec3 direction = glm::normalize(m_direction);
+    glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.f, 0.f, 1.f) : glm::vec3(0.f, 1.f, 0.f);
+
+    // Square frustum around the outer cone, the near plane scales with range to keep depth precision sensible
+    glm::mat4 light_view = glm::lookAt(m_position, m_position + direction, up);
+    glm::mat4 light_projection = glm::perspective(glm::radians(std::min(2.f * m_outer_angle, 170.f)), 1.f, std::max(m_range * 0.01f, 0.05f), m_range);
+    atlas.set_tile_matrix(m_shadow_tile, light_projection * light_view, m_position);
+}
 }
-}
\ No newline at end of file
@@ -2,8 +2,15 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <algorithm>
+
+#include "bounds.h"
 #include "shader.h"
 #include "framebuffer.h"
+#include "uniform_buffer.h"
+#include "light_clusters.h"
+#include "shadow_atlas.h"
+#include "point_shadows.h"
 
 namespace slam_renderer
 {
@@ -20,16 +27,32 @@ class light
 public:
     light(glm::vec3 position, glm::vec3 colour, float diffuse, float ambient, float specular);
 
-    virtual void load_to_shader(std::shared_ptr<shader> shader, std::string prefix) const;
+    // Writes this light into the per-frame light block, or appends it to local_lights if it is clustered
+    virtual void load_to_buffer(light_uniforms& uniforms, std::vector<local_light_data>& local_lights) = 0;
+
+    // Asks the atlas (or the point shadow slots) for this frame's shadows, ranked by how much of the view the light can reach
+    virtual void request_shadows(shadow_atlas& atlas, point_shadows& point_shadows, const glm::mat4& view, const glm::mat4& projection)
+    {
+    }
+
+    // Fits a shadow matrix to every tile that got space in the atlas
+    virtual void update_shadow_tiles(shadow_atlas& atlas, const glm::mat4& view, const glm::mat4& projection, const aabb& scene_bounds)
+    {
+    }
 
     light_type get_type() const
     {
         return m_type;
     }
 
-    std::shared_ptr<framebuffer> get_shadow_map()
+    bool get_casts_shadows() const
     {
-        return m_shadow_map;
+        return m_casts_shadows;
+    }
+
+    void set_casts_shadows(bool casts_shadows)
+    {
+        m_casts_shadows = casts_shadows;
     }
 
     const glm::vec3& get_position() const
@@ -37,6 +60,11 @@ public:
         return m_position;
     }
 
+    void set_position(const glm::vec3& position)
+    {
+        m_position = position;
+    }
+
 protected:
     glm::vec3 m_position;
     glm::vec3 m_diffuse;
@@ -44,7 +72,7 @@ protected:
     glm::vec3 m_specular;
 
     light_type m_type;
-    std::shared_ptr<framebuffer> m_shadow_map = nullptr; // Currently only supported on direcitonal lights
+    bool m_casts_shadows = true;
 };
 
 class directional_light : public light
@@ -52,24 +80,66 @@ class directional_light : public light
 public:
     directional_light(glm::vec3 direction, glm::vec3 position, glm::vec3 colour, float diffuse, float ambient, float specular);
 
-    void load_to_shader(std::shared_ptr<shader> shader, std::string prefix) const override;
+    void load_to_buffer(light_uniforms& uniforms, std::vector<local_light_data>& local_lights) override;
+
+    // One tile per cascade, nearer cascades rank above every spot light
+    void request_shadows(shadow_atlas& atlas, point_shadows& point_shadows, const glm::mat4& view, const glm::mat4& projection) override;
+    void update_shadow_tiles(shadow_atlas& atlas, const glm::mat4& view, const glm::mat4& projection, const aabb& scene_bounds) override;
+
     const glm::vec3& get_direction() const
     {
         return m_direction;
     }
 
-    const glm::mat4 get_light_space_matrix()
+    void set_direction(const glm::vec3& direction)
+    {
+        m_direction = direction;
+    }
+
+    unsigned int get_cascade_count() const
+    {
+        return m_cascade_count;
+    }
+
+    // Cascades that got an atlas tile this frame, the farthest ones go first when the atlas is full
+    unsigned int get_shadowed_cascade_count() const
     {
-        glm::mat4 view = glm::lookAt(m_position, m_position + m_direction, glm::vec3(0.f, 1.f, 0.f));
-        
-        float near_plane = 0.5f, far_plane = 100.f;
-        glm::mat4 projection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, near_plane, far_plane);
+        return m_shadowed_cascades;
+    }
+
+    // Each cascade takes its own atlas tile
+    void set_cascade_count(unsigned int count)
+    {
+        m_cascade_count = std::clamp(count, 1u, max_shadow_cascades);
+    }
 
-        return projection * view;
+    // Nothing past this view depth gets shadows
+    void set_shadow_distance(float distance)
+    {
+        m_shadow_distance = distance;
+    }
+
+    // 0 splits the view evenly, 1 logarithmically (same texel density at every depth)
+    void set_cascade_split_lambda(float lambda)
+    {
+        m_split_lambda = lambda;
     }
 
 private:
+    // Splits the camera frustum (up to the shadow distance) into cascades and fits a texel snapped light frustum
+    // to each tile. Casters anywhere in scene_bounds between the light and a cascade still land in its tile
+    void update_cascades(shadow_atlas& atlas, const glm::mat4& view, const glm::mat4& projection, const aabb& scene_bounds);
+
     glm::vec3 m_direction;
+
+    unsigned int m_cascade_count = max_shadow_cascades;
+    float m_shadow_distance = 100.f;
+    float m_split_lambda = 0.75f;
+    glm::vec4 m_cascade_splits = glm::vec4(0.f);
+
+    int m_first_shadow_tile = -1;
+    unsigned int m_shadowed_cascades = 0;
+    shadow_tile_cache m_shadow_caches[max_shadow_cascades];
 };
 
 class point_light : public light
@@ -77,12 +147,24 @@ class point_light : public light
 public:
     point_light(float constant, float linear, float quadratic, glm::vec3 position, glm::vec3 colour, float diffuse, float ambient, float specular);
 
-    void load_to_shader(std::shared_ptr<shader> shader, std::string prefix) const override;
+    void load_to_buffer(light_uniforms& uniforms, std::vector<local_light_data>& local_lights) override;
+
+    // A cube slot, nothing when the light can't reach the view
+    void request_shadows(shadow_atlas& atlas, point_shadows& point_shadows, const glm::mat4& view, const glm::mat4& projection) override;
+
+    float get_range() const
+    {
+        return m_range;
+    }
 
 private:
     float m_constant;
     float m_linear;
     float m_quadratic;
+    // Where the attenuated light drops below 1/256, nothing past it is lit
+    float m_range;
+
+    point_shadow_state m_shadow_state;
 };
 
 class spot_light : public light
@@ -90,12 +172,26 @@ class spot_light : public light
 public:
     spot_light(float angle, float outer_angle, glm::vec3 direction, glm::vec3 position, glm::vec3 colour, float diffuse, float ambient, float specular);
 
-    void load_to_shader(std::shared_ptr<shader> shader, std::string prefix) const override;
+    void load_to_buffer(light_uniforms& uniforms, std::vector<local_light_data>& local_lights) override;
+
+    // One perspective tile covering the outer cone, nothing when the light can't reach the view
+    void request_shadows(shadow_atlas& atlas, point_shadows& point_shadows, const glm::mat4& view, const glm::mat4& projection) override;
+    void update_shadow_tiles(shadow_atlas& atlas, const glm::mat4& view, const glm::mat4& projection, const aabb& scene_bounds) override;
+
+    // Spot lights aren't attenuated so they need an explicit cut off to be clustered
+    void set_range(float range)
+    {
+        m_range = range;
+    }
 
 private:
     float m_angle;
     float m_outer_angle;
     glm::vec3 m_direction;
+    float m_range = 100.f;
+
+    int m_shadow_tile = -1;
+    shadow_tile_cache m_shadow_cache;
 };
 }
 
@@ -0,0 +1,256 @@
+#include "light_clusters.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include <slam_utils/threading/thread_pool.h>
+
+namespace slam_renderer
+{
+void light_clusters::init(gl_state& state)
+{
+    m_light_buffer.init(state, GL_RGBA32F);
+    m_cluster_buffer.init(state, GL_RG32UI);
+    m_index_buffer.init(state, GL_R32UI);
+
+    m_cluster_lights.resize(cluster_count);
+    m_slice_lights.resize(clusters_z);
+    m_slice_indices.resize(clusters_z);
+}
+
+void light_clusters::build_cluster_bounds(const glm::mat4& projection, int width, int height)
+{
+    glm::mat4 inverse_projection = glm::inverse(projection);
+    auto unproject = [&inverse_projection](float x, float y, float z) -> glm::vec3
+        {
+            glm::vec4 position = inverse_projection * glm::vec4(x, y, z, 1.f);
+            return glm::vec3(position) / position.w;
+        };
+
+    float near_plane = std::max(-unproject(0.f, 0.f, -1.f).z, 0.001f);
+    float far_plane = std::max(-unproject(0.f, 0.f, 1.f).z, near_plane * 2.f);
+
+    // slice = log(depth) * scale + bias, exponential so slices are roughly as deep as they are wide
+    float log_ratio = std::log(far_plane / near_plane);
+    m_slice_scale = clusters_z / log_ratio;
+    m_slice_bias = -(clusters_z * std::log(near_plane)) / log_ratio;
+
+    // Tiles are whole pixels so the shader finds its tile from gl_FragCoord with the same divide
+    m_tile_size = glm::vec2(std::ceil(float(width) / clusters_x), std::ceil(float(height) / clusters_y));
+
+    m_bounds.resize(cluster_count);
+    m_column_extents.assign(clusters_z * clusters_x, glm::vec2(FLT_MAX, -FLT_MAX));
+    m_row_extents.assign(clusters_z * clusters_y, glm::vec2(FLT_MAX, -FLT_MAX));
+
+    for (unsigned int z = 0; z < clusters_z; ++z)
+    {
+        float slice_depths[2] = {
+            near_plane * std::pow(far_plane / near_plane, float(z) / clusters_z),
+            near_plane * std::pow(far_plane / near_plane, float(z + 1) / clusters_z)
+        };
+
+        for (unsigned int y = 0; y < clusters_y; ++y)
+        {
+            float tile_y[2] = {
+                std::min(2.f * y * m_tile_size.y / height - 1.f, 1.f),
+                std::min(2.f * (y + 1) * m_tile_size.y / height - 1.f, 1.f)
+            };
+
+            for (unsigned int x = 0; x < clusters_x; ++x)
+            {
+                float tile_x[2] = {
+                    std::min(2.f * x * m_tile_size.x / width - 1.f, 1.f),
+                    std::min(2.f * (x + 1) * m_tile_size.x / width - 1.f, 1.f)
+                };
+
+                // Each tile corner is a line from the near to the far plane (a ray for perspective, parallel for
+                // orthographic), cut at both slice depths
+                cluster_bounds bounds = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+                for (unsigned int corner = 0; corner < 4; ++corner)
+                {
+                    glm::vec3 start = unproject(tile_x[corner & 1], tile_y[corner >> 1], -1.f);
+                    glm::vec3 end = unproject(tile_x[corner & 1], tile_y[corner >> 1], 1.f);
+
+                    for (float depth : slice_depths)
+                    {
+                        float t = (-depth - start.z) / (end.z - start.z);
+                        glm::vec3 point = start + t * (end - start);
+                        point.z = depth;
+
+                        bounds.m_min = glm::min(bounds.m_min, point);
+                        bounds.m_max = glm::max(bounds.m_max, point);
+                    }
+                }
+                m_bounds[x + clusters_x * (y + clusters_y * z)] = bounds;
+
+                glm::vec2& column = m_column_extents[z * clusters_x + x];
+                column = glm::vec2(std::min(column.x, bounds.m_min.x), std::max(column.y, bounds.m_max.x));
+                glm::vec2& row = m_row_extents[z * clusters_y + y];
+                row = glm::vec2(std::min(row.x, bounds.m_min.y), std::max(row.y, bounds.m_max.y));
+            }
+        }
+    }
+}
+
+void light_clusters::update(const glm::mat4& view, const glm::mat4& projection, int width, int height, const std::vector<local_light_data>& lights, thread_pool& pool)
+{
+    if (projection != m_projection || width != m_width || height != m_height)
+    {
+        build_cluster_bounds(projection, width, height);
+        m_projection = projection;
+        m_width = width;
+        m_height = height;
+    }
+
+    for (std::vector<uint32_t>& slice_lights : m_slice_lights)
+    {
+        slice_lights.clear();
+    }
+
+    // Bin lights into the depth slices their sphere overlaps, the slice jobs then only look at their own lights
+    m_spheres.resize(lights.size());
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        glm::vec4 centre = view * glm::vec4(glm::vec3(lights[i].m_position), 1.f);
+        light_sphere& sphere = m_spheres[i];
+        sphere.m_centre = glm::vec3(centre.x, centre.y, -centre.z);
+        sphere.m_radius = lights[i].m_position.w;
+
+        float max_depth = sphere.m_centre.z + sphere.m_radius;
+        if (max_depth <= 0.f)
+        {
+            continue;
+        }
+        float min_depth = sphere.m_centre.z - sphere.m_radius;
+
+        float first_slice = min_depth > 0.f ? std::floor(std::log(min_depth) * m_slice_scale + m_slice_bias) : 0.f;
+        float last_slice = std::floor(std::log(max_depth) * m_slice_scale + m_slice_bias);
+        if (last_slice < 0.f || first_slice >= float(clusters_z))
+        {
+            continue;
+        }
+
+        unsigned int last = std::min(static_cast<unsigned int>(last_slice), clusters_z - 1);
+        for (unsigned int slice = static_cast<unsigned int>(std::max(first_slice, 0.f)); slice <= last; ++slice)
+        {
+            m_slice_lights[slice].push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    pool.parallel_for(clusters_z, 1, [this](size_t begin, size_t end)
+        {
+            for (size_t slice = begin; slice < end; ++slice)
+            {
+                assign_slice(static_cast<unsigned int>(slice));
+            }
+        });
+
+    // Stitch the slice lists together, offsets so far are relative to their own slice
+    m_light_indices.clear();
+    m_max_cluster_lights = 0;
+    for (unsigned int slice = 0; slice < clusters_z; ++slice)
+    {
+        uint32_t base = static_cast<uint32_t>(m_light_indices.size());
+        m_light_indices.insert(m_light_indices.end(), m_slice_indices[slice].begin(), m_slice_indices[slice].end());
+
+        for (unsigned int cluster = slice * clusters_x * clusters_y; cluster < (slice + 1) * clusters_x * clusters_y; ++cluster)
+        {
+            m_cluster_lights[cluster].x += base;
+            m_max_cluster_lights = std::max(m_max_cluster_lights, m_cluster_lights[cluster].y);
+        }
+    }
+
+    m_light_buffer.update(lights.data(), lights.size() * sizeof(local_light_data));
+    m_cluster_buffer.update(m_cluster_lights.data(), m_cluster_lights.size() * sizeof(glm::uvec2));
+    m_index_buffer.update(m_light_indices.data(), m_light_indices.size() * sizeof(uint32_t));
+}
+
+void light_clusters::assign_slice(unsigned int slice)
+{
+    const std::vector<uint32_t>& slice_lights = m_slice_lights[slice];
+    std::vector<uint32_t>& indices = m_slice_indices[slice];
+    indices.clear();
+
+    const glm::vec2* columns = &m_column_extents[slice * clusters_x];
+    const glm::vec2* rows = &m_row_extents[slice * clusters_y];
+
+    // Column/row range [x0, x1) [y0, y1) of each light in this slice, columns and rows are monotonic so a scan from each end will do
+    std::vector<glm::uvec4> ranges(slice_lights.size());
+    for (size_t i = 0; i < slice_lights.size(); ++i)
+    {
+        const light_sphere& sphere = m_spheres[slice_lights[i]];
+        glm::uvec4& range = ranges[i];
+
+        range.x = 0;
+        while (range.x < clusters_x && columns[range.x].y < sphere.m_centre.x - sphere.m_radius)
+        {
+            ++range.x;
+        }
+        range.y = clusters_x;
+        while (range.y > 0 && columns[range.y - 1].x > sphere.m_centre.x + sphere.m_radius)
+        {
+            --range.y;
+        }
+
+        range.z = 0;
+        while (range.z < clusters_y && rows[range.z].y < sphere.m_centre.y - sphere.m_radius)
+        {
+            ++range.z;
+        }
+        range.w = clusters_y;
+        while (range.w > 0 && rows[range.w - 1].x > sphere.m_centre.y + sphere.m_radius)
+        {
+            --range.w;
+        }
+    }
+
+    for (unsigned int y = 0; y < clusters_y; ++y)
+    {
+        for (unsigned int x = 0; x < clusters_x; ++x)
+        {
+            unsigned int cluster = x + clusters_x * (y + clusters_y * slice);
+            const cluster_bounds& bounds = m_bounds[cluster];
+            m_cluster_lights[cluster] = glm::uvec2(static_cast<uint32_t>(indices.size()), 0);
+
+            for (size_t i = 0; i < slice_lights.size(); ++i)
+            {
+                const glm::uvec4& range = ranges[i];
+                if (x < range.x || x >= range.y || y < range.z || y >= range.w)
+                {
+                    continue;
+                }
+
+                const light_sphere& sphere = m_spheres[slice_lights[i]];
+                glm::vec3 closest = glm::clamp(sphere.m_centre, bounds.m_min, bounds.m_max);
+                glm::vec3 offset = closest - sphere.m_centre;
+                if (glm::dot(offset, offset) <= sphere.m_radius * sphere.m_radius)
+                {
+                    indices.push_back(slice_lights[i]);
+                    ++m_cluster_lights[cluster].y;
+                }
+            }
+        }
+    }
+}
+
+void light_clusters::load_to_buffer(light_uniforms& uniforms) const
+{
+    uniforms.m_cluster_dimensions = glm::uvec4(clusters_x, clusters_y, clusters_z, 0);
+    uniforms.m_cluster_params = glm::vec4(m_slice_scale, m_slice_bias, m_tile_size);
+}
+
+void light_clusters::bind(gl_state& state) const
+{
+    m_light_buffer.bind(state, local_light_buffer_unit);
+    m_cluster_buffer.bind(state, cluster_lights_unit);
+    m_index_buffer.bind(state, light_indices_unit);
+}
+
+void light_clusters::free()
+{
+    m_light_buffer.free();
+    m_cluster_buffer.free();
+    m_index_buffer.free();
+}
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "gl_state.h"
+#include "texel_buffer.h"
+#include "uniform_buffer.h"
+
+class thread_pool;
+
+namespace slam_renderer
+{
+// Texture units the clustered lighting buffers are bound to for the whole opaque pass
+static const unsigned int local_light_buffer_unit = 3;
+static const unsigned int cluster_lights_unit = 4;
+static const unsigned int light_indices_unit = 5;
+
+// Point and spot lights, fetched as consecutive RGBA32F texels in lit_fragment.glsl (LOCAL_LIGHT_TEXELS)
+struct local_light_data
+{
+    glm::vec4 m_position; // w range, nothing is lit past it
+    glm::vec4 m_ambient; // w type, 0 point 1 spot
+    glm::vec4 m_diffuse; // w shadow atlas tile (spot) or cube slot (point), -1 without one
+    glm::vec4 m_specular;
+    glm::vec4 m_attenuation; // constant, linear, quadratic, w spot inner angle cos
+    glm::vec4 m_direction; // spot only, w outer angle cos (point shadow near plane for point lights)
+};
+
+// Clustered forward lighting. The view frustum is split into a grid of screen tiles by exponential depth slices,
+// every local light is assigned to the clusters its range overlaps and fragments only shade the lights of their
+// own cluster. Assignment runs on the CPU over the thread pool, one z slice per job
+class light_clusters
+{
+public:
+    static const unsigned int clusters_x = 16;
+    static const unsigned int clusters_y = 9;
+    static const unsigned int clusters_z = 24;
+    static const unsigned int cluster_count = clusters_x * clusters_y * clusters_z;
+
+    void init(gl_state& state);
+
+    // Cluster bounds are only rebuilt when the projection or resolution changes
+    void update(const glm::mat4& view, const glm::mat4& projection, int width, int height, const std::vector<local_light_data>& lights, thread_pool& pool);
+
+    // Grid dimensions and depth slicing for the shader to find its cluster
+    void load_to_buffer(light_uniforms& uniforms) const;
+
+    void bind(gl_state& state) const;
+
+    void free();
+
+    // Light references across every cluster from the last update
+    size_t get_light_reference_count() const
+    {
+        return m_light_indices.size();
+    }
+
+    unsigned int get_max_cluster_lights() const
+    {
+        return m_max_cluster_lights;
+    }
+
+private:
+    void build_cluster_bounds(const glm::mat4& projection, int width, int height);
+    void assign_slice(unsigned int slice);
+
+    struct cluster_bounds
+    {
+        glm::vec3 m_min;
+        glm::vec3 m_max;
+    };
+
+    // View space light spheres, z is positive depth
+    struct light_sphere
+    {
+        glm::vec3 m_centre;
+        float m_radius;
+    };
+
+    glm::mat4 m_projection = glm::mat4(0.f);
+    int m_width = 0;
+    int m_height = 0;
+    glm::vec2 m_tile_size;
+    float m_slice_scale = 0.f;
+    float m_slice_bias = 0.f;
+
+    // View space (positive depth) bounds of every cluster, x fastest then y then z
+    std::vector<cluster_bounds> m_bounds;
+    // Per slice x extent of each column and y extent of each row, used to narrow down which clusters a light can touch
+    std::vector<glm::vec2> m_column_extents;
+    std::vector<glm::vec2> m_row_extents;
+
+    std::vector<light_sphere> m_spheres;
+    std::vector<std::vector<uint32_t>> m_slice_lights;
+    // Each slice job writes its own index list with slice relative offsets, stitched together afterwards
+    std::vector<std::vector<uint32_t>> m_slice_indices;
+
+    // Offset into m_light_indices and light count per cluster
+    std::vector<glm::uvec2> m_cluster_lights;
+    std::vector<uint32_t> m_light_indices;
+    unsigned int m_max_cluster_lights = 0;
+
+    texel_buffer m_light_buffer;
+    texel_buffer m_cluster_buffer;
+    texel_buffer m_index_buffer;
+};
+}
@@ -2,152 +2,152 @@
 
 #include "renderer.h"
 
-#include <format>
-
-#define MAX_NUM_POINT_LIGHTS 4
-
 namespace slam_renderer
 {
-material::material(std::shared_ptr<shader> shader, std::shared_ptr<texture> texture, float shininess, glm::vec3 albedo, glm::vec3 specular)
+material::material(shader_handle shader, texture_handle texture, float shininess, glm::vec3 albedo, glm::vec3 specular)
     : m_shader(shader)
     , m_albedo_texture(texture)
     , m_albedo(albedo)
     , m_specular(specular)
     , m_shininess(shininess)
 {
-    m_shader->use();
-    if (m_albedo_texture != nullptr)
+    renderer* renderer = renderer::get_instance();
+    slam_renderer::shader* material_shader = renderer->get_shader(m_shader);
+    m_shader_type = material_shader->get_type();
+
+    m_pipeline_state.m_program = material_shader->m_id;
+    // Depth only passes only fetch the position stream
+    const geometry_arena& arena = renderer->get_geometry_arena();
+    m_pipeline_state.m_vertex_array = is_depth_only() ? arena.get_position_vertex_array() : arena.get_vertex_array();
+    if (m_shader_type == shader_type::unlit_cube)
     {
-        std::string uniform = "u_material.albedo_texture";
-        if (m_shader->get_type() == shader_type::unlit_cube)
-        {
-            uniform = "skybox";
-        }
-        int albedo = glGetUniformLocation(m_shader->m_id, uniform.c_str());
+        // Drawn at the far plane after everything else
+        m_pipeline_state.m_depth_func = compare_func::less_equal;
+    }
+    else if (m_shader_type == shader_type::depth_prepass)
+    {
+        // Shares the colour target with the lit pass, only depth is written
+        m_pipeline_state.m_colour_write = false;
+    }
+
+    m_sample_albedo_uniform = material_shader->find_uniform<bool>("u_material.sample_albedo");
+    m_sample_specular_uniform = material_shader->find_uniform<bool>("u_material.sample_specular");
+    m_albedo_uniform = material_shader->find_uniform<glm::vec3>("u_material.albedo");
+    m_specular_uniform = material_shader->find_uniform<glm::vec3>("u_material.specular");
+    m_shininess_uniform = material_shader->find_uniform<float>("u_material.shininess");
+    m_light_space_matrix_uniform = material_shader->find_uniform<glm::mat4>("light_space_matrix");
+
+    material_shader->use();
 
-        if (albedo == -1)
+    // Every shader drawing from the arena decodes its vertices, the skybox and depth passes included
+    uniform<int> vertex_decode = material_shader->find_uniform<int>("u_vertex_decode");
+    if (vertex_decode.is_valid())
+    {
+        material_shader->set(vertex_decode, int(vertex_decode_unit));
+    }
+
+    if (m_albedo_texture.is_valid())
+    {
+        uniform<int> albedo = m_shader_type == shader_type::unlit_cube
+            ? material_shader->find_uniform<int>("skybox")
+            : material_shader->find_uniform<int>("u_material.albedo_texture");
+
+        if (!albedo.is_valid())
         {
             std::cout << "ERROR::MATERIAL::COULD NOT SET ALBEDO TEXTURE EVEN THOUGH TEXTURE IS DEFINED: " << std::endl;
             return;
         }
-        glUniform1i(albedo, 0);
+        material_shader->set(albedo, 0);
     }
 
-    if (m_shader->get_type() == shader_type::lit)
+    if (m_shader_type == shader_type::lit)
     {
-        int shadow_map = glGetUniformLocation(m_shader->m_id, "u_shadow_map");
-        if (shadow_map == -1)
+        uniform<int> shadow_atlas = material_shader->find_uniform<int>("u_shadow_atlas");
+        if (!shadow_atlas.is_valid())
         {
-            std::cout << "ERROR::MATERIAL::COULD NOT SET SHADOW MAP SAMPLER: " << std::endl;
+            std::cout << "ERROR::MATERIAL::COULD NOT SET SHADOW ATLAS SAMPLER: " << std::endl;
             return;
         }
-        glUniform1i(shadow_map, 2);
+        material_shader->set(shadow_atlas, int(shadow_atlas_unit));
+        material_shader->set(material_shader->find_uniform<int>("u_point_shadows"), int(point_shadow_unit));
+
+        material_shader->set(material_shader->find_uniform<int>("u_local_lights"), int(local_light_buffer_unit));
+        material_shader->set(material_shader->find_uniform<int>("u_cluster_lights"), int(cluster_lights_unit));
+        material_shader->set(material_shader->find_uniform<int>("u_light_indices"), int(light_indices_unit));
     }
 }
 
-void material::use(glm::mat4 transform)
+void material::set_specular_map(texture_handle texture)
 {
-    m_shader->use();
+    m_specular_map = texture;
 
-    // TODO don't know if we need to do this every frame - only if there is a different texture loaded?
-    if (m_albedo_texture != nullptr)
-    {
-        glActiveTexture(GL_TEXTURE0);
+    slam_renderer::shader* material_shader = renderer::get_instance()->get_shader(m_shader);
+    material_shader->use();
+    uniform<int> specular = material_shader->find_uniform<int>("u_material.specular_map");
 
-        m_albedo_texture->bind();
-        if (m_shader->get_type() == shader_type::lit)
-        {
-            m_shader->set_bool("u_material.sample_albedo", true);
-        }
-    }
-    else if(m_shader->get_type() != shader_type::shadow_pass)
+    if (!specular.is_valid())
     {
-        m_shader->set_bool("u_material.sample_albedo", false);
+        std::cout << "ERROR::MATERIAL::COULD NOT SET SPECULAR MAP EVEN THOUGH TEXTURE IS DEFINED " << std::endl;
+        return;
     }
+    material_shader->set(specular, 1);
+}
 
-    if (m_specular_map != nullptr)
-    {
-        glActiveTexture(GL_TEXTURE1);
-        m_specular_map->bind();
-        m_shader->set_bool("u_material.sample_specular", true);
-    }
-    else if(m_shader->get_type() != shader_type::shadow_pass)
+material material::make_variant(shader_handle shader) const
+{
+    material variant(shader, m_albedo_texture, m_shininess, m_albedo, m_specular);
+    if (m_specular_map.is_valid())
     {
-        m_shader->set_bool("u_material.sample_specular", false);
+        variant.set_specular_map(m_specular_map);
     }
+    variant.set_name(m_name.empty() ? m_name : m_name + "::variant");
+    return variant;
+}
 
+void material::bind()
+{
     renderer* renderer = renderer::get_instance();
+    slam_renderer::shader* material_shader = renderer->get_shader(m_shader);
 
-    if (m_shader->get_type() != shader_type::unlit_cube && m_shader->get_type() != shader_type::shadow_pass)
+    // TODO don't know if we need to do this every frame - only if there is a different texture loaded?
+    if (m_albedo_texture.is_valid())
     {
-        m_shader->set_vec3("u_camera_position", renderer::get_instance()->get_camera()->get_position());
-        m_shader->set_vec3("u_material.albedo", m_albedo);
-        m_shader->set_mat4("transform", transform);
-        m_shader->set_mat4("view", renderer->get_view());
-
-        m_shader->set_vec3("u_material.albedo", m_albedo);
+        renderer->get_texture(m_albedo_texture)->bind(0);
+        if (has_lit_inputs())
+        {
+            material_shader->set(m_sample_albedo_uniform, true);
+        }
     }
-    else if(m_shader->get_type() != shader_type::shadow_pass)
+    else if(!is_depth_only())
     {
-        glm::mat4 view = glm::mat4(glm::mat3(renderer->get_view()));
-        m_shader->set_mat4("view", view);
-        
+        material_shader->set(m_sample_albedo_uniform, false);
     }
-    if (m_shader->get_type() != shader_type::shadow_pass)
+
+    if (m_specular_map.is_valid())
     {
-        m_shader->set_mat4("projection", renderer->get_projection());
+        renderer->get_texture(m_specular_map)->bind(1);
+        material_shader->set(m_sample_specular_uniform, true);
+    }
+    else if(!is_depth_only())
+    {
+        material_shader->set(m_sample_specular_uniform, false);
     }
 
-    if (m_shader->get_type() == shader_type::shadow_pass)
+    // Camera view/projection and lights come from the per-frame uniform blocks
+    if (m_shader_type != shader_type::unlit_cube && !is_depth_only())
     {
-        glm::mat4 light_space_matrix;
-        light_space_matrix = renderer->get_current_pass_directional_light()->get_light_space_matrix();
-        m_shader->set_mat4("transform", transform);
-        m_shader->set_mat4("light_space_matrix", light_space_matrix);
+        material_shader->set(m_albedo_uniform, m_albedo);
     }
 
-    if (m_shader->get_type() == shader_type::lit)
+    if (m_shader_type == shader_type::shadow_pass)
     {
-        m_shader->set_vec3("u_material.specular", m_specular);
-        m_shader->set_float("u_material.shininess", m_shininess);
-        glm::mat4 light_space_matrix;
-        light_space_matrix = renderer->get_current_pass_directional_light()->get_light_space_matrix();
-        m_shader->set_mat4("light_space_matrix", light_space_matrix);
-
-        size_t point_count = 0;
-        for (auto& light : renderer->get_lights())
-        {
-            switch (light->get_type())
-            {
-            case (light_type::directional):
-            {
-                light->load_to_shader(m_shader, "u_directional_light");
-                break;
-            }
-            case (light_type::point):
-            {
-                light->load_to_shader(m_shader, std::format("u_point_lights[{}]", point_count));
-                point_count = (point_count + 1) % MAX_NUM_POINT_LIGHTS;
-                break;
-            }
-            case (light_type::spot):
-            {
-                light->load_to_shader(m_shader, "u_spot_light");
-                break;
-            }
-            default:
-            {
-                std::cout << "ERROR::MATERIAL::LIGHT TYPE NOT SUPPORTED: " << (int)light->get_type() << std::endl;
-            }
-            }
-            
-       }
+        material_shader->set(m_light_space_matrix_uniform, renderer->get_current_shadow_matrix());
     }
-    
-}
 
-void material::post_draw()
-{
-    m_shader->post_draw();
+    if (has_lit_inputs())
+    {
+        material_shader->set(m_specular_uniform, m_specular);
+        material_shader->set(m_shininess_uniform, m_shininess);
+    }
 }
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 
 #include "texture.h"
 #include "shader.h"
+#include "handles.h"
+#include "gl_state.h"
 
 namespace slam_renderer
 {
@@ -11,41 +13,55 @@ class material
 {
 public:
     // Just use the texture and set everything else to white
-    material(std::shared_ptr<shader> shader, std::shared_ptr<texture> texture, float shininess)
+    material(shader_handle shader, texture_handle texture, float shininess)
         : material(shader, texture, shininess, glm::vec3(1.f), glm::vec3(1.f)) {};
     // Same colour for all and just use strength values
-    material(std::shared_ptr<shader> shader, std::shared_ptr<texture> texture, float shininess, glm::vec3 colour, float albedo, float specular)
+    material(shader_handle shader, texture_handle texture, float shininess, glm::vec3 colour, float albedo, float specular)
         : material(shader, texture, shininess, colour* albedo, colour* specular) {};
     // Different colours for each property
-    material(std::shared_ptr<shader> shader, std::shared_ptr<texture> texture, float shininess, glm::vec3 albedo, glm::vec3 specular);
+    material(shader_handle shader, texture_handle texture, float shininess, glm::vec3 albedo, glm::vec3 specular);
 
-    void set_specular_map(std::shared_ptr<texture> texture)
-    {
-        m_specular_map = texture;
+    void set_specular_map(texture_handle texture);
+
+    // Copy of this material's inputs drawn with a different shader
+    material make_variant(shader_handle shader) const;
 
-        m_shader->use();
-        int specular = glGetUniformLocation(m_shader->m_id, "u_material.specular_map");
+    // G-buffer twin of a lit material, drawn instead of it when deferred shading is on
+    material_handle get_deferred_variant() const
+    {
+        return m_deferred_variant;
+    }
 
-        if (specular == -1)
-        {
-            std::cout << "ERROR::MATERIAL::COULD NOT SET SPECULAR MAP EVEN THOUGH TEXTURE IS DEFINED " << std::endl;
-            return;
-        }
-        glUniform1i(specular, 1);
+    void set_deferred_variant(material_handle variant)
+    {
+        m_deferred_variant = variant;
     }
 
-    void use(glm::mat4 transform);
+    // Binds textures and all per-material uniforms, the program has to be current already (see get_pipeline_state).
+    // Only needs calling when the material changes. Transforms are not uniforms, they come from the per-instance
+    // attribute stream set up by the render queue
+    void bind();
 
-    void post_draw();
+    // Program, vertex format and depth state, cull and polygon mode are left to the pass
+    const pipeline_state& get_pipeline_state() const
+    {
+        return m_pipeline_state;
+    }
 
     void set_name(std::string name)
     {
         m_name = name;
     }
 
+    // Cached at construction so the draw path doesn't need to resolve the shader handle
     const shader_type get_shader_type() const
     {
-        return m_shader->get_type();
+        return m_shader_type;
+    }
+
+    shader_handle get_shader() const
+    {
+        return m_shader;
     }
 
     const std::string& get_name() const
@@ -53,17 +69,64 @@ public:
         return m_name;
     }
 
+    const unsigned int get_shader_sort_id() const
+    {
+        return m_shader.m_index;
+    }
+
+    const unsigned int get_sort_id() const
+    {
+        return m_sort_id;
+    }
+
+    void set_sort_id(unsigned int sort_id)
+    {
+        m_sort_id = sort_id;
+    }
+
+    // Small value identifying the combination of textures this material binds, used to group draws in the render queue
+    const unsigned int get_texture_set() const
+    {
+        unsigned int albedo = m_albedo_texture.is_valid() ? m_albedo_texture.m_index + 1 : 0;
+        unsigned int specular = m_specular_map.is_valid() ? m_specular_map.m_index + 1 : 0;
+        return (albedo * 31 + specular) & 0xFFF;
+    }
+
 private:
+    // Lit and g-buffer shaders share the lit material inputs
+    bool has_lit_inputs() const
+    {
+        return m_shader_type == shader_type::lit || m_shader_type == shader_type::gbuffer;
+    }
+
+    // Position only shaders, no material inputs at all
+    bool is_depth_only() const
+    {
+        return m_shader_type == shader_type::shadow_pass || m_shader_type == shader_type::depth_prepass || m_shader_type == shader_type::point_shadow_pass;
+    }
+
     std::string m_name;
+    unsigned int m_sort_id = 0;
     glm::vec3 m_albedo;
     glm::vec3 m_specular;
     
     float m_shininess;
 
-    std::shared_ptr<texture> m_albedo_texture = nullptr;
-    std::shared_ptr<texture> m_specular_map = nullptr;
+    texture_handle m_albedo_texture;
+    texture_handle m_specular_map;
+
+    shader_handle m_shader;
+    shader_type m_shader_type = shader_type::unlit;
+    pipeline_state m_pipeline_state;
+    material_handle m_deferred_variant;
 
-    std::shared_ptr<shader> m_shader;
+    // Resolved once from the shader's location table so bind() never looks anything up by name
+    uniform<bool> m_sample_albedo_uniform;
+    uniform<bool> m_sample_specular_uniform;
+    uniform<glm::vec3> m_albedo_uniform;
+    uniform<glm::vec3> m_specular_uniform;
+    uniform<float> m_shininess_uniform;
+    uniform<glm::mat4> m_light_space_matrix_uniform;
 };
 }
 
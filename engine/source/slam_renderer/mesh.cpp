@@ -5,86 +5,106 @@
 
 #include "renderer.h"
 
+namespace
+{
+    // A coarser lod has to be this far under the error limit before it is switched to
+    static const float lod_hysteresis = 0.75f;
+}
+
 namespace slam_renderer
 {
-mesh::mesh(vertices vertices, faces faces, std::shared_ptr<material> material, glm::mat4 transform)
-    : m_transform(transform)
-    , m_vertices(vertices)
-    , m_faces(faces)
+mesh::mesh(geometry_handle geometry, material_handle material, uint32_t node)
+    : m_node(node)
+    , m_geometry(geometry)
     , m_material(material)
 {
-    setup();
+    update_cullable();
 }
 
-void mesh::setup()
+void mesh::override_material(material_handle material)
 {
-    glGenVertexArrays(1, &m_vertex_array);
-    glBindVertexArray(m_vertex_array);
-
-    glGenBuffers(1, &m_vertex_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vertex_buffer);
-    glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(vertex), &m_vertices.front(), GL_STATIC_DRAW);
-
-    glGenBuffers(1, &m_element_buffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_element_buffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_faces.size() * sizeof(unsigned int), &m_faces.front(), GL_STATIC_DRAW);
-
-    // Vertex positions
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    // Normals
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, m_normal));
-    glEnableVertexAttribArray(1);
-
-    //// Colour
-    //glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    //glEnableVertexAttribArray(1);
-
-    // UVs
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, m_uv));
-    glEnableVertexAttribArray(2);
+    m_material = material;
+    update_cullable();
+}
 
-    // Unbind
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+void mesh::update_cullable()
+{
+    const material* mesh_material = renderer::get_instance()->get_material(m_material);
+    m_cullable = mesh_material == nullptr || mesh_material->get_shader_type() != shader_type::unlit_cube;
 }
 
-void mesh::draw(float delta, glm::mat4 parent_transform, std::shared_ptr<material> override_material)
+void mesh::enqueue(render_queue& queue, render_pass pass, mesh_geometry* geometry, material* mesh_material, material* deferred_material,
+    const glm::mat4& world_transform, const glm::vec3& eye, material* override_material, unsigned int lod_bias) const
 {
-    //animate first
-    //m_transform = glm::rotate(m_transform, delta * glm::radians(90.f), glm::vec3(0.5f, 1.0f, 0.0f));
+    float depth = glm::distance(eye, glm::vec3(world_transform * glm::vec4(geometry->get_bounds().get_centre(), 1.f)));
+    unsigned int lod = std::min(m_lod + lod_bias, geometry->get_lod_count() - 1);
 
     if (override_material == nullptr)
     {
-        m_material->use(parent_transform * m_transform);
+        // Lit materials go through the g-buffer instead of the forward pass when deferred shading is on
+        if (pass == render_pass::gbuffer)
+        {
+            if (deferred_material != nullptr)
+            {
+                queue.push(pass, geometry, deferred_material, world_transform, depth, lod);
+            }
+            return;
+        }
+        if (deferred_material != nullptr)
+        {
+            return;
+        }
+
+        if (mesh_material->get_shader_type() == shader_type::unlit_cube)
+        {
+            pass = render_pass::skybox;
+        }
+        queue.push(pass, geometry, mesh_material, world_transform, depth, lod);
     }
     else
     {
-        if (override_material->get_shader_type() == shader_type::shadow_pass && m_material->get_shader_type() == shader_type::unlit_cube)
+        // The skybox is drawn at the far plane, it never needs to be in the pre-pass. Shadow passes have already
+        // left it out (see is_shadow_caster)
+        if (override_material->get_shader_type() == shader_type::depth_prepass && mesh_material->get_shader_type() == shader_type::unlit_cube)
         {
             return;
         }
-        override_material->use(parent_transform * m_transform);
+        queue.push(pass, geometry, override_material, world_transform, depth, lod);
     }
+}
 
-    glBindVertexArray(m_vertex_array);
-    glDrawElements(GL_TRIANGLES, GLsizei(m_faces.size()), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+bool mesh::update_lod(const mesh_geometry& geometry, float pixel_radius, float max_pixel_error)
+{
+    unsigned int lod = 0;
+    for (unsigned int candidate = geometry.get_lod_count() - 1; candidate > 0; --candidate)
+    {
+        float limit = candidate > m_lod ? max_pixel_error * lod_hysteresis : max_pixel_error;
+        if (geometry.get_lod_error(candidate) * pixel_radius <= limit)
+        {
+            lod = candidate;
+            break;
+        }
+    }
+    bool changed = lod != m_lod;
+    m_lod = static_cast<uint8_t>(lod);
+    return changed;
+}
 
-    if (override_material == nullptr)
+bool mesh::is_shadow_caster(shadow_casters casters) const
+{
+    if (!m_casts_shadows || !m_cullable)
     {
-        m_material->post_draw();
+        return false;
     }
-    else
+
+    switch (casters)
     {
-        override_material->post_draw();
+    case shadow_casters::static_only:
+        return m_static;
+    case shadow_casters::dynamic_only:
+        return !m_static;
+    default:
+        return true;
     }
 }
-
-void mesh::free()
-{
-    glDeleteVertexArrays(1, &m_vertex_array);
-    glDeleteBuffers(1, &m_vertex_buffer);
 }
-}
\ No newline at end of file
@@ -4,48 +4,125 @@
 #include <glm/glm.hpp>
 
 #include "material.h"
+#include "render_queue.h"
+#include "bounds.h"
+#include "mesh_geometry.h"
+#include "handles.h"
 
 namespace slam_renderer
 {
 class renderer;
 
-struct vertex
+// Which shadow casters a shadow pass draws
+enum class shadow_casters : uint8_t
 {
-    glm::vec3 m_position;
-    glm::vec3 m_normal;
-    glm::vec2 m_uv;
+    all,
+    static_only,
+    dynamic_only
 };
 
-typedef std::vector<vertex> vertices;
-typedef std::vector<unsigned int> faces;
+// Whether a mesh is rasterized into the software occlusion buffer
+enum class occluder_mode : uint8_t
+{
+    automatic, // When it covers enough of the screen
+    always,
+    never
+};
 
+// Node of an imported model's hierarchy, parents always come before their children
+struct mesh_node
+{
+    static const uint32_t no_parent = ~0u;
+
+    uint32_t m_parent = no_parent;
+    glm::mat4 m_transform = glm::mat4(1.f);
+};
+
+// A placement of shared mesh_geometry with its own material, cheap to copy so every model instance has its own
 class mesh
 {
 public:
-    mesh(vertices vertices, faces faces, std::shared_ptr<material> material, glm::mat4 transform);
+    mesh(geometry_handle geometry, material_handle material, uint32_t node);
+
+    // Pushes this mesh into the queue for the given pass, depth is measured from eye to the centre of the bounds.
+    // Drawn at the current lod plus lod_bias levels coarser. geometry and mesh_material are this mesh's, resolved by
+    // the renderer, deferred_material is mesh_material's deferred variant and only given while deferred shading is on
+    void enqueue(render_queue& queue, render_pass pass, mesh_geometry* geometry, material* mesh_material, material* deferred_material,
+        const glm::mat4& world_transform, const glm::vec3& eye, material* override_material = nullptr, unsigned int lod_bias = 0) const;
 
-    void draw(float delta, glm::mat4 parent_transform, std::shared_ptr<material> override_material = nullptr);
+    // Picks the coarsest of geometry's lods whose error stays under max_pixel_error when the bounding sphere is
+    // pixel_radius pixels across on screen. Moving to a coarser lod needs some margin so it doesn't flicker on the
+    // threshold. True when the lod changed. Runs on the renderer's workers so it only touches what it's given
+    bool update_lod(const mesh_geometry& geometry, float pixel_radius, float max_pixel_error);
 
-    void setup();
+    unsigned int get_lod() const
+    {
+        return m_lod;
+    }
 
-    void free();
+    void override_material(material_handle material);
 
-    void override_material(std::shared_ptr<material> material)
+    geometry_handle get_geometry() const
     {
-        m_material = material;
+        return m_geometry;
     }
 
-private:
-    glm::mat4 m_transform;
+    material_handle get_material() const
+    {
+        return m_material;
+    }
+
+    // Index into the owning model's nodes
+    uint32_t get_node() const
+    {
+        return m_node;
+    }
 
-    vertices m_vertices;
-    faces m_faces;
+    // Skyboxes are drawn around the camera so their bounds mean nothing
+    bool is_cullable() const
+    {
+        return m_cullable;
+    }
 
-    unsigned int m_vertex_array;
-    unsigned int m_vertex_buffer;
-    unsigned int m_element_buffer;
+    // Skyboxes never cast shadows whatever the flag says
+    bool is_shadow_caster(shadow_casters casters = shadow_casters::all) const;
 
-    std::shared_ptr<material> m_material;
+    // Use renderer::set_model_shadow_flags so cached shadows get invalidated
+    void set_shadow_flags(bool casts_shadows, bool is_static)
+    {
+        m_casts_shadows = casts_shadows;
+        m_static = is_static;
+    }
+
+    // Only meshes small enough to keep an occluder_geometry can be occluders whatever the mode
+    void set_occluder_mode(occluder_mode mode)
+    {
+        m_occluder_mode = mode;
+    }
+
+    occluder_mode get_occluder_mode() const
+    {
+        return m_occluder_mode;
+    }
+
+    // Static meshes are expected to (almost) never move, their shadows are cached
+    bool is_static() const
+    {
+        return m_static;
+    }
+
+private:
+    void update_cullable();
+
+    uint32_t m_node = 0;
+    bool m_casts_shadows = true;
+    bool m_static = false;
+    occluder_mode m_occluder_mode = occluder_mode::automatic;
+    uint8_t m_lod = 0;
+    // Kept from the material so per-candidate checks don't have to look it up
+    bool m_cullable = true;
+
+    geometry_handle m_geometry;
+    material_handle m_material;
 };
 }
-
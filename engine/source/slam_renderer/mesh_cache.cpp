@@ -0,0 +1,75 @@
+#include "mesh_cache.h"
+
+#include <fstream>
+#include <iostream>
+
+#include <slam_utils/hash/fnv1a.h>
+
+namespace slam_renderer
+{
+const mesh_cache::entry* mesh_cache::find(const std::string& path, unsigned int shader_index)
+{
+    // Anything added was hashed first, a path without a hash for its current write time can't have an entry
+    std::error_code error;
+    std::filesystem::file_time_type write_time = std::filesystem::last_write_time(path, error);
+    auto file = m_files.find(path);
+    if (error || file == m_files.end() || file->second.m_write_time != write_time)
+    {
+        return nullptr;
+    }
+
+    if (auto it = m_entries.find({ path, file->second.m_content_hash, shader_index }); it != m_entries.end())
+    {
+        std::cout << "MODEL::CACHE HIT: " << path << std::endl;
+        return &it->second;
+    }
+    return nullptr;
+}
+
+void mesh_cache::add(const std::string& path, unsigned int shader_index, const std::vector<mesh_node>& nodes, const std::vector<mesh>& meshes)
+{
+    uint64_t content_hash = get_content_hash(path);
+    if (content_hash == 0 || meshes.empty())
+    {
+        return;
+    }
+
+    m_entries[{ path, content_hash, shader_index }] = { nodes, meshes };
+}
+
+void mesh_cache::free()
+{
+    // The geometry itself lives in the renderer's pool and is freed with it
+    m_entries.clear();
+    m_files.clear();
+}
+
+uint64_t mesh_cache::get_content_hash(const std::string& path)
+{
+    std::error_code error;
+    std::filesystem::file_time_type write_time = std::filesystem::last_write_time(path, error);
+    if (error)
+    {
+        std::cout << "ERROR::MODEL::CACHE COULD NOT STAT: " << path << std::endl;
+        return 0;
+    }
+
+    if (auto it = m_files.find(path); it != m_files.end() && it->second.m_write_time == write_time)
+    {
+        return it->second.m_content_hash;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    // Mix the size in so an empty file doesn't hash to the sentinel
+    uint64_t content_hash = fnv1a(contents.data(), contents.size(), fnv1a_offset_basis ^ contents.size());
+    m_files[path] = { write_time, content_hash };
+    return content_hash;
+}
+
+void mesh_cache::set_content_hash(const std::string& path, std::filesystem::file_time_type write_time, uint64_t content_hash)
+{
+    m_files[path] = { write_time, content_hash };
+}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "mesh.h"
+
+namespace slam_renderer
+{
+// Imported models (node hierarchy + meshes referencing shared geometry and default materials) keyed by their source
+// path, its content hash and the shader their default materials were made with, so a model is only imported and
+// uploaded once while it's unchanged. A copy in another directory resolves its materials and textures against its
+// own directory so it isn't shared. Hashes are cached per path and only recomputed when the file's write time changes
+class mesh_cache
+{
+public:
+    struct entry
+    {
+        std::vector<mesh_node> m_nodes;
+        std::vector<mesh> m_meshes;
+    };
+
+    // nullptr if the file hasn't been imported yet or has changed since it was. Never reads the file, a hash is only
+    // used while the file keeps the write time it was taken at
+    const entry* find(const std::string& path, unsigned int shader_index);
+
+    void add(const std::string& path, unsigned int shader_index, const std::vector<mesh_node>& nodes, const std::vector<mesh>& meshes);
+
+    void free();
+
+    // 0 if the file can't be read
+    uint64_t get_content_hash(const std::string& path);
+
+    // For a hash known without reading the file, e.g. from a bake whose source still has the same write time
+    void set_content_hash(const std::string& path, std::filesystem::file_time_type write_time, uint64_t content_hash);
+
+private:
+    struct file_entry
+    {
+        std::filesystem::file_time_type m_write_time;
+        uint64_t m_content_hash = 0;
+    };
+
+    std::unordered_map<std::string, file_entry> m_files;
+    struct entry_key
+    {
+        std::string m_path;
+        uint64_t m_content_hash = 0;
+        unsigned int m_shader_index = 0;
+
+        bool operator<(const entry_key& other) const
+        {
+            return std::tie(m_path, m_content_hash, m_shader_index) < std::tie(other.m_path, other.m_content_hash, other.m_shader_index);
+        }
+    };
+
+    std::map<entry_key, entry> m_entries;
+};
+}
@@ -0,0 +1,81 @@
+#include "mesh_geometry.h"
+
+#include <algorithm>
+
+#include "renderer.h"
+#include "vertex_format.h"
+
+namespace
+{
+    unsigned int next_geometry_id = 0;
+}
+
+namespace slam_renderer
+{
+mesh_geometry::mesh_geometry(const vertices& vertices, const faces& faces, aabb bounds, const std::vector<lod_faces>& lods)
+{
+    packed_storage storage;
+    init(pack_geometry(vertices, faces, bounds, lods, storage));
+}
+
+mesh_geometry::mesh_geometry(const packed_geometry& geometry)
+{
+    init(geometry);
+}
+
+void mesh_geometry::init(const packed_geometry& geometry)
+{
+    m_bounds = geometry.m_bounds;
+    m_bounding_sphere = geometry.m_bounding_sphere;
+
+    geometry_arena& arena = renderer::get_instance()->get_geometry_arena();
+    m_lod_allocations[0] = arena.allocate(geometry.m_positions, geometry.m_attributes, geometry.m_vertex_count, geometry.m_decode,
+        geometry.m_indices[0], geometry.m_index_counts[0], geometry.m_index_type);
+    m_id = next_geometry_id++;
+
+    for (unsigned int lod = 1; lod < geometry.m_lod_count && lod < max_lod_count; ++lod)
+    {
+        m_lod_allocations[lod] = arena.allocate_lod(m_lod_allocations[0], geometry.m_indices[lod], geometry.m_index_counts[lod]);
+        m_lod_errors[lod] = m_bounding_sphere.m_radius > 0.f ? geometry.m_lod_errors[lod] / m_bounding_sphere.m_radius : 0.f;
+        ++m_lod_count;
+    }
+
+    // Decoded back from the packed data so it matches what the GPU draws
+    if (geometry.m_index_counts[0] / 3 <= max_occluder_triangles)
+    {
+        glm::vec3 offset = glm::vec3(geometry.m_decode.m_position_offset);
+        glm::vec3 scale = glm::vec3(geometry.m_decode.m_position_scale) / 65535.f;
+
+        m_occluder.m_positions.reserve(geometry.m_vertex_count);
+        for (uint32_t i = 0; i < geometry.m_vertex_count; ++i)
+        {
+            const uint16_t* position = geometry.m_positions[i].m_position;
+            m_occluder.m_positions.push_back(offset + glm::vec3(position[0], position[1], position[2]) * scale);
+        }
+
+        m_occluder.m_faces.resize(geometry.m_index_counts[0]);
+        if (geometry.m_index_type == index_type::uint16)
+        {
+            std::copy_n(static_cast<const uint16_t*>(geometry.m_indices[0]), m_occluder.m_faces.size(), m_occluder.m_faces.begin());
+        }
+        else
+        {
+            std::copy_n(static_cast<const uint32_t*>(geometry.m_indices[0]), m_occluder.m_faces.size(), m_occluder.m_faces.begin());
+        }
+    }
+}
+
+void mesh_geometry::free()
+{
+    geometry_arena& arena = renderer::get_instance()->get_geometry_arena();
+    for (unsigned int lod = 1; lod < m_lod_count; ++lod)
+    {
+        arena.release_lod(m_lod_allocations[lod]);
+        m_lod_allocations[lod] = {};
+    }
+    arena.release(m_lod_allocations[0]);
+    m_lod_allocations[0] = {};
+    m_lod_count = 1;
+    m_occluder = {};
+}
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include <slam_utils/memory/free_list_allocator.h>
+
+#include "bounds.h"
+
+namespace slam_renderer
+{
+struct packed_geometry;
+
+struct vertex
+{
+    glm::vec3 m_position;
+    glm::vec3 m_normal;
+    glm::vec2 m_uv;
+};
+
+typedef std::vector<vertex> vertices;
+typedef std::vector<unsigned int> faces;
+
+// mat4 per-instance transform takes up 4 consecutive attribute slots
+static const unsigned int instance_transform_location = 3;
+
+// Full detail plus up to four simplified index lists
+static const unsigned int max_lod_count = 5;
+
+// A simplified index list over the same vertices as the full detail mesh, error is how far it strays from the full
+// detail surface in the mesh's units
+struct lod_faces
+{
+    faces m_faces;
+    float m_error = 0.f;
+};
+
+// Meshes with more triangles than this cost more to rasterize on the CPU than they could save as occluders
+static const unsigned int max_occluder_triangles = 4096;
+
+// CPU side copy of a mesh's triangles for the software occlusion buffer, positions only
+struct occluder_geometry
+{
+    std::vector<glm::vec3> m_positions;
+    faces m_faces;
+};
+
+enum class index_type : uint8_t
+{
+    uint16,
+    uint32
+};
+
+inline unsigned int get_index_size(index_type type)
+{
+    return type == index_type::uint16 ? 2 : 4;
+}
+
+// Where a mesh lives inside the geometry_arena's shared buffers, offsets are in vertices/indices not bytes.
+// first index counts in indices of the allocation's own type
+struct geometry_allocation
+{
+    uint32_t m_base_vertex = free_list_allocator::invalid_offset;
+    uint32_t m_vertex_count = 0;
+    uint32_t m_first_index = free_list_allocator::invalid_offset;
+    uint32_t m_index_count = 0;
+    index_type m_index_type = index_type::uint32;
+
+    bool is_valid() const
+    {
+        return m_base_vertex != free_list_allocator::invalid_offset && m_first_index != free_list_allocator::invalid_offset;
+    }
+};
+
+// Immutable vertex/index ranges of the renderer's geometry_arena for a single imported mesh. Shared between
+// every model instance that uses it. Levels of detail are extra index ranges over the same vertices
+class mesh_geometry
+{
+public:
+    // Packs the vertices and faces first
+    mesh_geometry(const vertices& vertices, const faces& faces, aabb bounds, const std::vector<lod_faces>& lods = {});
+    // Uploads straight from the views, nothing is kept pointing into them
+    explicit mesh_geometry(const packed_geometry& geometry);
+
+    // Returns the ranges to the arena
+    void free();
+
+    // Sort id, meshes uploaded together get neighbouring ids
+    const unsigned int get_id() const
+    {
+        return m_id;
+    }
+
+    const geometry_allocation& get_allocation(unsigned int lod = 0) const
+    {
+        return m_lod_allocations[lod];
+    }
+
+    unsigned int get_lod_count() const
+    {
+        return m_lod_count;
+    }
+
+    // Relative to the bounding sphere radius so it holds for any uniform scale
+    float get_lod_error(unsigned int lod) const
+    {
+        return m_lod_errors[lod];
+    }
+
+    const aabb& get_bounds() const
+    {
+        return m_bounds;
+    }
+
+    const bounding_sphere& get_bounding_sphere() const
+    {
+        return m_bounding_sphere;
+    }
+
+    // nullptr when the mesh has too many triangles to be an occluder
+    const occluder_geometry* get_occluder() const
+    {
+        return m_occluder.m_faces.empty() ? nullptr : &m_occluder;
+    }
+
+private:
+    void init(const packed_geometry& geometry);
+
+    aabb m_bounds;
+    bounding_sphere m_bounding_sphere;
+
+    geometry_allocation m_lod_allocations[max_lod_count];
+    float m_lod_errors[max_lod_count] = {};
+    unsigned int m_lod_count = 1;
+    unsigned int m_id = 0;
+
+    occluder_geometry m_occluder;
+};
+}
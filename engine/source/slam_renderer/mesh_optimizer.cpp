@@ -0,0 +1,390 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+namespace
+{
+    // Forsyth's scoring, the cache is modelled as LRU of this size
+    static const unsigned int scoring_cache_size = 32;
+    static const float cache_decay_power = 1.5f;
+    static const float last_triangle_score = 0.75f;
+    static const float valence_boost_scale = 2.f;
+    static const float valence_boost_power = 0.5f;
+
+    // Cache position -1 is not in the cache, remaining_valence is how many triangles still need the vertex
+    float get_vertex_score(int cache_position, unsigned int remaining_valence)
+    {
+        if (remaining_valence == 0)
+        {
+            return -1.f;
+        }
+
+        float score = 0.f;
+        if (cache_position >= 0)
+        {
+            // The last triangle's vertices get a fixed score so the next one isn't biased towards any of its edges
+            if (cache_position < 3)
+            {
+                score = last_triangle_score;
+            }
+            else
+            {
+                score = std::pow(1.f - float(cache_position - 3) / float(scoring_cache_size - 3), cache_decay_power);
+            }
+        }
+
+        // Vertices with few triangles left are finished off before they fall out of the cache
+        return score + valence_boost_scale * std::pow(float(remaining_valence), -valence_boost_power);
+    }
+
+    // Overdraw cluster boundaries are found with the same FIFO model as analyze_vertex_cache
+    static const unsigned int overdraw_cache_size = 16;
+}
+
+namespace slam_renderer
+{
+vertex_cache_stats analyze_vertex_cache(const faces& faces, size_t vertex_count, unsigned int cache_size)
+{
+    vertex_cache_stats stats;
+    if (faces.empty() || vertex_count == 0)
+    {
+        return stats;
+    }
+
+    // FIFO by timestamp: a vertex is still cached while fewer than cache_size misses happened since it went in
+    std::vector<unsigned int> cached_at(vertex_count, 0);
+    unsigned int misses = 0;
+    for (unsigned int index : faces)
+    {
+        if (cached_at[index] == 0 || misses + 1 - cached_at[index] > cache_size)
+        {
+            ++misses;
+            cached_at[index] = misses;
+        }
+    }
+
+    stats.m_acmr = float(misses) / float(faces.size() / 3);
+    stats.m_atvr = float(misses) / float(vertex_count);
+    return stats;
+}
+
+void weld_vertices(vertices& vertices, faces& faces)
+{
+    std::vector<unsigned int> order(vertices.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    // Ties keep index order so the first of each run is the earliest copy
+    std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b)
+        {
+            return std::memcmp(&vertices[a], &vertices[b], sizeof(vertex)) < 0;
+        });
+
+    std::vector<unsigned int> remap(vertices.size());
+    for (size_t i = 0; i < order.size();)
+    {
+        size_t end = i + 1;
+        while (end < order.size() && std::memcmp(&vertices[order[end]], &vertices[order[i]], sizeof(vertex)) == 0)
+        {
+            ++end;
+        }
+        for (size_t j = i; j < end; ++j)
+        {
+            remap[order[j]] = order[i];
+        }
+        i = end;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        if (remap[i] == i)
+        {
+            vertices[kept] = vertices[i];
+            remap[i] = static_cast<unsigned int>(kept++);
+        }
+        else
+        {
+            // Survivors always come earlier so they're already renumbered
+            remap[i] = remap[remap[i]];
+        }
+    }
+    vertices.resize(kept);
+
+    for (unsigned int& index : faces)
+    {
+        index = remap[index];
+    }
+}
+
+void optimize_vertex_cache(faces& faces, size_t vertex_count)
+{
+    size_t triangle_count = faces.size() / 3;
+    if (triangle_count == 0)
+    {
+        return;
+    }
+
+    // Triangles of every vertex, the still unemitted ones are kept at the front of each range
+    std::vector<unsigned int> remaining_valence(vertex_count, 0);
+    for (unsigned int index : faces)
+    {
+        ++remaining_valence[index];
+    }
+    std::vector<unsigned int> first_triangle(vertex_count + 1, 0);
+    for (size_t v = 0; v < vertex_count; ++v)
+    {
+        first_triangle[v + 1] = first_triangle[v] + remaining_valence[v];
+    }
+    std::vector<unsigned int> vertex_triangles(faces.size());
+    {
+        std::vector<unsigned int> next_slot(first_triangle.begin(), first_triangle.end() - 1);
+        for (size_t i = 0; i < faces.size(); ++i)
+        {
+            vertex_triangles[next_slot[faces[i]]++] = static_cast<unsigned int>(i / 3);
+        }
+    }
+
+    std::vector<int> cache_position(vertex_count, -1);
+    std::vector<float> vertex_score(vertex_count);
+    for (size_t v = 0; v < vertex_count; ++v)
+    {
+        vertex_score[v] = get_vertex_score(-1, remaining_valence[v]);
+    }
+
+    std::vector<float> triangle_score(triangle_count);
+    for (size_t t = 0; t < triangle_count; ++t)
+    {
+        triangle_score[t] = vertex_score[faces[t * 3]] + vertex_score[faces[t * 3 + 1]] + vertex_score[faces[t * 3 + 2]];
+    }
+    std::vector<uint8_t> emitted(triangle_count, 0);
+
+    std::vector<unsigned int> cache;
+    std::vector<unsigned int> next_cache;
+    cache.reserve(scoring_cache_size + 3);
+    next_cache.reserve(scoring_cache_size + 3);
+
+    slam_renderer::faces result;
+    result.reserve(faces.size());
+
+    size_t best_triangle = size_t(std::max_element(triangle_score.begin(), triangle_score.end()) - triangle_score.begin());
+    size_t next_unemitted = 0;
+
+    while (result.size() < faces.size())
+    {
+        // Nothing around the cache is left, carry on from the first triangle not drawn yet
+        if (best_triangle == triangle_count)
+        {
+            while (emitted[next_unemitted])
+            {
+                ++next_unemitted;
+            }
+            best_triangle = next_unemitted;
+        }
+
+        emitted[best_triangle] = 1;
+        const unsigned int* corners = &faces[best_triangle * 3];
+        result.insert(result.end(), corners, corners + 3);
+
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            unsigned int v = corners[corner];
+            unsigned int* begin = &vertex_triangles[first_triangle[v]];
+            unsigned int* end = begin + remaining_valence[v];
+            std::iter_swap(std::find(begin, end, static_cast<unsigned int>(best_triangle)), end - 1);
+            --remaining_valence[v];
+        }
+
+        // The triangle's vertices move to the front, everything past the cache size falls out
+        next_cache.assign(corners, corners + 3);
+        for (unsigned int v : cache)
+        {
+            if (v != corners[0] && v != corners[1] && v != corners[2])
+            {
+                next_cache.push_back(v);
+            }
+        }
+
+        for (size_t i = 0; i < next_cache.size(); ++i)
+        {
+            unsigned int v = next_cache[i];
+            cache_position[v] = i < scoring_cache_size ? int(i) : -1;
+
+            float score = get_vertex_score(cache_position[v], remaining_valence[v]);
+            float delta = score - vertex_score[v];
+            vertex_score[v] = score;
+            for (unsigned int t = 0; t < remaining_valence[v]; ++t)
+            {
+                triangle_score[vertex_triangles[first_triangle[v] + t]] += delta;
+            }
+        }
+        if (next_cache.size() > scoring_cache_size)
+        {
+            next_cache.resize(scoring_cache_size);
+        }
+        cache.swap(next_cache);
+
+        // Only triangles touching the cache changed score
+        best_triangle = triangle_count;
+        float best_score = -1.f;
+        for (unsigned int v : cache)
+        {
+            for (unsigned int t = 0; t < remaining_valence[v]; ++t)
+            {
+                unsigned int triangle = vertex_triangles[first_triangle[v] + t];
+                if (triangle_score[triangle] > best_score)
+                {
+                    best_score = triangle_score[triangle];
+                    best_triangle = triangle;
+                }
+            }
+        }
+    }
+
+    faces.swap(result);
+}
+
+void optimize_overdraw(faces& faces, const vertices& vertices, float threshold)
+{
+    size_t triangle_count = faces.size() / 3;
+    if (triangle_count == 0)
+    {
+        return;
+    }
+
+    // Each cluster starts with a cold cache and ends as soon as its own ACMR is back within threshold of the whole
+    // mesh's, so drawing the clusters in any order costs at most that much extra
+    float max_cluster_acmr = analyze_vertex_cache(faces, vertices.size(), overdraw_cache_size).m_acmr * threshold;
+
+    std::vector<size_t> cluster_starts(1, 0);
+    std::vector<unsigned int> cached_at(vertices.size(), 0);
+    unsigned int misses = 0;
+    unsigned int cluster_misses = 0;
+    for (size_t t = 0; t < triangle_count; ++t)
+    {
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            unsigned int index = faces[t * 3 + corner];
+            if (cached_at[index] == 0 || misses + 1 - cached_at[index] > overdraw_cache_size)
+            {
+                ++misses;
+                ++cluster_misses;
+                cached_at[index] = misses;
+            }
+        }
+
+        if (t + 1 < triangle_count && float(cluster_misses) <= max_cluster_acmr * float(t + 1 - cluster_starts.back()))
+        {
+            cluster_starts.push_back(t + 1);
+            cluster_misses = 0;
+            // Ages everything out of the cache
+            misses += overdraw_cache_size;
+        }
+    }
+    cluster_starts.push_back(triangle_count);
+
+    size_t cluster_count = cluster_starts.size() - 1;
+    if (cluster_count < 2)
+    {
+        return;
+    }
+
+    // Area weighted centroids and normals
+    std::vector<glm::vec3> cluster_centroids(cluster_count, glm::vec3(0.f));
+    std::vector<glm::vec3> cluster_normals(cluster_count, glm::vec3(0.f));
+    glm::vec3 mesh_centroid = glm::vec3(0.f);
+    float mesh_area = 0.f;
+    for (size_t cluster = 0; cluster < cluster_count; ++cluster)
+    {
+        float cluster_area = 0.f;
+        for (size_t t = cluster_starts[cluster]; t < cluster_starts[cluster + 1]; ++t)
+        {
+            const glm::vec3& a = vertices[faces[t * 3]].m_position;
+            const glm::vec3& b = vertices[faces[t * 3 + 1]].m_position;
+            const glm::vec3& c = vertices[faces[t * 3 + 2]].m_position;
+            glm::vec3 normal = glm::cross(b - a, c - a);
+            float area = glm::length(normal);
+
+            cluster_centroids[cluster] += (a + b + c) * (area / 3.f);
+            cluster_normals[cluster] += normal;
+            cluster_area += area;
+        }
+
+        mesh_centroid += cluster_centroids[cluster];
+        mesh_area += cluster_area;
+        cluster_centroids[cluster] = cluster_area > 0.f ? cluster_centroids[cluster] / cluster_area : vertices[faces[cluster_starts[cluster] * 3]].m_position;
+    }
+    mesh_centroid = mesh_area > 0.f ? mesh_centroid / mesh_area : glm::vec3(0.f);
+
+    // Clusters further out along their own normal face away from more of the mesh
+    std::vector<float> cluster_keys(cluster_count);
+    for (size_t cluster = 0; cluster < cluster_count; ++cluster)
+    {
+        float length = glm::length(cluster_normals[cluster]);
+        glm::vec3 normal = length > 0.f ? cluster_normals[cluster] / length : glm::vec3(0.f);
+        cluster_keys[cluster] = glm::dot(cluster_centroids[cluster] - mesh_centroid, normal);
+    }
+
+    std::vector<size_t> cluster_order(cluster_count);
+    std::iota(cluster_order.begin(), cluster_order.end(), 0);
+    std::stable_sort(cluster_order.begin(), cluster_order.end(), [&](size_t a, size_t b)
+        {
+            return cluster_keys[a] > cluster_keys[b];
+        });
+
+    slam_renderer::faces result;
+    result.reserve(faces.size());
+    for (size_t cluster : cluster_order)
+    {
+        result.insert(result.end(), faces.begin() + cluster_starts[cluster] * 3, faces.begin() + cluster_starts[cluster + 1] * 3);
+    }
+    faces.swap(result);
+}
+
+void optimize_vertex_fetch(vertices& vertices, faces& faces, std::vector<lod_faces>& lods)
+{
+    std::vector<unsigned int> remap(vertices.size(), ~0u);
+    unsigned int next_vertex = 0;
+
+    auto assign = [&](const slam_renderer::faces& indices)
+        {
+            for (unsigned int index : indices)
+            {
+                if (remap[index] == ~0u)
+                {
+                    remap[index] = next_vertex++;
+                }
+            }
+        };
+
+    assign(faces);
+    for (const lod_faces& lod : lods)
+    {
+        assign(lod.m_faces);
+    }
+
+    slam_renderer::vertices result(next_vertex);
+    for (size_t v = 0; v < vertices.size(); ++v)
+    {
+        if (remap[v] != ~0u)
+        {
+            result[remap[v]] = vertices[v];
+        }
+    }
+    vertices.swap(result);
+
+    for (unsigned int& index : faces)
+    {
+        index = remap[index];
+    }
+    for (lod_faces& lod : lods)
+    {
+        for (unsigned int& index : lod.m_faces)
+        {
+            index = remap[index];
+        }
+    }
+}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "mesh_geometry.h"
+
+namespace slam_renderer
+{
+// Post-transform vertex cache efficiency of an index order: vertex shader invocations per triangle (ACMR) and per
+// vertex (ATVR), 0.5 and 1 are the best a regular grid can do
+struct vertex_cache_stats
+{
+    float m_acmr = 0.f;
+    float m_atvr = 0.f;
+};
+
+// Simulates a FIFO cache of cache_size vertices, about what current hardware behaves like
+vertex_cache_stats analyze_vertex_cache(const faces& faces, size_t vertex_count, unsigned int cache_size = 16);
+
+// Merges bitwise identical vertices, faces are remapped to the survivors which keep their first appearance order
+void weld_vertices(vertices& vertices, faces& faces);
+
+// Reorders triangles for the post-transform vertex cache (Forsyth's linear-speed algorithm)
+void optimize_vertex_cache(faces& faces, size_t vertex_count);
+
+// Keeps the vertex cache order within clusters but sorts the clusters so the outward facing ones, that hide the
+// most of the rest of the mesh, are drawn first (Sander et al., fast triangle reordering). Run after
+// optimize_vertex_cache, threshold is how much ACMR may grow in exchange
+void optimize_overdraw(faces& faces, const vertices& vertices, float threshold = 1.05f);
+
+// Orders vertices by their first use in faces then in every lod so fetches walk the vertex buffer linearly,
+// unreferenced vertices are dropped. Run last, it remaps every index list
+void optimize_vertex_fetch(vertices& vertices, faces& faces, std::vector<lod_faces>& lods);
+}
@@ -0,0 +1,448 @@
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace
+{
+    using namespace slam_renderer;
+
+    enum class vertex_kind : uint8_t
+    {
+        manifold, // Can collapse onto any neighbour
+        border, // On an open edge, only collapses along it
+        seam, // Position shared with one other vertex, both collapse along the seam together
+        locked
+    };
+
+    // Open edges constrain the surface with a plane through the edge at right angles to its triangle, weighted up so
+    // borders and seams hold their shape
+    static const float edge_quadric_weight = 10.f;
+
+    // Collapses in one pass are allowed up to this much more error than the one that would have reached the target
+    static const float pass_error_slack = 1.5f;
+
+    // Symmetric 4x4 plane quadric, divided by the accumulated weight it gives the squared distance to the planes
+    struct quadric
+    {
+        double m_a00 = 0.0, m_a01 = 0.0, m_a02 = 0.0, m_a11 = 0.0, m_a12 = 0.0, m_a22 = 0.0;
+        double m_b0 = 0.0, m_b1 = 0.0, m_b2 = 0.0, m_c = 0.0;
+        double m_weight = 0.0;
+
+        static quadric from_plane(const glm::vec3& normal, float distance, float weight)
+        {
+            quadric result;
+            result.m_a00 = weight * normal.x * normal.x;
+            result.m_a01 = weight * normal.x * normal.y;
+            result.m_a02 = weight * normal.x * normal.z;
+            result.m_a11 = weight * normal.y * normal.y;
+            result.m_a12 = weight * normal.y * normal.z;
+            result.m_a22 = weight * normal.z * normal.z;
+            result.m_b0 = weight * normal.x * distance;
+            result.m_b1 = weight * normal.y * distance;
+            result.m_b2 = weight * normal.z * distance;
+            result.m_c = weight * distance * distance;
+            result.m_weight = weight;
+            return result;
+        }
+
+        void add(const quadric& other)
+        {
+            m_a00 += other.m_a00;
+            m_a01 += other.m_a01;
+            m_a02 += other.m_a02;
+            m_a11 += other.m_a11;
+            m_a12 += other.m_a12;
+            m_a22 += other.m_a22;
+            m_b0 += other.m_b0;
+            m_b1 += other.m_b1;
+            m_b2 += other.m_b2;
+            m_c += other.m_c;
+            m_weight += other.m_weight;
+        }
+
+        float evaluate(const glm::vec3& point) const
+        {
+            double x = point.x, y = point.y, z = point.z;
+            double result = m_a00 * x * x + m_a11 * y * y + m_a22 * z * z
+                + 2.0 * (m_a01 * x * y + m_a02 * x * z + m_a12 * y * z)
+                + 2.0 * (m_b0 * x + m_b1 * y + m_b2 * z) + m_c;
+            return m_weight > 0.0 ? float(std::abs(result) / m_weight) : 0.f;
+        }
+    };
+
+    uint64_t make_edge_key(unsigned int a, unsigned int b)
+    {
+        return a < b ? (uint64_t(a) << 32 | b) : (uint64_t(b) << 32 | a);
+    }
+
+    // Sorted edge keys of the current triangles, an edge is open when it only appears once
+    struct edge_set
+    {
+        std::vector<uint64_t> m_keys;
+
+        void build(const faces& faces)
+        {
+            m_keys.clear();
+            for (size_t i = 0; i < faces.size(); i += 3)
+            {
+                for (int corner = 0; corner < 3; ++corner)
+                {
+                    m_keys.push_back(make_edge_key(faces[i + corner], faces[i + (corner + 1) % 3]));
+                }
+            }
+            std::sort(m_keys.begin(), m_keys.end());
+        }
+
+        size_t count(unsigned int a, unsigned int b) const
+        {
+            auto range = std::equal_range(m_keys.begin(), m_keys.end(), make_edge_key(a, b));
+            return size_t(range.second - range.first);
+        }
+    };
+
+    struct collapse
+    {
+        unsigned int m_from;
+        unsigned int m_to;
+        float m_cost;
+    };
+}
+
+namespace slam_renderer
+{
+faces simplify_mesh(const vertices& vertices, const faces& source_faces, size_t target_index_count, float* error)
+{
+    size_t vertex_count = vertices.size();
+    faces result = source_faces;
+    float max_cost = 0.f;
+
+    // Vertices sharing a position (split by normals or UVs) form a group, everything geometric is per group
+    std::vector<unsigned int> group(vertex_count);
+    std::vector<unsigned int> partner(vertex_count, ~0u);
+    std::vector<unsigned int> group_size(vertex_count, 0);
+    {
+        std::vector<unsigned int> order(vertex_count);
+        std::iota(order.begin(), order.end(), 0);
+        auto position_less = [&](unsigned int a, unsigned int b)
+            {
+                const glm::vec3& pa = vertices[a].m_position;
+                const glm::vec3& pb = vertices[b].m_position;
+                return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+            };
+        std::sort(order.begin(), order.end(), position_less);
+
+        for (size_t i = 0; i < vertex_count;)
+        {
+            size_t end = i + 1;
+            while (end < vertex_count && vertices[order[end]].m_position == vertices[order[i]].m_position)
+            {
+                ++end;
+            }
+            for (size_t j = i; j < end; ++j)
+            {
+                group[order[j]] = order[i];
+            }
+            group_size[order[i]] = static_cast<unsigned int>(end - i);
+            if (end - i == 2)
+            {
+                partner[order[i]] = order[i + 1];
+                partner[order[i + 1]] = order[i];
+            }
+            i = end;
+        }
+    }
+
+    edge_set edges;
+    edges.build(result);
+
+    // Kinds come from the original topology and never change, collapses only ever respect them
+    std::vector<vertex_kind> kind(vertex_count, vertex_kind::manifold);
+    {
+        std::vector<unsigned int> open_edges(vertex_count, 0);
+        for (size_t i = 0; i < edges.m_keys.size();)
+        {
+            size_t end = i + 1;
+            while (end < edges.m_keys.size() && edges.m_keys[end] == edges.m_keys[i])
+            {
+                ++end;
+            }
+            unsigned int a = unsigned(edges.m_keys[i] >> 32);
+            unsigned int b = unsigned(edges.m_keys[i] & 0xFFFFFFFF);
+            if (end - i == 1)
+            {
+                ++open_edges[a];
+                ++open_edges[b];
+            }
+            else if (end - i > 2)
+            {
+                kind[a] = vertex_kind::locked;
+                kind[b] = vertex_kind::locked;
+            }
+            i = end;
+        }
+
+        for (size_t v = 0; v < vertex_count; ++v)
+        {
+            if (kind[v] == vertex_kind::locked)
+            {
+                continue;
+            }
+
+            unsigned int size = group_size[group[v]];
+            if (size == 1)
+            {
+                kind[v] = open_edges[v] == 0 ? vertex_kind::manifold : open_edges[v] == 2 ? vertex_kind::border : vertex_kind::locked;
+            }
+            else if (size == 2 && open_edges[v] == 2 && open_edges[partner[v]] == 2)
+            {
+                kind[v] = vertex_kind::seam;
+            }
+            else
+            {
+                kind[v] = vertex_kind::locked;
+            }
+        }
+        // A seam is only a seam if both sides are
+        for (size_t v = 0; v < vertex_count; ++v)
+        {
+            if (kind[v] == vertex_kind::seam && kind[partner[v]] != vertex_kind::seam)
+            {
+                kind[v] = vertex_kind::locked;
+            }
+        }
+    }
+
+    auto position = [&](unsigned int v) -> const glm::vec3&
+        {
+            return vertices[v].m_position;
+        };
+
+    std::vector<quadric> quadrics(vertex_count);
+    for (size_t i = 0; i < result.size(); i += 3)
+    {
+        unsigned int corners[3] = { result[i], result[i + 1], result[i + 2] };
+        glm::vec3 normal = glm::cross(position(corners[1]) - position(corners[0]), position(corners[2]) - position(corners[0]));
+        float area = glm::length(normal);
+        if (area <= 0.f)
+        {
+            continue;
+        }
+        normal /= area;
+
+        quadric plane = quadric::from_plane(normal, -glm::dot(normal, position(corners[0])), area * 0.5f);
+        for (unsigned int corner : corners)
+        {
+            quadrics[group[corner]].add(plane);
+        }
+
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            unsigned int a = corners[corner];
+            unsigned int b = corners[(corner + 1) % 3];
+            if (edges.count(a, b) != 1)
+            {
+                continue;
+            }
+
+            glm::vec3 edge = position(b) - position(a);
+            float length = glm::length(edge);
+            glm::vec3 edge_normal = glm::cross(edge, normal);
+            if (length <= 0.f || glm::length(edge_normal) <= 0.f)
+            {
+                continue;
+            }
+            edge_normal = glm::normalize(edge_normal);
+
+            quadric constraint = quadric::from_plane(edge_normal, -glm::dot(edge_normal, position(a)), length * length * edge_quadric_weight);
+            quadrics[group[a]].add(constraint);
+            quadrics[group[b]].add(constraint);
+        }
+    }
+
+    std::vector<collapse> collapses;
+    std::vector<unsigned int> remap(vertex_count);
+    std::vector<uint8_t> touched(vertex_count);
+    std::vector<unsigned int> group_first_triangle(vertex_count + 1);
+    std::vector<unsigned int> group_triangles;
+
+    auto can_collapse = [&](unsigned int from, unsigned int to)
+        {
+            if (group[from] == group[to])
+            {
+                return false;
+            }
+
+            switch (kind[from])
+            {
+            case vertex_kind::manifold:
+                return true;
+            case vertex_kind::border:
+                return edges.count(from, to) == 1;
+            case vertex_kind::seam:
+                return kind[to] == vertex_kind::seam && edges.count(from, to) == 1 && edges.count(partner[from], partner[to]) == 1;
+            default:
+                return false;
+            }
+        };
+
+    // Moving from onto to must not turn any of the triangles around it over
+    auto flips_triangles = [&](unsigned int from, unsigned int to)
+        {
+            unsigned int from_group = group[from];
+            unsigned int to_group = group[to];
+            for (unsigned int t = group_first_triangle[from_group]; t < group_first_triangle[from_group + 1]; ++t)
+            {
+                size_t triangle = size_t(group_triangles[t]) * 3;
+                glm::vec3 before[3];
+                glm::vec3 after[3];
+                bool degenerate = false;
+                for (int corner = 0; corner < 3; ++corner)
+                {
+                    unsigned int corner_group = group[result[triangle + corner]];
+                    degenerate |= corner_group == to_group;
+                    before[corner] = position(result[triangle + corner]);
+                    after[corner] = corner_group == from_group ? position(to) : before[corner];
+                }
+                if (degenerate)
+                {
+                    continue;
+                }
+
+                glm::vec3 normal_before = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::vec3 normal_after = glm::cross(after[1] - after[0], after[2] - after[0]);
+                if (glm::dot(normal_before, normal_after) <= 0.f)
+                {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+    while (result.size() > target_index_count)
+    {
+        // Triangles around every group, rebuilt each pass as collapses change them
+        std::fill(group_first_triangle.begin(), group_first_triangle.end(), 0);
+        for (unsigned int index : result)
+        {
+            ++group_first_triangle[group[index] + 1];
+        }
+        for (size_t i = 1; i < group_first_triangle.size(); ++i)
+        {
+            group_first_triangle[i] += group_first_triangle[i - 1];
+        }
+        group_triangles.resize(result.size());
+        std::vector<unsigned int> next_slot(group_first_triangle.begin(), group_first_triangle.end() - 1);
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            group_triangles[next_slot[group[result[i]]]++] = static_cast<unsigned int>(i / 3);
+        }
+
+        // Cheaper direction of every edge
+        collapses.clear();
+        for (size_t i = 0; i < edges.m_keys.size(); ++i)
+        {
+            if (i > 0 && edges.m_keys[i] == edges.m_keys[i - 1])
+            {
+                continue;
+            }
+
+            unsigned int a = unsigned(edges.m_keys[i] >> 32);
+            unsigned int b = unsigned(edges.m_keys[i] & 0xFFFFFFFF);
+            float cost_a = can_collapse(a, b) ? quadrics[group[a]].evaluate(position(b)) : std::numeric_limits<float>::max();
+            float cost_b = can_collapse(b, a) ? quadrics[group[b]].evaluate(position(a)) : std::numeric_limits<float>::max();
+            if (cost_a == std::numeric_limits<float>::max() && cost_b == std::numeric_limits<float>::max())
+            {
+                continue;
+            }
+            collapses.push_back(cost_a <= cost_b ? collapse{ a, b, cost_a } : collapse{ b, a, cost_b });
+        }
+        if (collapses.empty())
+        {
+            break;
+        }
+
+        std::sort(collapses.begin(), collapses.end(), [](const collapse& a, const collapse& b)
+            {
+                return a.m_cost < b.m_cost;
+            });
+
+        // A manifold collapse removes two triangles, so roughly this many reach the target
+        size_t goal = std::min(collapses.size() - 1, (result.size() - target_index_count) / 6);
+        float cost_limit = collapses[goal].m_cost * pass_error_slack;
+
+        std::iota(remap.begin(), remap.end(), 0);
+        std::fill(touched.begin(), touched.end(), 0);
+        size_t removed_indices = 0;
+        size_t collapsed = 0;
+
+        // Cheap collapses that keep getting rejected (flips) would otherwise hold the limit down and leave passes
+        // with next to nothing to do, so every pass makes at least half its goal
+        for (const collapse& collapse : collapses)
+        {
+            if ((collapse.m_cost > cost_limit && collapsed * 2 >= goal) || result.size() - removed_indices <= target_index_count)
+            {
+                break;
+            }
+
+            unsigned int from_group = group[collapse.m_from];
+            unsigned int to_group = group[collapse.m_to];
+            if (touched[from_group] || touched[to_group] || flips_triangles(collapse.m_from, collapse.m_to))
+            {
+                continue;
+            }
+
+            remap[collapse.m_from] = collapse.m_to;
+            if (kind[collapse.m_from] == vertex_kind::seam)
+            {
+                remap[partner[collapse.m_from]] = partner[collapse.m_to];
+            }
+            quadrics[to_group].add(quadrics[from_group]);
+            touched[from_group] = 1;
+            touched[to_group] = 1;
+            max_cost = std::max(max_cost, collapse.m_cost);
+            ++collapsed;
+
+            // Triangles spanning the edge go away
+            for (unsigned int t = group_first_triangle[from_group]; t < group_first_triangle[from_group + 1]; ++t)
+            {
+                size_t triangle = size_t(group_triangles[t]) * 3;
+                if (group[result[triangle]] == to_group || group[result[triangle + 1]] == to_group || group[result[triangle + 2]] == to_group)
+                {
+                    removed_indices += 3;
+                }
+            }
+        }
+
+        if (collapsed == 0)
+        {
+            break;
+        }
+
+        size_t write = 0;
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            unsigned int a = remap[result[i]];
+            unsigned int b = remap[result[i + 1]];
+            unsigned int c = remap[result[i + 2]];
+            if (group[a] == group[b] || group[b] == group[c] || group[a] == group[c])
+            {
+                continue;
+            }
+            result[write++] = a;
+            result[write++] = b;
+            result[write++] = c;
+        }
+        result.resize(write);
+        edges.build(result);
+    }
+
+    if (error != nullptr)
+    {
+        *error = std::sqrt(max_cost);
+    }
+    return result;
+}
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "mesh_geometry.h"
+
+namespace slam_renderer
+{
+// Quadric error edge collapse. Vertices only ever collapse onto one of their neighbours, so the result indexes the
+// same vertices and can share their buffer. Vertices on open edges only slide along them and UV/normal seams
+// (positions shared by two vertices) collapse both sides together, anything more complicated stays put.
+// Stops at target_index_count or when nothing more can collapse, error is the largest distance any collapse moved
+// the surface in the mesh's own units
+faces simplify_mesh(const vertices& vertices, const faces& faces, size_t target_index_count, float* error = nullptr);
+}
@@ -1,25 +1,99 @@
 #include "model.h"
 
+#include <algorithm>
+#include <filesystem>
+
+#include <assimp/DefaultIOSystem.h>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "mesh_simplifier.h"
 #include "renderer.h"
 
-namespace slam_renderer
-{
-void model::draw(float delta, std::shared_ptr<material> override_material)
+namespace
 {
-    for (unsigned int i = 0; i < m_meshes.size(); ++i)
+    // Below this a simplified copy isn't worth its index range
+    static const size_t min_lod_triangles = 128;
+    // Each lod aims for this share of the previous one's triangles
+    static const float lod_triangle_ratio = 0.5f;
+    // The chain ends once simplification can't get under this share
+    static const float min_lod_reduction = 0.8f;
+
+    // Remembers every file assimp reads, e.g. an obj's .mtl, so the bake knows everything it came from
+    class recording_io_system : public Assimp::DefaultIOSystem
+    {
+    public:
+        Assimp::IOStream* Open(const char* path, const char* mode = "rb") override
+        {
+            Assimp::IOStream* stream = Assimp::DefaultIOSystem::Open(path, mode);
+            if (stream != nullptr && std::find(m_opened.begin(), m_opened.end(), path) == m_opened.end())
+            {
+                m_opened.push_back(path);
+            }
+            return stream;
+        }
+
+        std::vector<std::string> m_opened;
+    };
+
+    // Fills the size and write time, false if the file can't be stat'ed
+    bool stat_source(const std::string& path, slam_renderer::baked_source& source)
     {
-        m_meshes[i].draw(delta, m_transform, override_material);
+        std::error_code error;
+        uint64_t size = std::filesystem::file_size(path, error);
+        if (error)
+        {
+            return false;
+        }
+        std::filesystem::file_time_type write_time = std::filesystem::last_write_time(path, error);
+        if (error)
+        {
+            return false;
+        }
+
+        source.m_size = size;
+        source.m_write_time = static_cast<int64_t>(write_time.time_since_epoch().count());
+        return true;
     }
 }
 
+namespace slam_renderer
+{
 void model::load(std::string path)
 {
     m_directory = path.substr(0, path.find_last_of('/')) + "/";
     m_name = path.substr(path.find_last_of('/'));
 
+    // Already imported, just take our own copy of the nodes and meshes which all share the same geometry
+    mesh_cache& cache = renderer::get_instance()->get_mesh_cache();
+    if (const mesh_cache::entry* cached = cache.find(path, m_shader_index); cached != nullptr)
+    {
+        m_nodes = cached->m_nodes;
+        m_meshes = cached->m_meshes;
+        return;
+    }
+
+    // The geometry is uploaded straight out of the mapping. A current bake also gives the cache its sources' hashes
+    // so adding the model below doesn't read them
+    std::string baked_path = path + baked_model_extension;
+    mapped_file baked_file;
+    baked_model baked;
+    if (baked_file.open(baked_path) && read_baked_model(baked_file, baked) && is_baked_current(baked, path, cache))
+    {
+        std::cout << "MODEL::LOADING BAKED: " << m_name << " from " << m_directory << std::endl;
+        m_nodes = baked.m_nodes;
+        create_meshes(baked);
+        cache.add(path, m_shader_index, m_nodes, m_meshes);
+        return;
+    }
+    baked = {};
+    baked_file.close();
+
     std::cout << "MODEL::LOADING: " << m_name << " from " << m_directory << std::endl;
 
+    // Owned by the importer
+    recording_io_system* io_system = new recording_io_system();
     Assimp::Importer importer;
+    importer.SetIOHandler(io_system);
     const aiScene* ai_scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenNormals);
 
     if (!ai_scene || ai_scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !ai_scene->mRootNode)
@@ -27,29 +101,143 @@ void model::load(std::string path)
         std::cout << "ERROR::MODEL::" << importer.GetErrorString() << std::endl;
         return;
     }
-    process_node(ai_scene->mRootNode, ai_scene);
+    std::vector<imported_mesh> imported;
+    process_node(ai_scene->mRootNode, ai_scene, mesh_node::no_parent, imported);
+
+    // Simplification dominates the import, every mesh's chain is built on its own job
+    renderer::get_instance()->get_thread_pool().parallel_for(imported.size(), 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                import_geometry(imported[i]);
+            }
+        });
+
+    baked.m_nodes = m_nodes;
+    for (unsigned int i = 0; i < ai_scene->mNumMaterials; ++i)
+    {
+        baked.m_materials.push_back(import_material(ai_scene->mMaterials[i]));
+    }
+
+    for (const imported_mesh& imported_mesh : imported)
+    {
+        if (imported_mesh.m_optimized_stats.m_acmr > 0.f)
+        {
+            std::cout << "MODEL::OPTIMIZED: " << imported_mesh.m_ai_mesh->mName.C_Str() << " " << imported_mesh.m_faces.size() / 3 << " triangles ACMR "
+                << imported_mesh.m_imported_stats.m_acmr << " -> " << imported_mesh.m_optimized_stats.m_acmr << " ATVR "
+                << imported_mesh.m_imported_stats.m_atvr << " -> " << imported_mesh.m_optimized_stats.m_atvr << std::endl;
+        }
+
+        glm::vec3 position_step = get_position_step(imported_mesh.m_geometry.m_decode);
+        if (glm::max(position_step.x, glm::max(position_step.y, position_step.z)) > max_position_step)
+        {
+            std::cout << "MODEL::COARSE POSITIONS: " << imported_mesh.m_ai_mesh->mName.C_Str() << " quantized in steps of "
+                << position_step.x << " " << position_step.y << " " << position_step.z << std::endl;
+        }
+
+        uint32_t material = imported_mesh.m_ai_mesh->mMaterialIndex < ai_scene->mNumMaterials ? imported_mesh.m_ai_mesh->mMaterialIndex : baked_mesh::no_material;
+        baked.m_meshes.push_back({ imported_mesh.m_node, material, imported_mesh.m_geometry });
+    }
+    create_meshes(baked);
+
+    // The model itself first, then everything else assimp read. The bake is skipped if any of them can't be hashed
+    std::vector<std::string> source_paths = { path };
+    for (std::string opened : io_system->m_opened)
+    {
+        std::replace(opened.begin(), opened.end(), '\\', '/');
+        if (std::find(source_paths.begin(), source_paths.end(), opened) == source_paths.end())
+        {
+            source_paths.push_back(opened);
+        }
+    }
+
+    bool sources_known = true;
+    for (const std::string& source_path : source_paths)
+    {
+        baked_source source;
+        source.m_path = source_path.compare(0, m_directory.size(), m_directory) == 0 ? source_path.substr(m_directory.size()) : std::filesystem::absolute(source_path).string();
+        source.m_content_hash = cache.get_content_hash(source_path);
+        if (source.m_content_hash == 0 || !stat_source(source_path, source))
+        {
+            sources_known = false;
+            break;
+        }
+        baked.m_sources.push_back(source);
+    }
+
+    if (sources_known && write_baked_model(baked_path, baked))
+    {
+        std::cout << "MODEL::BAKED: " << baked_path << std::endl;
+    }
+
+    cache.add(path, m_shader_index, m_nodes, m_meshes);
+}
+
+bool model::is_baked_current(const baked_model& baked, const std::string& path, mesh_cache& cache) const
+{
+    auto get_source_path = [this](const baked_source& source)
+        {
+            return std::filesystem::path(source.m_path).is_absolute() ? source.m_path : m_directory + source.m_path;
+        };
+
+    if (baked.m_sources.empty() || get_source_path(baked.m_sources.front()) != path)
+    {
+        return false;
+    }
+
+    for (const baked_source& source : baked.m_sources)
+    {
+        std::string source_path = get_source_path(source);
+        baked_source current;
+        if (!stat_source(source_path, current))
+        {
+            return false;
+        }
+
+        // Untouched since the bake, its hash is trusted rather than reading the whole file again
+        if (current.m_size == source.m_size && current.m_write_time == source.m_write_time)
+        {
+            std::filesystem::file_time_type write_time{ std::filesystem::file_time_type::duration(source.m_write_time) };
+            cache.set_content_hash(source_path, write_time, source.m_content_hash);
+        }
+        else if (cache.get_content_hash(source_path) != source.m_content_hash)
+        {
+            return false;
+        }
+    }
+    return true;
 }
 
-void model::process_node(aiNode* ai_node, const aiScene* ai_scene)
+void model::process_node(aiNode* ai_node, const aiScene* ai_scene, uint32_t parent, std::vector<imported_mesh>& imported)
 {
+    uint32_t node = static_cast<uint32_t>(m_nodes.size());
+
+    // Assimp is row major, glm is column major
+    mesh_node new_node;
+    new_node.m_parent = parent;
+    new_node.m_transform = glm::transpose(glm::make_mat4(&ai_node->mTransformation.a1));
+    m_nodes.push_back(new_node);
+
     for (unsigned int i = 0; i < ai_node->mNumMeshes; ++i)
     {
-        aiMesh* ai_mesh = ai_scene->mMeshes[ai_node->mMeshes[i]];
-        m_meshes.push_back(process_mesh(ai_mesh, ai_scene));
+        imported_mesh imported_mesh;
+        imported_mesh.m_ai_mesh = ai_scene->mMeshes[ai_node->mMeshes[i]];
+        imported_mesh.m_node = node;
+        imported.push_back(std::move(imported_mesh));
     }
 
     for (unsigned int i = 0; i < ai_node->mNumChildren; ++i)
     {
-        process_node(ai_node->mChildren[i], ai_scene);
+        process_node(ai_node->mChildren[i], ai_scene, node, imported);
     }
 }
 
-mesh model::process_mesh(aiMesh* ai_mesh, const aiScene* ai_scene)
+void model::import_geometry(imported_mesh& imported)
 {
-    vertices vertices;
-    faces faces;
-
-    renderer* renderer = renderer::get_instance();
+    const aiMesh* ai_mesh = imported.m_ai_mesh;
+    vertices& vertices = imported.m_vertices;
+    faces& faces = imported.m_faces;
+    aabb& bounds = imported.m_bounds;
 
     for (unsigned int i = 0; i < ai_mesh->mNumVertices; ++i)
     {
@@ -58,6 +246,7 @@ mesh model::process_mesh(aiMesh* ai_mesh, const aiScene* ai_scene)
         vertex.m_position.x = ai_mesh->mVertices[i].x;
         vertex.m_position.y = ai_mesh->mVertices[i].y;
         vertex.m_position.z = ai_mesh->mVertices[i].z;
+        bounds.expand(vertex.m_position);
 
         vertex.m_normal.x = ai_mesh->mNormals[i].x;
         vertex.m_normal.y = ai_mesh->mNormals[i].y;
@@ -85,51 +274,123 @@ mesh model::process_mesh(aiMesh* ai_mesh, const aiScene* ai_scene)
         }
     }
 
-    // TODO we should get some kind of default material from the renderer
-    std::shared_ptr<material> mesh_material;
-
-    // TODO maybe we should just be able to pass the aiMaterial to a material to init from the constructor
-    if (ai_mesh->mMaterialIndex >= 0)
+    // Point and line primitives can't be simplified or reordered
+    if (faces.size() % 3 == 0)
     {
-        aiMaterial* ai_material = ai_scene->mMaterials[ai_mesh->mMaterialIndex];
+        optimize_geometry(imported);
+    }
 
-        mesh_material = renderer->find_material(ai_material->GetName().C_Str());
-        
-        //// No material so we create it
-        if(mesh_material == nullptr)
-        {
-            aiColor3D color(0.f, 0.f, 0.f);
+    imported.m_geometry = pack_geometry(vertices, faces, bounds, imported.m_lods, imported.m_packed);
+}
 
-            std::shared_ptr<texture> albedo, specular;
-            // TODO support mulitple textures of each type per material
-            if (ai_material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
-            {
-                // TODO fetch the texture from the renderer first using the path if possible
-                aiString path;
-                ai_material->GetTexture(aiTextureType_DIFFUSE, 0, &path);
-                albedo = renderer->get_register_texture(m_directory + path.C_Str(), true);
-            }
-            // TODO we just get the shader using a magic number...
-            // TODO load the colours for the material if we don't have a texture
-            mesh_material = std::make_shared<material>(renderer->get_shader(m_shader_index), albedo, 32.f, glm::vec3(1.f, 1.f, 1.f), 1.f, 1.f);
+void model::optimize_geometry(imported_mesh& imported)
+{
+    vertices& vertices = imported.m_vertices;
+    faces& faces = imported.m_faces;
 
-            // TODO remove duplicated code here and create a method
-            if (ai_material->GetTextureCount(aiTextureType_SPECULAR) > 0)
-            {
-                // TODO fetch the texture from the renderer first using the path if possible
-                aiString path;
-                ai_material->GetTexture(aiTextureType_SPECULAR, 0, &path);
-                specular = renderer->get_register_texture(m_directory + path.C_Str());
+    imported.m_imported_stats = analyze_vertex_cache(faces, vertices.size());
 
-                mesh_material->set_specular_map(specular);
-            }
+    // Welding first lets the simplifier see shared edges, lods are built from the reordered faces and the vertex
+    // order is settled last since it has to cover every level
+    weld_vertices(vertices, faces);
+    optimize_vertex_cache(faces, vertices.size());
+    optimize_overdraw(faces, vertices);
 
-            mesh_material->set_name(ai_material->GetName().C_Str());
-            renderer->register_material(mesh_material);
+    // Every level is simplified from the one before, so errors add up along the chain
+    const slam_renderer::faces* previous = &faces;
+    float error = 0.f;
+    imported.m_lods.reserve(max_lod_count - 1);
+    while (imported.m_lods.size() + 1 < max_lod_count && previous->size() / 3 >= min_lod_triangles)
+    {
+        size_t target_index_count = size_t(float(previous->size() / 3) * lod_triangle_ratio) * 3;
+        float lod_error = 0.f;
+        slam_renderer::faces simplified = simplify_mesh(vertices, *previous, target_index_count, &lod_error);
+        if (simplified.empty() || float(simplified.size()) > float(previous->size()) * min_lod_reduction)
+        {
+            break;
         }
+
+        error += lod_error;
+        imported.m_lods.push_back({ std::move(simplified), error });
+        previous = &imported.m_lods.back().m_faces;
+    }
+
+    // Coarser levels are only seen from far away so overdraw isn't worth trading their cache order for
+    for (lod_faces& lod : imported.m_lods)
+    {
+        optimize_vertex_cache(lod.m_faces, vertices.size());
     }
+    optimize_vertex_fetch(vertices, faces, imported.m_lods);
 
-    return mesh(vertices, faces, mesh_material, glm::mat4(1.));
+    imported.m_optimized_stats = analyze_vertex_cache(faces, vertices.size());
 }
 
-}
\ No newline at end of file
+baked_material model::import_material(const aiMaterial* ai_material)
+{
+    baked_material material;
+    material.m_name = ai_material->GetName().C_Str();
+
+    // TODO support mulitple textures of each type per material
+    aiString path;
+    if (ai_material->GetTextureCount(aiTextureType_DIFFUSE) > 0 && ai_material->GetTexture(aiTextureType_DIFFUSE, 0, &path) == AI_SUCCESS)
+    {
+        material.m_albedo_path = path.C_Str();
+    }
+    if (ai_material->GetTextureCount(aiTextureType_SPECULAR) > 0 && ai_material->GetTexture(aiTextureType_SPECULAR, 0, &path) == AI_SUCCESS)
+    {
+        material.m_specular_path = path.C_Str();
+    }
+    return material;
+}
+
+void model::create_meshes(const baked_model& baked)
+{
+    renderer* renderer = renderer::get_instance();
+    for (const baked_mesh& baked_mesh : baked.m_meshes)
+    {
+        // TODO we should get some kind of default material from the renderer
+        material_handle mesh_material;
+        if (baked_mesh.m_material != baked_mesh::no_material)
+        {
+            mesh_material = get_material(baked.m_materials[baked_mesh.m_material]);
+        }
+
+        geometry_handle geometry = renderer->register_geometry(baked_mesh.m_geometry);
+        m_meshes.push_back(mesh(geometry, mesh_material, baked_mesh.m_node));
+    }
+}
+
+material_handle model::get_material(const baked_material& source)
+{
+    renderer* renderer = renderer::get_instance();
+
+    // Material names only mean something within a model's directory, and the default materials also depend on the
+    // shader they're made with, so both go in the registered name like they do in the mesh_cache key
+    std::string name = m_directory + source.m_name + "::" + std::to_string(m_shader_index);
+    material_handle mesh_material = renderer->find_material(name);
+    if (mesh_material.is_valid())
+    {
+        return mesh_material;
+    }
+
+    // No material so we create it
+    texture_handle albedo, specular;
+    if (!source.m_albedo_path.empty())
+    {
+        // TODO fetch the texture from the renderer first using the path if possible
+        albedo = renderer->get_register_texture(m_directory + source.m_albedo_path, true);
+    }
+    // TODO we just get the shader using a magic number...
+    // TODO load the colours for the material if we don't have a texture
+    material new_material(renderer->get_shader(m_shader_index), albedo, 32.f, glm::vec3(1.f, 1.f, 1.f), 1.f, 1.f);
+
+    if (!source.m_specular_path.empty())
+    {
+        specular = renderer->get_register_texture(m_directory + source.m_specular_path);
+        new_material.set_specular_map(specular);
+    }
+
+    new_material.set_name(name);
+    return renderer->register_material(new_material);
+}
+}
@@ -4,7 +4,10 @@
 #include "assimp/scene.h"
 #include "assimp/postprocess.h"
 
+#include "baked_model.h"
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
 
 namespace slam_renderer
 {
@@ -18,36 +21,109 @@ public:
         load(path);
     }
 
-    void draw(float delta, std::shared_ptr<material> override_material = nullptr);
+    void override_material(material_handle material)
+    {
+        for (mesh& mesh : m_meshes)
+        {
+            mesh.override_material(material);
+        }
+    }
 
-    void free()
+    // Use renderer::set_model_shadow_flags so cached shadows get invalidated
+    void set_shadow_flags(bool casts_shadows, bool is_static)
     {
         for (mesh& mesh : m_meshes)
         {
-            mesh.free();
+            mesh.set_shadow_flags(casts_shadows, is_static);
         }
     }
 
-    void override_material(std::shared_ptr<material> material)
+    void set_occluder_mode(occluder_mode mode)
     {
         for (mesh& mesh : m_meshes)
         {
-            mesh.override_material(material);
+            mesh.set_occluder_mode(mode);
         }
     }
 
+    std::vector<mesh>& get_meshes()
+    {
+        return m_meshes;
+    }
+
+    const std::vector<mesh_node>& get_nodes() const
+    {
+        return m_nodes;
+    }
+
+    const glm::mat4& get_transform() const
+    {
+        return m_transform;
+    }
+
+    // Use renderer::set_model_transform so the world transforms get updated
+    void set_transform(const glm::mat4& transform)
+    {
+        m_transform = transform;
+    }
+
+    // Id of the model's root in the renderer's transform_hierarchy, m_nodes follow it in order
+    uint32_t get_root_node() const
+    {
+        return m_root_node;
+    }
+
+    void set_root_node(uint32_t root_node)
+    {
+        m_root_node = root_node;
+    }
+
+    uint32_t get_hierarchy_node(uint32_t node) const
+    {
+        return m_root_node + 1 + node;
+    }
+
 private:
+    // Everything about a mesh that can be built off the main thread
+    struct imported_mesh
+    {
+        aiMesh* m_ai_mesh = nullptr;
+        uint32_t m_node = 0;
+        vertices m_vertices;
+        faces m_faces;
+        aabb m_bounds;
+        std::vector<lod_faces> m_lods;
+        // Of the base faces as they came out of assimp and as they'll be drawn
+        vertex_cache_stats m_imported_stats;
+        vertex_cache_stats m_optimized_stats;
+        // Everything above packed into the arena's layout
+        packed_storage m_packed;
+        packed_geometry m_geometry;
+    };
+
+    // A baked copy of the file is used if it's up to date, otherwise assimp imports it and the bake is rewritten
     void load(std::string path);
-    void process_node(aiNode* ai_node, const aiScene* ai_scene);
-    mesh process_mesh(aiMesh* ai_mesh, const aiScene* ai_scene);
+    // Whether every source of the bake is unchanged, only reads the ones whose size or write time differ
+    bool is_baked_current(const baked_model& baked, const std::string& path, mesh_cache& cache) const;
+    void process_node(aiNode* ai_node, const aiScene* ai_scene, uint32_t parent, std::vector<imported_mesh>& imported);
+    // Copies the vertices/faces out of assimp, optimizes their order, simplifies them into a lod chain and packs
+    // the lot, safe to run on any thread
+    static void import_geometry(imported_mesh& imported);
+    static void optimize_geometry(imported_mesh& imported);
+    static baked_material import_material(const aiMaterial* ai_material);
+    // Materials and geometry are registered with the renderer so these stay on the main thread
+    void create_meshes(const baked_model& baked);
+    material_handle get_material(const baked_material& source);
 
-    // TODO these should probably be node-like and contain child meshes for transforms etc.
+    // Depth first so parents come before their children, meshes index into this
+    std::vector<mesh_node> m_nodes;
     std::vector<mesh> m_meshes;
 
     std::string m_directory;
     std::string m_name;
 
     glm::mat4 m_transform;
+    uint32_t m_root_node = 0;
 
     unsigned int m_shader_index = 0;
 };
@@ -0,0 +1,132 @@
+#include "point_shadows.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "renderer.h"
+
+namespace
+{
+    // Same views a cube map would be rendered with, so faces can be looked up with the cube map face/uv rules
+    static const glm::vec3 face_directions[] = { { 1.f, 0.f, 0.f }, { -1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, { 0.f, -1.f, 0.f }, { 0.f, 0.f, 1.f }, { 0.f, 0.f, -1.f } };
+    static const glm::vec3 face_ups[] = { { 0.f, -1.f, 0.f }, { 0.f, -1.f, 0.f }, { 0.f, 0.f, 1.f }, { 0.f, 0.f, -1.f }, { 0.f, -1.f, 0.f }, { 0.f, -1.f, 0.f } };
+}
+
+namespace slam_renderer
+{
+void point_shadows::init(unsigned int resolution)
+{
+    renderer* renderer = renderer::get_instance();
+    m_resolution = resolution;
+
+    // Owned here like the shadow atlas, the main target has to stay the first registered framebuffer
+    m_framebuffer = std::make_shared<framebuffer>(resolution, resolution, shader_handle{}, framebuffer_type::depth_array, max_lights * 6);
+
+    m_shader = renderer->register_shader("assets/shaders/point_shadow_vertex.glsl", "assets/shaders/empty_fragment.glsl", shader_type::point_shadow_pass, "assets/shaders/point_shadow_geometry.glsl");
+    m_material = renderer->register_material(material(m_shader, {}, 0.f));
+
+    shader* pass_shader = renderer->get_shader(m_shader);
+    m_light_position_uniform = pass_shader->find_uniform<glm::vec3>("u_light_position");
+    m_near_plane_uniform = pass_shader->find_uniform<float>("u_near_plane");
+    m_far_plane_uniform = pass_shader->find_uniform<float>("u_far_plane");
+    m_first_layer_uniform = pass_shader->find_uniform<int>("u_first_layer");
+}
+
+void point_shadows::begin_frame()
+{
+    m_requests.clear();
+}
+
+void point_shadows::request(float importance, point_shadow_state* state)
+{
+    m_requests.push_back({ importance, state });
+}
+
+void point_shadows::allocate()
+{
+    std::stable_sort(m_requests.begin(), m_requests.end(), [](const slot_request& a, const slot_request& b)
+        {
+            return a.m_importance > b.m_importance;
+        });
+
+    size_t shadowed = std::min(m_requests.size(), size_t(max_lights));
+    m_shadowed_lights.clear();
+    for (size_t i = 0; i < m_requests.size(); ++i)
+    {
+        point_shadow_state* state = m_requests[i].m_state;
+        state->m_slot = -1;
+        if (i < shadowed)
+        {
+            m_shadowed_lights.push_back(state);
+        }
+    }
+
+    // Lights that already own a slot keep it, the rest take over whichever slots are left
+    bool slot_taken[max_lights] = {};
+    for (point_shadow_state* state : m_shadowed_lights)
+    {
+        for (unsigned int slot = 0; slot < max_lights; ++slot)
+        {
+            if (m_slot_owners[slot] == state)
+            {
+                state->m_slot = static_cast<int>(slot);
+                slot_taken[slot] = true;
+                break;
+            }
+        }
+    }
+
+    unsigned int free_slot = 0;
+    for (point_shadow_state* state : m_shadowed_lights)
+    {
+        if (state->m_slot >= 0)
+        {
+            continue;
+        }
+
+        while (slot_taken[free_slot])
+        {
+            ++free_slot;
+        }
+        slot_taken[free_slot] = true;
+        m_slot_owners[free_slot] = state;
+        state->m_slot = static_cast<int>(free_slot);
+
+        // Whatever is in the slot belongs to another light
+        state->m_static_generation = shadow_tile_state::invalid_generation;
+        state->m_dynamic_generation = shadow_tile_state::invalid_generation;
+    }
+}
+
+void point_shadows::begin_light(gl_state& state, const point_shadow_state& light)
+{
+    state.set_depth_write(true);
+    m_framebuffer->clear_layers(light.m_slot * 6, 6);
+
+    shader* pass_shader = renderer::get_instance()->get_shader(m_shader);
+    pass_shader->use();
+    pass_shader->set(m_light_position_uniform, glm::vec3(light.m_sphere));
+    pass_shader->set(m_near_plane_uniform, get_near_plane(light.m_sphere.w));
+    pass_shader->set(m_far_plane_uniform, light.m_sphere.w);
+    pass_shader->set(m_first_layer_uniform, light.m_slot * 6);
+}
+
+glm::mat4 point_shadows::get_face_view_projection(const glm::vec3& position, float range, unsigned int face)
+{
+    glm::mat4 projection = glm::perspective(glm::radians(90.f), 1.f, get_near_plane(range), range);
+    return projection * glm::lookAt(position, position + face_directions[face], face_ups[face]);
+}
+
+void point_shadows::bind() const
+{
+    renderer* renderer = renderer::get_instance();
+    renderer->get_texture(m_framebuffer->get_texture())->bind(point_shadow_unit);
+}
+
+void point_shadows::free()
+{
+    if (m_framebuffer != nullptr)
+    {
+        m_framebuffer->free();
+    }
+}
+}
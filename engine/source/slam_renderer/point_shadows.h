@@ -0,0 +1,104 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "framebuffer.h"
+#include "gl_state.h"
+#include "handles.h"
+#include "shader.h"
+#include "shadow_atlas.h"
+
+namespace slam_renderer
+{
+// Lit passes read point light shadows from this unit
+static const unsigned int point_shadow_unit = 7;
+
+// A point light's cube slot and what it was last rendered with, owned by the light
+struct point_shadow_state
+{
+    int m_slot = -1; // -1 without shadows this frame
+    glm::vec4 m_sphere = glm::vec4(0.f); // Position and range, set by the light when it requests a slot
+    glm::vec4 m_rendered_sphere = glm::vec4(0.f);
+    uint32_t m_static_generation = shadow_tile_state::invalid_generation;
+    uint32_t m_dynamic_generation = shadow_tile_state::invalid_generation;
+};
+
+// Cube shadows for point lights, stored as six layers per light of one depth texture array since GL 3.3 has no cube
+// map arrays. Faces go +x -x +y -y +z -z and are laid out like cube map faces. All six are rendered in a single
+// pass per light: every caster is drawn once and point_shadow_geometry.glsl sends each triangle to the layers of
+// the faces it lands in. Only the most important lights get one of the fixed number of slots
+class point_shadows
+{
+public:
+    static const unsigned int max_lights = 8;
+
+    void init(unsigned int resolution = 512);
+
+    // Forgets last frame's requests, lights request a slot again every frame
+    void begin_frame();
+
+    // importance ranks the request like shadow_atlas::request, state.m_sphere has to be set already
+    void request(float importance, point_shadow_state* state);
+
+    // Gives the most important requests a slot, a light keeps the slot it had last frame so its faces can be reused
+    void allocate();
+
+    // Requests that got a slot in the last allocate
+    const std::vector<point_shadow_state*>& get_shadowed_lights() const
+    {
+        return m_shadowed_lights;
+    }
+
+    // Clears the light's six layers and points the pass shader at them, casters are drawn with get_material() next
+    void begin_light(gl_state& state, const point_shadow_state& light);
+
+    material_handle get_material() const
+    {
+        return m_material;
+    }
+
+    unsigned int get_resolution() const
+    {
+        return m_resolution;
+    }
+
+    void bind() const;
+
+    void free();
+
+    // Must match the views point_shadow_geometry.glsl projects with
+    static glm::mat4 get_face_view_projection(const glm::vec3& position, float range, unsigned int face);
+
+    // Near plane of every face, scaled with the range to keep depth precision sensible
+    static float get_near_plane(float range)
+    {
+        return std::max(range * 0.01f, 0.05f);
+    }
+
+private:
+    unsigned int m_resolution = 0;
+    std::shared_ptr<framebuffer> m_framebuffer;
+
+    shader_handle m_shader;
+    material_handle m_material;
+    uniform<glm::vec3> m_light_position_uniform;
+    uniform<float> m_near_plane_uniform;
+    uniform<float> m_far_plane_uniform;
+    uniform<int> m_first_layer_uniform;
+
+    struct slot_request
+    {
+        float m_importance;
+        point_shadow_state* m_state;
+    };
+    std::vector<slot_request> m_requests;
+    std::vector<point_shadow_state*> m_shadowed_lights;
+    // Only compared against, a light never has to give its slot back when it goes away
+    const point_shadow_state* m_slot_owners[max_lights] = {};
+};
+}
@@ -0,0 +1,243 @@
+#include "render_queue.h"
+
+#include <glad.h>
+
+#include <algorithm>
+
+#include "mesh_geometry.h"
+#include "geometry_arena.h"
+#include "material.h"
+
+namespace
+{
+    static const unsigned int pass_bits = 4;
+    static const unsigned int shader_bits = 10;
+    static const unsigned int material_bits = 14;
+    static const unsigned int texture_set_bits = 8;
+    static const unsigned int geometry_bits = 12;
+    static const unsigned int lod_bits = 3;
+    static const unsigned int depth_bits = 13;
+
+    static const unsigned int depth_shift = 0;
+    static const unsigned int lod_shift = depth_shift + depth_bits;
+    static const unsigned int geometry_shift = lod_shift + lod_bits;
+    static const unsigned int texture_set_shift = geometry_shift + geometry_bits;
+    static const unsigned int material_shift = texture_set_shift + texture_set_bits;
+    static const unsigned int shader_shift = material_shift + material_bits;
+    static const unsigned int pass_shift = shader_shift + shader_bits;
+
+    static_assert(pass_shift + pass_bits == 64, "render queue key must pack into 64 bits");
+    static_assert(slam_renderer::max_lod_count <= 1u << lod_bits, "every lod must fit in the render queue key");
+
+    uint64_t mask(unsigned int value, unsigned int bits)
+    {
+        return static_cast<uint64_t>(value) & ((uint64_t(1) << bits) - 1);
+    }
+}
+
+namespace slam_renderer
+{
+uint64_t render_queue::make_key(render_pass pass, unsigned int shader_id, unsigned int material_id, unsigned int texture_set, unsigned int geometry_id, unsigned int lod, uint32_t depth)
+{
+    return mask(static_cast<unsigned int>(pass), pass_bits) << pass_shift
+        | mask(shader_id, shader_bits) << shader_shift
+        | mask(material_id, material_bits) << material_shift
+        | mask(texture_set, texture_set_bits) << texture_set_shift
+        | mask(geometry_id, geometry_bits) << geometry_shift
+        | mask(lod, lod_bits) << lod_shift
+        | mask(depth, depth_bits) << depth_shift;
+}
+
+void render_queue::clear()
+{
+    m_items.clear();
+}
+
+void render_queue::push(render_pass pass, mesh_geometry* geometry, material* material, const glm::mat4& transform, float depth, unsigned int lod)
+{
+    // Front to back: quantise the depth so nearer objects get smaller keys within the same state
+    float normalised_depth = std::clamp(depth / m_max_depth, 0.f, 1.f);
+    uint32_t quantised_depth = static_cast<uint32_t>(normalised_depth * float((1u << depth_bits) - 1));
+
+    uint64_t key = make_key(pass, material->get_shader_sort_id(), material->get_sort_id(), material->get_texture_set(), geometry->get_id(), lod, quantised_depth);
+    m_items.push_back({ key, geometry, material, transform, static_cast<uint8_t>(lod) });
+}
+
+void render_queue::sort()
+{
+    size_t count = m_items.size();
+    m_sorted.resize(count);
+    m_scratch.resize(count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        m_sorted[i] = { m_items[i].m_key, static_cast<uint32_t>(i) };
+    }
+
+    // LSD radix sort, one byte per pass. Passes where every key has the same byte are skipped which is
+    // common as most scenes only use a handful of passes/shaders
+    for (unsigned int shift = 0; shift < 64; shift += 8)
+    {
+        size_t histogram[256] = {};
+        for (const sort_entry& entry : m_sorted)
+        {
+            ++histogram[(entry.m_key >> shift) & 0xFF];
+        }
+
+        if (count == 0 || histogram[(m_sorted[0].m_key >> shift) & 0xFF] == count)
+        {
+            continue;
+        }
+
+        size_t offset = 0;
+        for (size_t& bucket : histogram)
+        {
+            size_t bucket_count = bucket;
+            bucket = offset;
+            offset += bucket_count;
+        }
+
+        for (const sort_entry& entry : m_sorted)
+        {
+            m_scratch[histogram[(entry.m_key >> shift) & 0xFF]++] = entry;
+        }
+        m_sorted.swap(m_scratch);
+    }
+}
+
+void render_queue::submit(geometry_arena& arena, gl_state& state, const pass_settings& settings)
+{
+    m_state_changes = 0;
+    m_draw_calls = 0;
+
+    if (m_sorted.empty())
+    {
+        // Still reads back as zero samples rather than whatever the query held before
+        if (settings.m_samples_query != 0)
+        {
+            glBeginQuery(GL_SAMPLES_PASSED, settings.m_samples_query);
+            glEndQuery(GL_SAMPLES_PASSED);
+        }
+        return;
+    }
+
+    // Upload every transform in submission order so each batch is a contiguous range of the buffer
+    m_instance_transforms.resize(m_sorted.size());
+    for (size_t i = 0; i < m_sorted.size(); ++i)
+    {
+        m_instance_transforms[i] = m_items[m_sorted[i].m_index].m_transform;
+    }
+
+    if (m_instance_buffer == 0)
+    {
+        glGenBuffers(1, &m_instance_buffer);
+    }
+    state.bind_array_buffer(m_instance_buffer);
+
+    size_t upload_size = m_instance_transforms.size() * sizeof(glm::mat4);
+    if (upload_size > m_instance_buffer_capacity)
+    {
+        m_instance_buffer_capacity = std::max(upload_size, m_instance_buffer_capacity * 2);
+    }
+    // Orphan the old storage so we don't stall on draws from the previous pass still reading it
+    glBufferData(GL_ARRAY_BUFFER, m_instance_buffer_capacity, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, upload_size, m_instance_transforms.data());
+
+    arena.bind(m_instance_buffer, 0);
+    material* bound_material = nullptr;
+
+    // Skybox items sort last, the query ends when the first one comes up
+    bool counting_samples = settings.m_samples_query != 0;
+    if (counting_samples)
+    {
+        glBeginQuery(GL_SAMPLES_PASSED, settings.m_samples_query);
+    }
+
+    size_t batch_start = 0;
+    while (batch_start < m_sorted.size())
+    {
+        render_item& item = m_items[m_sorted[batch_start].m_index];
+
+        if (item.m_material != bound_material)
+        {
+            if (counting_samples && static_cast<render_pass>(item.m_key >> pass_shift) == render_pass::skybox)
+            {
+                glEndQuery(GL_SAMPLES_PASSED);
+                counting_samples = false;
+            }
+
+            pipeline_state pipeline = item.m_material->get_pipeline_state();
+            pipeline.m_polygon_mode = settings.m_polygon_mode;
+            if (settings.m_depth_prepassed && pipeline.m_depth_write)
+            {
+                pipeline.m_depth_func = compare_func::less_equal;
+                pipeline.m_depth_write = false;
+            }
+            state.apply(pipeline);
+
+            item.m_material->bind();
+            bound_material = item.m_material;
+            ++m_state_changes;
+        }
+
+        arena.set_instance_offset(batch_start * sizeof(glm::mat4));
+
+        // Different meshes with the same material and transform (e.g. every mesh under one model node) go out
+        // in a single multi draw that all reads the first transform
+        size_t run_end = batch_start + 1;
+        while (run_end < m_sorted.size())
+        {
+            const render_item& next = m_items[m_sorted[run_end].m_index];
+            if (next.m_material != item.m_material || next.m_geometry == item.m_geometry || next.m_transform != item.m_transform)
+            {
+                break;
+            }
+            ++run_end;
+        }
+
+        if (run_end - batch_start > 1)
+        {
+            for (size_t i = batch_start; i < run_end; ++i)
+            {
+                const render_item& run_item = m_items[m_sorted[i].m_index];
+                arena.queue_multi_draw(run_item.m_geometry->get_allocation(run_item.m_lod));
+            }
+            arena.submit_multi_draw();
+            ++m_draw_calls;
+
+            batch_start = run_end;
+            continue;
+        }
+
+        size_t batch_end = batch_start + 1;
+        while (batch_end < m_sorted.size())
+        {
+            const render_item& next = m_items[m_sorted[batch_end].m_index];
+            if (next.m_material != item.m_material || next.m_geometry != item.m_geometry || next.m_lod != item.m_lod)
+            {
+                break;
+            }
+            ++batch_end;
+        }
+
+        arena.draw(item.m_geometry->get_allocation(item.m_lod), static_cast<unsigned int>(batch_end - batch_start));
+        ++m_draw_calls;
+
+        batch_start = batch_end;
+    }
+
+    if (counting_samples)
+    {
+        glEndQuery(GL_SAMPLES_PASSED);
+    }
+}
+
+void render_queue::free()
+{
+    if (m_instance_buffer != 0)
+    {
+        glDeleteBuffers(1, &m_instance_buffer);
+        m_instance_buffer = 0;
+    }
+}
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "gl_state.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace slam_renderer
+{
+class mesh_geometry;
+class material;
+class geometry_arena;
+
+// Passes are the most significant bits of the key so everything in a pass is submitted together
+enum class render_pass : uint8_t
+{
+    shadow,
+    depth_prepass, // Opaque geometry depth only, when the depth pre-pass is on
+    gbuffer, // Lit materials' deferred variants when deferred shading is on
+    opaque,
+    skybox // Drawn after opaque geometry so depth testing rejects most of its fragments
+};
+
+// Applied on top of every material's pipeline state for a whole pass
+struct pass_settings
+{
+    polygon_mode m_polygon_mode = polygon_mode::fill;
+    // Depth is already final from a pre-pass, only fragments matching it get shaded and depth isn't written again
+    bool m_depth_prepassed = false;
+    // GL_SAMPLES_PASSED query wrapped around every item except the skybox, 0 for none
+    unsigned int m_samples_query = 0;
+};
+
+struct render_item
+{
+    uint64_t m_key;
+    mesh_geometry* m_geometry;
+    material* m_material;
+    glm::mat4 m_transform;
+    uint8_t m_lod;
+};
+
+// Collects every mesh to be drawn in a pass, sorts them by a packed state key and submits them
+// so that programs/textures/uniforms are only rebound when the key changes. Consecutive items with the
+// same material and geometry are collapsed into a single instanced draw, consecutive different geometry
+// with the same material and transform into a single multi draw
+class render_queue
+{
+public:
+    // Key layout (msb -> lsb): pass 4 | shader 10 | material 14 | texture set 8 | geometry 12 | lod 3 | depth 13
+    static uint64_t make_key(render_pass pass, unsigned int shader_id, unsigned int material_id, unsigned int texture_set, unsigned int geometry_id, unsigned int lod, uint32_t depth);
+
+    void clear();
+
+    void push(render_pass pass, mesh_geometry* geometry, material* material, const glm::mat4& transform, float depth, unsigned int lod = 0);
+
+    void sort();
+
+    // Everything is drawn from the arena's VAO. Each material's pipeline state is applied through state with the
+    // pass settings on top, so only what actually differs between materials reaches GL
+    void submit(geometry_arena& arena, gl_state& state, const pass_settings& settings);
+
+    size_t size() const
+    {
+        return m_items.size();
+    }
+
+    // Number of material binds issued by the last submit
+    unsigned int get_state_changes() const
+    {
+        return m_state_changes;
+    }
+
+    // Number of draw calls issued by the last submit
+    unsigned int get_draw_calls() const
+    {
+        return m_draw_calls;
+    }
+
+    void free();
+
+    // Depths are quantised over [0, max_depth] for the front to back part of the key, renderer::render sets it to
+    // the camera's far plane
+    void set_max_depth(float max_depth)
+    {
+        m_max_depth = max_depth;
+    }
+
+private:
+    std::vector<render_item> m_items;
+
+    // Radix sort works on (key, index) pairs so we only shuffle 16 bytes per item, not the whole render_item
+    struct sort_entry
+    {
+        uint64_t m_key;
+        uint32_t m_index;
+    };
+    std::vector<sort_entry> m_sorted;
+    std::vector<sort_entry> m_scratch;
+
+    // Transforms in sorted order, streamed to m_instance_buffer once per submit
+    std::vector<glm::mat4> m_instance_transforms;
+    unsigned int m_instance_buffer = 0;
+    size_t m_instance_buffer_capacity = 0;
+
+    float m_max_depth = 200.f;
+    unsigned int m_state_changes = 0;
+    unsigned int m_draw_calls = 0;
+};
+}
@@ -1,5 +1,17 @@
 #include "renderer.h"
 
+#include <bit>
+
+namespace
+{
+    // Bounding sphere radius over distance to the eye a mesh needs before it is picked as an occluder automatically
+    static const float min_occluder_size = 0.2f;
+    static const size_t max_automatic_occluders = 32;
+    static const size_t max_automatic_occluder_triangles = 32768;
+
+    static const size_t min_lod_batch = 256;
+}
+
 namespace slam_renderer
 {
 
@@ -12,19 +24,43 @@ namespace slam_renderer
 
         m_camera->recalculate_projections(m_window);
         glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
-        glEnable(GL_DEPTH_TEST);
+        m_gl_state.set_depth_test(true);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        // Grows on demand, this is enough for the sample scenes without a resize
+        m_geometry_arena.init(m_gl_state, 1 << 18, 1 << 20);
+        m_frame_uniforms.init(uniform_block_binding::frame, sizeof(frame_uniforms));
+        m_light_uniforms.init(uniform_block_binding::lights, sizeof(light_uniforms));
+        m_shadow_uniforms.init(uniform_block_binding::shadows, sizeof(shadow_uniforms));
+        m_light_clusters.init(m_gl_state);
+        m_deferred_lighting.init(window_width, window_height);
+        m_depth_prepass.init();
+        m_shadow_atlas.init();
+        m_point_shadows.init();
+        m_software_occlusion.init();
+
+        shader_handle shadow_map_shader = register_shader("assets/shaders/to_depth_vertex.glsl", "assets/shaders/empty_fragment.glsl", slam_renderer::shader_type::shadow_pass);
+        m_shadow_pass_material = register_material(material(shadow_map_shader, {}, 0.f));
+        m_internal_shader_count = static_cast<unsigned int>(m_shaders.size());
     }
 
     void renderer::toggle_wireframe()
     {
+        // Picked up by the pipeline state of the next pass
         m_wireframe = !m_wireframe;
+    }
 
-        GLenum mode = m_wireframe ? GL_LINE : GL_FILL;
+    void renderer::toggle_deferred_shading()
+    {
+        m_deferred_shading = !m_deferred_shading;
+        std::cout << "RENDERER::DEFERRED SHADING: " << m_deferred_shading << std::endl;
+    }
 
-        glPolygonMode(GL_FRONT_AND_BACK, mode);
+    void renderer::cycle_depth_prepass_mode()
+    {
+        m_depth_prepass.cycle_mode();
     }
 
     void renderer::toggle_persepctive()
@@ -32,141 +68,689 @@ namespace slam_renderer
         m_perspective = !m_perspective;
     }
 
+    void renderer::toggle_occlusion_culling()
+    {
+        m_occlusion_culling = !m_occlusion_culling;
+        std::cout << "RENDERER::OCCLUSION CULLING: " << m_occlusion_culling << std::endl;
+    }
+
     void renderer::render(float delta)
     {
+        m_gl_state.reset_stats();
         m_camera->update(delta, m_window);
+        update_draw_candidates();
+        update_shadow_caster_bounds();
+
+        // Camera data is uploaded once here rather than per material
+        frame_uniforms frame_data;
+        frame_data.m_view = get_view();
+        frame_data.m_projection = get_projection();
+        frame_data.m_view_projection = frame_data.m_projection * frame_data.m_view;
+        frame_data.m_inverse_view_projection = glm::inverse(frame_data.m_view_projection);
+        frame_data.m_camera_position = glm::vec4(m_camera->get_position(), 1.f);
+        m_frame_uniforms.update(&frame_data, sizeof(frame_data));
+
+        // Front to back keys are spread over the camera's depth range
+        glm::vec4 far_point = glm::inverse(frame_data.m_projection) * glm::vec4(0.f, 0.f, 1.f, 1.f);
+        m_render_queue.set_max_depth(-far_point.z / far_point.w);
+
+        int width, height;
+        get_resolution(&width, &height);
+        update_lods(m_camera->get_position(), frame_data.m_projection, height);
+
+        // Deferred shading already lays down depth in the g-buffer pass, wireframe lines would be hidden by it
+        m_depth_prepass.begin_frame(!m_deferred_shading && !m_wireframe);
+
+        // Shadowed lights share one atlas, every light asks for its tiles before any are sized so the space goes
+        // to whichever matter most this frame. Matrices are fitted to the tile sizes they got afterwards
+        m_shadow_atlas.begin_frame();
+        m_point_shadows.begin_frame();
+        for (auto& light : m_lights)
+        {
+            light->request_shadows(m_shadow_atlas, m_point_shadows, frame_data.m_view, frame_data.m_projection);
+        }
+        m_shadow_atlas.allocate();
+        m_point_shadows.allocate();
+
+        shadow_uniforms shadow_data = {};
+        for (auto& light : m_lights)
+        {
+            light->update_shadow_tiles(m_shadow_atlas, frame_data.m_view, frame_data.m_projection, m_shadow_caster_bounds);
+        }
+        m_shadow_atlas.load_to_buffer(shadow_data);
+        m_shadow_uniforms.update(&shadow_data, sizeof(shadow_data));
+
+        // Same for lights. Point and spot lights are binned into view space clusters so each fragment only loops
+        // over the ones that can reach it
+        light_uniforms light_data = {};
+        m_local_lights.clear();
+        for (auto& light : m_lights)
+        {
+            light->load_to_buffer(light_data, m_local_lights);
+        }
+        m_light_clusters.update(frame_data.m_view, frame_data.m_projection, width, height, m_local_lights, m_thread_pool);
+        m_light_clusters.load_to_buffer(light_data);
+        m_light_uniforms.update(&light_data, sizeof(light_data));
 
         // Shadow mapping pass
-        glCullFace(GL_FRONT);
-        for (auto light : m_lights)
+        m_shadow_stats = {};
+        render_shadow_atlas(delta);
+        render_point_shadows(delta);
+
+        // Camera passes skip whatever is hidden behind the occluders, shadow passes see from elsewhere
+        update_software_occlusion(m_camera->get_position(), frame_data.m_view_projection);
+
+        // Deferred: lit materials write the g-buffer first, lighting is then resolved into the target below
+        if (m_deferred_shading)
         {
-            if (light->get_type() == light_type::directional)
+            m_deferred_lighting.begin_geometry_pass(m_gl_state);
+            draw_models(delta, render_pass::gbuffer, m_camera->get_position(), frame_data.m_view_projection);
+        }
+
+        // Normal pass
+        m_gl_state.set_viewport(0, 0, width, height);
+
+        unsigned int target = m_framebuffers.size() > 0 ? m_framebuffers.at(0)->get_id() : 0;
+        m_gl_state.bind_framebuffer(target);
+
+        m_gl_state.set_colour_write(true);
+        m_gl_state.set_depth_write(true);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+        if (m_depth_prepass.is_active())
+        {
+            draw_models(delta, render_pass::depth_prepass, m_camera->get_position(), frame_data.m_view_projection, m_depth_prepass.get_material());
+        }
+
+        // Every shadow comes from the atlas or the point light cubes, they stay bound for the whole pass
+        m_shadow_atlas.bind();
+        m_point_shadows.bind();
+        m_light_clusters.bind(m_gl_state);
+
+        if (m_deferred_shading)
+        {
+            m_deferred_lighting.resolve(m_gl_state, m_geometry_arena, target, m_local_lights, frame_data.m_view_projection);
+        }
+
+        // Everything when forward, only what has no deferred variant (unlit, skybox) otherwise
+        draw_models(delta, render_pass::opaque, m_camera->get_position(), frame_data.m_view_projection);
+        m_depth_prepass.end_frame();
+
+        post_render(delta);
+    }
+
+    void renderer::update_draw_candidates()
+    {
+        auto get_world_bounds = [this](const mesh& mesh, const glm::mat4& transform) -> aabb
+            {
+                if (mesh.is_cullable())
+                {
+                    return m_geometries.get(mesh.get_geometry())->get_bounds().transformed(transform);
+                }
+                // Big enough to straddle every plane so it is never culled
+                return { glm::vec3(-1e30f), glm::vec3(1e30f) };
+            };
+
+        m_transforms.update();
+
+        if (m_scene_dirty)
+        {
+            // Counting sort the meshes by node so each node's candidates are contiguous
+            m_node_first_candidate.assign(m_transforms.size() + 1, 0);
+            for (model& model : m_models)
+            {
+                for (const mesh& mesh : model.get_meshes())
+                {
+                    ++m_node_first_candidate[model.get_hierarchy_node(mesh.get_node()) + 1];
+                }
+            }
+            for (size_t i = 1; i < m_node_first_candidate.size(); ++i)
+            {
+                m_node_first_candidate[i] += m_node_first_candidate[i - 1];
+            }
+
+            m_draw_candidates.resize(m_node_first_candidate.back());
+            std::vector<uint32_t> next_candidate(m_node_first_candidate.begin(), m_node_first_candidate.end() - 1);
+            for (model& model : m_models)
             {
-                // TODO shading in the render stage only actually supports a single directional light...
-                m_current_pass_directional_light = static_pointer_cast<directional_light>(light);
-                std::shared_ptr<framebuffer> shadow_map = light->get_shadow_map();
-                
-                glViewport(0, 0, shadow_map->get_width(), shadow_map->get_height());
-                shadow_map->bind();
+                for (mesh& mesh : model.get_meshes())
+                {
+                    uint32_t node = model.get_hierarchy_node(mesh.get_node());
+                    m_draw_candidates[next_candidate[node]++] = { &mesh, m_transforms.get_world_transform(node), node };
+                }
+            }
+
+            std::vector<aabb> world_bounds;
+            world_bounds.reserve(m_draw_candidates.size());
+            for (const draw_candidate& candidate : m_draw_candidates)
+            {
+                world_bounds.push_back(get_world_bounds(*candidate.m_mesh, candidate.m_transform));
+            }
+
+            m_scene_bvh.build(world_bounds);
+            m_scene_dirty = false;
+            m_shadow_caster_bounds_dirty = true;
+            ++m_static_shadow_generation;
+            ++m_dynamic_shadow_generation;
+            return;
+        }
+
+        bool static_casters_moved = false;
+        bool dynamic_casters_moved = false;
+
+        for (const transform_hierarchy::node_range& range : m_transforms.get_updated_ranges())
+        {
+            for (uint32_t position = range.m_begin; position < range.m_end; ++position)
+            {
+                uint32_t node = m_transforms.get_node_at(position);
+                for (uint32_t candidate = m_node_first_candidate[node]; candidate < m_node_first_candidate[node + 1]; ++candidate)
+                {
+                    draw_candidate& draw_candidate = m_draw_candidates[candidate];
+                    draw_candidate.m_transform = m_transforms.get_world_transform(node);
+                    m_scene_bvh.refit(candidate, get_world_bounds(*draw_candidate.m_mesh, draw_candidate.m_transform));
+
+                    if (draw_candidate.m_mesh->is_shadow_caster(shadow_casters::static_only))
+                    {
+                        static_casters_moved = true;
+                    }
+                    else if (draw_candidate.m_mesh->is_shadow_caster(shadow_casters::dynamic_only))
+                    {
+                        dynamic_casters_moved = true;
+                    }
+                }
+            }
+        }
+
+        m_static_shadow_generation += static_casters_moved;
+        m_dynamic_shadow_generation += dynamic_casters_moved;
+        m_shadow_caster_bounds_dirty |= static_casters_moved || dynamic_casters_moved;
+    }
+
+    void renderer::update_shadow_caster_bounds()
+    {
+        if (!m_shadow_caster_bounds_dirty)
+        {
+            return;
+        }
+
+        // The bvh root can't be used, never culled meshes like the skybox sit in it with huge bounds
+        m_shadow_caster_bounds = aabb();
+        for (uint32_t candidate = 0; candidate < m_draw_candidates.size(); ++candidate)
+        {
+            const mesh& mesh = *m_draw_candidates[candidate].m_mesh;
+            if (mesh.is_cullable() && mesh.is_shadow_caster())
+            {
+                m_shadow_caster_bounds.expand(m_scene_bvh.get_object_bounds(candidate));
+            }
+        }
+        m_shadow_caster_bounds_dirty = false;
+    }
+
+    void renderer::update_lods(const glm::vec3& eye, const glm::mat4& projection, int height)
+    {
+        // Perspective projections shrink with distance, orthographic ones don't
+        bool perspective = projection[3][3] == 0.f;
+        float pixels_per_unit = projection[1][1] * 0.5f * float(height);
+
+        // Every candidate, not just visible ones, shadow passes draw with the camera's lods too
+        std::atomic<bool> static_casters_changed = false;
+        std::atomic<bool> dynamic_casters_changed = false;
+        m_thread_pool.parallel_for(m_draw_candidates.size(), min_lod_batch, [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    draw_candidate& draw_candidate = m_draw_candidates[i];
+                    const mesh_geometry* geometry = m_geometries.get(draw_candidate.m_mesh->get_geometry());
+                    if (geometry->get_lod_count() == 1)
+                    {
+                        continue;
+                    }
+
+                    const glm::mat4& transform = draw_candidate.m_transform;
+                    float scale = std::max({ glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])) });
+                    float radius = geometry->get_bounding_sphere().m_radius * scale;
+                    glm::vec3 centre = glm::vec3(transform * glm::vec4(geometry->get_bounding_sphere().m_centre, 1.f));
+                    float distance = perspective ? std::max(glm::distance(eye, centre), radius) : 1.f;
+
+                    if (draw_candidate.m_mesh->update_lod(*geometry, radius * pixels_per_unit / distance, m_lod_pixel_error))
+                    {
+                        if (draw_candidate.m_mesh->is_shadow_caster(shadow_casters::static_only))
+                        {
+                            static_casters_changed = true;
+                        }
+                        else if (draw_candidate.m_mesh->is_shadow_caster(shadow_casters::dynamic_only))
+                        {
+                            dynamic_casters_changed = true;
+                        }
+                    }
+                }
+            });
+
+        // Cached shadows were drawn with the old lods
+        m_static_shadow_generation += static_casters_changed;
+        m_dynamic_shadow_generation += dynamic_casters_changed;
+    }
+
+    void renderer::render_shadow_atlas(float delta)
+    {
+        std::shared_ptr<framebuffer> atlas = m_shadow_atlas.get_framebuffer();
+        std::shared_ptr<framebuffer> static_atlas = m_shadow_atlas.get_static_framebuffer();
+
+        // Each tile is drawn with its own viewport, the scissor keeps clears and blits inside it. Casters are culled
+        // against each tile's own frustum. Static casters are drawn into the static atlas only when the tile or one
+        // of them moves, dynamic casters go on top of a copy of it
+        m_gl_state.set_scissor_test(true);
+        for (unsigned int i = 0; i < m_shadow_atlas.get_tile_count(); ++i)
+        {
+            const shadow_tile& tile = m_shadow_atlas.get_tile(i);
+            if (tile.m_size == 0)
+            {
+                continue;
+            }
+
+            glm::ivec3 rect(tile.m_offset, tile.m_size);
+            shadow_tile_state& static_state = tile.m_cache->m_static;
+            shadow_tile_state& state = tile.m_cache->m_live;
+            m_current_shadow_matrix = tile.m_matrix;
+
+            if (state.m_rect == rect && state.m_matrix == tile.m_matrix && state.m_static_generation == m_static_shadow_generation && state.m_dynamic_generation == m_dynamic_shadow_generation)
+            {
+                ++m_shadow_stats.m_cached_tiles;
+                continue;
+            }
+
+            m_gl_state.set_viewport(rect.x, rect.y, rect.z, rect.z);
+            m_gl_state.set_scissor(rect.x, rect.y, rect.z, rect.z);
+
+            if (static_state.m_rect != rect || static_state.m_matrix != tile.m_matrix || static_state.m_static_generation != m_static_shadow_generation)
+            {
+                // Clears respect the depth mask
+                static_atlas->bind();
+                m_gl_state.set_depth_write(true);
                 glClear(GL_DEPTH_BUFFER_BIT);
-                draw_models(delta, m_shadow_pass_material);
+                draw_models(delta, render_pass::shadow, tile.m_eye, tile.m_matrix, m_shadow_pass_material, shadow_casters::static_only);
+
+                static_state.m_rect = rect;
+                static_state.m_matrix = tile.m_matrix;
+                static_state.m_static_generation = m_static_shadow_generation;
+                ++m_shadow_stats.m_static_redraws;
             }
+
+            m_gl_state.blit(static_atlas->get_id(), atlas->get_id(), rect.x, rect.y, rect.z, rect.z, GL_DEPTH_BUFFER_BIT);
+            draw_models(delta, render_pass::shadow, tile.m_eye, tile.m_matrix, m_shadow_pass_material, shadow_casters::dynamic_only);
+
+            state.m_rect = rect;
+            state.m_matrix = tile.m_matrix;
+            state.m_static_generation = m_static_shadow_generation;
+            state.m_dynamic_generation = m_dynamic_shadow_generation;
+            ++m_shadow_stats.m_dynamic_redraws;
         }
+        m_gl_state.set_scissor_test(false);
+    }
 
-        // Normal pass
-        glCullFace(GL_BACK);
+    void renderer::render_point_shadows(float delta)
+    {
+        unsigned int resolution = m_point_shadows.get_resolution();
+        m_gl_state.set_viewport(0, 0, resolution, resolution);
 
-        int width, height;
-        get_resolution(&width, &height);
-        glViewport(0, 0, width, height);
+        // One pass per light covers all six faces. There's no static copy here, a cube is redrawn whole once the
+        // light or any caster moves
+        for (point_shadow_state* light : m_point_shadows.get_shadowed_lights())
+        {
+            if (light->m_rendered_sphere == light->m_sphere && light->m_static_generation == m_static_shadow_generation && light->m_dynamic_generation == m_dynamic_shadow_generation)
+            {
+                ++m_shadow_stats.m_cached_cubes;
+                continue;
+            }
 
-        if (m_framebuffers.size() > 0)
+            m_point_shadows.begin_light(m_gl_state, *light);
+            draw_point_shadow_casters(delta, glm::vec3(light->m_sphere), light->m_sphere.w);
+
+            light->m_rendered_sphere = light->m_sphere;
+            light->m_static_generation = m_static_shadow_generation;
+            light->m_dynamic_generation = m_dynamic_shadow_generation;
+            ++m_shadow_stats.m_cube_redraws;
+        }
+    }
+
+    void renderer::draw_point_shadow_casters(float delta, const glm::vec3& position, float range)
+    {
+        material* pass_material = m_materials.get(m_point_shadows.get_material());
+
+        frustum face_frustums[6];
+        for (unsigned int face = 0; face < 6; ++face)
         {
-            m_framebuffers.at(0)->bind();
+            face_frustums[face] = frustum::from_matrix(point_shadows::get_face_view_projection(position, range, face));
         }
 
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // The bvh narrows things down to the light's bounding box, every candidate is then tested against each face
+        glm::mat4 box = glm::ortho(-range, range, -range, range, -range, range) * glm::translate(glm::mat4(1.f), -position);
+        m_visible_candidates.clear();
+        m_intersecting_candidates.clear();
+        m_scene_bvh.query_frustum(frustum::from_matrix(box), m_visible_candidates, m_intersecting_candidates);
+        m_visible_candidates.insert(m_visible_candidates.end(), m_intersecting_candidates.begin(), m_intersecting_candidates.end());
+
+        m_render_queue.clear();
+        for (uint32_t candidate : m_visible_candidates)
+        {
+            const draw_candidate& draw_candidate = m_draw_candidates[candidate];
+            if (!draw_candidate.m_mesh->is_shadow_caster(shadow_casters::all))
+            {
+                continue;
+            }
+
+            const aabb& bounds = m_scene_bvh.get_object_bounds(candidate);
+            unsigned int face_mask = 0;
+            for (unsigned int face = 0; face < 6; ++face)
+            {
+                face_mask |= face_frustums[face].intersects(bounds) ? 1u << face : 0u;
+            }
+            if (face_mask == 0)
+            {
+                continue;
+            }
 
-        draw_models(delta);
+            // point_shadow_vertex.glsl reads the mask back out of the unused corner of the transform
+            glm::mat4 transform = draw_candidate.m_transform;
+            transform[0][3] = static_cast<float>(face_mask);
+            enqueue_candidate(draw_candidate, render_pass::shadow, transform, position, pass_material, m_shadow_lod_bias);
 
-        post_render(delta);
+            ++m_shadow_stats.m_cube_casters;
+            m_shadow_stats.m_culled_cube_faces += 6 - std::popcount(face_mask);
+        }
+
+        m_render_queue.sort();
+        m_render_queue.submit(m_geometry_arena, m_gl_state, pass_settings{});
     }
 
-    void renderer::draw_models(float delta, std::shared_ptr<material> override_material)
+    void renderer::update_software_occlusion(const glm::vec3& eye, const glm::mat4& view_projection)
     {
-        for (model& model : m_models)
+        m_software_occlusion.begin_frame(view_projection);
+        if (!m_occlusion_culling)
+        {
+            return;
+        }
+
+        cull_candidates(frustum::from_matrix(view_projection));
+
+        // Designated occluders always go in, the rest are ranked by how much of the view they could cover
+        m_occluder_candidates.clear();
+        for (uint32_t candidate : m_visible_candidates)
+        {
+            const draw_candidate& draw_candidate = m_draw_candidates[candidate];
+            const occluder_geometry* occluder = get_geometry(draw_candidate.m_mesh->get_geometry())->get_occluder();
+            occluder_mode mode = draw_candidate.m_mesh->get_occluder_mode();
+            if (occluder == nullptr || mode == occluder_mode::never || !draw_candidate.m_mesh->is_cullable())
+            {
+                continue;
+            }
+
+            if (mode == occluder_mode::always)
+            {
+                m_software_occlusion.add_occluder(*occluder, draw_candidate.m_transform);
+                continue;
+            }
+
+            // Anything around the camera, like the walls of the room it is in, is always worth it
+            const aabb& bounds = m_scene_bvh.get_object_bounds(candidate);
+            float radius = glm::length(bounds.get_extents());
+            float distance = glm::distance(eye, bounds.get_centre());
+            float size = distance > radius ? radius / distance : std::numeric_limits<float>::max();
+            if (size >= min_occluder_size)
+            {
+                m_occluder_candidates.push_back({ size, candidate });
+            }
+        }
+
+        std::sort(m_occluder_candidates.begin(), m_occluder_candidates.end(), [](const occluder_candidate& a, const occluder_candidate& b)
+            {
+                return a.m_size > b.m_size;
+            });
+
+        size_t occluder_count = 0;
+        size_t triangle_count = 0;
+        for (const occluder_candidate& occluder_candidate : m_occluder_candidates)
         {
-            model.draw(delta, override_material);
+            const draw_candidate& draw_candidate = m_draw_candidates[occluder_candidate.m_candidate];
+            const occluder_geometry* occluder = get_geometry(draw_candidate.m_mesh->get_geometry())->get_occluder();
+            if (triangle_count + occluder->m_faces.size() / 3 > max_automatic_occluder_triangles)
+            {
+                continue;
+            }
+
+            m_software_occlusion.add_occluder(*occluder, draw_candidate.m_transform);
+            triangle_count += occluder->m_faces.size() / 3;
+            if (++occluder_count == max_automatic_occluders)
+            {
+                break;
+            }
         }
+
+        m_software_occlusion.rasterize(m_thread_pool);
     }
 
-    void renderer::post_render(float delta)
+    void renderer::cull_candidates(const frustum& view_frustum)
     {
-        if (m_framebuffers.size() > 0)
+        // Whole subtrees inside the frustum are accepted by the bvh, only objects in straddling leaves get tested individually
+        m_visible_candidates.clear();
+        m_intersecting_candidates.clear();
+        m_scene_bvh.query_frustum(view_frustum, m_visible_candidates, m_intersecting_candidates);
+
+        m_cull_set.clear();
+        for (uint32_t candidate : m_intersecting_candidates)
+        {
+            m_cull_set.add(m_scene_bvh.get_object_bounds(candidate));
+        }
+        m_cull_set.cull(view_frustum, m_visibility, &m_thread_pool);
+
+        for (size_t i = 0; i < m_intersecting_candidates.size(); ++i)
         {
-            bool was_wireframe = m_wireframe;
-            if (m_wireframe)
+            if (m_visibility[i])
             {
-                toggle_wireframe();
+                m_visible_candidates.push_back(m_intersecting_candidates[i]);
             }
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-            m_framebuffers.at(0)->draw(delta);
+        }
+    }
+
+    void renderer::draw_models(float delta, render_pass pass, const glm::vec3& eye, const glm::mat4& view_projection, material_handle override_material, shadow_casters casters)
+    {
+        material* pass_material = m_materials.get(override_material);
+
+        cull_candidates(frustum::from_matrix(view_projection));
+
+        cull_stats& stats = m_cull_stats[static_cast<size_t>(pass)];
+        stats.m_occluded = 0;
+
+        // Only valid for the view the buffer was rasterized from
+        if (pass != render_pass::shadow && m_software_occlusion.is_ready())
+        {
+            m_occludee_bounds.clear();
+            for (uint32_t candidate : m_visible_candidates)
+            {
+                m_occludee_bounds.push_back(m_scene_bvh.get_object_bounds(candidate));
+            }
+            stats.m_occluded = m_software_occlusion.test(m_occludee_bounds, m_visibility, &m_thread_pool);
+
+            size_t visible_count = 0;
+            for (size_t i = 0; i < m_visible_candidates.size(); ++i)
+            {
+                if (m_visibility[i])
+                {
+                    m_visible_candidates[visible_count++] = m_visible_candidates[i];
+                }
+            }
+            m_visible_candidates.resize(visible_count);
+        }
+
+        stats.m_visible = static_cast<unsigned int>(m_visible_candidates.size());
+        stats.m_culled = static_cast<unsigned int>(m_draw_candidates.size()) - stats.m_visible;
 
-            if (was_wireframe)
+        m_render_queue.clear();
+        for (uint32_t candidate : m_visible_candidates)
+        {
+            if (pass == render_pass::shadow && !m_draw_candidates[candidate].m_mesh->is_shadow_caster(casters))
             {
-                toggle_wireframe();
+                continue;
             }
+            unsigned int lod_bias = pass == render_pass::shadow ? m_shadow_lod_bias : 0;
+            enqueue_candidate(m_draw_candidates[candidate], pass, m_draw_candidates[candidate].m_transform, eye, pass_material, lod_bias);
         }
+
+        pass_settings settings;
+        settings.m_polygon_mode = m_wireframe ? polygon_mode::line : polygon_mode::fill;
+        settings.m_depth_prepassed = pass == render_pass::opaque && m_depth_prepass.is_active();
+        settings.m_samples_query = m_depth_prepass.get_samples_query(pass);
+
+        m_render_queue.sort();
+        m_render_queue.submit(m_geometry_arena, m_gl_state, settings);
     }
 
-    std::shared_ptr<texture> renderer::get_register_texture(std::string path, bool isSRGB, texture_type type, int width, int height)
+    void renderer::enqueue_candidate(const draw_candidate& candidate, render_pass pass, const glm::mat4& transform, const glm::vec3& eye, material* pass_material, unsigned int lod_bias)
+    {
+        const mesh& mesh = *candidate.m_mesh;
+        material* mesh_material = m_materials.get(mesh.get_material());
+        material* deferred_material = m_deferred_shading ? m_materials.get(mesh_material->get_deferred_variant()) : nullptr;
+        mesh.enqueue(m_render_queue, pass, m_geometries.get(mesh.get_geometry()), mesh_material, deferred_material, transform, eye, pass_material, lod_bias);
+    }
+
+    void renderer::post_render(float delta)
     {
-        auto predicate = [path](std::shared_ptr<texture>& texture)
+        if (m_framebuffers.size() > 0)
+        {
+            // The quad always draws filled, its pipeline state doesn't take the wireframe toggle
+            m_gl_state.bind_framebuffer(0);
+            m_framebuffers.at(0)->draw(delta);
+        }
+    }
+
+    texture_handle renderer::get_register_texture(std::string path, bool isSRGB, texture_type type, int width, int height, int layers)
+    {
+        auto predicate = [path](const texture& texture)
             {
-                return !path.empty() && texture->get_path() == path;
+                return !path.empty() && texture.get_path() == path;
             };
 
         if (!path.empty())
         {
             if (const auto it = std::find_if(m_textures.begin(), m_textures.end(), predicate); it != m_textures.end())
             {
-                return *it;
+                return m_textures.get_handle(static_cast<uint32_t>(it - m_textures.begin()));
             }
         }
 
         // Texture not found or path was empty so cannot be used to compare
-        std::shared_ptr<texture> texture_ptr = nullptr;
         if (!path.empty())
         {
             std::cout << "TEXTURE::REGISTER: " << path  << " sRGB: " << isSRGB << std::endl;
-            texture_ptr = std::make_shared<texture>(path, type, isSRGB);
+            return m_textures.insert(texture(path, type, isSRGB));
         }
         else if (width > 0 && height > 0)
         {
             std::cout << "TEXTURE::REGISTER: " << width << "x" << height << " sRGB: " << isSRGB << std::endl;
-            texture_ptr = std::make_shared<texture>(width, height, type, isSRGB);
+            return m_textures.insert(texture(width, height, type, isSRGB, layers));
         }
-        else
+
+        std::cout << "ERROR::TEXTURE::REGISTER: Invalid texture params: " << path << " | " << width << "x" << height << std::endl;
+        return {};
+    }
+
+    shader_handle renderer::register_shader(const char* vertex_path, const char* fragment_path, shader_type type, const char* geometry_path)
+    {
+        shader_handle handle = m_shaders.insert(shader(vertex_path, fragment_path, type, geometry_path));
+        m_shaders.get(handle)->set_sort_id(handle.m_index);
+        return handle;
+    }
+
+    material_handle renderer::register_material(const material& material)
+    {
+        std::cout << "MATERIAL::REGISTER: " << material.get_name() << std::endl;
+        material_handle handle = m_materials.insert(material);
+        m_materials.get(handle)->set_sort_id(handle.m_index);
+
+        // Lit materials get a twin with the same inputs for the g-buffer pass
+        if (material.get_shader_type() == shader_type::lit)
         {
-            std::cout << "ERROR::TEXTURE::REGISTER: Invalid texture params: " << path << " | " << width << "x" << height << std::endl;
+            material_handle deferred_variant = register_material(material.make_variant(m_deferred_lighting.get_gbuffer_shader()));
+            m_materials.get(handle)->set_deferred_variant(deferred_variant);
         }
+        return handle;
+    }
+
+    geometry_handle renderer::register_geometry(const vertices& vertices, const faces& faces, aabb bounds, const std::vector<lod_faces>& lods)
+    {
+        return m_geometries.insert(mesh_geometry(vertices, faces, bounds, lods));
+    }
+
+    geometry_handle renderer::register_geometry(const packed_geometry& geometry)
+    {
+        return m_geometries.insert(mesh_geometry(geometry));
+    }
+
+    model_handle renderer::register_model(std::string path, glm::mat4 transform, unsigned int shader_index)
+    {
+        model_handle handle = m_models.insert(model(path, transform, shader_index));
+        model* model = m_models.get(handle);
 
-        if (texture_ptr != nullptr)
+        // Imported nodes go in right after the root so they are contiguous ids (see model::get_hierarchy_node)
+        uint32_t root_node = m_transforms.add_node(transform_hierarchy::invalid_node, transform);
+        for (const mesh_node& node : model->get_nodes())
         {
-            m_textures.push_back(texture_ptr);
+            uint32_t parent = node.m_parent == mesh_node::no_parent ? root_node : root_node + 1 + node.m_parent;
+            m_transforms.add_node(parent, node.m_transform);
         }
-        return texture_ptr;
+        model->set_root_node(root_node);
+
+        m_scene_dirty = true;
+        return handle;
     }
 
-    std::shared_ptr<shader> renderer::register_shader(const char* vertex_path, const char* fragment_path, shader_type type)
+    void renderer::set_model_transform(model_handle model_handle, const glm::mat4& transform)
     {
-        std::shared_ptr<shader> shader_ptr = std::make_shared<shader>(shader(vertex_path, fragment_path, type));
-        m_shaders.push_back(shader_ptr);
-        return shader_ptr;
+        model* model = m_models.get(model_handle);
+        if (model == nullptr)
+        {
+            return;
+        }
+        model->set_transform(transform);
+        m_transforms.set_local_transform(model->get_root_node(), transform);
     }
 
-    void renderer::register_material(std::shared_ptr<material> material)
+    void renderer::set_model_node_transform(model_handle model_handle, uint32_t node, const glm::mat4& transform)
     {
-        std::cout << "MATERIAL::REGISTER: " << material->get_name() << std::endl;
-        m_materials.push_back(material);
+        model* model = m_models.get(model_handle);
+        if (model == nullptr || node >= model->get_nodes().size())
+        {
+            std::cout << "ERROR::MODEL::INVALID NODE: " << node << std::endl;
+            return;
+        }
+        m_transforms.set_local_transform(model->get_hierarchy_node(node), transform);
     }
 
-    model* renderer::register_model(std::string path, glm::mat4 transform, unsigned int shader_index)
+    void renderer::set_model_shadow_flags(model_handle model_handle, bool casts_shadows, bool is_static)
     {
-        m_models.push_back(model(path, transform, shader_index));
-        return &m_models.back();
+        model* model = m_models.get(model_handle);
+        if (model == nullptr)
+        {
+            return;
+        }
+        model->set_shadow_flags(casts_shadows, is_static);
+
+        // The model may have moved between the static and dynamic sets, either way both are stale
+        ++m_static_shadow_generation;
+        ++m_dynamic_shadow_generation;
+        m_shadow_caster_bounds_dirty = true;
     }
 
-    std::shared_ptr<directional_light> renderer::register_directional_light(glm::vec3 direction, glm::vec3 position, glm::vec3 colour, float diffuse, float ambient, float specular)
+    void renderer::set_model_occluder_mode(model_handle model_handle, occluder_mode mode)
     {
-        // TODO this requires direcitonal lights to be registered first...
-        if (m_lights.size() == 0)
+        if (model* model = m_models.get(model_handle); model != nullptr)
         {
-            std::shared_ptr<shader> shadow_map_shader = register_shader("assets/shaders/to_depth_vertex.glsl", "assets/shaders/empty_fragment.glsl", slam_renderer::shader_type::shadow_pass);
-            m_shadow_pass_material = std::make_shared<material>(shadow_map_shader, nullptr, 0.f);
-            register_material(m_shadow_pass_material);
+            model->set_occluder_mode(mode);
         }
+    }
 
+    std::shared_ptr<directional_light> renderer::register_directional_light(glm::vec3 direction, glm::vec3 position, glm::vec3 colour, float diffuse, float ambient, float specular)
+    {
         std::shared_ptr<directional_light> light_ptr = std::make_shared<directional_light>(direction, position, colour, diffuse, ambient, specular);
         m_lights.push_back(light_ptr);
         return light_ptr;
@@ -186,37 +770,47 @@ namespace slam_renderer
         return light_ptr;
     }
 
-    std::shared_ptr<framebuffer> renderer::register_framebuffer(framebuffer_type type, std::shared_ptr<shader> shader, int width, int height)
+    std::shared_ptr<framebuffer> renderer::register_framebuffer(framebuffer_type type, shader_handle shader, int width, int height, int layers)
     {
         if (width == 0 && height == 0)
         {
             get_resolution(&width, &height);
         }
-        std::shared_ptr<framebuffer> framebuffer_ptr = std::make_shared<framebuffer>(width, height, shader, type);
+        std::shared_ptr<framebuffer> framebuffer_ptr = std::make_shared<framebuffer>(width, height, shader, type, layers);
         m_framebuffers.push_back(framebuffer_ptr);
         return framebuffer_ptr;
     }
 
 void renderer::free()
 {
+    m_render_queue.free();
+    m_frame_uniforms.free();
+    m_light_uniforms.free();
+    m_shadow_uniforms.free();
+    m_shadow_atlas.free();
+    m_point_shadows.free();
+    m_light_clusters.free();
+    m_deferred_lighting.free();
+    m_depth_prepass.free();
+
     for (auto& framebuffer : m_framebuffers)
     {
         framebuffer->free();
     }
 
-    for (model& model : m_models)
-    {
-        model.free();
-    }
+    m_mesh_cache.free();
+
+    // Every mesh_geometry is a range of the arena so this frees them all
+    m_geometry_arena.free();
 
-    for (auto& shader : m_shaders)
+    for (shader& shader : m_shaders)
     {
-        shader->free();
+        shader.free();
     }
 
-    for (auto& texture : m_textures)
+    for (texture& texture : m_textures)
     {
-        texture->free();
+        texture.free();
     }
 }
 
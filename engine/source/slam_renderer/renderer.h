@@ -15,11 +15,40 @@
 #include "light.h"
 #include "material.h"
 #include "framebuffer.h"
+#include "render_queue.h"
+#include "culling.h"
+#include "bvh.h"
+#include "mesh_cache.h"
+#include "geometry_arena.h"
+#include "transform_hierarchy.h"
+#include "uniform_buffer.h"
+#include "light_clusters.h"
+#include "deferred_lighting.h"
+#include "depth_prepass.h"
+#include "shadow_atlas.h"
+#include "point_shadows.h"
+#include "software_occlusion.h"
+#include "gl_state.h"
+#include "handles.h"
 
 #include <slam_utils/patterns/singleton.h>
+#include <slam_utils/threading/thread_pool.h>
+#include <slam_utils/containers/slot_map.h>
 
 namespace slam_renderer
 {
+// Shadow atlas tiles and point light cubes over the last frame, cached ones weren't touched at all
+struct shadow_stats
+{
+    unsigned int m_cached_tiles = 0;
+    unsigned int m_static_redraws = 0;
+    unsigned int m_dynamic_redraws = 0;
+    unsigned int m_cached_cubes = 0;
+    unsigned int m_cube_redraws = 0;
+    // Caster instances drawn into cubes and cube faces they were culled from
+    unsigned int m_cube_casters = 0;
+    unsigned int m_culled_cube_faces = 0;
+};
 
 class renderer : public singleton<renderer>
 {
@@ -28,22 +57,53 @@ public:
     renderer(GLFWwindow* window);
 
     void render(float delta);
-    void draw_models(float delta, std::shared_ptr<material> override_material = nullptr);
+    // Culls every mesh against view_projection and submits the visible set through the render queue
+    // Shadow passes only draw the given casters
+    void draw_models(float delta, render_pass pass, const glm::vec3& eye, const glm::mat4& view_projection, material_handle override_material = {}, shadow_casters casters = shadow_casters::all);
     void post_render(float delta);
 
     void toggle_wireframe();
+    // Switches lit materials between clustered forward and deferred shading
+    void toggle_deferred_shading();
+    // Automatic (measured overdraw) -> always -> never
+    void cycle_depth_prepass_mode();
     void toggle_persepctive();
+    void toggle_occlusion_culling();
 
-    std::shared_ptr<texture> get_register_texture(std::string path, bool isSRGB = false, texture_type type = texture_type::texture_2d, int width = 0, int height = 0);
-    std::shared_ptr<shader> register_shader(const char* vertex_path, const char* fragment_path, shader_type type = shader_type::unlit);
-    void register_material(std::shared_ptr<material> material);
-    model* register_model(std::string path, glm::mat4 transform, unsigned int shader_index = 0);
+    // Meshes switch to the coarsest lod that strays less than this many pixels from the full detail surface
+    void set_lod_pixel_error(float pixel_error)
+    {
+        m_lod_pixel_error = pixel_error;
+    }
+
+    // Shadow passes draw this many lods coarser than the camera sees
+    void set_shadow_lod_bias(unsigned int bias)
+    {
+        m_shadow_lod_bias = bias;
+        ++m_static_shadow_generation;
+        ++m_dynamic_shadow_generation;
+    }
+
+    texture_handle get_register_texture(std::string path, bool isSRGB = false, texture_type type = texture_type::texture_2d, int width = 0, int height = 0, int layers = 1);
+    shader_handle register_shader(const char* vertex_path, const char* fragment_path, shader_type type = shader_type::unlit, const char* geometry_path = nullptr);
+    material_handle register_material(const material& material);
+    geometry_handle register_geometry(const vertices& vertices, const faces& faces, aabb bounds, const std::vector<lod_faces>& lods = {});
+    // Already packed, e.g. views into a mapped baked model
+    geometry_handle register_geometry(const packed_geometry& geometry);
+    model_handle register_model(std::string path, glm::mat4 transform, unsigned int shader_index = 0);
+    void set_model_transform(model_handle model, const glm::mat4& transform);
+    // Local transform of one of the model's imported nodes, only that node's subtree gets updated
+    void set_model_node_transform(model_handle model, uint32_t node, const glm::mat4& transform);
+    // Every mesh of the model casts shadows by default and is dynamic (redrawn into the shadow map every frame)
+    void set_model_shadow_flags(model_handle model, bool casts_shadows, bool is_static);
+    // By default meshes become occluders when they cover enough of the screen
+    void set_model_occluder_mode(model_handle model, occluder_mode mode);
 
     std::shared_ptr<directional_light> register_directional_light(glm::vec3 direction, glm::vec3 position, glm::vec3 colour, float diffuse, float ambient, float specular);
     std::shared_ptr<point_light> register_point_light(float constant, float linear, float quadratic, glm::vec3 position, glm::vec3 colour, float diffuse, float ambient, float specular);
     std::shared_ptr<spot_light> register_spot_light(float angle, float outer_angle, glm::vec3 direction, glm::vec3 position, glm::vec3 colour, float diffuse, float ambient, float specular);
 
-    std::shared_ptr<framebuffer> register_framebuffer(framebuffer_type type, std::shared_ptr<slam_renderer::shader> shader, int width = 0, int height = 0);
+    std::shared_ptr<framebuffer> register_framebuffer(framebuffer_type type, shader_handle shader, int width = 0, int height = 0, int layers = 1);
 
     void free();
 
@@ -67,38 +127,67 @@ public:
         return m_lights;
     }
 
-    const std::shared_ptr<material> find_material(std::string name)
+    // Handles resolve to nullptr once the resource has been removed
+    texture* get_texture(texture_handle handle)
+    {
+        return m_textures.get(handle);
+    }
+
+    shader* get_shader(shader_handle handle)
+    {
+        return m_shaders.get(handle);
+    }
+
+    material* get_material(material_handle handle)
+    {
+        return m_materials.get(handle);
+    }
+
+    mesh_geometry* get_geometry(geometry_handle handle)
+    {
+        return m_geometries.get(handle);
+    }
+
+    model* get_model(model_handle handle)
+    {
+        return m_models.get(handle);
+    }
+
+    material_handle find_material(std::string name)
     {
         if (name.empty())
         {
             std::cout << "ERROR::MATERIAL::CANNOT FETCH A MATERIAL WITH BLANK NAME" << std::endl;
-            return nullptr;
+            return {};
         }
-        auto predicate = [name](std::shared_ptr<material>& material)
+        auto predicate = [name](const material& material)
             {
-                return material->get_name() == name;
+                return material.get_name() == name;
             };
 
         if (const auto it = std::find_if(m_materials.begin(), m_materials.end(), predicate); it != m_materials.end())
         {
-            return *it;
+            return m_materials.get_handle(static_cast<uint32_t>(it - m_materials.begin()));
         }
         else
         {
-            return nullptr;
+            return {};
         }
 
     }
 
-    const std::shared_ptr<shader> get_shader(unsigned int index)
+    // Shaders are never removed so registration order is the dense order. The renderer's own shaders come first,
+    // indices count from the first shader registered from outside
+    shader_handle get_shader(unsigned int index)
     {
+        index += m_internal_shader_count;
         if (index >= m_shaders.size())
         {
             std::cout << "ERROR::SHADER::OUT OF BOUNDS index: " << index << std::endl;
-            return nullptr;
+            return {};
         }
 
-        return m_shaders[index];
+        return m_shaders.get_handle(index);
     }
 
     void get_resolution(int* width, int* height) const
@@ -106,27 +195,194 @@ public:
         glfwGetWindowSize(m_window, width, height);
     }
 
-    std::shared_ptr<directional_light> get_current_pass_directional_light()
+    // Light space matrix of the shadow atlas tile being rendered
+    const glm::mat4& get_current_shadow_matrix() const
+    {
+        return m_current_shadow_matrix;
+    }
+
+    // Visible/culled mesh counts from the last time the pass was drawn
+    const cull_stats& get_cull_stats(render_pass pass) const
+    {
+        return m_cull_stats[static_cast<size_t>(pass)];
+    }
+
+    const shadow_stats& get_shadow_stats() const
+    {
+        return m_shadow_stats;
+    }
+
+    const shadow_atlas& get_shadow_atlas() const
+    {
+        return m_shadow_atlas;
+    }
+
+    const point_shadows& get_point_shadows() const
+    {
+        return m_point_shadows;
+    }
+
+    const software_occlusion& get_software_occlusion() const
+    {
+        return m_software_occlusion;
+    }
+
+    gl_state& get_gl_state()
+    {
+        return m_gl_state;
+    }
+
+    bool is_deferred_shading() const
+    {
+        return m_deferred_shading;
+    }
+
+    const depth_prepass& get_depth_prepass() const
+    {
+        return m_depth_prepass;
+    }
+
+    const deferred_lighting& get_deferred_lighting() const
+    {
+        return m_deferred_lighting;
+    }
+
+    const light_clusters& get_light_clusters() const
+    {
+        return m_light_clusters;
+    }
+
+    geometry_arena& get_geometry_arena()
+    {
+        return m_geometry_arena;
+    }
+
+    mesh_cache& get_mesh_cache()
+    {
+        return m_mesh_cache;
+    }
+
+    thread_pool& get_thread_pool()
+    {
+        return m_thread_pool;
+    }
+
+    // Hierarchy over the world bounds of every mesh, object ids index the scene meshes (see get_scene_mesh)
+    const bvh& get_scene_bvh() const
     {
-        return m_current_pass_directional_light;
+        return m_scene_bvh;
+    }
+
+    mesh* get_scene_mesh(uint32_t object, glm::mat4* world_transform = nullptr)
+    {
+        if (world_transform != nullptr)
+        {
+            *world_transform = m_draw_candidates[object].m_transform;
+        }
+        return m_draw_candidates[object].m_mesh;
     }
 
+private:
+    struct draw_candidate;
+
+    void update_draw_candidates();
+    // Directional cascades are pulled back to these so casters outside the view still reach them
+    void update_shadow_caster_bounds();
+    // Picks every candidate's lod from its size on screen
+    void update_lods(const glm::vec3& eye, const glm::mat4& projection, int height);
+    // Fills m_visible_candidates with every candidate inside the frustum
+    void cull_candidates(const frustum& frustum);
+    // Rasterizes this frame's occluders for the camera passes to be tested against
+    void update_software_occlusion(const glm::vec3& eye, const glm::mat4& view_projection);
+    void render_shadow_atlas(float delta);
+    void render_point_shadows(float delta);
+    // Every caster in range of the light drawn once, each tagged with the cube faces its bounds overlap
+    void draw_point_shadow_casters(float delta, const glm::vec3& position, float range);
+    // Resolves the candidate's geometry and materials from the pools and pushes it into m_render_queue
+    void enqueue_candidate(const draw_candidate& candidate, render_pass pass, const glm::mat4& transform, const glm::vec3& eye, material* pass_material, unsigned int lod_bias);
+
 private:
     GLFWwindow* m_window;
     camera* m_camera;
 
-    std::vector<std::shared_ptr<texture>> m_textures;
-    std::vector<std::shared_ptr<shader>> m_shaders;
-    std::vector<std::shared_ptr<material>> m_materials;
-    std::vector<model> m_models;
+    gl_state m_gl_state;
+
+    slot_map<texture> m_textures;
+    slot_map<shader> m_shaders;
+    unsigned int m_internal_shader_count = 0;
+    slot_map<material> m_materials;
+    slot_map<mesh_geometry> m_geometries;
+    geometry_arena m_geometry_arena;
+    slot_map<model> m_models;
+    mesh_cache m_mesh_cache;
+
+    render_queue m_render_queue;
+    uniform_buffer m_frame_uniforms;
+    uniform_buffer m_light_uniforms;
+    uniform_buffer m_shadow_uniforms;
+    light_clusters m_light_clusters;
+    std::vector<local_light_data> m_local_lights;
+    deferred_lighting m_deferred_lighting;
+    depth_prepass m_depth_prepass;
+
+    // Model roots and their imported nodes, world matrices are only recomputed for subtrees that changed
+    transform_hierarchy m_transforms;
+
+    // Every mesh in the scene with its world transform, shared by all passes. Only rebuilt when models are
+    // registered, meshes under moved nodes are updated in place and refit in the bvh
+    struct draw_candidate
+    {
+        mesh* m_mesh;
+        glm::mat4 m_transform;
+        uint32_t m_node;
+    };
+    std::vector<draw_candidate> m_draw_candidates;
+    // Candidates are grouped by hierarchy node, node n owns [m_node_first_candidate[n], m_node_first_candidate[n + 1])
+    std::vector<uint32_t> m_node_first_candidate;
+    bool m_scene_dirty = true;
+    bvh m_scene_bvh;
+    // World bounds of every cullable shadow caster, recomputed after casters move
+    aabb m_shadow_caster_bounds;
+    bool m_shadow_caster_bounds_dirty = true;
+
+    // Bumped whenever a static/dynamic shadow caster moves or the scene changes, atlas tiles rendered with an
+    // older generation are stale (see shadow_tile_state)
+    uint32_t m_static_shadow_generation = 0;
+    uint32_t m_dynamic_shadow_generation = 0;
+    shadow_atlas m_shadow_atlas;
+    point_shadows m_point_shadows;
+    shadow_stats m_shadow_stats;
+
+    software_occlusion m_software_occlusion;
+    struct occluder_candidate
+    {
+        float m_size;
+        uint32_t m_candidate;
+    };
+    std::vector<occluder_candidate> m_occluder_candidates;
+    bool m_occlusion_culling = true;
+
+    float m_lod_pixel_error = 1.f;
+    unsigned int m_shadow_lod_bias = 1;
+
+    // Per pass scratch
+    std::vector<uint32_t> m_visible_candidates;
+    std::vector<uint32_t> m_intersecting_candidates;
+    cull_set m_cull_set;
+    std::vector<uint8_t> m_visibility;
+    std::vector<aabb> m_occludee_bounds;
+    cull_stats m_cull_stats[5];
+
+    thread_pool m_thread_pool;
 
     std::vector<std::shared_ptr<framebuffer>> m_framebuffers;
 
     std::vector<std::shared_ptr<light>> m_lights;
-    std::shared_ptr<directional_light> m_current_pass_directional_light;
-    std::shared_ptr<material> m_shadow_pass_material;
+    glm::mat4 m_current_shadow_matrix = glm::mat4(1.f);
+    material_handle m_shadow_pass_material;
 
     bool m_wireframe = false;
+    bool m_deferred_shading = false;
     bool m_perspective = true;
 };
 }
\ No newline at end of file
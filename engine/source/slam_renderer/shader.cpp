@@ -1,16 +1,51 @@
 #include "shader.h"
 
+#include <algorithm>
+
 #include <glm/gtc/type_ptr.hpp>
 #include "light.h"
+#include "uniform_buffer.h"
 #include "renderer.h"
+#include "vertex_format.h"
+
+namespace
+{
+    // Decoding of the geometry_arena's packed vertices, shared by every vertex shader
+    static const char* const vertex_decode_path = "assets/shaders/vertex_decode.glsl";
+
+    // Goes right after the #version line, #line keeps compile errors pointing at the shader's own lines
+    void add_vertex_decode(std::string& source)
+    {
+        static const std::string vertex_decode = []()
+            {
+                std::ifstream file(vertex_decode_path, std::fstream::in);
+                if (!file.is_open())
+                {
+                    std::cout << "ERROR::SHADER::VERTEX DECODE::COULD NOT OPEN" << std::endl;
+                    return std::string();
+                }
+                return "#define VERTEX_PAGE_SHIFT " + std::to_string(slam_renderer::vertex_page_shift) + "\n"
+                    + std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()) + "\n#line 2\n";
+            }();
+
+        size_t version_end = source.find('\n');
+        if (source.compare(0, 8, "#version") != 0 || version_end == std::string::npos)
+        {
+            std::cout << "ERROR::SHADER::VERTEX::NO VERSION LINE" << std::endl;
+            return;
+        }
+        source.insert(version_end + 1, vertex_decode);
+    }
+}
 
 namespace slam_renderer
 {
-shader::shader(const char* vertex_path, const char* fragment_path, shader_type type)
+shader::shader(const char* vertex_path, const char* fragment_path, shader_type type, const char* geometry_path)
     : m_type(type)
 {
     m_vertex_path = vertex_path;
     m_fragment_path = fragment_path;
+    m_geometry_path = geometry_path != nullptr ? geometry_path : "";
 
     // Read in the vertex shader
     std::ifstream vertex_shader_file(vertex_path, std::fstream::in);
@@ -32,6 +67,7 @@ shader::shader(const char* vertex_path, const char* fragment_path, shader_type t
         std::cout << "ERROR::SHADER::VERTEX::COULD NOT OPEN\n" << std::endl;
     }
 
+    add_vertex_decode(vertex_shader_source);
     const char* vertex_shader_source_c = vertex_shader_source.c_str();
 
     // Read in fragment shader
@@ -55,6 +91,31 @@ shader::shader(const char* vertex_path, const char* fragment_path, shader_type t
     }
 
     const char* fragment_shader_source_c = fragment_shader_source.c_str();
+
+    // Optional geometry shader
+    std::string geometry_shader_source;
+    if (geometry_path != nullptr)
+    {
+        std::ifstream geometry_shader_file(geometry_path, std::fstream::in);
+        geometry_shader_file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        if (geometry_shader_file.is_open())
+        {
+            try
+            {
+                geometry_shader_source = std::string(std::istreambuf_iterator<char>(geometry_shader_file), std::istreambuf_iterator<char>());
+            }
+            catch (std::ifstream::failure e)
+            {
+                std::cout << "ERROR::SHADER::GEOMETRY::COULD NOT READ\n" << std::endl;
+            }
+        }
+        else
+        {
+            std::cout << "ERROR::SHADER::GEOMETRY::COULD NOT OPEN\n" << std::endl;
+        }
+    }
+
+    const char* geometry_shader_source_c = geometry_shader_source.c_str();
     
     // Compile vertex shader
     int success;
@@ -86,10 +147,32 @@ shader::shader(const char* vertex_path, const char* fragment_path, shader_type t
         __debugbreak();
     }
 
+    // Compile geometry shader
+    unsigned int geometry_shader = 0;
+    if (geometry_path != nullptr)
+    {
+        geometry_shader = glCreateShader(GL_GEOMETRY_SHADER);
+        glShaderSource(geometry_shader, 1, &geometry_shader_source_c, nullptr);
+        glCompileShader(geometry_shader);
+        glGetShaderiv(geometry_shader, GL_COMPILE_STATUS, &success);
+
+        if (!success)
+        {
+            char infoLog[512];
+            glGetShaderInfoLog(geometry_shader, 512, NULL, infoLog);
+            std::cout << "ERROR::SHADER::GEOMETRY::COMPILATION_FAILED\n" << infoLog << std::endl;
+            __debugbreak();
+        }
+    }
+
     // Compile the shader program
     m_id = glCreateProgram();
     glAttachShader(m_id, vertex_shader);
     glAttachShader(m_id, fragment_shader);
+    if (geometry_shader != 0)
+    {
+        glAttachShader(m_id, geometry_shader);
+    }
     glLinkProgram(m_id);
 
     glGetProgramiv(m_id, GL_LINK_STATUS, &success);
@@ -101,68 +184,145 @@ shader::shader(const char* vertex_path, const char* fragment_path, shader_type t
         __debugbreak();
     }
 
+    // Shared uniform blocks (per-frame camera data etc.) always live at the same binding points
+    uniform_buffer::bind_blocks(m_id);
+    build_uniform_table();
+
     // Delete the shaders
     glDeleteShader(vertex_shader);
     glDeleteShader(fragment_shader);
+    if (geometry_shader != 0)
+    {
+        glDeleteShader(geometry_shader);
+    }
 }
 
 void shader::use()
 {
-    if (m_type == shader_type::unlit_cube)
+    renderer::get_instance()->get_gl_state().use_program(m_id);
+}
+
+void shader::build_uniform_table()
+{
+    m_uniforms.clear();
+
+    int uniform_count = 0;
+    glGetProgramiv(m_id, GL_ACTIVE_UNIFORMS, &uniform_count);
+
+    char name[256];
+    for (int i = 0; i < uniform_count; ++i)
     {
-        glDepthFunc(GL_LEQUAL);
+        int length = 0;
+        int size = 0;
+        GLenum type;
+        glGetActiveUniform(m_id, i, sizeof(name), &length, &size, &type, name);
+
+        std::string uniform_name(name, length);
+        int location = glGetUniformLocation(m_id, uniform_name.c_str());
+        if (location == -1)
+        {
+            // Uniforms in blocks have no location
+            continue;
+        }
+
+        // Arrays of basic types are reported once as name[0], accept the bare name too and add every element
+        if (size_t bracket = uniform_name.rfind("[0]"); bracket != std::string::npos && bracket + 3 == uniform_name.size())
+        {
+            std::string base_name = uniform_name.substr(0, bracket);
+            m_uniforms.push_back({ fnv1a(base_name), location });
+            for (int element = 1; element < size; ++element)
+            {
+                std::string element_name = base_name + "[" + std::to_string(element) + "]";
+                m_uniforms.push_back({ fnv1a(element_name), glGetUniformLocation(m_id, element_name.c_str()) });
+            }
+        }
+        m_uniforms.push_back({ fnv1a(uniform_name), location });
     }
 
-    glUseProgram(m_id);
+    std::sort(m_uniforms.begin(), m_uniforms.end(),
+        [](const uniform_entry& a, const uniform_entry& b)
+        {
+            return a.m_hash < b.m_hash;
+        });
 }
 
-void shader::post_draw()
+int shader::find_location(uniform_name name) const
 {
-    if (m_type == shader_type::unlit_cube)
+    auto it = std::lower_bound(m_uniforms.begin(), m_uniforms.end(), name.m_hash,
+        [](const uniform_entry& entry, uint64_t hash)
+        {
+            return entry.m_hash < hash;
+        });
+
+    if (it == m_uniforms.end() || it->m_hash != name.m_hash)
     {
-        glDepthFunc(GL_LESS);
+        return -1;
     }
+    return it->m_location;
+}
+
+void shader::set(uniform<bool> uniform, bool value) const
+{
+    glUniform1i(uniform.m_location, (int)value);
 }
 
-void shader::set_bool(const std::string& name, bool value) const
+void shader::set(uniform<int> uniform, int value) const
 {
-    glUniform1i(glGetUniformLocation(m_id, name.c_str()), (int)value);
+    glUniform1i(uniform.m_location, value);
 }
-void shader::set_int(const std::string& name, int value) const
+
+void shader::set(uniform<float> uniform, float value) const
 {
-    glUniform1i(glGetUniformLocation(m_id, name.c_str()), value);
+    glUniform1f(uniform.m_location, value);
 }
-void shader::set_float(const std::string& name, float value) const
+
+void shader::set(uniform<glm::vec3> uniform, const glm::vec3& vec) const
 {
-    glUniform1f(glGetUniformLocation(m_id, name.c_str()), value);
+    glUniform3fv(uniform.m_location, 1, glm::value_ptr(vec));
 }
 
-void shader::set_vec3(const std::string& name, const glm::vec3& vec) const
+void shader::set(uniform<glm::mat4> uniform, const glm::mat4& mat) const
 {
-    int uniform = glGetUniformLocation(m_id, name.c_str());
+    glUniformMatrix4fv(uniform.m_location, 1, GL_FALSE, glm::value_ptr(mat));
+}
 
-    if (SHADER_VERBOSE_ERRORS && uniform == -1)
+void shader::set_bool(uniform_name name, bool value) const
+{
+    set(find_uniform<bool>(name), value);
+}
+void shader::set_int(uniform_name name, int value) const
+{
+    set(find_uniform<int>(name), value);
+}
+void shader::set_float(uniform_name name, float value) const
+{
+    set(find_uniform<float>(name), value);
+}
+
+void shader::set_vec3(uniform_name name, const glm::vec3& vec) const
+{
+    uniform<glm::vec3> uniform = find_uniform<glm::vec3>(name);
+
+    if (SHADER_VERBOSE_ERRORS && !uniform.is_valid())
     {
-        std::cout << "ERROR::SHADER::COULD NOT UPDATE UNIFORM: " << name.c_str() << std::endl;
+        std::cout << "ERROR::SHADER::COULD NOT UPDATE UNIFORM: " << name.m_name << std::endl;
         return;
     }
-    glUniform3fv(uniform, 1, glm::value_ptr(vec));
+    set(uniform, vec);
 }
 
-void shader::set_mat4(const std::string& name, const glm::mat4& mat) const
+void shader::set_mat4(uniform_name name, const glm::mat4& mat) const
 {
-    int uniform = glGetUniformLocation(m_id, name.c_str());
+    uniform<glm::mat4> uniform = find_uniform<glm::mat4>(name);
 
-    if (SHADER_VERBOSE_ERRORS && uniform == -1)
+    if (SHADER_VERBOSE_ERRORS && !uniform.is_valid())
     {
-        std::cout << "ERROR::SHADER::COULD NOT UPDATE UNIFORM: " << name << std::endl;
+        std::cout << "ERROR::SHADER::COULD NOT UPDATE UNIFORM: " << name.m_name << std::endl;
         return;
     }
-
-    glUniformMatrix4fv(uniform, 1, GL_FALSE, glm::value_ptr(mat));
+    set(uniform, mat);
 }
 
-
 void shader::free()
 {
     glDeleteProgram(m_id);
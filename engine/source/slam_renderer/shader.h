@@ -4,10 +4,14 @@
 #include <glm/glm.hpp>
 
 #include <string>
+#include <string_view>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+#include <slam_utils/hash/fnv1a.h>
+
 #include "texture.h"
 
 #define SHADER_VERBOSE_ERRORS 1
@@ -19,22 +23,72 @@ enum class shader_type
     lit,
     unlit,
     unlit_cube, // Doesn't write to depth
-    shadow_pass
+    shadow_pass,
+    depth_prepass, // Position only like shadow_pass, camera comes from the frame block
+    point_shadow_pass, // Position only, a geometry shader sends each triangle to the cube faces it's visible from
+    gbuffer // Same material inputs as lit, writes them out for deferred lighting
+};
+
+// Location resolved from the shader's table at link time, typed so it can only be set with a matching value
+template <typename T>
+struct uniform
+{
+    int m_location = -1;
+
+    bool is_valid() const
+    {
+        return m_location != -1;
+    }
+};
+
+// Key into a shader's location table. String literals are hashed at compile time, built strings
+// (e.g. light array elements) are hashed at runtime but still never reach glGetUniformLocation
+struct uniform_name
+{
+    template <size_t N>
+    consteval uniform_name(const char (&name)[N])
+        : m_hash(fnv1a(name, N - 1))
+        , m_name(name, N - 1)
+    {
+    }
+
+    uniform_name(const std::string& name)
+        : m_hash(fnv1a(name))
+        , m_name(name)
+    {
+    }
+
+    uint64_t m_hash;
+    // Only for error messages, not valid beyond the call it was passed to
+    std::string_view m_name;
 };
 
 class shader
 {
 public:
-    shader(const char* vertex_path, const char* frament_path, shader_type type = shader_type::unlit);
+    shader(const char* vertex_path, const char* frament_path, shader_type type = shader_type::unlit, const char* geometry_path = nullptr);
 
+    // Goes through the renderer's gl_state, depth state etc. comes from the material's pipeline_state
     void use();
-    void post_draw();
 
-    void set_bool(const std::string& name, bool value) const;
-    void set_int(const std::string& name, int value) const;
-    void set_float(const std::string& name, float value) const;
-    void set_vec3(const std::string& name, const glm::vec3& vec) const;
-    void set_mat4(const std::string& name, const glm::mat4& mat) const;
+    // Invalid (and setting it is a no-op) if the program has no active uniform with that name
+    template <typename T>
+    uniform<T> find_uniform(uniform_name name) const
+    {
+        return { find_location(name) };
+    }
+
+    void set(uniform<bool> uniform, bool value) const;
+    void set(uniform<int> uniform, int value) const;
+    void set(uniform<float> uniform, float value) const;
+    void set(uniform<glm::vec3> uniform, const glm::vec3& vec) const;
+    void set(uniform<glm::mat4> uniform, const glm::mat4& mat) const;
+
+    void set_bool(uniform_name name, bool value) const;
+    void set_int(uniform_name name, int value) const;
+    void set_float(uniform_name name, float value) const;
+    void set_vec3(uniform_name name, const glm::vec3& vec) const;
+    void set_mat4(uniform_name name, const glm::mat4& mat) const;
 
     void free();
 
@@ -43,14 +97,39 @@ public:
         return m_type;
     }
 
+    const unsigned int get_sort_id() const
+    {
+        return m_sort_id;
+    }
+
+    void set_sort_id(unsigned int sort_id)
+    {
+        m_sort_id = sort_id;
+    }
+
 public:
 
     unsigned int m_id;
 
 private:
+    // Fills m_uniforms with every active uniform, array elements get an entry each
+    void build_uniform_table();
+    int find_location(uniform_name name) const;
+
+    struct uniform_entry
+    {
+        uint64_t m_hash;
+        int m_location;
+    };
+
+    // Sorted by hash, binary searched by find_location
+    std::vector<uniform_entry> m_uniforms;
+
     shader_type m_type = shader_type::unlit;
+    unsigned int m_sort_id = 0;
     // Used for debug info
     std::string m_vertex_path;
     std::string m_fragment_path;
+    std::string m_geometry_path;
 };
 }
\ No newline at end of file
@@ -0,0 +1,179 @@
+#include "shadow_atlas.h"
+
+#include <algorithm>
+
+#include "renderer.h"
+
+namespace
+{
+    // Every other bit of value packed together, the x (or y, shifted by one) of a morton code
+    uint32_t compact_bits(uint32_t value)
+    {
+        value &= 0x55555555u;
+        value = (value | (value >> 1)) & 0x33333333u;
+        value = (value | (value >> 2)) & 0x0f0f0f0fu;
+        value = (value | (value >> 4)) & 0x00ff00ffu;
+        value = (value | (value >> 8)) & 0x0000ffffu;
+        return value;
+    }
+}
+
+namespace slam_renderer
+{
+void shadow_atlas::init(unsigned int size, unsigned int min_tile_size, unsigned int max_tile_size)
+{
+    m_size = size;
+    m_min_tile_size = min_tile_size;
+    m_max_tile_size = std::min(max_tile_size, size);
+
+    uint32_t side = size / min_tile_size;
+    m_cell_owners.assign(side * side, nullptr);
+
+    // Owned here like the g-buffer, the main target has to stay the first registered framebuffer
+    m_framebuffer = std::make_shared<framebuffer>(size, size, shader_handle{}, framebuffer_type::depth);
+    m_static_framebuffer = std::make_shared<framebuffer>(size, size, shader_handle{}, framebuffer_type::depth);
+}
+
+void shadow_atlas::begin_frame()
+{
+    m_tiles.clear();
+}
+
+int shadow_atlas::request(float importance, shadow_tile_cache* cache)
+{
+    if (m_tiles.size() >= max_shadow_tiles)
+    {
+        return -1;
+    }
+
+    shadow_tile& tile = m_tiles.emplace_back();
+    tile.m_importance = importance;
+    tile.m_cache = cache;
+    return static_cast<int>(m_tiles.size() - 1);
+}
+
+unsigned int shadow_atlas::get_requested_size(float importance) const
+{
+    // Smallest power of two covering the importance share of the max size
+    float wanted = std::min(importance, 1.f) * m_max_tile_size;
+    unsigned int size = m_min_tile_size;
+    while (size < m_max_tile_size && float(size) < wanted)
+    {
+        size *= 2;
+    }
+    return size;
+}
+
+void shadow_atlas::allocate()
+{
+    // Placement works in min tile sized cells, a tile of size s covers (s / min)^2 of them
+    auto get_cells = [this](unsigned int size) -> uint32_t
+        {
+            uint32_t side = size / m_min_tile_size;
+            return side * side;
+        };
+    uint32_t free_cells = get_cells(m_size);
+    uint32_t used_cells = 0;
+
+    m_order.resize(m_tiles.size());
+    for (uint32_t i = 0; i < m_order.size(); ++i)
+    {
+        m_order[i] = i;
+        m_tiles[i].m_size = get_requested_size(m_tiles[i].m_importance);
+        used_cells += get_cells(m_tiles[i].m_size);
+    }
+    std::stable_sort(m_order.begin(), m_order.end(), [this](uint32_t a, uint32_t b)
+        {
+            return m_tiles[a].m_importance > m_tiles[b].m_importance;
+        });
+
+    // Over budget, halve the least important tile that can still shrink and drop tiles once none can
+    size_t kept = m_order.size();
+    while (used_cells > free_cells)
+    {
+        size_t shrink = kept;
+        while (shrink > 0 && m_tiles[m_order[shrink - 1]].m_size == m_min_tile_size)
+        {
+            --shrink;
+        }
+
+        if (shrink > 0)
+        {
+            shadow_tile& tile = m_tiles[m_order[shrink - 1]];
+            used_cells -= get_cells(tile.m_size) - get_cells(tile.m_size / 2);
+            tile.m_size /= 2;
+        }
+        else
+        {
+            --kept;
+            used_cells -= get_cells(m_tiles[m_order[kept]].m_size);
+            m_tiles[m_order[kept]].m_size = 0;
+        }
+    }
+    m_dropped_tiles = static_cast<unsigned int>(m_order.size() - kept);
+    m_order.resize(kept);
+
+    // Biggest first along a morton curve, every tile starts on a multiple of its own cell count so it always
+    // lands on an aligned square of its own size and nothing overlaps
+    std::stable_sort(m_order.begin(), m_order.end(), [this](uint32_t a, uint32_t b)
+        {
+            return m_tiles[a].m_size > m_tiles[b].m_size;
+        });
+
+    uint32_t cell = 0;
+    for (uint32_t index : m_order)
+    {
+        shadow_tile& tile = m_tiles[index];
+        tile.m_offset = glm::ivec2(compact_bits(cell), compact_bits(cell >> 1)) * static_cast<int>(m_min_tile_size);
+
+        // Whatever is in the rect may have been drawn by another light since this one last had it, the same rect
+        // and matrix alone don't make its cached depth valid
+        uint32_t end = cell + get_cells(tile.m_size);
+        bool owned = true;
+        for (uint32_t owned_cell = cell; owned_cell < end; ++owned_cell)
+        {
+            owned &= m_cell_owners[owned_cell] == tile.m_cache;
+            m_cell_owners[owned_cell] = tile.m_cache;
+        }
+        if (!owned)
+        {
+            tile.m_cache->m_static.m_static_generation = shadow_tile_state::invalid_generation;
+            tile.m_cache->m_live.m_static_generation = shadow_tile_state::invalid_generation;
+            tile.m_cache->m_live.m_dynamic_generation = shadow_tile_state::invalid_generation;
+        }
+        cell = end;
+    }
+}
+
+void shadow_atlas::set_tile_matrix(int tile, const glm::mat4& matrix, const glm::vec3& eye)
+{
+    m_tiles[tile].m_matrix = matrix;
+    m_tiles[tile].m_eye = eye;
+}
+
+void shadow_atlas::load_to_buffer(shadow_uniforms& uniforms) const
+{
+    float texel = 1.f / m_size;
+    for (size_t i = 0; i < m_tiles.size(); ++i)
+    {
+        const shadow_tile& tile = m_tiles[i];
+        uniforms.m_matrices[i] = tile.m_matrix;
+        uniforms.m_rects[i] = glm::vec4(glm::vec2(tile.m_offset) * texel, glm::vec2(float(tile.m_size) * texel));
+    }
+}
+
+void shadow_atlas::bind() const
+{
+    renderer* renderer = renderer::get_instance();
+    renderer->get_texture(m_framebuffer->get_texture())->bind(shadow_atlas_unit);
+}
+
+void shadow_atlas::free()
+{
+    if (m_framebuffer != nullptr)
+    {
+        m_framebuffer->free();
+        m_static_framebuffer->free();
+    }
+}
+}
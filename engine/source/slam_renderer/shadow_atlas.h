@@ -0,0 +1,123 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "framebuffer.h"
+#include "gl_state.h"
+#include "uniform_buffer.h"
+
+namespace slam_renderer
+{
+// Lit passes read every shadow from this unit
+static const unsigned int shadow_atlas_unit = 2;
+
+// What an atlas tile was last rendered with, it is only redrawn once one of these changes
+struct shadow_tile_state
+{
+    static const uint32_t invalid_generation = ~0u;
+
+    glm::mat4 m_matrix = glm::mat4(0.f);
+    glm::ivec3 m_rect = glm::ivec3(-1); // x, y, size
+    uint32_t m_static_generation = invalid_generation;
+    uint32_t m_dynamic_generation = invalid_generation;
+};
+
+// Lights keep one of these per tile they request, the static state is for the same rect in the static copy
+struct shadow_tile_cache
+{
+    shadow_tile_state m_static;
+    shadow_tile_state m_live;
+};
+
+struct shadow_tile
+{
+    float m_importance = 0.f;
+    unsigned int m_size = 0; // 0 when it didn't fit this frame
+    glm::ivec2 m_offset = glm::ivec2(0);
+    glm::mat4 m_matrix = glm::mat4(1.f);
+    glm::vec3 m_eye = glm::vec3(0.f); // Casters are depth sorted from here
+    shadow_tile_cache* m_cache = nullptr;
+};
+
+// Every shadowed light renders into square tiles of one depth texture, so lit passes need a single sampler and the
+// depth memory stays fixed however many lights cast shadows. Lights request tiles every frame with an importance,
+// roughly the share of the screen the tile affects, and the atlas hands out power of two sizes from it. When they
+// don't all fit the least important tiles are halved and then dropped. A second atlas keeps the static casters of
+// every tile so only dynamic casters are redrawn while a tile stays put (see renderer::render_shadow_atlas)
+class shadow_atlas
+{
+public:
+    void init(unsigned int size = 4096, unsigned int min_tile_size = 128, unsigned int max_tile_size = 1024);
+
+    // Forgets last frame's tiles, lights request theirs again every frame
+    void begin_frame();
+
+    // Index into the tile table, -1 once it is full. An importance of 1 asks for the max tile size, anything above
+    // only ranks the tile higher when space runs out
+    int request(float importance, shadow_tile_cache* cache);
+
+    // Sizes and places every requested tile
+    void allocate();
+
+    void set_tile_matrix(int tile, const glm::mat4& matrix, const glm::vec3& eye);
+
+    const shadow_tile& get_tile(int tile) const
+    {
+        return m_tiles[tile];
+    }
+
+    unsigned int get_tile_count() const
+    {
+        return static_cast<unsigned int>(m_tiles.size());
+    }
+
+    // Tiles that didn't fit in the last allocate
+    unsigned int get_dropped_tiles() const
+    {
+        return m_dropped_tiles;
+    }
+
+    unsigned int get_size() const
+    {
+        return m_size;
+    }
+
+    std::shared_ptr<framebuffer> get_framebuffer() const
+    {
+        return m_framebuffer;
+    }
+
+    std::shared_ptr<framebuffer> get_static_framebuffer() const
+    {
+        return m_static_framebuffer;
+    }
+
+    // Matrix and uv rect of every tile, dropped tiles get an empty rect
+    void load_to_buffer(shadow_uniforms& uniforms) const;
+
+    void bind() const;
+
+    void free();
+
+private:
+    unsigned int get_requested_size(float importance) const;
+
+    unsigned int m_size = 0;
+    unsigned int m_min_tile_size = 0;
+    unsigned int m_max_tile_size = 0;
+
+    std::shared_ptr<framebuffer> m_framebuffer;
+    std::shared_ptr<framebuffer> m_static_framebuffer;
+
+    std::vector<shadow_tile> m_tiles;
+    // Scratch, tile indices by importance and then by size
+    std::vector<uint32_t> m_order;
+    unsigned int m_dropped_tiles = 0;
+    // Which light's cache last had each min tile sized cell, in morton order
+    std::vector<const shadow_tile_cache*> m_cell_owners;
+};
+}
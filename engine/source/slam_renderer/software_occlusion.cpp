@@ -0,0 +1,385 @@
+#include "software_occlusion.h"
+
+#include <slam_utils/threading/thread_pool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define OCCLUSION_SSE 1
+#endif
+
+#if OCCLUSION_SSE
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    static const size_t min_test_batch = 256;
+
+    // Sutherland-Hodgman against z = -w, a triangle comes out as nothing, a triangle or a quad
+    int clip_near(const glm::vec4* input, glm::vec4* output)
+    {
+        int count = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            const glm::vec4& current = input[i];
+            const glm::vec4& next = input[(i + 1) % 3];
+            float current_distance = current.z + current.w;
+            float next_distance = next.z + next.w;
+
+            if (current_distance >= 0.f)
+            {
+                output[count++] = current;
+            }
+            if ((current_distance >= 0.f) != (next_distance >= 0.f))
+            {
+                output[count++] = glm::mix(current, next, current_distance / (current_distance - next_distance));
+            }
+        }
+        return count;
+    }
+}
+
+namespace slam_renderer
+{
+void software_occlusion::init(unsigned int width, unsigned int height)
+{
+    m_width = width;
+    m_height = height;
+    for (unsigned int level = 0; level < level_count; ++level)
+    {
+        m_levels[level].assign(size_t(get_width(level)) * get_height(level), 1.f);
+    }
+}
+
+void software_occlusion::begin_frame(const glm::mat4& view_projection)
+{
+    m_view_projection = view_projection;
+    m_occluders.clear();
+    m_triangle_count = 0;
+    m_rasterized = false;
+}
+
+void software_occlusion::add_occluder(const occluder_geometry& geometry, const glm::mat4& world_transform)
+{
+    m_occluders.push_back({ &geometry, world_transform, 0, 0 });
+}
+
+void software_occlusion::rasterize(thread_pool& pool)
+{
+    size_t triangle_capacity = 0;
+    for (occluder& occluder : m_occluders)
+    {
+        occluder.m_first_triangle = triangle_capacity;
+        triangle_capacity += occluder.m_geometry->m_faces.size() / 3 * 2;
+    }
+    m_triangles.resize(triangle_capacity);
+
+    // Occluders write to their own ranges so they can be transformed and clipped in parallel
+    pool.parallel_for(m_occluders.size(), 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                setup_occluder(m_occluders[i]);
+            }
+        });
+
+    for (const occluder& occluder : m_occluders)
+    {
+        m_triangle_count += static_cast<unsigned int>(occluder.m_triangle_count);
+    }
+
+    pool.parallel_for(m_height / band_height, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t band = begin; band < end; ++band)
+            {
+                rasterize_band(static_cast<unsigned int>(band));
+            }
+        });
+
+    m_rasterized = true;
+}
+
+void software_occlusion::setup_occluder(occluder& occluder)
+{
+    const occluder_geometry& geometry = *occluder.m_geometry;
+    glm::mat4 transform = m_view_projection * occluder.m_transform;
+    glm::vec2 screen_size = glm::vec2(float(m_width), float(m_height));
+
+    screen_triangle* output = &m_triangles[occluder.m_first_triangle];
+    size_t count = 0;
+
+    for (size_t face = 0; face + 2 < geometry.m_faces.size(); face += 3)
+    {
+        glm::vec4 clip[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            clip[i] = transform * glm::vec4(geometry.m_positions[geometry.m_faces[face + i]], 1.f);
+        }
+
+        glm::vec4 clipped[4];
+        int clipped_count = clip_near(clip, clipped);
+        if (clipped_count < 3)
+        {
+            continue;
+        }
+
+        glm::vec3 screen[4];
+        glm::vec2 screen_min = glm::vec2(std::numeric_limits<float>::max());
+        glm::vec2 screen_max = glm::vec2(-std::numeric_limits<float>::max());
+        for (int i = 0; i < clipped_count; ++i)
+        {
+            glm::vec3 ndc = glm::vec3(clipped[i]) / clipped[i].w;
+            screen[i] = glm::vec3((glm::vec2(ndc) * 0.5f + 0.5f) * screen_size, ndc.z);
+            screen_min = glm::min(screen_min, glm::vec2(screen[i]));
+            screen_max = glm::max(screen_max, glm::vec2(screen[i]));
+        }
+
+        if (screen_max.x < 0.f || screen_max.y < 0.f || screen_min.x > screen_size.x || screen_min.y > screen_size.y)
+        {
+            continue;
+        }
+
+        // Fan, the quad only appears when the near plane cuts off a single vertex
+        for (int i = 2; i < clipped_count; ++i)
+        {
+            output[count++] = { { screen[0], screen[i - 1], screen[i] } };
+        }
+    }
+
+    occluder.m_triangle_count = count;
+}
+
+void software_occlusion::rasterize_band(unsigned int band)
+{
+    int first_row = static_cast<int>(band * band_height);
+    int last_row = first_row + static_cast<int>(band_height) - 1;
+
+    std::fill(m_levels[0].begin() + size_t(first_row) * m_width, m_levels[0].begin() + size_t(last_row + 1) * m_width, 1.f);
+
+    for (const occluder& occluder : m_occluders)
+    {
+        for (size_t i = 0; i < occluder.m_triangle_count; ++i)
+        {
+            rasterize_triangle(m_triangles[occluder.m_first_triangle + i], first_row, last_row);
+        }
+    }
+
+    // Every texel keeps the farthest depth of the four below it, the band's rows never reach into another band
+    for (unsigned int level = 1; level < level_count; ++level)
+    {
+        const std::vector<float>& source = m_levels[level - 1];
+        std::vector<float>& target = m_levels[level];
+        unsigned int source_width = get_width(level - 1);
+        unsigned int width = get_width(level);
+
+        for (unsigned int y = unsigned(first_row) >> level; y < unsigned(last_row + 1) >> level; ++y)
+        {
+            const float* row = &source[size_t(y * 2) * source_width];
+            const float* next_row = row + source_width;
+            for (unsigned int x = 0; x < width; ++x)
+            {
+                target[size_t(y) * width + x] = std::max(std::max(row[x * 2], row[x * 2 + 1]), std::max(next_row[x * 2], next_row[x * 2 + 1]));
+            }
+        }
+    }
+}
+
+void software_occlusion::rasterize_triangle(const screen_triangle& triangle, int first_row, int last_row)
+{
+    glm::vec3 v0 = triangle.m_vertices[0];
+    glm::vec3 v1 = triangle.m_vertices[1];
+    glm::vec3 v2 = triangle.m_vertices[2];
+
+    // Pixel centres covered by the bounds, clamped to the band
+    int min_y = std::max(first_row, int(std::ceil(std::min({ v0.y, v1.y, v2.y }) - 0.5f)));
+    int max_y = std::min(last_row, int(std::floor(std::max({ v0.y, v1.y, v2.y }) - 0.5f)));
+    if (min_y > max_y)
+    {
+        return;
+    }
+    int min_x = std::max(0, int(std::ceil(std::min({ v0.x, v1.x, v2.x }) - 0.5f)));
+    int max_x = std::min(int(m_width) - 1, int(std::floor(std::max({ v0.x, v1.x, v2.x }) - 0.5f)));
+    if (min_x > max_x)
+    {
+        return;
+    }
+
+    // Winding isn't consistent across the sample assets so both sides are drawn, flipped to counter clockwise
+    float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+    if (std::abs(area) < 1e-6f)
+    {
+        return;
+    }
+    if (area < 0.f)
+    {
+        std::swap(v1, v2);
+        area = -area;
+    }
+
+    // Edge functions a * x + b * y + c, positive inside
+    const glm::vec3* vertices[3] = { &v0, &v1, &v2 };
+    float edge_a[3], edge_b[3], edge_c[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        const glm::vec3& from = *vertices[i];
+        const glm::vec3& to = *vertices[(i + 1) % 3];
+        edge_a[i] = from.y - to.y;
+        edge_b[i] = to.x - from.x;
+        edge_c[i] = -(edge_a[i] * from.x + edge_b[i] * from.y);
+    }
+
+    // z/w is linear in screen space, clamped so extrapolating to pixel centres can't go past the vertices
+    float depth_x = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+    float depth_y = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+    float depth_c = v0.z - depth_x * v0.x - depth_y * v0.y;
+    float min_depth = std::min({ v0.z, v1.z, v2.z });
+    float max_depth = std::max({ v0.z, v1.z, v2.z });
+
+    std::vector<float>& depth = m_levels[0];
+
+    for (int y = min_y; y <= max_y; ++y)
+    {
+        float pixel_y = float(y) + 0.5f;
+        float* row = &depth[size_t(y) * m_width];
+        int x = min_x;
+
+#if OCCLUSION_SSE
+        // 4 pixels per iteration, widths are a multiple of 4 so aligned groups never run off the row
+        x &= ~3;
+        const __m128 lane_offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        __m128 row_edges[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            row_edges[i] = _mm_set1_ps(edge_b[i] * pixel_y + edge_c[i]);
+        }
+        __m128 row_depth = _mm_set1_ps(depth_y * pixel_y + depth_c);
+
+        for (; x <= max_x; x += 4)
+        {
+            __m128 pixel_x = _mm_add_ps(_mm_set1_ps(float(x)), lane_offsets);
+
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int i = 0; i < 3; ++i)
+            {
+                __m128 edge = _mm_add_ps(_mm_mul_ps(pixel_x, _mm_set1_ps(edge_a[i])), row_edges[i]);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(edge, _mm_setzero_ps()));
+            }
+            if (_mm_movemask_ps(inside) == 0)
+            {
+                continue;
+            }
+
+            __m128 pixel_depth = _mm_add_ps(_mm_mul_ps(pixel_x, _mm_set1_ps(depth_x)), row_depth);
+            pixel_depth = _mm_min_ps(_mm_max_ps(pixel_depth, _mm_set1_ps(min_depth)), _mm_set1_ps(max_depth));
+
+            __m128 previous = _mm_loadu_ps(row + x);
+            __m128 nearest = _mm_min_ps(previous, pixel_depth);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, previous)));
+        }
+#endif
+
+        // Scalar fallback
+        for (; x <= max_x; ++x)
+        {
+            float pixel_x = float(x) + 0.5f;
+            bool inside = true;
+            for (int i = 0; i < 3; ++i)
+            {
+                inside &= edge_a[i] * pixel_x + edge_b[i] * pixel_y + edge_c[i] >= 0.f;
+            }
+            if (inside)
+            {
+                float pixel_depth = std::clamp(depth_x * pixel_x + depth_y * pixel_y + depth_c, min_depth, max_depth);
+                row[x] = std::min(row[x], pixel_depth);
+            }
+        }
+    }
+}
+
+bool software_occlusion::is_visible(const aabb& box) const
+{
+    glm::vec2 ndc_min = glm::vec2(std::numeric_limits<float>::max());
+    glm::vec2 ndc_max = glm::vec2(-std::numeric_limits<float>::max());
+    float nearest = std::numeric_limits<float>::max();
+
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        glm::vec3 position = glm::vec3(corner & 1 ? box.m_max.x : box.m_min.x, corner & 2 ? box.m_max.y : box.m_min.y, corner & 4 ? box.m_max.z : box.m_min.z);
+        glm::vec4 clip = m_view_projection * glm::vec4(position, 1.f);
+        if (clip.z < -clip.w)
+        {
+            return true;
+        }
+
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        ndc_min = glm::min(ndc_min, glm::vec2(ndc));
+        ndc_max = glm::max(ndc_max, glm::vec2(ndc));
+        nearest = std::min(nearest, ndc.z);
+    }
+
+    int min_x = std::max(0, int(std::floor((ndc_min.x * 0.5f + 0.5f) * m_width)));
+    int max_x = std::min(int(m_width) - 1, int(std::floor((ndc_max.x * 0.5f + 0.5f) * m_width)));
+    int min_y = std::max(0, int(std::floor((ndc_min.y * 0.5f + 0.5f) * m_height)));
+    int max_y = std::min(int(m_height) - 1, int(std::floor((ndc_max.y * 0.5f + 0.5f) * m_height)));
+
+    // Off screen, that's for the frustum test to decide
+    if (min_x > max_x || min_y > max_y)
+    {
+        return true;
+    }
+
+    // Coarsest level is picked so the box covers at most a few texels each way
+    int span = std::max(max_x - min_x, max_y - min_y);
+    unsigned int level = 0;
+    while (level + 1 < level_count && (span >> level) > 3)
+    {
+        ++level;
+    }
+
+    const std::vector<float>& depth = m_levels[level];
+    unsigned int width = get_width(level);
+    for (int y = min_y >> level; y <= max_y >> level; ++y)
+    {
+        for (int x = min_x >> level; x <= max_x >> level; ++x)
+        {
+            if (nearest <= depth[size_t(y) * width + x])
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+unsigned int software_occlusion::test(const std::vector<aabb>& boxes, std::vector<uint8_t>& visibility, thread_pool* pool) const
+{
+    visibility.resize(boxes.size());
+
+    auto test_range = [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                visibility[i] = is_visible(boxes[i]);
+            }
+        };
+
+    if (pool != nullptr)
+    {
+        pool->parallel_for(boxes.size(), min_test_batch, test_range);
+    }
+    else
+    {
+        test_range(0, boxes.size());
+    }
+
+    unsigned int occluded = 0;
+    for (uint8_t visible : visibility)
+    {
+        occluded += !visible;
+    }
+    return occluded;
+}
+}
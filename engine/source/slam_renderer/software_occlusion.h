@@ -0,0 +1,109 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "bounds.h"
+#include "mesh_geometry.h"
+
+class thread_pool;
+
+namespace slam_renderer
+{
+// Low resolution depth buffer rasterized on the CPU from a handful of occluder meshes, with a hierarchical-Z
+// (farthest depth) pyramid built on top so bounding boxes can be tested against it without any GPU readback.
+// The buffer is split into bands of rows, each band is one job on the thread pool: it clears its rows, rasterizes
+// every occluder triangle overlapping them four pixels at a time and builds its part of the pyramid. Depth is NDC z
+// like the GPU depth buffer, with 1 (far) where nothing was drawn
+class software_occlusion
+{
+public:
+    // Rows per job, also how many pyramid levels can be built inside a band
+    static const unsigned int band_height = 16;
+    static const unsigned int level_count = 5;
+
+    // width must be a multiple of 16 and height of band_height
+    void init(unsigned int width = 256, unsigned int height = 128);
+
+    // Forgets last frame's occluders
+    void begin_frame(const glm::mat4& view_projection);
+
+    // geometry has to stay alive until rasterize
+    void add_occluder(const occluder_geometry& geometry, const glm::mat4& world_transform);
+
+    void rasterize(thread_pool& pool);
+
+    // False only when the box is certainly hidden behind rasterized occluders, boxes crossing the near plane are
+    // always visible
+    bool is_visible(const aabb& box) const;
+
+    // Writes 1 for every box that might be visible, 0 otherwise. Returns how many were occluded
+    unsigned int test(const std::vector<aabb>& boxes, std::vector<uint8_t>& visibility, thread_pool* pool = nullptr) const;
+
+    // Nothing to test against until a frame has been rasterized
+    bool is_ready() const
+    {
+        return m_rasterized;
+    }
+
+    unsigned int get_width(unsigned int level = 0) const
+    {
+        return m_width >> level;
+    }
+
+    unsigned int get_height(unsigned int level = 0) const
+    {
+        return m_height >> level;
+    }
+
+    // Row major, level 0 is the full resolution depth
+    const std::vector<float>& get_depth(unsigned int level = 0) const
+    {
+        return m_levels[level];
+    }
+
+    unsigned int get_occluder_count() const
+    {
+        return static_cast<unsigned int>(m_occluders.size());
+    }
+
+    // Triangles that reached the rasterizer in the last frame, after near plane clipping
+    unsigned int get_triangle_count() const
+    {
+        return m_triangle_count;
+    }
+
+private:
+    // Screen space (pixels) x/y and NDC depth
+    struct screen_triangle
+    {
+        glm::vec3 m_vertices[3];
+    };
+
+    struct occluder
+    {
+        const occluder_geometry* m_geometry;
+        glm::mat4 m_transform;
+        // Into m_triangles, room for every triangle to be split in two by the near plane
+        size_t m_first_triangle;
+        size_t m_triangle_count;
+    };
+
+    void setup_occluder(occluder& occluder);
+    void rasterize_band(unsigned int band);
+    void rasterize_triangle(const screen_triangle& triangle, int first_row, int last_row);
+
+    unsigned int m_width = 0;
+    unsigned int m_height = 0;
+    glm::mat4 m_view_projection = glm::mat4(1.f);
+
+    std::vector<occluder> m_occluders;
+    std::vector<screen_triangle> m_triangles;
+    unsigned int m_triangle_count = 0;
+
+    std::vector<float> m_levels[level_count];
+    bool m_rasterized = false;
+};
+}
@@ -0,0 +1,56 @@
+#include "texel_buffer.h"
+
+#include <algorithm>
+
+namespace
+{
+    // A buffer texture needs some storage behind it even before the first update
+    static const size_t min_capacity = 256;
+}
+
+namespace slam_renderer
+{
+void texel_buffer::init(gl_state& state, GLenum internal_format)
+{
+    m_capacity = min_capacity;
+
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, m_capacity, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    // The texture just points at the buffer, reallocating the buffer storage doesn't need this redoing
+    glGenTextures(1, &m_texture);
+    state.bind_texture(0, GL_TEXTURE_BUFFER, m_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, internal_format, m_buffer);
+}
+
+void texel_buffer::update(const void* data, size_t size)
+{
+    if (size > m_capacity)
+    {
+        m_capacity = std::max(size, m_capacity * 2);
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, m_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, m_capacity, nullptr, GL_STREAM_DRAW);
+    if (size > 0)
+    {
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void texel_buffer::bind(gl_state& state, unsigned int unit) const
+{
+    state.bind_texture(unit, GL_TEXTURE_BUFFER, m_texture);
+}
+
+void texel_buffer::free()
+{
+    glDeleteTextures(1, &m_texture);
+    glDeleteBuffers(1, &m_buffer);
+    m_texture = m_buffer = 0;
+    m_capacity = 0;
+}
+}
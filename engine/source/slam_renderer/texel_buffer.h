@@ -0,0 +1,30 @@
+#pragma once
+
+#include <glad.h>
+
+#include <cstddef>
+
+#include "gl_state.h"
+
+namespace slam_renderer
+{
+// GL buffer read in shaders through a samplerBuffer/usamplerBuffer with texelFetch, for per-frame data that is too
+// big or too variable in size for a uniform block
+class texel_buffer
+{
+public:
+    void init(gl_state& state, GLenum internal_format);
+
+    // Grows (never shrinks) to fit size and orphans the previous contents like uniform_buffer::update
+    void update(const void* data, size_t size);
+
+    void bind(gl_state& state, unsigned int unit) const;
+
+    void free();
+
+private:
+    unsigned int m_buffer = 0;
+    unsigned int m_texture = 0;
+    size_t m_capacity = 0;
+};
+}
@@ -3,6 +3,8 @@
 #include <stb_image.h>
 #include <iostream>
 
+#include "renderer.h"
+
 namespace slam_renderer
 {
 texture::texture(std::string path, texture_type type, bool isSRGB)
@@ -11,9 +13,10 @@ texture::texture(std::string path, texture_type type, bool isSRGB)
     , m_isSRGB(isSRGB)
 {
     GLenum target = get_gl_target();
+    gl_state& state = renderer::get_instance()->get_gl_state();
 
     glGenTextures(1, &m_id);
-    glBindTexture(target, m_id);
+    state.bind_texture(0, target, m_id);
 
     stbi_set_flip_vertically_on_load(m_type != texture_type::cubemap);
 
@@ -35,15 +38,16 @@ texture::texture(std::string path, texture_type type, bool isSRGB)
         std::cout << "ERROR::TEXTURE::UNSUPPORTED TEXTURE TYPE:  " << (int)m_type << std::endl;
     }
     set_gl_params(target);
-    glBindTexture(target, 0);
+    state.bind_texture(0, target, 0);
 }
 
-texture::texture(unsigned int width, unsigned int height, texture_type type, bool isSRGB)
+texture::texture(unsigned int width, unsigned int height, texture_type type, bool isSRGB, unsigned int layers)
     : m_path("")
     , m_type(type)
     , m_width(width)
     , m_height(height)
-    , m_channels(type == texture_type::depth_2d ? 1 : 4)
+    , m_channels(type == texture_type::depth_2d || type == texture_type::depth_2d_array || type == texture_type::depth_stencil_2d ? 1 : 4)
+    , m_layers(layers)
     , m_isSRGB(isSRGB)
 {
     glGenTextures(1, &m_id);
@@ -52,11 +56,24 @@ texture::texture(unsigned int width, unsigned int height, texture_type type, boo
     GLenum internal_format, format, pixel_type;
     get_gl_formats(internal_format, format, pixel_type);
 
-    glBindTexture(target, m_id);
-    glTexImage2D(target, 0, internal_format, width, height, 0, format, pixel_type, NULL);
+    gl_state& state = renderer::get_instance()->get_gl_state();
+    state.bind_texture(0, target, m_id);
+    if (target == GL_TEXTURE_2D_ARRAY)
+    {
+        glTexImage3D(target, 0, internal_format, width, height, layers, 0, format, pixel_type, NULL);
+    }
+    else
+    {
+        glTexImage2D(target, 0, internal_format, width, height, 0, format, pixel_type, NULL);
+    }
 
     set_gl_params(target);
-    glBindTexture(target, 0);
+    state.bind_texture(0, target, 0);
+}
+
+void texture::bind(unsigned int unit) const
+{
+    renderer::get_instance()->get_gl_state().bind_texture(unit, get_gl_target(), m_id);
 }
 
 void texture::load_face(std::string path, GLenum target, bool generate_mips)
@@ -94,6 +111,7 @@ void texture::set_gl_params(GLenum target)
         break;
     }
     case texture_type::depth_2d:
+    case texture_type::depth_2d_array:
     {
         glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -103,6 +121,15 @@ void texture::set_gl_params(GLenum target)
         glTexParameterfv(target, GL_TEXTURE_BORDER_COLOR, border_colour);
         break;
     }
+    case texture_type::colour_16f:
+    case texture_type::depth_stencil_2d:
+    {
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        break;
+    }
     case texture_type::cubemap:
     {
         glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
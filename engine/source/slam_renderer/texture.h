@@ -10,7 +10,12 @@ enum class texture_type
 {
     texture_2d,
     depth_2d,
+    // One layer per shadow cascade
+    depth_2d_array,
     cubemap,
+    // Render targets that are read back unfiltered (g-buffer)
+    colour_16f,
+    depth_stencil_2d
 };
 
 class texture
@@ -18,7 +23,7 @@ class texture
 public:
     texture(std::string path, texture_type type = texture_type::texture_2d, bool isSRGB = false);
 
-    texture(unsigned int width, unsigned int height, texture_type type = texture_type::texture_2d, bool isSRGB = false);
+    texture(unsigned int width, unsigned int height, texture_type type = texture_type::texture_2d, bool isSRGB = false, unsigned int layers = 1);
 
     void free();
 
@@ -37,10 +42,8 @@ public:
         return m_type;
     }
 
-    void bind() const
-    {
-        glBindTexture(get_gl_target(), m_id);
-    }
+    // Binds to the given texture unit through the renderer's gl_state
+    void bind(unsigned int unit = 0) const;
 
 private:
     void load_face(std::string path, GLenum target, bool generate_mips);
@@ -52,9 +55,15 @@ private:
         {
         case texture_type::texture_2d:
         case texture_type::depth_2d:
+        case texture_type::colour_16f:
+        case texture_type::depth_stencil_2d:
         {
             return GL_TEXTURE_2D;
         }
+        case texture_type::depth_2d_array:
+        {
+            return GL_TEXTURE_2D_ARRAY;
+        }
         case texture_type::cubemap:
         {
             return GL_TEXTURE_CUBE_MAP;
@@ -69,12 +78,26 @@ private:
         internal_format = GL_RED;
         format = GL_RED;
         pixel_type = GL_UNSIGNED_BYTE;
-        if (m_channels == 1 && m_type == texture_type::depth_2d)
+        if (m_channels == 1 && (m_type == texture_type::depth_2d || m_type == texture_type::depth_2d_array))
         {
             internal_format = GL_DEPTH_COMPONENT;
             format = GL_DEPTH_COMPONENT;
             pixel_type = GL_FLOAT;
         }
+        if (m_type == texture_type::depth_stencil_2d)
+        {
+            internal_format = GL_DEPTH24_STENCIL8;
+            format = GL_DEPTH_STENCIL;
+            pixel_type = GL_UNSIGNED_INT_24_8;
+            return;
+        }
+        if (m_type == texture_type::colour_16f)
+        {
+            internal_format = GL_RGBA16F;
+            format = GL_RGBA;
+            pixel_type = GL_FLOAT;
+            return;
+        }
         if (m_channels == 3)
         {
             internal_format = m_isSRGB ? GL_SRGB : GL_RGB;
@@ -93,6 +116,7 @@ private:
     int m_width;
     int m_height;
     int m_channels;
+    unsigned int m_layers = 1;
     bool m_isSRGB = false;
 
     unsigned int m_id = 0;
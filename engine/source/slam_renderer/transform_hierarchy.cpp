@@ -0,0 +1,131 @@
+#include "transform_hierarchy.h"
+
+#include <algorithm>
+
+namespace slam_renderer
+{
+uint32_t transform_hierarchy::add_node(uint32_t parent, const glm::mat4& local_transform)
+{
+    uint32_t parent_position = parent == invalid_node ? invalid_node : m_node_positions[parent];
+    uint32_t position = parent == invalid_node ? static_cast<uint32_t>(size()) : parent_position + m_subtree_sizes[parent_position];
+    uint32_t node = static_cast<uint32_t>(m_node_positions.size());
+
+    if (position < size())
+    {
+        // Everything from position onwards moves up one, fix up parents that point past the gap
+        for (uint32_t& parent_index : m_parents)
+        {
+            if (parent_index != invalid_node && parent_index >= position)
+            {
+                ++parent_index;
+            }
+        }
+        for (uint32_t& node_position : m_node_positions)
+        {
+            if (node_position >= position)
+            {
+                ++node_position;
+            }
+        }
+    }
+
+    m_parents.insert(m_parents.begin() + position, parent_position);
+    m_subtree_sizes.insert(m_subtree_sizes.begin() + position, 1);
+    m_local_transforms.insert(m_local_transforms.begin() + position, local_transform);
+    m_world_transforms.insert(m_world_transforms.begin() + position, local_transform);
+    m_dirty.insert(m_dirty.begin() + position, 1);
+    m_position_nodes.insert(m_position_nodes.begin() + position, node);
+    m_node_positions.push_back(position);
+
+    for (uint32_t ancestor = parent_position; ancestor != invalid_node; ancestor = m_parents[ancestor])
+    {
+        ++m_subtree_sizes[ancestor];
+    }
+
+    m_dirty_nodes.push_back(node);
+    return node;
+}
+
+void transform_hierarchy::set_local_transform(uint32_t node, const glm::mat4& local_transform)
+{
+    uint32_t position = m_node_positions[node];
+    m_local_transforms[position] = local_transform;
+
+    if (!m_dirty[position])
+    {
+        m_dirty[position] = 1;
+        m_dirty_nodes.push_back(node);
+    }
+}
+
+void transform_hierarchy::update()
+{
+    m_updated_ranges.clear();
+    m_updated_count = 0;
+
+    if (m_dirty_nodes.empty())
+    {
+        return;
+    }
+
+    m_dirty_positions.clear();
+    for (uint32_t node : m_dirty_nodes)
+    {
+        uint32_t position = m_node_positions[node];
+        m_dirty_positions.push_back(position);
+        m_dirty[position] = 0;
+    }
+    m_dirty_nodes.clear();
+
+    // In position order a dirty node inside an earlier dirty subtree is already covered by that sweep
+    std::sort(m_dirty_positions.begin(), m_dirty_positions.end());
+
+    uint32_t covered_end = 0;
+    for (uint32_t position : m_dirty_positions)
+    {
+        if (position < covered_end)
+        {
+            continue;
+        }
+
+        uint32_t end = position + m_subtree_sizes[position];
+        update_range(position, end);
+        covered_end = end;
+
+        // Merge with the previous range when they touch so callers see fewer, longer runs
+        if (!m_updated_ranges.empty() && m_updated_ranges.back().m_end == position)
+        {
+            m_updated_ranges.back().m_end = end;
+        }
+        else
+        {
+            m_updated_ranges.push_back({ position, end });
+        }
+        m_updated_count += end - position;
+    }
+}
+
+void transform_hierarchy::update_range(uint32_t begin, uint32_t end)
+{
+    // Parents always come first, either earlier in this range or outside it and already up to date
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        uint32_t parent = m_parents[i];
+        m_world_transforms[i] = parent == invalid_node ? m_local_transforms[i] : m_world_transforms[parent] * m_local_transforms[i];
+    }
+}
+
+void transform_hierarchy::clear()
+{
+    m_parents.clear();
+    m_subtree_sizes.clear();
+    m_local_transforms.clear();
+    m_world_transforms.clear();
+    m_dirty.clear();
+    m_node_positions.clear();
+    m_position_nodes.clear();
+    m_dirty_nodes.clear();
+    m_updated_ranges.clear();
+    m_updated_count = 0;
+}
+}
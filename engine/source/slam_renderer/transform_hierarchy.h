@@ -0,0 +1,95 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace slam_renderer
+{
+// Scene graph transforms stored as SoA arrays in depth-first order, so every parent comes before its children
+// and each subtree is one contiguous range. Changing a node's local transform only marks it dirty, update()
+// then recomputes the world matrices of each dirty subtree in a single linear sweep over that range.
+// Nodes are referred to by a stable id, their position in the arrays can move when nodes are inserted mid-tree
+class transform_hierarchy
+{
+public:
+    static const uint32_t invalid_node = ~0u;
+
+    // Range of array positions whose world matrices were recomputed by the last update()
+    struct node_range
+    {
+        uint32_t m_begin;
+        uint32_t m_end;
+    };
+
+    // Inserted as the last child of parent, or as a new root. Appending is the cheap case (loading a model
+    // depth first never has to shift anything)
+    uint32_t add_node(uint32_t parent, const glm::mat4& local_transform);
+
+    void set_local_transform(uint32_t node, const glm::mat4& local_transform);
+
+    // Recomputes world matrices for dirty subtrees only, a subtree nested inside another dirty one is swept once
+    void update();
+
+    void clear();
+
+    const glm::mat4& get_local_transform(uint32_t node) const
+    {
+        return m_local_transforms[m_node_positions[node]];
+    }
+
+    // Only valid after update() if the node or one of its ancestors has changed
+    const glm::mat4& get_world_transform(uint32_t node) const
+    {
+        return m_world_transforms[m_node_positions[node]];
+    }
+
+    uint32_t get_parent(uint32_t node) const
+    {
+        uint32_t parent_position = m_parents[m_node_positions[node]];
+        return parent_position == invalid_node ? invalid_node : m_position_nodes[parent_position];
+    }
+
+    uint32_t get_node_at(uint32_t position) const
+    {
+        return m_position_nodes[position];
+    }
+
+    const std::vector<node_range>& get_updated_ranges() const
+    {
+        return m_updated_ranges;
+    }
+
+    // Nodes whose world matrix was recomputed by the last update()
+    uint32_t get_updated_count() const
+    {
+        return m_updated_count;
+    }
+
+    size_t size() const
+    {
+        return m_parents.size();
+    }
+
+private:
+    void update_range(uint32_t begin, uint32_t end);
+
+    // Indexed by position, parents are positions as well and always less than the child's
+    std::vector<uint32_t> m_parents;
+    std::vector<uint32_t> m_subtree_sizes;
+    std::vector<glm::mat4> m_local_transforms;
+    std::vector<glm::mat4> m_world_transforms;
+    std::vector<uint8_t> m_dirty;
+
+    // Stable node id <-> current position
+    std::vector<uint32_t> m_node_positions;
+    std::vector<uint32_t> m_position_nodes;
+
+    // Node ids rather than positions so inserting between set and update doesn't invalidate them
+    std::vector<uint32_t> m_dirty_nodes;
+    std::vector<uint32_t> m_dirty_positions;
+    std::vector<node_range> m_updated_ranges;
+    uint32_t m_updated_count = 0;
+};
+}
@@ -0,0 +1,59 @@
+#include "uniform_buffer.h"
+
+#include <glad.h>
+
+namespace
+{
+    struct block_name
+    {
+        const char* m_name;
+        slam_renderer::uniform_block_binding m_binding;
+    };
+
+    static const block_name block_names[] = {
+        { "frame_data", slam_renderer::uniform_block_binding::frame },
+        { "light_data", slam_renderer::uniform_block_binding::lights },
+        { "shadow_data", slam_renderer::uniform_block_binding::shadows }
+    };
+}
+
+namespace slam_renderer
+{
+void uniform_buffer::init(uniform_block_binding binding, size_t size)
+{
+    m_size = size;
+
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    glBufferData(GL_UNIFORM_BUFFER, m_size, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, static_cast<unsigned int>(binding), m_buffer);
+}
+
+void uniform_buffer::update(const void* data, size_t size)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    glBufferData(GL_UNIFORM_BUFFER, m_size, nullptr, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void uniform_buffer::free()
+{
+    glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+}
+
+void uniform_buffer::bind_blocks(unsigned int program)
+{
+    for (const block_name& block : block_names)
+    {
+        unsigned int index = glGetUniformBlockIndex(program, block.m_name);
+        if (index != GL_INVALID_INDEX)
+        {
+            glUniformBlockBinding(program, index, static_cast<unsigned int>(block.m_binding));
+        }
+    }
+}
+}
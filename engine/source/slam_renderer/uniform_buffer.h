@@ -0,0 +1,74 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+namespace slam_renderer
+{
+// Fixed binding points, shaders get their blocks mapped to these by name when they're linked
+enum class uniform_block_binding : unsigned int
+{
+    frame = 0,
+    lights = 1,
+    shadows = 2
+};
+
+// Mirrors the std140 frame_data block, everything is vec4 aligned so no padding is needed
+struct frame_uniforms
+{
+    glm::mat4 m_view;
+    glm::mat4 m_projection;
+    glm::mat4 m_view_projection;
+    glm::mat4 m_inverse_view_projection; // Depth to world position for deferred lighting
+    glm::vec4 m_camera_position; // w unused
+};
+
+// The light structs mirror the std140 light_data block, again only vec4/mat4 members so the layout matches.
+// Point and spot lights don't fit a fixed size block, they go through light_clusters instead
+static const unsigned int max_directional_lights = 4; // MAX_DIRECTIONAL_LIGHTS in the shaders
+static const unsigned int max_shadow_cascades = 4;
+
+struct directional_light_data
+{
+    glm::vec4 m_direction; // w first shadow atlas tile, one per cascade from there on, -1 without shadows
+    glm::vec4 m_ambient; // w shadow cascade count
+    glm::vec4 m_diffuse;
+    glm::vec4 m_specular;
+    glm::vec4 m_cascade_splits; // View depth each cascade ends at
+};
+
+struct light_uniforms
+{
+    directional_light_data m_directional_lights[max_directional_lights];
+    glm::uvec4 m_cluster_dimensions; // x, y, z, w unused
+    glm::vec4 m_cluster_params; // slice scale, slice bias, tile size in pixels
+    glm::ivec4 m_counts; // directional, local
+};
+
+// Mirrors the std140 shadow_data block, one entry per shadow atlas tile
+static const unsigned int max_shadow_tiles = 32; // MAX_SHADOW_TILES in the shaders
+
+struct shadow_uniforms
+{
+    glm::mat4 m_matrices[max_shadow_tiles];
+    glm::vec4 m_rects[max_shadow_tiles]; // uv offset, uv size
+};
+
+// Thin wrapper over a GL uniform buffer that stays bound to its binding point
+class uniform_buffer
+{
+public:
+    void init(uniform_block_binding binding, size_t size);
+
+    // Orphans the previous contents so an update never waits on draws still reading them
+    void update(const void* data, size_t size);
+
+    void free();
+
+    // Binds every known uniform block in program to its fixed binding point, blocks the program doesn't use are skipped
+    static void bind_blocks(unsigned int program);
+
+private:
+    unsigned int m_buffer = 0;
+    size_t m_size = 0;
+};
+}
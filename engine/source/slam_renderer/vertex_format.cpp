@@ -0,0 +1,161 @@
+#include "vertex_format.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    static const float unorm16_max = 65535.f;
+    static const float snorm16_max = 32767.f;
+
+    uint16_t quantize_unorm16(float value, float offset, float scale)
+    {
+        float normalized = scale > 0.f ? (value - offset) / scale : 0.f;
+        return static_cast<uint16_t>(std::lround(std::clamp(normalized, 0.f, 1.f) * unorm16_max));
+    }
+
+    int16_t quantize_snorm16(float value)
+    {
+        return static_cast<int16_t>(std::lround(std::clamp(value, -1.f, 1.f) * snorm16_max));
+    }
+
+    float sign_not_zero(float value)
+    {
+        return value >= 0.f ? 1.f : -1.f;
+    }
+}
+
+namespace slam_renderer
+{
+glm::vec2 encode_octahedral(const glm::vec3& normal)
+{
+    float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (length == 0.f)
+    {
+        return glm::vec2(0.f);
+    }
+
+    // Project onto the octahedron then fold the lower half over the upper one
+    glm::vec2 encoded = glm::vec2(normal) / length;
+    if (normal.z < 0.f)
+    {
+        encoded = glm::vec2((1.f - std::abs(encoded.y)) * sign_not_zero(encoded.x), (1.f - std::abs(encoded.x)) * sign_not_zero(encoded.y));
+    }
+    return encoded;
+}
+
+glm::vec3 decode_octahedral(const glm::vec2& encoded)
+{
+    glm::vec3 normal = glm::vec3(encoded, 1.f - std::abs(encoded.x) - std::abs(encoded.y));
+    float fold = std::max(-normal.z, 0.f);
+    normal.x += normal.x >= 0.f ? -fold : fold;
+    normal.y += normal.y >= 0.f ? -fold : fold;
+    return glm::normalize(normal);
+}
+
+vertex_decode pack_vertices(const vertices& vertices, std::vector<packed_position>& positions, std::vector<packed_attributes>& attributes)
+{
+    vertex_decode decode;
+    positions.resize(vertices.size());
+    attributes.resize(vertices.size());
+    if (vertices.empty())
+    {
+        return decode;
+    }
+
+    // Bounds are taken from the vertices themselves, anything the caller passed may be looser
+    glm::vec3 position_min = vertices.front().m_position;
+    glm::vec3 position_max = position_min;
+    glm::vec2 uv_min = vertices.front().m_uv;
+    glm::vec2 uv_max = uv_min;
+    for (const vertex& vertex : vertices)
+    {
+        position_min = glm::min(position_min, vertex.m_position);
+        position_max = glm::max(position_max, vertex.m_position);
+        uv_min = glm::min(uv_min, vertex.m_uv);
+        uv_max = glm::max(uv_max, vertex.m_uv);
+    }
+
+    glm::vec3 position_scale = position_max - position_min;
+    glm::vec2 uv_scale = uv_max - uv_min;
+    decode.m_position_offset = glm::vec4(position_min, 0.f);
+    decode.m_position_scale = glm::vec4(position_scale, 0.f);
+    decode.m_uv_offset_scale = glm::vec4(uv_min, uv_scale);
+
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        const vertex& vertex = vertices[i];
+
+        packed_position& position = positions[i];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            position.m_position[axis] = quantize_unorm16(vertex.m_position[axis], position_min[axis], position_scale[axis]);
+        }
+        position.m_position[3] = 0;
+
+        packed_attributes& out = attributes[i];
+        glm::vec2 normal = encode_octahedral(vertex.m_normal);
+        out.m_normal[0] = quantize_snorm16(normal.x);
+        out.m_normal[1] = quantize_snorm16(normal.y);
+
+        out.m_uv[0] = quantize_unorm16(vertex.m_uv.x, uv_min.x, uv_scale.x);
+        out.m_uv[1] = quantize_unorm16(vertex.m_uv.y, uv_min.y, uv_scale.y);
+    }
+
+    return decode;
+}
+
+packed_geometry pack_geometry(const vertices& vertices, const faces& faces, aabb bounds, const std::vector<lod_faces>& lods, packed_storage& storage)
+{
+    packed_geometry geometry;
+    geometry.m_decode = pack_vertices(vertices, storage.m_positions, storage.m_attributes);
+    geometry.m_positions = storage.m_positions.data();
+    geometry.m_attributes = storage.m_attributes.data();
+    geometry.m_vertex_count = static_cast<uint32_t>(vertices.size());
+    geometry.m_index_type = get_index_type(vertices.size());
+
+    geometry.m_bounds = bounds;
+    if (!vertices.empty())
+    {
+        geometry.m_bounding_sphere = bounding_sphere::from_points(bounds, &vertices.front().m_position, vertices.size(), sizeof(vertex));
+    }
+
+    auto add_level = [&](const slam_renderer::faces& level_faces, float error)
+        {
+            unsigned int level = geometry.m_lod_count++;
+            pack_indices(level_faces, geometry.m_index_type, storage.m_indices[level]);
+            geometry.m_indices[level] = storage.m_indices[level].data();
+            geometry.m_index_counts[level] = static_cast<uint32_t>(level_faces.size());
+            geometry.m_lod_errors[level] = error;
+        };
+
+    add_level(faces, 0.f);
+    for (const lod_faces& lod : lods)
+    {
+        if (geometry.m_lod_count == max_lod_count || lod.m_faces.empty())
+        {
+            break;
+        }
+        add_level(lod.m_faces, lod.m_error);
+    }
+
+    return geometry;
+}
+
+void pack_indices(const faces& faces, index_type type, std::vector<uint8_t>& packed)
+{
+    packed.resize(faces.size() * get_index_size(type));
+    if (type == index_type::uint32)
+    {
+        std::memcpy(packed.data(), faces.data(), packed.size());
+        return;
+    }
+
+    uint16_t* out = reinterpret_cast<uint16_t*>(packed.data());
+    for (size_t i = 0; i < faces.size(); ++i)
+    {
+        out[i] = static_cast<uint16_t>(faces[i]);
+    }
+}
+}
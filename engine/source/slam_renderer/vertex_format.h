@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mesh_geometry.h"
+
+namespace slam_renderer
+{
+// The geometry_arena hands out vertices in pages of this many, every page stores how to decode the vertices in it.
+// The vertex shaders find it from gl_VertexID >> vertex_page_shift, shader.cpp defines it for them
+static const unsigned int vertex_page_shift = 6;
+static const unsigned int vertex_page_size = 1u << vertex_page_shift;
+
+// Where the arena's vertex shaders read the page decode table from
+static const unsigned int vertex_decode_unit = 8;
+
+// Imports warn about meshes whose get_position_step is coarser than this
+static const float max_position_step = 0.01f;
+
+// The arena keeps positions in their own tightly packed stream so depth only passes fetch nothing else,
+// together the two streams are half the size of vertex. Quantizing isn't optional: every mesh goes through the
+// arena's one VAO so a multi-draw can span any of them, a float position format would need a second VAO and
+// split the batches. Meshes over max_position_step should be split up before import
+struct packed_position
+{
+    // unorm16 within the mesh's bounds, w is padding
+    uint16_t m_position[4];
+};
+static_assert(sizeof(packed_position) == 8, "packed_position must match the arena's position attribute layout");
+
+struct packed_attributes
+{
+    // Octahedral snorm16
+    int16_t m_normal[2];
+    // unorm16 within the mesh's uv bounds
+    uint16_t m_uv[2];
+};
+static_assert(sizeof(packed_attributes) == 8, "packed_attributes must match the arena's vertex attribute layout");
+
+// Turns a mesh's packed positions/uvs back into its own units, laid out as 3 RGBA32F texels per page
+struct vertex_decode
+{
+    glm::vec4 m_position_offset = glm::vec4(0.f);
+    glm::vec4 m_position_scale = glm::vec4(0.f);
+    // uv offset in xy, uv scale in zw
+    glm::vec4 m_uv_offset_scale = glm::vec4(0.f);
+};
+
+// Distance between neighbouring quantized positions on each axis
+inline glm::vec3 get_position_step(const vertex_decode& decode)
+{
+    return glm::vec3(decode.m_position_scale) / 65535.f;
+}
+
+// Meshes small enough for 16 bit indices get them, indices are relative to the mesh's own vertices
+inline index_type get_index_type(size_t vertex_count)
+{
+    return vertex_count <= 0x10000 ? index_type::uint16 : index_type::uint32;
+}
+
+// Everything the arena and a mesh_geometry need, already in GPU layout. Only views, e.g. into a mapped baked file
+struct packed_geometry
+{
+    const packed_position* m_positions = nullptr;
+    const packed_attributes* m_attributes = nullptr;
+    uint32_t m_vertex_count = 0;
+    vertex_decode m_decode;
+
+    // Full detail first then each lod, all of m_index_type
+    index_type m_index_type = index_type::uint32;
+    const void* m_indices[max_lod_count] = {};
+    uint32_t m_index_counts[max_lod_count] = {};
+    // In the mesh's units like lod_faces
+    float m_lod_errors[max_lod_count] = {};
+    unsigned int m_lod_count = 0;
+
+    aabb m_bounds;
+    bounding_sphere m_bounding_sphere;
+};
+
+// What pack_geometry's views point at, has to outlive them
+struct packed_storage
+{
+    std::vector<packed_position> m_positions;
+    std::vector<packed_attributes> m_attributes;
+    std::vector<uint8_t> m_indices[max_lod_count];
+};
+
+// Packs vertices and every index list into storage, lods past max_lod_count - 1 are dropped
+packed_geometry pack_geometry(const vertices& vertices, const faces& faces, aabb bounds, const std::vector<lod_faces>& lods, packed_storage& storage);
+
+// Quantizes against the vertices' own position and uv bounds, returns what the shader needs to undo it
+vertex_decode pack_vertices(const vertices& vertices, std::vector<packed_position>& positions, std::vector<packed_attributes>& attributes);
+
+// Indices stored as type, raw bytes so the arena can upload either kind
+void pack_indices(const faces& faces, index_type type, std::vector<uint8_t>& packed);
+
+// Same maths as decode_normal in vertex_decode.glsl
+glm::vec2 encode_octahedral(const glm::vec3& normal);
+glm::vec3 decode_octahedral(const glm::vec2& encoded);
+}
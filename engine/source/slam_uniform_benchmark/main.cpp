@@ -0,0 +1,100 @@
+#include <slam_renderer/renderer.h>
+
+#include <chrono>
+
+// Prints the per-draw cost of setting the lit material's uniforms through glGetUniformLocation, by hashed name and
+// through the location table. Run from the repository root so the shaders are found
+void run_uniform_benchmark(slam_renderer::shader& shader)
+{
+    const int iterations = 100000;
+
+    auto time_per_draw = [iterations](const auto& draw)
+        {
+            glFinish();
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < iterations; ++i)
+            {
+                draw();
+            }
+            glFinish();
+            auto end = std::chrono::high_resolution_clock::now();
+            return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+        };
+
+    shader.use();
+    glm::vec3 colour(1.f);
+    glm::mat4 matrix(1.f);
+
+    // What material::bind used to do, a std::string and a glGetUniformLocation per uniform
+    double by_location = time_per_draw([&]()
+        {
+            glUniform1i(glGetUniformLocation(shader.m_id, std::string("u_material.sample_albedo").c_str()), 1);
+            glUniform1i(glGetUniformLocation(shader.m_id, std::string("u_material.sample_specular").c_str()), 1);
+            glUniform3fv(glGetUniformLocation(shader.m_id, std::string("u_material.albedo").c_str()), 1, &colour[0]);
+            glUniform3fv(glGetUniformLocation(shader.m_id, std::string("u_material.specular").c_str()), 1, &colour[0]);
+            glUniform1f(glGetUniformLocation(shader.m_id, std::string("u_material.shininess").c_str()), 32.f);
+            glUniformMatrix4fv(glGetUniformLocation(shader.m_id, std::string("light_space_matrix").c_str()), 1, GL_FALSE, &matrix[0][0]);
+        });
+
+    double by_name = time_per_draw([&]()
+        {
+            shader.set_bool("u_material.sample_albedo", true);
+            shader.set_bool("u_material.sample_specular", true);
+            shader.set_vec3("u_material.albedo", colour);
+            shader.set_vec3("u_material.specular", colour);
+            shader.set_float("u_material.shininess", 32.f);
+            shader.set_mat4("light_space_matrix", matrix);
+        });
+
+    slam_renderer::uniform<bool> sample_albedo = shader.find_uniform<bool>("u_material.sample_albedo");
+    slam_renderer::uniform<bool> sample_specular = shader.find_uniform<bool>("u_material.sample_specular");
+    slam_renderer::uniform<glm::vec3> albedo = shader.find_uniform<glm::vec3>("u_material.albedo");
+    slam_renderer::uniform<glm::vec3> specular = shader.find_uniform<glm::vec3>("u_material.specular");
+    slam_renderer::uniform<float> shininess = shader.find_uniform<float>("u_material.shininess");
+    slam_renderer::uniform<glm::mat4> light_space_matrix = shader.find_uniform<glm::mat4>("light_space_matrix");
+    double by_handle = time_per_draw([&]()
+        {
+            shader.set(sample_albedo, true);
+            shader.set(sample_specular, true);
+            shader.set(albedo, colour);
+            shader.set(specular, colour);
+            shader.set(shininess, 32.f);
+            shader.set(light_space_matrix, matrix);
+        });
+
+    std::cout << "BENCHMARK::UNIFORMS: 6 uniforms per draw, glGetUniformLocation " << by_location << "ns, hashed name "
+        << by_name << "ns, handle " << by_handle << "ns" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+    GLFWwindow* window = glfwCreateWindow(1280, 720, "slam_uniform_benchmark", nullptr, nullptr);
+    if (window == nullptr)
+    {
+        std::cout << "Failed to create GLFW Window" << std::endl;
+        glfwTerminate();
+        return -1;
+    }
+    glfwMakeContextCurrent(window);
+
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+        std::cout << "Failed to initialize GLAD" << std::endl;
+        return -1;
+    }
+
+    slam_renderer::renderer* renderer = new slam_renderer::renderer(window);
+    slam_renderer::shader_handle lit_shader = renderer->register_shader("assets/shaders/vertex.glsl", "assets/shaders/lit_fragment.glsl", slam_renderer::shader_type::lit);
+    run_uniform_benchmark(*renderer->get_shader(lit_shader));
+
+    renderer->free();
+
+    glfwTerminate();
+    return 0;
+}
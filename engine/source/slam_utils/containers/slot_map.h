@@ -0,0 +1,165 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Typed reference into a slot_map. The generation is bumped whenever a slot is reused so stale handles
+// resolve to nullptr instead of to whatever was inserted afterwards
+template <typename T>
+struct handle
+{
+    static const uint32_t invalid_index = ~0u;
+
+    uint32_t m_index = invalid_index;
+    uint32_t m_generation = 0;
+
+    bool is_valid() const
+    {
+        return m_index != invalid_index;
+    }
+
+    bool operator==(const handle& other) const
+    {
+        return m_index == other.m_index && m_generation == other.m_generation;
+    }
+
+    bool operator!=(const handle& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+// Values are kept densely packed so iterating is a linear walk over a vector. Handles go through an
+// indirection table of slots which stays stable as values are added/removed
+template <typename T>
+class slot_map
+{
+public:
+    typedef handle<T> handle_type;
+
+    handle_type insert(T value)
+    {
+        uint32_t slot_index;
+        if (m_free_head != handle_type::invalid_index)
+        {
+            slot_index = m_free_head;
+            m_free_head = m_slots[slot_index].m_dense_index;
+        }
+        else
+        {
+            slot_index = static_cast<uint32_t>(m_slots.size());
+            m_slots.push_back({ 0, 0 });
+        }
+
+        m_slots[slot_index].m_dense_index = static_cast<uint32_t>(m_values.size());
+        m_values.push_back(std::move(value));
+        m_dense_to_slot.push_back(slot_index);
+
+        return { slot_index, m_slots[slot_index].m_generation };
+    }
+
+    // Swaps the last value into the gap so the values stay dense
+    bool remove(handle_type handle)
+    {
+        if (!contains(handle))
+        {
+            return false;
+        }
+
+        slot& removed = m_slots[handle.m_index];
+        uint32_t dense_index = removed.m_dense_index;
+        uint32_t last_index = static_cast<uint32_t>(m_values.size() - 1);
+
+        if (dense_index != last_index)
+        {
+            m_values[dense_index] = std::move(m_values[last_index]);
+            m_dense_to_slot[dense_index] = m_dense_to_slot[last_index];
+            m_slots[m_dense_to_slot[dense_index]].m_dense_index = dense_index;
+        }
+        m_values.pop_back();
+        m_dense_to_slot.pop_back();
+
+        ++removed.m_generation;
+        removed.m_dense_index = m_free_head;
+        m_free_head = handle.m_index;
+        return true;
+    }
+
+    bool contains(handle_type handle) const
+    {
+        return handle.m_index < m_slots.size() && m_slots[handle.m_index].m_generation == handle.m_generation;
+    }
+
+    T* get(handle_type handle)
+    {
+        return contains(handle) ? &m_values[m_slots[handle.m_index].m_dense_index] : nullptr;
+    }
+
+    const T* get(handle_type handle) const
+    {
+        return contains(handle) ? &m_values[m_slots[handle.m_index].m_dense_index] : nullptr;
+    }
+
+    uint32_t get_dense_index(handle_type handle) const
+    {
+        return contains(handle) ? m_slots[handle.m_index].m_dense_index : handle_type::invalid_index;
+    }
+
+    handle_type get_handle(uint32_t dense_index) const
+    {
+        uint32_t slot_index = m_dense_to_slot[dense_index];
+        return { slot_index, m_slots[slot_index].m_generation };
+    }
+
+    size_t size() const
+    {
+        return m_values.size();
+    }
+
+    void clear()
+    {
+        m_values.clear();
+        m_dense_to_slot.clear();
+        m_slots.clear();
+        m_free_head = handle_type::invalid_index;
+    }
+
+    T& operator[](size_t dense_index)
+    {
+        return m_values[dense_index];
+    }
+
+    typename std::vector<T>::iterator begin()
+    {
+        return m_values.begin();
+    }
+
+    typename std::vector<T>::iterator end()
+    {
+        return m_values.end();
+    }
+
+    typename std::vector<T>::const_iterator begin() const
+    {
+        return m_values.begin();
+    }
+
+    typename std::vector<T>::const_iterator end() const
+    {
+        return m_values.end();
+    }
+
+private:
+    struct slot
+    {
+        // Index into m_values while alive, next free slot once removed
+        uint32_t m_dense_index;
+        uint32_t m_generation;
+    };
+
+    std::vector<T> m_values;
+    std::vector<uint32_t> m_dense_to_slot;
+    std::vector<slot> m_slots;
+    uint32_t m_free_head = handle_type::invalid_index;
+};
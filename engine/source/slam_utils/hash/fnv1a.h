@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+
+// 64 bit FNV-1a, constexpr so string literals can be hashed at compile time
+constexpr uint64_t fnv1a_offset_basis = 0xcbf29ce484222325ull;
+constexpr uint64_t fnv1a_prime = 0x100000001b3ull;
+
+constexpr uint64_t fnv1a(const char* data, size_t size, uint64_t hash = fnv1a_offset_basis)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= fnv1a_prime;
+    }
+    return hash;
+}
+
+constexpr uint64_t fnv1a(std::string_view string)
+{
+    return fnv1a(string.data(), string.size());
+}
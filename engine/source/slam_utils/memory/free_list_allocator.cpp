@@ -0,0 +1,109 @@
+#include "free_list_allocator.h"
+
+#include <algorithm>
+#include <iterator>
+
+free_list_allocator::free_list_allocator(uint32_t capacity)
+{
+    reset(capacity);
+}
+
+uint32_t free_list_allocator::allocate(uint32_t size)
+{
+    if (size == 0)
+    {
+        return invalid_offset;
+    }
+
+    for (size_t i = 0; i < m_free_ranges.size(); ++i)
+    {
+        range& free_range = m_free_ranges[i];
+        if (free_range.m_size < size)
+        {
+            continue;
+        }
+
+        uint32_t offset = free_range.m_offset;
+        free_range.m_offset += size;
+        free_range.m_size -= size;
+        if (free_range.m_size == 0)
+        {
+            m_free_ranges.erase(m_free_ranges.begin() + i);
+        }
+        m_free_size -= size;
+        return offset;
+    }
+    return invalid_offset;
+}
+
+void free_list_allocator::release(uint32_t offset, uint32_t size)
+{
+    if (offset == invalid_offset || size == 0)
+    {
+        return;
+    }
+
+    auto next = std::lower_bound(m_free_ranges.begin(), m_free_ranges.end(), offset,
+        [](const range& free_range, uint32_t offset)
+        {
+            return free_range.m_offset < offset;
+        });
+
+    bool merge_previous = next != m_free_ranges.begin() && std::prev(next)->m_offset + std::prev(next)->m_size == offset;
+    bool merge_next = next != m_free_ranges.end() && offset + size == next->m_offset;
+
+    if (merge_previous && merge_next)
+    {
+        std::prev(next)->m_size += size + next->m_size;
+        m_free_ranges.erase(next);
+    }
+    else if (merge_previous)
+    {
+        std::prev(next)->m_size += size;
+    }
+    else if (merge_next)
+    {
+        next->m_offset = offset;
+        next->m_size += size;
+    }
+    else
+    {
+        m_free_ranges.insert(next, { offset, size });
+    }
+    m_free_size += size;
+}
+
+void free_list_allocator::grow(uint32_t new_capacity)
+{
+    if (new_capacity <= m_capacity)
+    {
+        return;
+    }
+
+    uint32_t old_capacity = m_capacity;
+    m_capacity = new_capacity;
+    release(old_capacity, new_capacity - old_capacity);
+}
+
+void free_list_allocator::reset(uint32_t capacity)
+{
+    m_free_ranges.clear();
+    m_capacity = capacity;
+    m_free_size = 0;
+    if (capacity > 0)
+    {
+        m_free_ranges.push_back({ 0, capacity });
+        m_free_size = capacity;
+    }
+}
+
+uint32_t free_list_allocator::get_free_tail() const
+{
+    if (m_free_ranges.empty())
+    {
+        return 0;
+    }
+
+    const range& last = m_free_ranges.back();
+    return last.m_offset + last.m_size == m_capacity ? last.m_size : 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Hands out [offset, offset + size) ranges of an abstract address space (e.g. elements of a GPU buffer).
+// First fit over an offset sorted free list, neighbouring ranges are merged back together on release
+class free_list_allocator
+{
+public:
+    static const uint32_t invalid_offset = ~0u;
+
+    explicit free_list_allocator(uint32_t capacity = 0);
+
+    // invalid_offset if no free range is big enough, grow() and try again
+    uint32_t allocate(uint32_t size);
+    void release(uint32_t offset, uint32_t size);
+
+    // Extends the space at the end, existing allocations keep their offsets
+    void grow(uint32_t new_capacity);
+
+    void reset(uint32_t capacity);
+
+    uint32_t get_capacity() const
+    {
+        return m_capacity;
+    }
+
+    uint32_t get_free_size() const
+    {
+        return m_free_size;
+    }
+
+    // Size of the free range at the very end, the minimum a grow needs to add is size - this
+    uint32_t get_free_tail() const;
+
+private:
+    struct range
+    {
+        uint32_t m_offset;
+        uint32_t m_size;
+    };
+
+    std::vector<range> m_free_ranges;
+    uint32_t m_capacity = 0;
+    uint32_t m_free_size = 0;
+};
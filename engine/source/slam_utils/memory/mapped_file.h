@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read only memory mapping of a whole file, pages are only read in when first touched
+class mapped_file
+{
+public:
+    mapped_file() = default;
+    ~mapped_file();
+
+    mapped_file(const mapped_file& other) = delete;
+    void operator=(const mapped_file&) = delete;
+
+    // False if the file doesn't exist, is empty or can't be mapped
+    bool open(const std::string& path);
+    void close();
+
+    bool is_open() const
+    {
+        return m_data != nullptr;
+    }
+
+    const uint8_t* get_data() const
+    {
+        return m_data;
+    }
+
+    size_t get_size() const
+    {
+        return m_size;
+    }
+
+private:
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+
+#ifdef _WIN32
+    void* m_file = nullptr;
+    void* m_mapping = nullptr;
+#endif
+};
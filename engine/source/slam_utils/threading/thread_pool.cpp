@@ -0,0 +1,113 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+thread_pool::thread_pool(unsigned int worker_count)
+{
+    if (worker_count == 0)
+    {
+        unsigned int hardware_threads = std::thread::hardware_concurrency();
+        worker_count = hardware_threads > 1 ? hardware_threads - 1 : 1;
+    }
+
+    for (unsigned int i = 0; i < worker_count; ++i)
+    {
+        m_workers.emplace_back(&thread_pool::worker_loop, this);
+    }
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+
+    for (std::thread& worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+void thread_pool::parallel_for(size_t count, size_t min_batch_size, const std::function<void(size_t, size_t)>& func)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    size_t max_batches = m_workers.size() + 1;
+    size_t batch_size = std::max(min_batch_size, (count + max_batches - 1) / max_batches);
+    size_t batch_count = (count + batch_size - 1) / batch_size;
+
+    // Not worth waking anyone up
+    if (batch_count <= 1)
+    {
+        func(0, count);
+        return;
+    }
+
+    std::atomic<size_t> remaining = batch_count - 1;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t batch = 1; batch < batch_count; ++batch)
+        {
+            size_t begin = batch * batch_size;
+            size_t end = std::min(count, begin + batch_size);
+            m_jobs.push([&func, &remaining, begin, end]()
+                {
+                    func(begin, end);
+                    remaining.fetch_sub(1, std::memory_order_release);
+                });
+        }
+    }
+    m_condition.notify_all();
+
+    // The caller takes the first batch then helps drain the queue rather than sitting idle
+    func(0, std::min(count, batch_size));
+    while (remaining.load(std::memory_order_acquire) > 0)
+    {
+        if (!run_one())
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void thread_pool::worker_loop()
+{
+    while (true)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+
+            if (m_stopping && m_jobs.empty())
+            {
+                return;
+            }
+
+            job = std::move(m_jobs.front());
+            m_jobs.pop();
+        }
+        job();
+    }
+}
+
+bool thread_pool::run_one()
+{
+    std::function<void()> job;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_jobs.empty())
+        {
+            return false;
+        }
+        job = std::move(m_jobs.front());
+        m_jobs.pop();
+    }
+    job();
+    return true;
+}
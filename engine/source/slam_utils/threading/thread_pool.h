@@ -0,0 +1,40 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads so per-frame jobs (culling, light assignment etc.) don't pay for thread creation
+class thread_pool
+{
+public:
+    // 0 uses hardware_concurrency - 1 workers, the calling thread always helps out
+    explicit thread_pool(unsigned int worker_count = 0);
+    ~thread_pool();
+
+    thread_pool(thread_pool& other) = delete;
+    void operator=(const thread_pool&) = delete;
+
+    // Splits [0, count) into batches of at least min_batch_size and runs func(begin, end) on each.
+    // Blocks until every batch has finished
+    void parallel_for(size_t count, size_t min_batch_size, const std::function<void(size_t, size_t)>& func);
+
+    unsigned int get_worker_count() const
+    {
+        return static_cast<unsigned int>(m_workers.size());
+    }
+
+private:
+    void worker_loop();
+    bool run_one();
+
+    std::vector<std::thread> m_workers;
+    std::queue<std::function<void()>> m_jobs;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping = false;
+};